@@ -0,0 +1,370 @@
+/*
+	Benchmark for the main import/export paths through the DLL, run over the nifs in
+	PyNifly/tests. Reports per-stage latency percentiles, throughput and peak memory
+	as JSON, so results from different builds can be compared.
+
+	Usage: NiflyBench [--tests <dir>] [--iterations <n>] [--out <file.json>]
+
+	Each nif goes through the same steps Blender import and export take: load it, read
+	its geometry and bone weights, load a skin for it, write the weights back through
+	the skin, rebuild its shapes in a new nif, and save it. Every nif is run once untimed
+	to warm up, then timed for each iteration.
+	*/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+#include "NiflyWrapper.hpp"
+
+namespace {
+	const char* CORPUS_DIRS[] = { "FO4", "Skyrim", "SkyrimSE", "FNV" };
+
+	struct Stage {
+		std::string name;
+		std::vector<double> samples;	// ms, one per nif per iteration
+		double bytes = 0;
+		double verts = 0;
+	};
+
+	enum StageID { LOAD, GEOMETRY, WEIGHTS, SKIN_LOAD, SKIN_WRITE, CREATE, SAVE, STAGE_COUNT };
+
+	struct ShapeData {
+		void* shape;
+		std::string name;
+		std::vector<float> verts;
+		std::vector<float> normals;
+		std::vector<float> uvs;
+		std::vector<uint16_t> tris;
+		int vertCount = 0;
+		int triCount = 0;
+		std::vector<std::string> bones;
+		std::vector<std::vector<VertexWeightPair>> weights;
+	};
+
+	using Clock = std::chrono::steady_clock;
+
+	double Ms(Clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	/* Call a DLL getter that fills buf and returns the full count, growing buf if the
+		count didn't fit. */
+	template <typename T, typename Fn>
+	int FetchAll(std::vector<T>& buf, int perItem, Fn fetch) {
+		int n = fetch(buf.data(), int(buf.size()));
+		if (n * perItem > int(buf.size())) {
+			buf.resize(size_t(n) * perItem);
+			n = fetch(buf.data(), int(buf.size()));
+		}
+		buf.resize(size_t(n) * perItem);
+		return n;
+	}
+
+	std::string GetString(int (*fn)(void*, void*, char*, int), void* a, void* b) {
+		int len = fn(a, b, nullptr, 0);
+		std::string s(size_t(len) + 1, '\0');
+		fn(a, b, s.data(), len + 1);
+		s.resize(len);
+		return s;
+	}
+
+	uint64_t PeakRSS() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS pmc;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+			return uint64_t(pmc.PeakWorkingSetSize);
+		return 0;
+#else
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return uint64_t(usage.ru_maxrss) * 1024;
+#endif
+	}
+
+	/* Run one nif through every stage, adding a sample to each stage it reaches, or
+		just run it if stages is null. Returns false if the nif couldn't be loaded. */
+	bool BenchNif(const std::filesystem::path& path, const std::filesystem::path& outDir,
+		Stage* stages)
+	{
+		auto t = Clock::now();
+		void* nif = load(path.u8string().c_str());
+		if (!nif)
+			return false;
+		if (stages) {
+			stages[LOAD].samples.push_back(Ms(t));
+			stages[LOAD].bytes += double(std::filesystem::file_size(path));
+		}
+
+		char gameBuf[32];
+		getGameName(nif, gameBuf, sizeof(gameBuf));
+		std::string game = gameBuf;
+
+		// Geometry export
+		t = Clock::now();
+		std::vector<void*> shapeRefs(getShapes(nif, nullptr, 0, 0));
+		getShapes(nif, shapeRefs.data(), int(shapeRefs.size()), 0);
+		std::vector<ShapeData> shapes(shapeRefs.size());
+		double vertTotal = 0, geomBytes = 0;
+		for (size_t i = 0; i < shapes.size(); i++) {
+			ShapeData& sd = shapes[i];
+			sd.shape = shapeRefs[i];
+			char nameBuf[512];
+			getShapeName(sd.shape, nameBuf, sizeof(nameBuf));
+			sd.name = nameBuf;
+
+			sd.verts.resize(3 * 1024);
+			sd.vertCount = FetchAll(sd.verts, 3, [&](float* b, int n) { return getVertsForShape(nif, sd.shape, b, n, 0); });
+			sd.tris.resize(3 * 1024);
+			sd.triCount = FetchAll(sd.tris, 3, [&](uint16_t* b, int n) { return getTriangles(nif, sd.shape, b, n, 0); });
+			sd.normals.resize(sd.verts.size());
+			FetchAll(sd.normals, 3, [&](float* b, int n) { return getNormalsForShape(nif, sd.shape, b, n, 0); });
+			sd.uvs.resize(size_t(sd.vertCount) * 2);
+			FetchAll(sd.uvs, 2, [&](float* b, int n) { return getUVs(nif, sd.shape, b, n, 0); });
+			// createNifShapeFromData needs UVs for every vert
+			sd.uvs.resize(size_t(sd.vertCount) * 2, 0.0f);
+
+			vertTotal += sd.vertCount;
+			geomBytes += double((sd.verts.size() + sd.normals.size() + sd.uvs.size()) * sizeof(float)
+				+ sd.tris.size() * sizeof(uint16_t));
+		}
+		if (stages) {
+			stages[GEOMETRY].samples.push_back(Ms(t));
+			stages[GEOMETRY].bytes += geomBytes;
+			stages[GEOMETRY].verts += vertTotal;
+		}
+
+		// Weight export
+		t = Clock::now();
+		double skinnedVerts = 0, weightBytes = 0;
+		for (auto& sd : shapes) {
+			if (!hasSkinInstance(sd.shape))
+				continue;
+			skinnedVerts += sd.vertCount;
+			std::string names = GetString(getShapeBoneNames, nif, sd.shape);
+			for (size_t start = 0; start < names.size();) {
+				size_t end = std::min(names.find('\n', start), names.size());
+				sd.bones.push_back(names.substr(start, end - start));
+				start = end + 1;
+			}
+			sd.weights.resize(sd.bones.size());
+			for (int b = 0; b < int(sd.bones.size()); b++) {
+				sd.weights[b].resize(getShapeBoneWeightsCount(nif, sd.shape, b));
+				getShapeBoneWeights(nif, sd.shape, b, sd.weights[b].data(), int(sd.weights[b].size()));
+				weightBytes += double(sd.weights[b].size() * sizeof(VertexWeightPair));
+			}
+		}
+		if (stages && skinnedVerts > 0) {
+			stages[WEIGHTS].samples.push_back(Ms(t));
+			stages[WEIGHTS].bytes += weightBytes;
+			stages[WEIGHTS].verts += skinnedVerts;
+		}
+
+		// Skin load and write; only games with a reference skeleton
+		if (skinnedVerts > 0 && (game == "SKYRIM" || game == "SKYRIMSE" || game == "FO4")) {
+			t = Clock::now();
+			void* skin = loadSkinForNif(nif, game.c_str());
+			if (stages) {
+				stages[SKIN_LOAD].samples.push_back(Ms(t));
+				stages[SKIN_LOAD].verts += skinnedVerts;
+			}
+
+			t = Clock::now();
+			for (auto& sd : shapes)
+				for (size_t b = 0; b < sd.bones.size(); b++) {
+					float xf[13];
+					if (!getShapeSkinToBone(nif, sd.shape, sd.bones[b].c_str(), xf))
+						continue;
+					nifly::MatTransform mt;
+					mt.translation = nifly::Vector3(xf[0], xf[1], xf[2]);
+					for (int r = 0; r < 3; r++)
+						for (int c = 0; c < 3; c++)
+							mt.rotation[r][c] = xf[3 + r * 3 + c];
+					mt.scale = xf[12];
+					setShapeWeights(skin, sd.shape, sd.bones[b].c_str(), sd.weights[b].data(),
+						int(sd.weights[b].size()), &mt);
+				}
+			writeSkinToNif(skin, 0);
+			if (stages) {
+				stages[SKIN_WRITE].samples.push_back(Ms(t));
+				stages[SKIN_WRITE].verts += skinnedVerts;
+			}
+			// Untimed. The skin owns the skeleton it loaded, so this frees both.
+			destroySkin(skin);
+		}
+
+		// Shape creation
+		t = Clock::now();
+		void* newNif = createNif(game.empty() ? "SKYRIM" : game.c_str(), 0, "Scene Root");
+		for (auto& sd : shapes)
+			createNifShapeFromData(newNif, sd.name.c_str(), sd.verts.data(), sd.uvs.data(),
+				sd.normals.empty() ? nullptr : sd.normals.data(), sd.vertCount,
+				sd.tris.data(), sd.triCount);
+		if (stages) {
+			stages[CREATE].samples.push_back(Ms(t));
+			stages[CREATE].bytes += geomBytes;
+			stages[CREATE].verts += vertTotal;
+		}
+		destroy(newNif);
+
+		// Save
+		std::filesystem::path outPath = outDir / path.filename();
+		t = Clock::now();
+		saveNif(nif, outPath.u8string().c_str());
+		if (stages) {
+			stages[SAVE].samples.push_back(Ms(t));
+			std::error_code ec;
+			auto size = std::filesystem::file_size(outPath, ec);
+			if (!ec) stages[SAVE].bytes += double(size);
+			stages[SAVE].verts += vertTotal;
+		}
+
+		destroy(nif);
+		return true;
+	}
+
+	double Percentile(const std::vector<double>& sorted, double p) {
+		if (sorted.empty())
+			return 0;
+		size_t rank = size_t(std::ceil(p / 100.0 * sorted.size()));
+		return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+	}
+
+	std::string JsonEscape(const std::string& s) {
+		std::string out;
+		for (char c : s) {
+			if (c == '"' || c == '\\')
+				out += '\\';
+			out += (c == '\n' || c == '\r') ? ' ' : c;
+		}
+		return out;
+	}
+
+	std::filesystem::path FindTestsDir() {
+		for (auto dir = std::filesystem::current_path(); ; dir = dir.parent_path()) {
+			if (std::filesystem::is_directory(dir / "PyNifly/tests"))
+				return dir / "PyNifly/tests";
+			if (dir == dir.parent_path())
+				return "PyNifly/tests";
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::filesystem::path testsDir;
+	std::filesystem::path outFile;
+	int iterations = 3;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--tests" && i + 1 < argc)
+			testsDir = argv[++i];
+		else if (arg == "--iterations" && i + 1 < argc)
+			iterations = std::max(1, atoi(argv[++i]));
+		else if (arg == "--out" && i + 1 < argc)
+			outFile = argv[++i];
+		else {
+			std::cerr << "Usage: NiflyBench [--tests <dir>] [--iterations <n>] [--out <file.json>]\n";
+			return 2;
+		}
+	}
+	if (testsDir.empty())
+		testsDir = FindTestsDir();
+
+	std::vector<std::filesystem::path> files;
+	for (auto& sub : CORPUS_DIRS) {
+		std::filesystem::path dir = testsDir / sub;
+		if (!std::filesystem::is_directory(dir))
+			continue;
+		std::vector<std::filesystem::path> dirFiles;
+		for (auto& entry : std::filesystem::directory_iterator(dir)) {
+			std::string ext = entry.path().extension().string();
+			std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+			if (entry.is_regular_file() && ext == ".nif")
+				dirFiles.push_back(entry.path());
+		}
+		std::sort(dirFiles.begin(), dirFiles.end());
+		files.insert(files.end(), dirFiles.begin(), dirFiles.end());
+	}
+	if (files.empty()) {
+		std::cerr << "No nifs found under " << testsDir.string() << "\n";
+		return 1;
+	}
+
+	std::filesystem::path saveDir = std::filesystem::temp_directory_path() / "niflybench";
+	std::filesystem::create_directories(saveDir);
+
+	std::vector<Stage> stages(STAGE_COUNT);
+	const char* stageNames[STAGE_COUNT] = { "load", "geometry_export", "weight_export",
+		"skin_load", "skin_write", "shape_create", "save" };
+	for (int s = 0; s < STAGE_COUNT; s++)
+		stages[s].name = stageNames[s];
+
+	std::vector<std::string> skipped;
+	std::vector<bool> loadable(files.size());
+	for (size_t f = 0; f < files.size(); f++) {
+		loadable[f] = BenchNif(files[f], saveDir, nullptr);
+		if (!loadable[f])
+			skipped.push_back(files[f].lexically_relative(testsDir).generic_string());
+	}
+
+	auto runStart = Clock::now();
+	for (int it = 0; it < iterations; it++)
+		for (size_t f = 0; f < files.size(); f++)
+			if (loadable[f])
+				BenchNif(files[f], saveDir, stages.data());
+	double wallMs = Ms(runStart);
+
+	const int* version = getVersion();
+	std::string json;
+	char line[512];
+	snprintf(line, sizeof(line),
+		"{\n  \"version\": \"%d.%d.%d\",\n  \"iterations\": %d,\n  \"files\": %d,\n  \"wall_ms\": %.3f,\n  \"peak_rss_bytes\": %llu,\n",
+		version[0], version[1], version[2], iterations, int(files.size() - skipped.size()), wallMs,
+		(unsigned long long)PeakRSS());
+	json += line;
+
+	json += "  \"skipped\": [";
+	for (size_t i = 0; i < skipped.size(); i++)
+		json += (i ? ", \"" : "\"") + JsonEscape(skipped[i]) + "\"";
+	json += "],\n  \"stages\": {\n";
+
+	for (int s = 0; s < STAGE_COUNT; s++) {
+		Stage& st = stages[s];
+		std::sort(st.samples.begin(), st.samples.end());
+		double total = 0;
+		for (double ms : st.samples)
+			total += ms;
+		double secs = total / 1000.0;
+		snprintf(line, sizeof(line),
+			"    \"%s\": {\"count\": %d, \"total_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, \"mb_per_s\": %.2f, \"verts_per_s\": %.0f}%s\n",
+			st.name.c_str(), int(st.samples.size()), total,
+			Percentile(st.samples, 50), Percentile(st.samples, 90), Percentile(st.samples, 99),
+			st.samples.empty() ? 0.0 : st.samples.back(),
+			secs > 0 ? st.bytes / (1024.0 * 1024.0) / secs : 0.0,
+			secs > 0 ? st.verts / secs : 0.0,
+			s + 1 < STAGE_COUNT ? "," : "");
+		json += line;
+	}
+	json += "  }\n}\n";
+
+	if (outFile.empty())
+		std::cout << json;
+	else {
+		std::ofstream out(outFile, std::ios::binary);
+		out << json;
+	}
+	return 0;
+}
@@ -0,0 +1,336 @@
+/*
+	Generates synthetic nifs far bigger than the test corpus, for scale testing the DLL.
+	Everything is built through the DLL's own API, and the output depends only on the
+	parameters and seed, so the same command always writes the same file.
+
+	Usage: NiflyStressGen --out <file.nif> [--preset body|kit|skeleton|cloth|collision]
+		[--game SKYRIM|SKYRIMSE|FO4] [--verts n] [--shapes n] [--bones n]
+		[--weights n] [--extra-bytes n] [--collision-shapes n] [--collision-verts n]
+		[--seed n]
+
+	A preset sets every option to suit one kind of stress; options after it override it.
+	--verts is the total over all shapes. A shape with more verts than a nif shape can
+	hold is split into pieces by createNifShapesFromData. Bones form a tree, four
+	children to a node, running up the mesh; each vert is weighted to --weights bones
+	near its height. --extra-bytes adds cloth data (FO4) or string extra data of that
+	size. --collision-shapes convex shapes of --collision-verts verts each go on the
+	root, under a list shape if there's more than one.
+
+	Write the files into <dir>/<game dir>/ to run NiflyBench over them with --tests <dir>.
+	*/
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "NiflyWrapper.hpp"
+
+namespace {
+	const float PI = 3.14159265f;
+	const float MESH_HEIGHT = 120.0f;
+	const int MAX_PIECES = 1024;
+
+	struct Params {
+		std::string game = "SKYRIMSE";
+		int verts = 50000;
+		int shapes = 1;
+		int bones = 50;
+		int weights = 4;
+		int extraBytes = 0;
+		int collisionShapes = 0;
+		int collisionVerts = 0;
+		uint32_t seed = 1;
+	};
+
+	bool ApplyPreset(const std::string& name, Params& p) {
+		if (name == "body") {
+			p.verts = 500000; p.shapes = 1; p.bones = 100; p.weights = 4;
+		}
+		else if (name == "kit") {
+			p.verts = 200000; p.shapes = 200; p.bones = 60; p.weights = 2;
+		}
+		else if (name == "skeleton") {
+			p.verts = 50000; p.shapes = 4; p.bones = 1000; p.weights = 4;
+		}
+		else if (name == "cloth") {
+			p.game = "FO4"; p.verts = 100000; p.shapes = 8; p.bones = 120; p.weights = 4;
+			p.extraBytes = 8 * 1024 * 1024;
+		}
+		else if (name == "collision") {
+			p.verts = 20000; p.shapes = 1; p.bones = 0;
+			p.collisionShapes = 64; p.collisionVerts = 256;
+		}
+		else
+			return false;
+		return true;
+	}
+
+	/* xorshift32, so output doesn't depend on the standard library's generators */
+	struct Random {
+		uint32_t state;
+		explicit Random(uint32_t seed) : state(seed ? seed : 1) {}
+		float Next() {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return float(state >> 8) / float(1 << 24);
+		}
+	};
+
+	std::string BoneName(int i) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "StressBone%04d", i);
+		return buf;
+	}
+
+	int BoneParent(int i) { return i == 0 ? -1 : (i - 1) / 4; }
+
+	/* Bones sit on the mesh axis, evenly spaced up its height. */
+	nifly::MatTransform BoneToParent(int i, int boneCount) {
+		nifly::MatTransform xf;
+		float z = MESH_HEIGHT * float(i) / float(boneCount);
+		int parent = BoneParent(i);
+		if (parent >= 0)
+			z -= MESH_HEIGHT * float(parent) / float(boneCount);
+		xf.translation = nifly::Vector3(0.0f, 0.0f, z);
+		return xf;
+	}
+
+	/* One shape's worth of an open cylinder, rows up and columns around. */
+	struct Mesh {
+		std::vector<float> verts;
+		std::vector<float> normals;
+		std::vector<float> uvs;
+		std::vector<uint32_t> tris;
+		std::vector<int> row;
+		int rows = 0;
+	};
+
+	Mesh MakeMesh(int vertCount, int shapeIndex, Random& rng) {
+		Mesh m;
+		int cols = std::max(4, int(std::sqrt(float(vertCount))));
+		m.rows = std::max(2, vertCount / cols);
+		float radius = 10.0f + 0.5f * float(shapeIndex);
+		for (int r = 0; r < m.rows; r++)
+			for (int c = 0; c < cols; c++) {
+				float angle = 2.0f * PI * float(c) / float(cols);
+				float jitter = 1.0f + 0.02f * (rng.Next() - 0.5f);
+				float nx = std::cos(angle), ny = std::sin(angle);
+				m.verts.insert(m.verts.end(), { nx * radius * jitter, ny * radius * jitter,
+					MESH_HEIGHT * float(r) / float(m.rows - 1) });
+				m.normals.insert(m.normals.end(), { nx, ny, 0.0f });
+				m.uvs.insert(m.uvs.end(), { float(c) / float(cols - 1), float(r) / float(m.rows - 1) });
+				m.row.push_back(r);
+			}
+		for (int r = 0; r + 1 < m.rows; r++)
+			for (int c = 0; c + 1 < cols; c++) {
+				uint32_t a = r * cols + c, b = a + 1, d = a + cols, e = d + 1;
+				m.tris.insert(m.tris.end(), { a, b, e, a, e, d });
+			}
+		return m;
+	}
+
+	void AddCollision(void* nif, const Params& p, Random& rng) {
+		BHKConvexVertsShapeBuf convex = {};
+		convex.material = 3839073443;		// SKY_HAV_MAT_STONE
+		convex.radius = 0.01f;
+
+		std::vector<int> children;
+		for (int s = 0; s < p.collisionShapes; s++) {
+			std::vector<float> verts, normals;
+			float cx = 20.0f * (rng.Next() - 0.5f), cy = 20.0f * (rng.Next() - 0.5f);
+			float cz = MESH_HEIGHT * rng.Next(), size = 1.0f + 4.0f * rng.Next();
+			for (int i = 0; i < p.collisionVerts; i++) {
+				// Fibonacci sphere: evenly spread points and their face planes
+				float z = 1.0f - 2.0f * (float(i) + 0.5f) / float(p.collisionVerts);
+				float rxy = std::sqrt(std::max(0.0f, 1.0f - z * z));
+				float angle = float(i) * 2.39996323f;
+				float x = rxy * std::cos(angle), y = rxy * std::sin(angle);
+				verts.insert(verts.end(), { (cx + x * size) / 70.0f, (cy + y * size) / 70.0f, (cz + z * size) / 70.0f, 0.0f });
+				normals.insert(normals.end(), { x, y, z, -(x * cx + y * cy + z * cz) / 70.0f - size / 70.0f });
+			}
+			children.push_back(addCollConvexVertsShape(nif, &convex, verts.data(), p.collisionVerts,
+				normals.data(), p.collisionVerts));
+		}
+
+		int shapeID = children[0];
+		if (children.size() > 1) {
+			BHKListShapeBuf list = {};
+			list.material = convex.material;
+			shapeID = addCollListShape(nif, &list);
+			for (int child : children)
+				addCollListChild(nif, shapeID, child);
+		}
+
+		BHKRigidBodyBuf body = {};
+		body.collisionFilter_layer = 1;
+		body.broadPhaseType = 1;
+		body.collisionResponse = 1;
+		body.processContactCallbackDelay = 0xFFFF;
+		body.collisionFilterCopy_layer = 1;
+		body.rotation_w = 1.0f;
+		body.timeFactor = 1.0f;
+		body.gravityFactor = 1.0f;
+		body.friction = 0.5f;
+		body.rollingFrictionMult = 1.0f;
+		body.restitution = 0.4f;
+		body.maxLinearVelocity = 104.4f;
+		body.maxAngularVelocity = 31.57f;
+		body.penetrationDepth = 0.15f;
+		body.motionSystem = 7;			// Fixed
+		body.deactivatorType = 1;
+		body.solverDeactivation = 1;
+		body.qualityType = 1;			// Fixed
+		int bodyID = addRigidBody(nif, "bhkRigidBody", shapeID, &body);
+		addCollision(nif, nullptr, bodyID, 129);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Params p;
+	std::filesystem::path outPath;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		const char* val = i + 1 < argc ? argv[i + 1] : "";
+		bool ok = i + 1 < argc;
+		if (arg == "--out") outPath = val;
+		else if (arg == "--preset") ok = ApplyPreset(val, p);
+		else if (arg == "--game") p.game = val;
+		else if (arg == "--verts") p.verts = atoi(val);
+		else if (arg == "--shapes") p.shapes = atoi(val);
+		else if (arg == "--bones") p.bones = atoi(val);
+		else if (arg == "--weights") p.weights = atoi(val);
+		else if (arg == "--extra-bytes") p.extraBytes = atoi(val);
+		else if (arg == "--collision-shapes") p.collisionShapes = atoi(val);
+		else if (arg == "--collision-verts") p.collisionVerts = atoi(val);
+		else if (arg == "--seed") p.seed = uint32_t(strtoul(val, nullptr, 10));
+		else ok = false;
+		if (!ok) {
+			std::cerr << "Bad argument: " << arg << "\n";
+			return 2;
+		}
+		i++;
+	}
+	if (outPath.empty()) {
+		std::cerr << "Usage: NiflyStressGen --out <file.nif> [--preset name] [options]; see the source for options\n";
+		return 2;
+	}
+	p.shapes = std::max(1, p.shapes);
+	p.verts = std::max(p.verts, 4 * p.shapes);
+	p.bones = std::max(0, p.bones);
+	p.weights = std::clamp(p.weights, 1, std::max(1, p.bones));
+	if (p.collisionShapes > 0)
+		p.collisionVerts = std::max(p.collisionVerts, 4);
+
+	Random rng(p.seed);
+	void* nif = createNif(p.game.c_str(), 0, "StressRoot");
+
+	std::vector<void*> boneNodes(p.bones);
+	for (int b = 0; b < p.bones; b++) {
+		nifly::MatTransform xf = BoneToParent(b, p.bones);
+		int parent = BoneParent(b);
+		boneNodes[b] = addNode(nif, BoneName(b).c_str(), &xf, parent >= 0 ? boneNodes[parent] : nullptr);
+	}
+	void* skin = p.bones > 0 ? createSkinForNif(nif, p.game.c_str()) : nullptr;
+
+	// Every shape weights the same bones, so their names and transforms are set up once.
+	std::vector<std::string> boneNames(p.bones), parentNames(p.bones);
+	std::vector<const char*> boneNamePtrs(p.bones), parentPtrs(p.bones);
+	std::vector<nifly::MatTransform> boneXforms(p.bones);
+	for (int b = 0; b < p.bones; b++) {
+		boneNames[b] = BoneName(b);
+		int parent = BoneParent(b);
+		if (parent >= 0)
+			parentNames[b] = BoneName(parent);
+		boneNamePtrs[b] = boneNames[b].c_str();
+		parentPtrs[b] = parent >= 0 ? parentNames[b].c_str() : nullptr;
+		boneXforms[b] = BoneToParent(b, p.bones);
+	}
+	nifly::MatTransform identity;
+
+	// Register the whole tree with the skin, so bones a shape doesn't use still parent
+	// the ones it does.
+	for (int b = 0; b < p.bones; b++)
+		addBoneToSkin(skin, boneNamePtrs[b], &boneXforms[b], parentPtrs[b]);
+
+	float weightTotal = 0;
+	for (int w = 0; w < p.weights; w++)
+		weightTotal += 1.0f / float(w + 1);
+
+	int pieceTotal = 0, vertTotal = 0;
+	std::vector<void*> pieces(MAX_PIECES);
+	for (int s = 0; s < p.shapes; s++) {
+		int vertCount = p.verts / p.shapes + (s < p.verts % p.shapes ? 1 : 0);
+		Mesh m = MakeMesh(vertCount, s, rng);
+		int meshVerts = int(m.row.size());
+		vertTotal += meshVerts;
+		int triCount = int(m.tris.size() / 3);
+
+		// Weights go with the verts into however many pieces the mesh is split into.
+		std::vector<VertexBoneWeightBuf> weights;
+		ShapeSplitExtrasBuf extras = {};
+		if (skin) {
+			for (int v = 0; v < meshVerts; v++) {
+				int first = std::min(p.bones - 1, m.row[v] * p.bones / m.rows);
+				for (int w = 0; w < p.weights; w++)
+					weights.push_back({ uint32_t(v), uint16_t((first + w) % p.bones), 
+						1.0f / float(w + 1) / weightTotal });
+			}
+			extras.skin = skin;
+			extras.globalToSkin = &identity;
+			extras.boneCount = p.bones;
+			extras.boneNames = boneNamePtrs.data();
+			extras.boneXforms = boneXforms.data();
+			extras.boneParents = parentPtrs.data();
+			extras.weights = weights.data();
+			extras.weightCount = int(weights.size());
+		}
+
+		char name[32];
+		snprintf(name, sizeof(name), "StressShape%03d", s);
+		int pieceCount = createNifShapesFromData(nif, name, m.verts.data(), m.uvs.data(), m.normals.data(),
+			meshVerts, m.tris.data(), triCount, nullptr, nullptr, pieces.data(), MAX_PIECES,
+			nullptr, 0, nullptr, skin ? &extras : nullptr);
+		if (pieceCount <= 0) {
+			std::cerr << "Could not create shape " << name << "\n";
+			return 1;
+		}
+		pieceTotal += pieceCount;
+	}
+
+	if (p.extraBytes > 0) {
+		std::vector<char> data(size_t(p.extraBytes) + 1);
+		for (int i = 0; i < p.extraBytes; i++)
+			data[i] = char('a' + int(rng.Next() * 26.0f));
+		char extraName[] = "StressData";
+		if (p.game == "FO4")
+			setClothExtraData(nif, nullptr, extraName, data.data(), p.extraBytes);
+		else
+			setStringExtraData(nif, nullptr, extraName, data.data());
+	}
+
+	if (p.collisionShapes > 0)
+		AddCollision(nif, p, rng);
+
+	if (outPath.has_parent_path())
+		std::filesystem::create_directories(outPath.parent_path());
+	int err = skin ? saveSkinnedNif(skin, outPath.u8string().c_str())
+		: saveNif(nif, outPath.u8string().c_str());
+	if (skin) destroySkin(skin);
+	destroy(nif);
+	if (err) {
+		std::cerr << "Could not write " << outPath.string() << "\n";
+		return 1;
+	}
+
+	std::error_code ec;
+	auto size = std::filesystem::file_size(outPath, ec);
+	printf("{\"file\": \"%s\", \"shapes\": %d, \"verts\": %d, \"bones\": %d, \"bytes\": %llu}\n",
+		outPath.generic_string().c_str(), pieceTotal, vertTotal, p.bones,
+		(unsigned long long)(ec ? 0 : size));
+	return 0;
+}
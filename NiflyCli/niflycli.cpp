@@ -0,0 +1,949 @@
+/*
+	Batch processing of nifs without Blender. Runs the steps of a JSON job over every
+	nif under a directory tree, spread over worker threads, and streams one JSON line
+	per nif to a manifest.
+
+	Usage: niflycli <job.json> [--threads <n>] [--manifest <file>] [--fresh] [--dry-run]
+
+	A job looks like:
+		{
+			"input": "meshes",
+			"output": "converted/meshes",
+			"steps": [
+				{"op": "retexture", "replace": {"textures\\old\\": "textures\\new\\"}},
+				{"op": "rename_bones", "map": {"Bip01 L Hand": "NPC L Hand [LHnd]"}},
+				{"op": "reversion", "game": "SKYRIMSE"},
+				{"op": "recompute_normals", "smooth": true, "angle": 60},
+				{"op": "strip_extra_data", "names": ["HDT Havok Path"]},
+				{"op": "validate"}
+			]
+		}
+	Relative paths are relative to the job file. Output mirrors the input tree, and may
+	be the input directory itself to edit in place. A job made only of "validate"
+	steps writes nothing and needs no output. The manifest defaults to manifest.jsonl
+	in the output (or input) directory.
+
+	Steps:
+		retexture			Replace text in every texture path. Case and slash direction
+							are ignored when matching.
+		rename_bones		Rename nodes, and so the bones skins refer to.
+		reversion			Convert between SKYRIM and SKYRIMSE.
+		recompute_normals	Recompute normals and tangents; "smooth" (default true) and
+							"angle" (default 60) control smoothing across split verts.
+		strip_extra_data	Remove extra data from the root and every shape; "names"
+							limits it to extra data with those names.
+		validate			Check for bad geometry and weights. Problems are listed in
+							the manifest and mark the nif invalid.
+
+	Reruns resume: a nif is skipped if the manifest already has it done, by the same
+	job, with the same content (before or after processing). --fresh starts over.
+	*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "NiflyWrapper.hpp"
+
+namespace {
+	/* ************************** JSON ************************** */
+
+	struct Json {
+		enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT } type = NUL;
+		bool boolean = false;
+		double number = 0;
+		std::string str;
+		std::vector<Json> items;
+		std::vector<std::pair<std::string, Json>> members;	// In file order
+
+		const Json* Get(const std::string& key) const {
+			for (auto& m : members)
+				if (m.first == key)
+					return &m.second;
+			return nullptr;
+		}
+		std::string GetString(const std::string& key, const std::string& dflt = "") const {
+			const Json* v = Get(key);
+			return (v && v->type == STRING) ? v->str : dflt;
+		}
+		double GetNumber(const std::string& key, double dflt) const {
+			const Json* v = Get(key);
+			return (v && v->type == NUMBER) ? v->number : dflt;
+		}
+		bool GetBool(const std::string& key, bool dflt) const {
+			const Json* v = Get(key);
+			return (v && v->type == BOOL) ? v->boolean : dflt;
+		}
+	};
+
+	class JsonParser {
+	public:
+		explicit JsonParser(const std::string& text) : s(text) {}
+
+		/* Parse the whole text as one value. On failure returns false with a message
+			naming the line. */
+		bool Parse(Json& out, std::string& error) {
+			pos = 0;
+			err.clear();
+			if (Value(out)) {
+				Space();
+				if (pos == s.size())
+					return true;
+				Fail("unexpected text after the value");
+			}
+			int line = 1 + int(std::count(s.begin(), s.begin() + std::min(pos, s.size()), '\n'));
+			error = "line " + std::to_string(line) + ": " + err;
+			return false;
+		}
+
+	private:
+		const std::string& s;
+		size_t pos = 0;
+		std::string err;
+
+		bool Fail(const char* msg) {
+			if (err.empty()) err = msg;
+			return false;
+		}
+		void Space() {
+			while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n' || s[pos] == '\r'))
+				pos++;
+		}
+		bool Literal(const char* word) {
+			size_t n = strlen(word);
+			if (s.compare(pos, n, word) != 0)
+				return Fail("unknown literal");
+			pos += n;
+			return true;
+		}
+		void PutUtf8(std::string& out, uint32_t cp) {
+			if (cp < 0x80)
+				out += char(cp);
+			else if (cp < 0x800) {
+				out += char(0xC0 | (cp >> 6));
+				out += char(0x80 | (cp & 0x3F));
+			}
+			else if (cp < 0x10000) {
+				out += char(0xE0 | (cp >> 12));
+				out += char(0x80 | ((cp >> 6) & 0x3F));
+				out += char(0x80 | (cp & 0x3F));
+			}
+			else {
+				out += char(0xF0 | (cp >> 18));
+				out += char(0x80 | ((cp >> 12) & 0x3F));
+				out += char(0x80 | ((cp >> 6) & 0x3F));
+				out += char(0x80 | (cp & 0x3F));
+			}
+		}
+		bool Hex4(uint32_t& cp) {
+			if (pos + 4 > s.size())
+				return Fail("short \\u escape");
+			cp = 0;
+			for (int i = 0; i < 4; i++) {
+				char c = s[pos++];
+				cp <<= 4;
+				if (c >= '0' && c <= '9') cp |= c - '0';
+				else if (c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+				else if (c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+				else return Fail("bad \\u escape");
+			}
+			return true;
+		}
+		bool String(std::string& out) {
+			pos++;	// Opening quote
+			while (pos < s.size() && s[pos] != '"') {
+				char c = s[pos++];
+				if (c != '\\') {
+					out += c;
+					continue;
+				}
+				if (pos >= s.size())
+					break;
+				char e = s[pos++];
+				switch (e) {
+				case '"': out += '"'; break;
+				case '\\': out += '\\'; break;
+				case '/': out += '/'; break;
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'n': out += '\n'; break;
+				case 'r': out += '\r'; break;
+				case 't': out += '\t'; break;
+				case 'u': {
+					uint32_t cp;
+					if (!Hex4(cp)) return false;
+					if (cp >= 0xD800 && cp < 0xDC00 && s.compare(pos, 2, "\\u") == 0) {
+						uint32_t lo;
+						pos += 2;
+						if (!Hex4(lo)) return false;
+						cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+					}
+					PutUtf8(out, cp);
+					break;
+				}
+				default:
+					return Fail("bad escape in string");
+				}
+			}
+			if (pos >= s.size())
+				return Fail("unterminated string");
+			pos++;
+			return true;
+		}
+		bool Value(Json& v) {
+			Space();
+			if (pos >= s.size())
+				return Fail("unexpected end of text");
+			char c = s[pos];
+			if (c == '{') {
+				v.type = Json::OBJECT;
+				pos++;
+				Space();
+				if (pos < s.size() && s[pos] == '}') { pos++; return true; }
+				while (true) {
+					Space();
+					if (pos >= s.size() || s[pos] != '"')
+						return Fail("expected a key");
+					std::string key;
+					if (!String(key)) return false;
+					Space();
+					if (pos >= s.size() || s[pos] != ':')
+						return Fail("expected ':'");
+					pos++;
+					v.members.emplace_back(key, Json());
+					if (!Value(v.members.back().second)) return false;
+					Space();
+					if (pos < s.size() && s[pos] == ',') { pos++; continue; }
+					if (pos < s.size() && s[pos] == '}') { pos++; return true; }
+					return Fail("expected ',' or '}'");
+				}
+			}
+			if (c == '[') {
+				v.type = Json::ARRAY;
+				pos++;
+				Space();
+				if (pos < s.size() && s[pos] == ']') { pos++; return true; }
+				while (true) {
+					v.items.emplace_back();
+					if (!Value(v.items.back())) return false;
+					Space();
+					if (pos < s.size() && s[pos] == ',') { pos++; continue; }
+					if (pos < s.size() && s[pos] == ']') { pos++; return true; }
+					return Fail("expected ',' or ']'");
+				}
+			}
+			if (c == '"') {
+				v.type = Json::STRING;
+				return String(v.str);
+			}
+			if (c == 't') { v.type = Json::BOOL; v.boolean = true; return Literal("true"); }
+			if (c == 'f') { v.type = Json::BOOL; v.boolean = false; return Literal("false"); }
+			if (c == 'n') { v.type = Json::NUL; return Literal("null"); }
+
+			const char* start = s.c_str() + pos;
+			char* end = nullptr;
+			v.type = Json::NUMBER;
+			v.number = strtod(start, &end);
+			if (end == start)
+				return Fail("unexpected character");
+			pos += end - start;
+			return true;
+		}
+	};
+
+	std::string Utf8(const std::filesystem::path& p) {
+		std::u8string u = p.generic_u8string();
+		return std::string(u.begin(), u.end());
+	}
+
+	std::filesystem::path PathFromUtf8(const std::string& s) {
+		return std::filesystem::path(std::u8string(s.begin(), s.end()));
+	}
+
+	std::string JsonEscape(const std::string& s) {
+		std::string out;
+		for (unsigned char c : s) {
+			if (c == '"' || c == '\\') {
+				out += '\\';
+				out += char(c);
+			}
+			else if (c < 0x20) {
+				char esc[8];
+				snprintf(esc, sizeof(esc), "\\u%04x", c);
+				out += esc;
+			}
+			else
+				out += char(c);
+		}
+		return out;
+	}
+
+	/* ************************** HASHING ************************** */
+
+	/* FNV-1a; only needs to tell whether a file changed since the last run. */
+	uint64_t Hash(const char* data, size_t len, uint64_t h = 14695981039346656037ull) {
+		for (size_t i = 0; i < len; i++) {
+			h ^= uint8_t(data[i]);
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+
+	bool HashFile(const std::filesystem::path& path, std::string& out) {
+		std::ifstream in(path, std::ios::binary);
+		if (!in)
+			return false;
+		uint64_t h = 14695981039346656037ull;
+		std::vector<char> buf(1 << 16);
+		while (in) {
+			in.read(buf.data(), buf.size());
+			h = Hash(buf.data(), size_t(in.gcount()), h);
+		}
+		char hex[17];
+		snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+		out = hex;
+		return true;
+	}
+
+	/* ************************** WORK STEALING ************************** */
+
+	/* Run fn(worker, task) for every task in [0, count) on up to threadCount threads.
+		Each worker starts with its own contiguous run of tasks and takes from the front
+		of it; a worker that runs dry steals from the back of the fullest queue, so a
+		few slow nifs don't leave the other threads idle. */
+	void RunWorkStealing(size_t count, unsigned threadCount,
+		const std::function<void(unsigned, size_t)>& fn)
+	{
+		struct WorkQueue {
+			std::mutex mutex;
+			std::deque<size_t> tasks;
+		};
+		threadCount = unsigned(std::max<size_t>(1, std::min<size_t>(threadCount, count)));
+		std::vector<WorkQueue> queues(threadCount);
+		for (unsigned t = 0; t < threadCount; t++)
+			for (size_t i = count * t / threadCount; i < count * (t + 1) / threadCount; i++)
+				queues[t].tasks.push_back(i);
+
+		auto worker = [&](unsigned w) {
+			while (true) {
+				size_t task = 0;
+				bool found = false;
+				{
+					std::lock_guard<std::mutex> lock(queues[w].mutex);
+					if (!queues[w].tasks.empty()) {
+						task = queues[w].tasks.front();
+						queues[w].tasks.pop_front();
+						found = true;
+					}
+				}
+				while (!found) {
+					// Tasks are never added, so once every queue is empty we're done.
+					unsigned victim = w;
+					size_t most = 0;
+					for (unsigned v = 0; v < threadCount; v++) {
+						std::lock_guard<std::mutex> lock(queues[v].mutex);
+						if (queues[v].tasks.size() > most) {
+							most = queues[v].tasks.size();
+							victim = v;
+						}
+					}
+					if (most == 0)
+						return;
+					std::lock_guard<std::mutex> lock(queues[victim].mutex);
+					if (!queues[victim].tasks.empty()) {
+						task = queues[victim].tasks.back();
+						queues[victim].tasks.pop_back();
+						found = true;
+					}
+				}
+				fn(w, task);
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (unsigned t = 1; t < threadCount; t++)
+			threads.emplace_back(worker, t);
+		worker(0);
+		for (auto& t : threads)
+			t.join();
+	}
+
+	/* ************************** JOB ************************** */
+
+	struct Job {
+		std::filesystem::path input;
+		std::filesystem::path output;
+		std::filesystem::path manifest;
+		std::vector<Json> steps;
+		bool writes = false;
+		std::string hash;		// Of the job file, so edited jobs rerun
+	};
+
+	const char* STEP_OPS[] = { "retexture", "rename_bones", "reversion",
+		"recompute_normals", "strip_extra_data", "validate" };
+
+	bool LoadJob(const std::filesystem::path& path, Job& job, std::string& error) {
+		std::ifstream in(path, std::ios::binary);
+		if (!in) {
+			error = "can't read " + path.string();
+			return false;
+		}
+		std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		char hex[17];
+		snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)Hash(text.data(), text.size()));
+		job.hash = hex;
+
+		Json root;
+		if (!JsonParser(text).Parse(root, error))
+			return false;
+		if (root.type != Json::OBJECT) {
+			error = "job must be a JSON object";
+			return false;
+		}
+
+		std::filesystem::path base = std::filesystem::absolute(path).parent_path();
+		auto resolve = [&](const std::string& p) {
+			return p.empty() ? std::filesystem::path() : (base / PathFromUtf8(p)).lexically_normal();
+		};
+		job.input = resolve(root.GetString("input"));
+		job.output = resolve(root.GetString("output"));
+		job.manifest = resolve(root.GetString("manifest"));
+		if (job.input.empty() || !std::filesystem::is_directory(job.input)) {
+			error = "\"input\" must name a directory";
+			return false;
+		}
+
+		const Json* steps = root.Get("steps");
+		if (!steps || steps->type != Json::ARRAY || steps->items.empty()) {
+			error = "\"steps\" must be a non-empty array";
+			return false;
+		}
+		for (auto& step : steps->items) {
+			std::string op = step.GetString("op");
+			if (std::find_if(std::begin(STEP_OPS), std::end(STEP_OPS),
+				[&](const char* s) { return op == s; }) == std::end(STEP_OPS)) {
+				error = "unknown step \"" + op + "\"";
+				return false;
+			}
+			if (op != "validate")
+				job.writes = true;
+		}
+		job.steps = steps->items;
+
+		if (job.writes && job.output.empty()) {
+			error = "\"output\" is required when steps change the nifs";
+			return false;
+		}
+		if (job.manifest.empty())
+			job.manifest = (job.output.empty() ? job.input : job.output) / "manifest.jsonl";
+		return true;
+	}
+
+	/* ************************** STEPS ************************** */
+
+	struct FileResult {
+		std::string status = "ok";
+		std::string error;
+		std::vector<std::pair<std::string, int>> changes;	// Per step
+		std::vector<std::string> issues;
+		std::vector<std::string> log;
+	};
+
+	std::vector<void*> GetShapeList(void* nif) {
+		std::vector<void*> shapes(getShapes(nif, nullptr, 0, 0));
+		getShapes(nif, shapes.data(), int(shapes.size()), 0);
+		return shapes;
+	}
+
+	std::string ShapeName(void* shape) {
+		char buf[512];
+		getShapeName(shape, buf, sizeof(buf));
+		return buf;
+	}
+
+	/* Texture paths compare without regard to case or slash direction. */
+	char PathFold(char c) {
+		return c == '/' ? '\\' : char(tolower((unsigned char)c));
+	}
+
+	bool ReplacePathText(std::string& s, const std::string& from, const std::string& to) {
+		if (from.empty())
+			return false;
+		bool changed = false;
+		for (size_t i = 0; i + from.size() <= s.size();) {
+			size_t j = 0;
+			while (j < from.size() && PathFold(s[i + j]) == PathFold(from[j]))
+				j++;
+			if (j == from.size()) {
+				s.replace(i, from.size(), to);
+				i += to.size();
+				changed = true;
+			}
+			else
+				i++;
+		}
+		return changed;
+	}
+
+	int Retexture(void* nif, const Json& step, FileResult& result) {
+		const Json* replace = step.Get("replace");
+		if (!replace || replace->type != Json::OBJECT) {
+			result.error = "retexture needs a \"replace\" object";
+			return -1;
+		}
+		int count = 0;
+		for (void* shape : GetShapeList(nif)) {
+			// BSShaderTextureSet has up to 10 slots
+			for (int slot = 0; slot < 10; slot++) {
+				int len = getShaderTextureSlot(nif, shape, slot, nullptr, 0);
+				if (len <= 0)
+					continue;
+				std::vector<char> buf(size_t(len) + 1);
+				getShaderTextureSlot(nif, shape, slot, buf.data(), len + 1);
+				std::string path = buf.data();
+				bool changed = false;
+				for (auto& m : replace->members)
+					if (m.second.type == Json::STRING)
+						changed |= ReplacePathText(path, m.first, m.second.str);
+				if (changed) {
+					setShaderTextureSlot(nif, shape, slot, path.c_str());
+					count++;
+				}
+			}
+		}
+		return count;
+	}
+
+	int RenameBones(void* nif, const Json& step, FileResult& result) {
+		const Json* map = step.Get("map");
+		if (!map || map->type != Json::OBJECT) {
+			result.error = "rename_bones needs a \"map\" object";
+			return -1;
+		}
+		std::vector<void*> nodes(getNodeCount(nif));
+		getNodes(nif, nodes.data());
+		int count = 0;
+		for (void* node : nodes) {
+			char buf[512];
+			getNodeName(node, buf, sizeof(buf));
+			const Json* newName = map->Get(buf);
+			if (newName && newName->type == Json::STRING) {
+				setNodeName(node, newName->str.c_str());
+				count++;
+			}
+		}
+		return count;
+	}
+
+	int Reversion(void* nif, const Json& step, FileResult& result) {
+		std::string game = step.GetString("game");
+		int rv = convertNifGame(nif, game.c_str());
+		if (rv < 0) {
+			result.error = "can't convert to \"" + game + "\"";
+			return -1;
+		}
+		return rv == 0 ? 1 : 0;
+	}
+
+	int RecomputeNormals(void* nif, const Json& step, FileResult&) {
+		bool smooth = step.GetBool("smooth", true);
+		float angle = float(step.GetNumber("angle", 60.0));
+		int count = 0;
+		for (void* shape : GetShapeList(nif)) {
+			// Shapes without normals are left that way
+			if (getNormalsForShape(nif, shape, nullptr, 0, 0) == 0)
+				continue;
+			calcShapeNormals(nif, shape, smooth, angle);
+			count++;
+		}
+		return count;
+	}
+
+	int StripExtraData(void* nif, const Json& step, FileResult&) {
+		std::vector<std::string> names;
+		if (const Json* list = step.Get("names"))
+			for (auto& n : list->items)
+				if (n.type == Json::STRING)
+					names.push_back(n.str);
+
+		std::vector<void*> targets = { nullptr };
+		for (void* shape : GetShapeList(nif))
+			targets.push_back(shape);
+		int count = 0;
+		for (void* target : targets) {
+			if (names.empty())
+				count += removeExtraData(nif, target, nullptr);
+			for (auto& name : names)
+				count += removeExtraData(nif, target, name.c_str());
+		}
+		return count;
+	}
+
+	/* Call a DLL getter that fills buf and returns the full count, growing buf if the
+		count didn't fit. */
+	template <typename T, typename Fn>
+	int FetchAll(std::vector<T>& buf, int perItem, Fn fetch) {
+		int n = fetch(buf.data(), int(buf.size()));
+		if (n * perItem > int(buf.size())) {
+			buf.resize(size_t(n) * perItem);
+			n = fetch(buf.data(), int(buf.size()));
+		}
+		buf.resize(size_t(n) * perItem);
+		return n;
+	}
+
+	int Validate(void* nif, const Json& step, FileResult& result) {
+		float weightTolerance = float(step.GetNumber("weight_tolerance", 0.01));
+		size_t before = result.issues.size();
+		auto issue = [&](const std::string& shape, const std::string& what, int count) {
+			if (count > 0)
+				result.issues.push_back(shape + ": " + std::to_string(count) + " " + what);
+		};
+
+		for (void* shape : GetShapeList(nif)) {
+			std::string name = ShapeName(shape);
+			std::vector<float> verts(3 * 1024);
+			int vertCount = FetchAll(verts, 3, [&](float* b, int n) { return getVertsForShape(nif, shape, b, n, 0); });
+			std::vector<uint16_t> tris(3 * 1024);
+			int triCount = FetchAll(tris, 3, [&](uint16_t* b, int n) { return getTriangles(nif, shape, b, n, 0); });
+			std::vector<float> normals(verts.size());
+			int normCount = FetchAll(normals, 3, [&](float* b, int n) { return getNormalsForShape(nif, shape, b, n, 0); });
+
+			int badVerts = 0;
+			for (float f : verts)
+				badVerts += !std::isfinite(f);
+			issue(name, "vert coordinates not finite", badVerts);
+
+			int outOfRange = 0, degenerate = 0;
+			for (int t = 0; t < triCount; t++) {
+				uint16_t a = tris[3 * t], b = tris[3 * t + 1], c = tris[3 * t + 2];
+				outOfRange += (a >= vertCount || b >= vertCount || c >= vertCount);
+				degenerate += (a == b || b == c || a == c);
+			}
+			issue(name, "tris index past the last vert", outOfRange);
+			issue(name, "degenerate tris", degenerate);
+
+			if (normCount > 0) {
+				if (normCount != vertCount)
+					result.issues.push_back(name + ": " + std::to_string(normCount) + " normals for "
+						+ std::to_string(vertCount) + " verts");
+				int badNormals = 0;
+				for (int i = 0; i < normCount; i++) {
+					float len = std::sqrt(normals[3 * i] * normals[3 * i] + normals[3 * i + 1] * normals[3 * i + 1]
+						+ normals[3 * i + 2] * normals[3 * i + 2]);
+					badNormals += !(len > 0.5f && len < 1.5f);
+				}
+				issue(name, "normals not unit length", badNormals);
+			}
+
+			if (hasSkinInstance(shape)) {
+				std::vector<float> weightSum(vertCount, 0.0f);
+				int boneCount = getShapeBoneCount(nif, shape);
+				int badRefs = 0;
+				for (int b = 0; b < boneCount; b++) {
+					std::vector<VertexWeightPair> weights(getShapeBoneWeightsCount(nif, shape, b));
+					getShapeBoneWeights(nif, shape, b, weights.data(), int(weights.size()));
+					for (auto& w : weights) {
+						if (w.vertex < vertCount)
+							weightSum[w.vertex] += w.weight;
+						else
+							badRefs++;
+					}
+				}
+				int unweighted = 0, unnormalized = 0;
+				for (float sum : weightSum) {
+					if (sum == 0.0f)
+						unweighted++;
+					else if (std::abs(sum - 1.0f) > weightTolerance)
+						unnormalized++;
+				}
+				issue(name, "weights for verts past the last vert", badRefs);
+				issue(name, "skinned verts with no weights", unweighted);
+				issue(name, "verts whose weights don't sum to 1", unnormalized);
+			}
+		}
+		return int(result.issues.size() - before);
+	}
+
+	int RunStep(void* nif, const Json& step, FileResult& result) {
+		std::string op = step.GetString("op");
+		if (op == "retexture") return Retexture(nif, step, result);
+		if (op == "rename_bones") return RenameBones(nif, step, result);
+		if (op == "reversion") return Reversion(nif, step, result);
+		if (op == "recompute_normals") return RecomputeNormals(nif, step, result);
+		if (op == "strip_extra_data") return StripExtraData(nif, step, result);
+		return Validate(nif, step, result);
+	}
+
+	/* ************************** MANIFEST ************************** */
+
+	struct DoneEntry {
+		std::string job;
+		std::set<std::string> hashes;	// Input and output content that needs no rerun
+	};
+
+	/* What earlier runs finished, by relative path. Failed nifs aren't counted, so
+		they're retried. */
+	std::map<std::string, DoneEntry> ReadManifest(const std::filesystem::path& path) {
+		std::map<std::string, DoneEntry> done;
+		std::ifstream in(path);
+		std::string line;
+		while (std::getline(in, line)) {
+			Json rec;
+			std::string error;
+			if (!JsonParser(line).Parse(rec, error) || rec.type != Json::OBJECT)
+				continue;	// A line cut short by an interrupted run
+			std::string status = rec.GetString("status");
+			std::string file = rec.GetString("file");
+			if (status == "failed") {
+				done.erase(file);
+				continue;
+			}
+			DoneEntry& e = done[file];
+			if (e.job != rec.GetString("job"))
+				e.hashes.clear();
+			e.job = rec.GetString("job");
+			e.hashes.insert(rec.GetString("hash"));
+			if (rec.Get("out_hash"))
+				e.hashes.insert(rec.GetString("out_hash"));
+		}
+		return done;
+	}
+
+	std::string ManifestLine(const std::string& file, const std::string& hash, const std::string& outHash,
+		const std::string& jobHash, double ms, const FileResult& r)
+	{
+		std::ostringstream out;
+		out << "{\"file\": \"" << JsonEscape(file) << "\", \"status\": \"" << r.status << "\""
+			<< ", \"job\": \"" << jobHash << "\", \"hash\": \"" << hash << "\"";
+		if (!outHash.empty())
+			out << ", \"out_hash\": \"" << outHash << "\"";
+		char msBuf[32];
+		snprintf(msBuf, sizeof(msBuf), "%.3f", ms);
+		out << ", \"ms\": " << msBuf;
+		if (!r.error.empty())
+			out << ", \"error\": \"" << JsonEscape(r.error) << "\"";
+		out << ", \"changes\": {";
+		for (size_t i = 0; i < r.changes.size(); i++)
+			out << (i ? ", " : "") << "\"" << r.changes[i].first << "\": " << r.changes[i].second;
+		out << "}, \"issues\": [";
+		for (size_t i = 0; i < r.issues.size(); i++)
+			out << (i ? ", " : "") << "\"" << JsonEscape(r.issues[i]) << "\"";
+		out << "], \"log\": [";
+		for (size_t i = 0; i < r.log.size(); i++)
+			out << (i ? ", " : "") << "\"" << JsonEscape(r.log[i]) << "\"";
+		out << "]}\n";
+		return out.str();
+	}
+
+	/* ************************** RUNNING ************************** */
+
+	/* Collect warnings and errors logged since the worker's cursor, and move the cursor
+		past them. Most DLL messages don't name the nif they're about, so a record counts
+		as this file's if this worker logged it or it names the nif. */
+	void CollectLog(uint64_t& cursor, void* nif, std::vector<std::string>* out) {
+		uint32_t thread = getLogThreadId();
+		niflydll::LogEntry entries[64];
+		int n;
+		while ((n = getLogRecords(&cursor, entries, 64)) > 0)
+			for (int i = 0; i < n; i++)
+				if (out && entries[i].level >= niflydll::LOG_WARNING
+					&& (entries[i].thread == thread || (nif && entries[i].handle == nif)))
+					out->push_back(entries[i].message);
+	}
+
+	/* Makes a DLL session current on this thread for the life of the scope, then frees
+		everything created under it. */
+	struct SessionScope {
+		void* session = createSession();
+		void* previous = setSession(session);
+		~SessionScope() {
+			setSession(previous);
+			destroySession(session);
+		}
+	};
+
+	FileResult ProcessNif(const Job& job, const std::filesystem::path& src, const std::filesystem::path& dst,
+		bool dryRun, uint64_t& logCursor)
+	{
+		FileResult result;
+		CollectLog(logCursor, nullptr, nullptr);
+		// Anything a step creates (skins, skeletons) is freed with the file.
+		SessionScope scope;
+		void* nif = load(src.u8string().c_str());
+		if (!nif) {
+			result.status = "failed";
+			result.error = "can't load the nif";
+			return result;
+		}
+
+		for (auto& step : job.steps) {
+			std::string op = step.GetString("op");
+			int count = RunStep(nif, step, result);
+			if (count < 0) {
+				result.status = "failed";
+				break;
+			}
+			result.changes.emplace_back(op, count);
+		}
+
+		if (result.status != "failed" && job.writes && !dryRun) {
+			std::error_code ec;
+			std::filesystem::create_directories(dst.parent_path(), ec);
+			if (saveNif(nif, dst.u8string().c_str()) != 0) {
+				result.status = "failed";
+				result.error = "can't write " + Utf8(dst);
+			}
+		}
+		if (result.status == "ok" && !result.issues.empty())
+			result.status = "invalid";
+
+		CollectLog(logCursor, nif, &result.log);
+		destroy(nif);
+		return result;
+	}
+
+	std::vector<std::filesystem::path> FindNifs(const Job& job) {
+		std::vector<std::filesystem::path> files;
+		std::error_code ec;
+		std::filesystem::path outDir = job.output;
+		for (auto it = std::filesystem::recursive_directory_iterator(job.input,
+				std::filesystem::directory_options::skip_permission_denied, ec);
+			it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+		{
+			if (ec)
+				break;
+			// Don't pick up our own output when it's inside the input tree
+			if (it->is_directory() && !outDir.empty() && outDir != job.input && it->path() == outDir) {
+				it.disable_recursion_pending();
+				continue;
+			}
+			std::string ext = it->path().extension().string();
+			std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+			if (it->is_regular_file() && ext == ".nif")
+				files.push_back(it->path());
+		}
+		std::sort(files.begin(), files.end());
+		return files;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char* usage = "Usage: niflycli <job.json> [--threads <n>] [--manifest <file>] [--fresh] [--dry-run]\n";
+	std::filesystem::path jobFile;
+	std::filesystem::path manifestOverride;
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	bool fresh = false;
+	bool dryRun = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--threads" && i + 1 < argc)
+			threads = unsigned(std::max(1, atoi(argv[++i])));
+		else if (arg == "--manifest" && i + 1 < argc)
+			manifestOverride = argv[++i];
+		else if (arg == "--fresh")
+			fresh = true;
+		else if (arg == "--dry-run")
+			dryRun = true;
+		else if (jobFile.empty() && arg[0] != '-')
+			jobFile = arg;
+		else {
+			std::cerr << usage;
+			return 2;
+		}
+	}
+	if (jobFile.empty()) {
+		std::cerr << usage;
+		return 2;
+	}
+
+	Job job;
+	std::string error;
+	if (!LoadJob(jobFile, job, error)) {
+		std::cerr << jobFile.string() << ": " << error << "\n";
+		return 2;
+	}
+	if (!manifestOverride.empty())
+		job.manifest = manifestOverride;
+
+	std::vector<std::filesystem::path> files = FindNifs(job);
+	std::map<std::string, DoneEntry> done;
+	if (!fresh && !dryRun)
+		done = ReadManifest(job.manifest);
+
+	std::error_code ec;
+	std::filesystem::create_directories(job.manifest.parent_path(), ec);
+	std::ofstream manifest;
+	if (!dryRun) {
+		manifest.open(job.manifest, fresh ? (std::ios::out | std::ios::trunc) : (std::ios::out | std::ios::app));
+		if (!manifest) {
+			std::cerr << "Can't write manifest " << job.manifest.string() << "\n";
+			return 2;
+		}
+	}
+	std::mutex manifestMutex;
+
+	// Only warnings and errors go to the manifest
+	setLogLevel(niflydll::LOG_WARNING);
+	std::vector<uint64_t> logCursors(threads, 0);
+	std::atomic<int> ok = 0, invalid = 0, failed = 0, skipped = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	RunWorkStealing(files.size(), threads, [&](unsigned worker, size_t i) {
+		const std::filesystem::path& src = files[i];
+		std::string rel = Utf8(src.lexically_relative(job.input));
+		std::string hash;
+		if (!HashFile(src, hash)) {
+			failed++;
+			std::cerr << rel << ": can't read the file\n";
+			return;
+		}
+		auto prior = done.find(rel);
+		if (prior != done.end() && prior->second.job == job.hash && prior->second.hashes.count(hash)) {
+			skipped++;
+			return;
+		}
+
+		std::filesystem::path dst = job.writes ? job.output / src.lexically_relative(job.input) : std::filesystem::path();
+		auto t = std::chrono::steady_clock::now();
+		FileResult result = ProcessNif(job, src, dst, dryRun, logCursors[worker]);
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count();
+
+		std::string outHash;
+		if (job.writes && !dryRun && result.status != "failed")
+			HashFile(dst, outHash);
+
+		if (result.status == "ok") ok++;
+		else if (result.status == "invalid") invalid++;
+		else {
+			failed++;
+			std::cerr << rel << ": " << result.error << "\n";
+		}
+
+		if (!dryRun) {
+			std::string line = ManifestLine(rel, hash, outHash, job.hash, ms, result);
+			std::lock_guard<std::mutex> lock(manifestMutex);
+			manifest << line;
+			manifest.flush();
+		}
+	});
+
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%d nifs: %d ok, %d invalid, %d failed, %d already done (%.1f s, %u threads)\n",
+		int(files.size()), ok.load(), invalid.load(), failed.load(), skipped.load(), secs, threads);
+	return (failed || invalid) ? 1 : 0;
+}
@@ -11,7 +11,8 @@ See the included LICENSE file
 /* +++ NiflyDLL Changes +++ */
 //#include <wx/log.h>
 //#include <wx/msgdlg.h>
-#include "logger.hpp"
+#include "Logger.hpp"
+#include "NiflyHandles.hpp"
 #include <unordered_set>
 
 //extern ConfigurationManager Config;
@@ -19,6 +20,14 @@ See the included LICENSE file
 
 using namespace nifly;
 
+/* +++ NiflyDLL Changes +++ */
+/* Delete a bone's node, retiring any handle to it first. */
+static void DeleteBoneNode(NifFile* nif, const std::string& boneName) {
+	niflydll::HandleRetireBlock(nif, nif->FindBlockByName<NiNode>(boneName));
+	nif->DeleteNode(boneName);
+}
+/* +++ NiflyDLL Changes +++ */
+
 bool AnimInfo::AddShapeBone(const std::string& shape, const std::string& boneName) {
 	for (auto &bone : shapeBones[shape])
 		if (!bone.compare(boneName))
@@ -28,6 +37,9 @@ bool AnimInfo::AddShapeBone(const std::string& shape, const std::string& boneNam
 	shapeBones[shape].push_back(boneName);
 	GetSkeleton()->RefBone(boneName);
 	RecalcXFormSkinToBone(shape, boneName);
+/* +++ NiflyDLL Changes +++ */
+	MarkShapeDirty(shape);
+/* +++ NiflyDLL Changes +++ */
 	return true;
 }
 
@@ -44,7 +56,9 @@ bool AnimInfo::RemoveShapeBone(const std::string& shape, const std::string& bone
 	if (refNif && refNif->IsValid()) {
 		if (GetSkeleton()->GetBoneRefCount(boneName) <= 0) {
 			if (refNif->CanDeleteNode(boneName))
-				refNif->DeleteNode(boneName);
+/* +++ NiflyDLL Changes +++ */
+				DeleteBoneNode(refNif, boneName);
+/* +++ NiflyDLL Changes +++ */
 		}
 	}
 
@@ -59,7 +73,9 @@ void AnimInfo::Clear() {
 
 				if (GetSkeleton()->GetBoneRefCount(boneName) <= 0) {
 					if (refNif->CanDeleteNode(boneName))
-						refNif->DeleteNode(boneName);
+/* +++ NiflyDLL Changes +++ */
+						DeleteBoneNode(refNif, boneName);
+/* +++ NiflyDLL Changes +++ */
 				}
 			}
 		}
@@ -90,7 +106,9 @@ void AnimInfo::ClearShape(const std::string& shape) {
 		if (refNif && refNif->IsValid()) {
 			if (GetSkeleton()->GetBoneRefCount(boneName) <= 0) {
 				if (refNif->CanDeleteNode(boneName))
-					refNif->DeleteNode(boneName);
+/* +++ NiflyDLL Changes +++ */
+					DeleteBoneNode(refNif, boneName);
+/* +++ NiflyDLL Changes +++ */
 			}
 		}
 	}
@@ -120,6 +138,9 @@ void AnimInfo::DeleteVertsForShape(const std::string& shape, const std::vector<u
 	for (auto &w : skin.boneWeights) {
 		ApplyIndexMapToMapKeys(w.second.weights, indexCollapse, -static_cast<int>(indices.size()));
 	}
+/* +++ NiflyDLL Changes +++ */
+	skin.dirty = true;
+/* +++ NiflyDLL Changes +++ */
 }
 
 void AnimSkin::InsertVertexIndices(const std::vector<uint16_t>& indices) {
@@ -132,6 +153,9 @@ void AnimSkin::InsertVertexIndices(const std::vector<uint16_t>& indices) {
 	for (auto &w : boneWeights) {
 		ApplyIndexMapToMapKeys(w.second.weights, indexExpand, static_cast<int>(indices.size()));
 	}
+/* +++ NiflyDLL Changes +++ */
+	dirty = true;
+/* +++ NiflyDLL Changes +++ */
 }
 
 void AnimWeight::LoadFromNif(NifFile* loadFromFile, NiShape* shape, const int& index) {
@@ -177,6 +201,11 @@ bool AnimInfo::LoadFromNif(NifFile* nif, AnimSkeleton* skel) {
 		LoadFromNif(nif, s, skel);
 
 	refNif = nif;
+/* +++ NiflyDLL Changes +++ */
+	// Everything now matches the reference nif.
+	for (auto &skin : shapeSkinning)
+		skin.second.ClearDirty();
+/* +++ NiflyDLL Changes +++ */
 	return true;
 }
 
@@ -218,6 +247,10 @@ bool AnimInfo::LoadFromNif(NifFile* nif, NiShape* shape, AnimSkeleton* skel, boo
 	}
 
 	shapeSkinning[shapeName].LoadFromNif(nif, shape, skel);
+/* +++ NiflyDLL Changes +++ */
+	if (nif == refNif)
+		shapeSkinning[shapeName].ClearDirty();
+/* +++ NiflyDLL Changes +++ */
 
 	if (!nonRefBones.empty())
 		wxLogMessage("Bones in shape '%s' not found in reference skeleton and added as custom bones: %s", shapeName.c_str(), nonRefBones.c_str());
@@ -243,6 +276,9 @@ bool AnimInfo::CloneShape(NifFile* nif, NiShape* shape, const std::string& newSh
 	}
 
 	shapeSkinning[newShape] = shapeSkinning[shapeName];
+/* +++ NiflyDLL Changes +++ */
+	MarkShapeDirty(newShape);
+/* +++ NiflyDLL Changes +++ */
 	return true;
 }
 
@@ -294,6 +330,9 @@ void AnimInfo::SetXFormSkinToBone(const std::string& shape, const std::string& b
 		return;
 
 	shapeSkinning[shape].boneWeights[b].xformSkinToBone = stransform;
+/* +++ NiflyDLL Changes +++ */
+	shapeSkinning[shape].boneWeights[b].dirty = true;
+/* +++ NiflyDLL Changes +++ */
 }
 
 void AnimInfo::RecalcXFormSkinToBone(const std::string& shape, const std::string& boneName) {
@@ -317,6 +356,9 @@ void AnimInfo::ChangeGlobalToSkinTransform(const std::string& shape, const MatTr
 	shapeSkinning[shape].xformGlobalToSkin = newTrans;
 	for (const std::string &bone : shapeBones[shape])
 		RecalcXFormSkinToBone(shape, bone);
+/* +++ NiflyDLL Changes +++ */
+	MarkShapeDirty(shape);
+/* +++ NiflyDLL Changes +++ */
 }
 
 bool AnimInfo::CalcShapeSkinBounds(const std::string& shapeName, const int& boneIndex) {
@@ -357,6 +399,9 @@ void AnimInfo::SetWeights(const std::string& shape, const std::string& boneName,
 		return;
 
 	shapeSkinning[shape].boneWeights[bid].weights = inVertWeights;
+/* +++ NiflyDLL Changes +++ */
+	shapeSkinning[shape].boneWeights[bid].dirty = true;
+/* +++ NiflyDLL Changes +++ */
 }
 
 void AnimInfo::CleanupBones() {
@@ -381,7 +426,39 @@ void AnimInfo::CleanupBones() {
 	}
 }
 
-void AnimInfo::WriteToNif(NifFile* nif, const std::string& shapeException) {
+/* +++ NiflyDLL Changes +++ */
+void AnimInfo::MarkShapeDirty(const std::string& shape) {
+	auto skin = shapeSkinning.find(shape);
+	if (skin != shapeSkinning.end())
+		skin->second.dirty = true;
+}
+
+void AnimInfo::MarkBoneDirty(const std::string& shape, const std::string& boneName) {
+	int b = GetShapeBoneIndex(shape, boneName);
+	if (b < 0)
+		return;
+
+	shapeSkinning[shape].boneWeights[b].dirty = true;
+}
+
+bool AnimInfo::IsShapeDirty(const std::string& shape) const {
+	auto skin = shapeSkinning.find(shape);
+	if (skin == shapeSkinning.end())
+		return false;
+
+	return skin->second.IsDirty();
+}
+
+std::vector<std::string> AnimInfo::GetDirtyShapes() const {
+	std::vector<std::string> dirtyShapes;
+	for (auto &skin : shapeSkinning)
+		if (skin.second.IsDirty())
+			dirtyShapes.push_back(skin.first);
+	return dirtyShapes;
+}
+/* +++ NiflyDLL Changes +++ */
+
+void AnimInfo::WriteToNif(NifFile* nif, const std::string& shapeException, bool dirtyOnly) {
 	// Collect list of needed bones.  Also delete bones used by shapeException
 	// and no other shape if they have no children and have root parent.
 	std::unordered_set<const AnimBone *> neededBones;
@@ -394,7 +471,9 @@ void AnimInfo::WriteToNif(NifFile* nif, const std::string& shapeException) {
 			if (bones.first == shapeException) {
 				if (bptr->refCount <= 1) {
 					if (nif->CanDeleteNode(bone))
-						nif->DeleteNode(bone);
+/* +++ NiflyDLL Changes +++ */
+						DeleteBoneNode(nif, bone);
+/* +++ NiflyDLL Changes +++ */
 				}
 				continue;
 			}
@@ -470,6 +549,11 @@ void AnimInfo::WriteToNif(NifFile* nif, const std::string& shapeException) {
 	for (auto &bones : shapeBones) {
 		if (bones.first == shapeException)
 			continue;
+/* +++ NiflyDLL Changes +++ */
+		// The bone list only changes when the skin itself is dirty.
+		if (dirtyOnly && !shapeSkinning[bones.first].dirty)
+			continue;
+/* +++ NiflyDLL Changes +++ */
 		std::vector<int> bids;
 		for (auto &bone : bones.second) {
 			auto it = boneIDMap.find(bone);
@@ -487,6 +571,12 @@ void AnimInfo::WriteToNif(NifFile* nif, const std::string& shapeException) {
 		if (shapeBoneList.first == shapeException)
 			continue;
 
+/* +++ NiflyDLL Changes +++ */
+		AnimSkin& skin = shapeSkinning[shapeBoneList.first];
+		if (dirtyOnly && !skin.IsDirty())
+			continue;
+/* +++ NiflyDLL Changes +++ */
+
 		auto shape = nif->FindBlockByName<NiShape>(shapeBoneList.first);
 		if (!shape)
 			continue;
@@ -498,12 +588,16 @@ void AnimInfo::WriteToNif(NifFile* nif, const std::string& shapeException) {
 			AnimBone* bptr = GetSkeleton()->GetBonePtr(boneName);
 
 			int bid = GetShapeBoneIndex(shapeBoneList.first, boneName);
-			AnimWeight& bw = shapeSkinning[shapeBoneList.first].boneWeights[bid];
+			AnimWeight& bw = skin.boneWeights[bid];
 
 			if (isBSShape)
 				for (auto vw : bw.weights)
 					vertWeights[vw.first].Add(bid, vw.second);
 
+/* +++ NiflyDLL Changes +++ */
+			if (dirtyOnly && !skin.dirty && !bw.dirty)
+				continue;
+/* +++ NiflyDLL Changes +++ */
 			nif->SetShapeTransformSkinToBone(shape, bid, bw.xformSkinToBone);
 			if (!bptr)
 				incomplete = true;
@@ -520,6 +614,13 @@ void AnimInfo::WriteToNif(NifFile* nif, const std::string& shapeException) {
 			for (auto &vid : vertWeights)
 				nif->SetShapeVertWeights(shapeBoneList.first, vid.first, vid.second.boneIds, vid.second.weights);
 		}
+
+/* +++ NiflyDLL Changes +++ */
+		// Only the reference nif is tracked; writing to any other nif
+		// leaves the shape dirty with respect to the reference.
+		if (nif == refNif)
+			skin.ClearDirty();
+/* +++ NiflyDLL Changes +++ */
 	}
 
 	if (incomplete)
@@ -533,6 +634,9 @@ void AnimInfo::RenameShape(const std::string& shapeName, const std::string& newS
 	if (shapeSkinning.find(shapeName) != shapeSkinning.end()) {
 		shapeSkinning[newShapeName] = std::move(shapeSkinning[shapeName]);
 		shapeSkinning.erase(shapeName);
+/* +++ NiflyDLL Changes +++ */
+		shapeSkinning[newShapeName].dirty = true;
+/* +++ NiflyDLL Changes +++ */
 	}
 
 	if (shapeBones.find(shapeName) != shapeBones.end()) {
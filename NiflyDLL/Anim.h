@@ -9,7 +9,7 @@ See the included LICENSE file
 
 /* +++ NiflyDLL Changes +++ */
 //#include "../utils/ConfigurationManager.h"
-#include "logger.hpp"
+#include "Logger.hpp"
 /* +++ NiflyDLL Changes +++ */
 
 #include <map>
@@ -82,6 +82,10 @@ public:
 	std::unordered_map<uint16_t, float> weights;
 	nifly::MatTransform xformSkinToBone;
 	nifly::BoundingSphere bounds;
+/* +++ NiflyDLL Changes +++ */
+	// Weights or skin-to-bone transform changed since last written to the nif.
+	bool dirty = true;
+/* +++ NiflyDLL Changes +++ */
 
 	void LoadFromNif(nifly::NifFile* loadFromFile, nifly::NiShape* shape, const int& index);
 };
@@ -92,6 +96,26 @@ public:
 	std::unordered_map<int, AnimWeight> boneWeights;
 	std::unordered_map<std::string, int> boneNames;
 	nifly::MatTransform xformGlobalToSkin;
+/* +++ NiflyDLL Changes +++ */
+	// Bone list or global-to-skin transform changed since last written to the
+	// nif, so every bone of the shape has to be rewritten.
+	bool dirty = true;
+
+	bool IsDirty() const {
+		if (dirty)
+			return true;
+		for (auto &bw : boneWeights)
+			if (bw.second.dirty)
+				return true;
+		return false;
+	}
+
+	void ClearDirty() {
+		dirty = false;
+		for (auto &bw : boneWeights)
+			bw.second.dirty = false;
+	}
+/* +++ NiflyDLL Changes +++ */
 
 	void LoadFromNif(nifly::NifFile* loadFromFile, nifly::NiShape* shape, AnimSkeleton* skel);
 
@@ -118,6 +142,9 @@ public:
 		for (auto &bn : boneNames)
 			if (bn.second > boneID)
 				bn.second--;
+/* +++ NiflyDLL Changes +++ */
+		dirty = true;
+/* +++ NiflyDLL Changes +++ */
 	}
 
 	void InsertVertexIndices(const std::vector<uint16_t>& indices);
@@ -175,6 +202,9 @@ public:
 	size_t GetActiveBoneCount() const;
 	size_t GetActiveBoneNames(std::vector<std::string>& outBoneNames) const;
 	void DisableCustomTransforms();
+/* +++ NiflyDLL Changes +++ */
+	size_t GetBoneCount() const { return allBones.size() + customBones.size(); }
+/* +++ NiflyDLL Changes +++ */
 };
 
 /* Represents animation weighting to a common skeleton across multiple shapes, sourced from nif files*/
@@ -228,7 +258,19 @@ public:
 	void ChangeGlobalToSkinTransform(const std::string& shape, const nifly::MatTransform& newTrans);
 	bool CalcShapeSkinBounds(const std::string& shapeName, const int& boneIndex);
 	void CleanupBones();
-	void WriteToNif(nifly::NifFile* nif, const std::string& shapeException = "");
+/* +++ NiflyDLL Changes +++ */
+	// WriteToNif with dirtyOnly set only rewrites the shapes and bones changed
+	// since they were loaded from or last written to the reference nif.
+	void WriteToNif(nifly::NifFile* nif, const std::string& shapeException = "", bool dirtyOnly = false);
+
+	// Dirty tracking. Anything that changes skinning through AnimInfo marks the
+	// affected shape or bone; callers that edit weights through GetWeightsPtr
+	// must mark them themselves.
+	void MarkShapeDirty(const std::string& shape);
+	void MarkBoneDirty(const std::string& shape, const std::string& boneName);
+	bool IsShapeDirty(const std::string& shape) const;
+	std::vector<std::string> GetDirtyShapes() const;
+/* +++ NiflyDLL Changes +++ */
 
 	void RenameShape(const std::string& shapeName, const std::string& newShapeName);
 };
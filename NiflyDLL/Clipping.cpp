@@ -0,0 +1,110 @@
+/*
+	Clipping detection.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <atomic>
+#include "NifFile.hpp"
+#include "NiflyFunctions.hpp"
+#include "NiflyParallel.hpp"
+#include "Clipping.hpp"
+
+using namespace nifly;
+
+namespace {
+	const size_t CLIP_BLOCK = 256;
+
+	/* Area-weighted vertex normals, from the mesh itself so they're in its space and
+		exist even when the shape has none. */
+	std::vector<Vector3> SmoothNormals(const MeshBVH& mesh) {
+		std::vector<Vector3> normals(mesh.Verts().size());
+		for (uint32_t i = 0; i < mesh.Tris().size(); i++) {
+			if (!mesh.ValidTri(i))
+				continue;
+			const Triangle& t = mesh.Tris()[i];
+			const Vector3& a = mesh.Verts()[t.p1];
+			Vector3 n = (mesh.Verts()[t.p2] - a).cross(mesh.Verts()[t.p3] - a);
+			normals[t.p1] += n;
+			normals[t.p2] += n;
+			normals[t.p3] += n;
+		}
+		for (auto& n : normals)
+			n.Normalize();
+		return normals;
+	}
+
+	/* Majority vote over three skewed rays, so a ray grazing an edge can't decide it. */
+	bool InsideByParity(const MeshBVH& body, const Vector3& p) {
+		static const Vector3 dirs[3] = {
+			Vector3(0.577f, 0.613f, 0.539f),
+			Vector3(-0.629f, 0.521f, -0.577f),
+			Vector3(0.511f, -0.601f, -0.614f) };
+		int votes = 0;
+		for (auto& d : dirs)
+			votes += body.CountHits(p, d) & 1;
+		return votes >= 2;
+	}
+}
+
+int FindClipping(const MeshBVH& body, const std::vector<Vector3>& verts,
+	float maxDepth, uint32_t options, std::vector<float>& depth)
+{
+	depth.assign(verts.size(), 0.0f);
+	if (body.Empty())
+		return 0;
+
+	std::vector<Vector3> normals;
+	if (!(options & CLIP_RAY_PARITY))
+		normals = SmoothNormals(body);
+	float limit = maxDepth > 0.0f ? maxDepth : FLT_MAX;
+	std::atomic<int> clipping = 0;
+
+	size_t blocks = (verts.size() + CLIP_BLOCK - 1) / CLIP_BLOCK;
+	niflydll::ParallelFor(blocks, [&](size_t b) {
+		int blockClipping = 0;
+		size_t end = std::min(verts.size(), (b + 1) * CLIP_BLOCK);
+		for (size_t v = b * CLIP_BLOCK; v < end; v++) {
+			MeshBVH::Hit hit;
+			if (!body.ClosestPoint(verts[v], hit, limit) || hit.distance == 0.0f)
+				continue;
+
+			bool inside;
+			if (options & CLIP_RAY_PARITY)
+				inside = InsideByParity(body, verts[v]);
+			else {
+				const Triangle& t = body.Tris()[hit.tri];
+				Vector3 n = normals[t.p1] * hit.bary[0] + normals[t.p2] * hit.bary[1] + normals[t.p3] * hit.bary[2];
+				inside = (verts[v] - hit.point).dot(n) < 0.0f;
+			}
+			if (inside) {
+				depth[v] = hit.distance;
+				blockClipping++;
+			}
+		}
+		clipping += blockClipping;
+		});
+
+	return clipping;
+}
+
+int FindShapeClipping(NifFile* bodyNif, NiShape* body, NifFile* nif, NiShape* shape,
+	float maxDepth, uint32_t options, std::vector<float>& depth)
+{
+	MatTransform bodyToGlobal = CalcShapeTransformToGlobal(bodyNif, body);
+	std::vector<Vector3> bodyVerts;
+	bodyNif->GetVertsForShape(body, bodyVerts);
+	for (auto& v : bodyVerts)
+		v = bodyToGlobal.ApplyTransform(v);
+	std::vector<Triangle> bodyTris;
+	body->GetTriangles(bodyTris);
+	MeshBVH bvh;
+	bvh.Build(bodyVerts, bodyTris);
+
+	MatTransform shapeToGlobal = CalcShapeTransformToGlobal(nif, shape);
+	std::vector<Vector3> verts;
+	nif->GetVertsForShape(shape, verts);
+	for (auto& v : verts)
+		v = shapeToGlobal.ApplyTransform(v);
+
+	return FindClipping(bvh, verts, maxDepth, options, depth);
+}
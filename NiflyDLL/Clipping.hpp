@@ -0,0 +1,28 @@
+/*
+	Clipping detection: find the vertices of a shape, such as an outfit, that sit inside
+	another shape, such as the body it's fitted to.
+	*/
+#include <vector>
+#include "BasicTypes.hpp"
+#include "NifFile.hpp"
+#include "MeshBVH.hpp"
+
+#pragma once
+
+const uint32_t CLIP_RAY_PARITY = 1;		// Decide inside/outside by counting ray crossings; for closed meshes
+
+/* Penetration depth of each vertex into the body mesh: the distance to the closest point
+	on the body for vertices behind its surface, 0 for vertices in front. By default a
+	vertex is behind the surface if it's on the back side of the body's interpolated
+	normal at the closest point, which works for open meshes. With CLIP_RAY_PARITY it's
+	inside if rays from it cross the body an odd number of times. Vertices deeper than
+	maxDepth (0 = no limit) are taken to be on the far side of the body, not clipping.
+	Runs in parallel over the vertices. Returns the number of clipping vertices. */
+int FindClipping(const MeshBVH& body, const std::vector<nifly::Vector3>& verts,
+	float maxDepth, uint32_t options, std::vector<float>& depth);
+
+/* Find the shape's vertices that clip into the body. Both shapes are put in global space
+	through their skin transforms, so they're compared in the pose they're skinned in. */
+int FindShapeClipping(nifly::NifFile* bodyNif, nifly::NiShape* body,
+	nifly::NifFile* nif, nifly::NiShape* shape,
+	float maxDepth, uint32_t options, std::vector<float>& depth);
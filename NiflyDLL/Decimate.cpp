@@ -0,0 +1,457 @@
+/*
+	Quadric error mesh decimation.
+
+	Works in passes: each pass scores every possible edge collapse by its quadric error
+	(plus a penalty for collapsing across different bone weights), then applies the
+	cheapest ones that don't touch each other until the target triangle count is reached.
+	Collapses work on groups of vertices sharing a position, so seam vertices move
+	together; a collapse is only allowed if every vertex of the group has a partner in the
+	target group along a mesh edge.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+#include "NifFile.hpp"
+#include "NiflyParallel.hpp"
+#include "Decimate.hpp"
+
+using namespace nifly;
+
+namespace {
+	struct Vec {
+		double x, y, z;
+	};
+
+	Vec Sub(const Vec& a, const Vec& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+	Vec Cross(const Vec& a, const Vec& b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+	double Dot(const Vec& a, const Vec& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	double Length(const Vec& a) { return std::sqrt(Dot(a, a)); }
+
+	struct Quadric {
+		double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+		void AddPlane(const Vec& n, double d, double w) {
+			a2 += w * n.x * n.x; ab += w * n.x * n.y; ac += w * n.x * n.z; ad += w * n.x * d;
+			b2 += w * n.y * n.y; bc += w * n.y * n.z; bd += w * n.y * d;
+			c2 += w * n.z * n.z; cd += w * n.z * d;
+			d2 += w * d * d;
+		}
+
+		void Add(const Quadric& q) {
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+			b2 += q.b2; bc += q.bc; bd += q.bd;
+			c2 += q.c2; cd += q.cd;
+			d2 += q.d2;
+		}
+
+		double Eval(const Vec& p) const {
+			return a2 * p.x * p.x + 2 * ab * p.x * p.y + 2 * ac * p.x * p.z + 2 * ad * p.x
+				+ b2 * p.y * p.y + 2 * bc * p.y * p.z + 2 * bd * p.y
+				+ c2 * p.z * p.z + 2 * cd * p.z
+				+ d2;
+		}
+	};
+
+	struct Collapse {
+		uint32_t from;
+		uint32_t to;
+		double cost;
+	};
+
+	uint64_t EdgeKey(uint32_t a, uint32_t b) {
+		if (a > b)
+			std::swap(a, b);
+		return (uint64_t(a) << 32) | b;
+	}
+
+	// Weight on border-preserving planes relative to face planes.
+	const double BorderWeight = 10.0;
+	// Cosine of the largest allowed change in face direction.
+	const double MaxNormalChange = 0.5;
+}
+
+std::vector<Triangle> DecimateTris(
+	const std::vector<Vector3>& verts,
+	const std::vector<Triangle>& tris,
+	const std::vector<std::vector<std::pair<uint16_t, float>>>* weights,
+	float targetRatio,
+	uint32_t options,
+	std::vector<uint32_t>& triSource)
+{
+	size_t vertCount = verts.size();
+	size_t triCount = tris.size();
+
+	triSource.resize(triCount);
+	std::iota(triSource.begin(), triSource.end(), 0);
+	for (auto& t : tris)
+		if (t.p1 >= vertCount || t.p2 >= vertCount || t.p3 >= vertCount)
+			return tris;
+
+	std::vector<Vec> pos(vertCount);
+	for (size_t v = 0; v < vertCount; v++)
+		pos[v] = { verts[v].x, verts[v].y, verts[v].z };
+
+	// Group vertices sharing a position.
+	std::vector<uint32_t> sorted(vertCount);
+	std::iota(sorted.begin(), sorted.end(), 0);
+	auto bits = [&](uint32_t v) {
+		uint32_t b[3];
+		std::memcpy(b, &verts[v].x, sizeof(float));
+		std::memcpy(b + 1, &verts[v].y, sizeof(float));
+		std::memcpy(b + 2, &verts[v].z, sizeof(float));
+		return std::make_tuple(b[0], b[1], b[2]);
+	};
+	std::stable_sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) { return bits(a) < bits(b); });
+	std::vector<uint32_t> group(vertCount);
+	std::vector<std::vector<uint32_t>> groupVerts;
+	for (size_t i = 0; i < vertCount; i++) {
+		if (i == 0 || bits(sorted[i]) != bits(sorted[i - 1]))
+			groupVerts.emplace_back();
+		group[sorted[i]] = uint32_t(groupVerts.size() - 1);
+		groupVerts.back().push_back(sorted[i]);
+	}
+	size_t groupCount = groupVerts.size();
+	std::vector<Vec> groupPos(groupCount);
+	for (size_t g = 0; g < groupCount; g++)
+		groupPos[g] = pos[groupVerts[g][0]];
+
+	std::vector<Triangle> cur = tris;
+	std::vector<char> alive(triCount, 1);
+	std::vector<std::vector<uint32_t>> vertTris(vertCount);
+	size_t aliveCount = 0;
+	auto degenerate = [&](const Triangle& t) {
+		return group[t.p1] == group[t.p2] || group[t.p2] == group[t.p3] || group[t.p3] == group[t.p1];
+	};
+	auto faceNormal = [&](const Vec& a, const Vec& b, const Vec& c) {
+		return Cross(Sub(b, a), Sub(c, a));
+	};
+
+	std::vector<Quadric> quadrics(groupCount);
+	for (uint32_t t = 0; t < triCount; t++) {
+		if (degenerate(cur[t])) {
+			alive[t] = 0;
+			continue;
+		}
+		aliveCount++;
+		for (uint16_t v : { cur[t].p1, cur[t].p2, cur[t].p3 })
+			vertTris[v].push_back(t);
+
+		Vec n = faceNormal(pos[cur[t].p1], pos[cur[t].p2], pos[cur[t].p3]);
+		double len = Length(n);
+		if (len == 0.0)
+			continue;
+		n = { n.x / len, n.y / len, n.z / len };
+		double d = -Dot(n, pos[cur[t].p1]);
+		for (uint16_t v : { cur[t].p1, cur[t].p2, cur[t].p3 })
+			quadrics[group[v]].AddPlane(n, d, len * 0.5);
+	}
+
+	// Open edges get an extra plane at right angles to the face, to hold the outline.
+	// Edges shared by more than two faces make their vertices immovable.
+	std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> edgeUse;
+	for (uint32_t t = 0; t < triCount; t++) {
+		if (!alive[t])
+			continue;
+		const Triangle& tri = cur[t];
+		for (auto e : { std::make_pair(tri.p1, tri.p2), std::make_pair(tri.p2, tri.p3), std::make_pair(tri.p3, tri.p1) }) {
+			auto& use = edgeUse[EdgeKey(group[e.first], group[e.second])];
+			use.first++;
+			use.second = t;
+		}
+	}
+	std::vector<char> border(groupCount, 0);
+	std::vector<char> locked(groupCount, 0);
+	for (auto& eu : edgeUse) {
+		uint32_t ga = uint32_t(eu.first >> 32);
+		uint32_t gb = uint32_t(eu.first & 0xFFFFFFFF);
+		if (eu.second.first > 2) {
+			locked[ga] = locked[gb] = 1;
+		}
+		else if (eu.second.first == 1) {
+			border[ga] = border[gb] = 1;
+			const Triangle& tri = cur[eu.second.second];
+			Vec fn = faceNormal(pos[tri.p1], pos[tri.p2], pos[tri.p3]);
+			Vec edge = Sub(groupPos[gb], groupPos[ga]);
+			Vec n = Cross(edge, fn);
+			double len = Length(n);
+			if (len == 0.0)
+				continue;
+			n = { n.x / len, n.y / len, n.z / len };
+			double d = -Dot(n, groupPos[ga]);
+			double w = BorderWeight * Dot(edge, edge);
+			quadrics[ga].AddPlane(n, d, w);
+			quadrics[gb].AddPlane(n, d, w);
+		}
+	}
+	if (options & DECIMATE_LOCK_BORDER)
+		for (size_t g = 0; g < groupCount; g++)
+			if (border[g])
+				locked[g] = 1;
+
+	// Bone weights, sorted by bone, for comparing vertices.
+	std::vector<std::vector<std::pair<uint16_t, float>>> vertWeights;
+	if (weights && !(options & DECIMATE_IGNORE_WEIGHTS) && weights->size() == vertCount) {
+		vertWeights = *weights;
+		for (auto& vw : vertWeights)
+			std::sort(vw.begin(), vw.end());
+	}
+	auto weightDiff = [&](uint32_t a, uint32_t b) {
+		if (vertWeights.empty())
+			return 0.0;
+		auto& wa = vertWeights[a];
+		auto& wb = vertWeights[b];
+		double diff = 0.0;
+		size_t i = 0, j = 0;
+		while (i < wa.size() || j < wb.size()) {
+			if (j == wb.size() || (i < wa.size() && wa[i].first < wb[j].first))
+				diff += std::abs(wa[i++].second);
+			else if (i == wa.size() || wb[j].first < wa[i].first)
+				diff += std::abs(wb[j++].second);
+			else
+				diff += std::abs(wa[i++].second - wb[j++].second);
+		}
+		return diff;
+	};
+
+	size_t target = std::max<size_t>(1, size_t(double(triCount) * std::clamp(targetRatio, 0.0f, 1.0f)));
+	std::vector<char> touched(groupCount);
+	std::vector<std::pair<uint32_t, uint32_t>> moves;
+
+	auto tryCollapse = [&](uint32_t from, uint32_t to) {
+		// Pair each vertex in the group with one in the target group along an edge.
+		moves.clear();
+		for (uint32_t u : groupVerts[from]) {
+			bool used = false;
+			int64_t partner = -1;
+			for (uint32_t t : vertTris[u]) {
+				if (!alive[t])
+					continue;
+				used = true;
+				for (uint16_t w : { cur[t].p1, cur[t].p2, cur[t].p3 })
+					if (group[w] == to) {
+						partner = w;
+						break;
+					}
+				if (partner >= 0)
+					break;
+			}
+			if (!used)
+				continue;
+			if (partner < 0)
+				return false;
+			moves.emplace_back(u, uint32_t(partner));
+		}
+		if (moves.empty())
+			return false;
+
+		// Faces that remain must not flip or turn too far.
+		for (auto& m : moves) {
+			for (uint32_t t : vertTris[m.first]) {
+				if (!alive[t])
+					continue;
+				Triangle after = cur[t];
+				for (uint16_t* c : { &after.p1, &after.p2, &after.p3 })
+					if (*c == m.first)
+						*c = uint16_t(m.second);
+				if (degenerate(after))
+					continue;
+				Vec nb = faceNormal(pos[cur[t].p1], pos[cur[t].p2], pos[cur[t].p3]);
+				Vec na = faceNormal(pos[after.p1], pos[after.p2], pos[after.p3]);
+				double dot = Dot(nb, na);
+				if (dot <= 0.0)
+					return false;
+				if (!(options & DECIMATE_IGNORE_NORMALS) && dot < MaxNormalChange * Length(nb) * Length(na))
+					return false;
+			}
+		}
+
+		for (auto& m : moves) {
+			for (uint32_t t : vertTris[m.first]) {
+				if (!alive[t])
+					continue;
+				for (uint16_t* c : { &cur[t].p1, &cur[t].p2, &cur[t].p3 })
+					if (*c == m.first)
+						*c = uint16_t(m.second);
+				if (degenerate(cur[t])) {
+					alive[t] = 0;
+					aliveCount--;
+				}
+				else
+					vertTris[m.second].push_back(t);
+			}
+			vertTris[m.first].clear();
+		}
+		quadrics[to].Add(quadrics[from]);
+
+		touched[from] = touched[to] = 1;
+		for (auto& m : moves)
+			for (uint32_t t : vertTris[m.second])
+				if (alive[t])
+					for (uint16_t w : { cur[t].p1, cur[t].p2, cur[t].p3 })
+						touched[group[w]] = 1;
+		return true;
+	};
+
+	std::vector<Collapse> candidates;
+	while (aliveCount > target) {
+		// Which group edges are open right now.
+		std::unordered_map<uint64_t, uint32_t> edgeCount;
+		for (uint32_t t = 0; t < triCount; t++) {
+			if (!alive[t])
+				continue;
+			const Triangle& tri = cur[t];
+			edgeCount[EdgeKey(group[tri.p1], group[tri.p2])]++;
+			edgeCount[EdgeKey(group[tri.p2], group[tri.p3])]++;
+			edgeCount[EdgeKey(group[tri.p3], group[tri.p1])]++;
+		}
+
+		candidates.clear();
+		for (auto& ec : edgeCount) {
+			uint32_t ga = uint32_t(ec.first >> 32);
+			uint32_t gb = uint32_t(ec.first & 0xFFFFFFFF);
+			for (auto dir : { std::make_pair(ga, gb), std::make_pair(gb, ga) }) {
+				uint32_t from = dir.first;
+				uint32_t to = dir.second;
+				if (locked[from])
+					continue;
+				// Border vertices may only slide along the border.
+				if (border[from] && ec.second != 1)
+					continue;
+				double cost = quadrics[from].Eval(groupPos[to]) + quadrics[to].Eval(groupPos[to]);
+				double wd = weightDiff(groupVerts[from][0], groupVerts[to][0]);
+				if (wd > 0.0) {
+					Vec e = Sub(groupPos[to], groupPos[from]);
+					double len2 = Dot(e, e);
+					cost += wd * len2 * len2;
+				}
+				candidates.push_back({ from, to, cost });
+			}
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const Collapse& a, const Collapse& b) {
+			if (a.cost != b.cost)
+				return a.cost < b.cost;
+			if (a.from != b.from)
+				return a.from < b.from;
+			return a.to < b.to;
+		});
+
+		std::fill(touched.begin(), touched.end(), 0);
+		size_t collapsed = 0;
+		for (auto& c : candidates) {
+			if (aliveCount <= target)
+				break;
+			if (touched[c.from] || touched[c.to])
+				continue;
+			if (tryCollapse(c.from, c.to))
+				collapsed++;
+		}
+		if (collapsed == 0)
+			break;
+	}
+
+	std::vector<Triangle> result;
+	triSource.clear();
+	for (uint32_t t = 0; t < triCount; t++) {
+		if (alive[t]) {
+			result.push_back(cur[t]);
+			triSource.push_back(t);
+		}
+	}
+	return result;
+}
+
+std::vector<NiShape*> DecimateShapes(NifFile* nif, const std::vector<NiShape*>& shapes,
+	float targetRatio, uint32_t options, NifFile* outNif)
+{
+	struct Job {
+		std::vector<Vector3> verts;
+		std::vector<Triangle> tris;
+		std::vector<std::vector<std::pair<uint16_t, float>>> weights;
+		std::vector<Triangle> result;
+		std::vector<uint32_t> triSource;
+	};
+	std::vector<Job> jobs(shapes.size());
+
+	for (size_t i = 0; i < shapes.size(); i++) {
+		Job& job = jobs[i];
+		NiShape* shape = shapes[i];
+		nif->GetVertsForShape(shape, job.verts);
+		shape->GetTriangles(job.tris);
+		if (shape->IsSkinned()) {
+			std::vector<int> boneIDs;
+			nif->GetShapeBoneIDList(shape, boneIDs);
+			job.weights.resize(job.verts.size());
+			for (int b = 0; b < int(boneIDs.size()); b++) {
+				std::unordered_map<uint16_t, float> bw;
+				nif->GetShapeBoneWeights(shape, b, bw);
+				for (auto& w : bw)
+					if (w.first < job.weights.size() && w.second > 0.0f)
+						job.weights[w.first].emplace_back(uint16_t(b), w.second);
+			}
+		}
+	}
+
+	niflydll::ParallelFor(jobs.size(), [&](size_t i) {
+		Job& job = jobs[i];
+		job.result = DecimateTris(job.verts, job.tris, job.weights.empty() ? nullptr : &job.weights,
+			targetRatio, options, job.triSource);
+		});
+
+	// Building the new shapes changes the nif, so that's done in order.
+	std::vector<NiShape*> newShapes;
+	for (size_t i = 0; i < shapes.size(); i++) {
+		Job& job = jobs[i];
+		std::string name = shapes[i]->name.get();
+		if (outNif == nif)
+			name += ":LOD";
+		NiShape* out = outNif->CloneShape(shapes[i], name, nif);
+		newShapes.push_back(out);
+		if (!out)
+			continue;
+
+		NiVector<BSDismemberSkinInstance::PartitionInfo> partInfos;
+		NifSegmentationInfo segInfo;
+		std::vector<int> triParts;
+		bool hasSegments = outNif->GetShapeSegments(out, segInfo, triParts);
+		bool hasPartitions = !hasSegments && outNif->GetShapePartitions(out, partInfos, triParts);
+
+		std::vector<char> used(job.verts.size(), 0);
+		for (auto& t : job.result)
+			used[t.p1] = used[t.p2] = used[t.p3] = 1;
+		std::vector<uint16_t> deleted;
+		std::vector<uint16_t> newIndex(job.verts.size());
+		uint16_t next = 0;
+		for (size_t v = 0; v < job.verts.size(); v++) {
+			if (used[v])
+				newIndex[v] = next++;
+			else
+				deleted.push_back(uint16_t(v));
+		}
+		if (!deleted.empty())
+			outNif->DeleteVertsForShape(out, deleted);
+
+		std::vector<Triangle> newTris;
+		newTris.reserve(job.result.size());
+		for (auto& t : job.result)
+			newTris.emplace_back(newIndex[t.p1], newIndex[t.p2], newIndex[t.p3]);
+		out->SetTriangles(newTris);
+
+		if (triParts.size() == job.tris.size()) {
+			std::vector<int> newTriParts;
+			for (auto src : job.triSource)
+				newTriParts.push_back(triParts[src]);
+			if (hasSegments)
+				outNif->SetShapeSegments(out, segInfo, newTriParts);
+			else if (hasPartitions)
+				outNif->SetShapePartitions(out, partInfos, newTriParts, true);
+		}
+		if (out->IsSkinned())
+			outNif->UpdateSkinPartitions(out);
+		outNif->CalcTangentsForShape(out);
+	}
+
+	return newShapes;
+}
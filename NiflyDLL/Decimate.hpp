@@ -0,0 +1,37 @@
+/*
+	Quadric error mesh decimation, for building LOD shapes.
+
+	Decimation collapses edges onto existing vertices (half-edge collapses), so every
+	surviving vertex keeps its original position, UVs, normal, color and weights. Vertices
+	split along UV or normal seams are collapsed together along the seam, so seams stay
+	intact.
+	*/
+#include <vector>
+#include "BasicTypes.hpp"
+#include "NifFile.hpp"
+
+#pragma once
+
+const uint32_t DECIMATE_LOCK_BORDER = 1;		// Don't move vertices on open edges
+const uint32_t DECIMATE_IGNORE_WEIGHTS = 2;		// Don't penalize collapsing across different bone weights
+const uint32_t DECIMATE_IGNORE_NORMALS = 4;		// Allow faces to turn more than 60 degrees (flips are never allowed)
+
+/* Decimate a triangle list to about targetRatio of its triangles.
+	weights, if given, has the (bone, weight) pairs for each vertex.
+	Returns the remaining triangles, which reference the original vertex indices.
+	triSource receives the index of the original triangle each one came from. */
+std::vector<nifly::Triangle> DecimateTris(
+	const std::vector<nifly::Vector3>& verts,
+	const std::vector<nifly::Triangle>& tris,
+	const std::vector<std::vector<std::pair<uint16_t, float>>>* weights,
+	float targetRatio,
+	uint32_t options,
+	std::vector<uint32_t>& triSource);
+
+/* Decimate the given shapes into outNif, which may be the same nif. Each shape is cloned
+	(shader, textures, alpha and skin come along) and its geometry replaced with the
+	decimated version; unused vertices are deleted, partitions and segments follow their
+	triangles. The decimation itself runs in parallel across shapes.
+	Returns the new shapes, 1:1 with the input (null where a shape couldn't be cloned). */
+std::vector<nifly::NiShape*> DecimateShapes(nifly::NifFile* nif, const std::vector<nifly::NiShape*>& shapes,
+	float targetRatio, uint32_t options, nifly::NifFile* outNif);
@@ -0,0 +1,58 @@
+/*
+	Hashed uniform grid over 3D points, for finding points within a tolerance of each
+	other: with cells at least as big as the tolerance, every match is in the point's own
+	cell or one of the 26 around it.
+
+	Cell coordinates are 64-bit, and the cell size is kept large enough relative to the
+	points' coordinates that no cell is more than 2^30 out from the origin, so a tiny
+	tolerance on a mesh far from the origin can't overflow them. Coordinates are clamped
+	as well, for infinite or NaN positions.
+	*/
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "BasicTypes.hpp"
+
+#pragma once
+
+struct GridCell {
+	int64_t x, y, z;
+	bool operator==(const GridCell& o) const { return x == o.x && y == o.y && z == o.z; }
+	GridCell Offset(int dx, int dy, int dz) const { return GridCell{ x + dx, y + dy, z + dz }; }
+};
+
+struct GridCellHash {
+	size_t operator()(const GridCell& k) const {
+		uint64_t h = uint64_t(k.x) * 0x9E3779B97F4A7C15ull ^ uint64_t(k.y) * 0xC2B2AE3D27D4EB4Full
+			^ uint64_t(k.z) * 0x165667B19E3779F9ull;
+		return size_t(h ^ (h >> 32));
+	}
+};
+
+const double GRID_MAX_CELL = double(1 << 30);
+
+/* Cell size for matching points within tolerance, where no point coordinate is further
+	than maxCoord from 0. */
+inline float GridCellSize(float tolerance, float maxCoord) {
+	return std::max({ tolerance, 1e-6f, float(double(maxCoord) / GRID_MAX_CELL) });
+}
+
+/* Largest coordinate of any of the points, for GridCellSize. */
+inline float GridMaxCoord(const std::vector<nifly::Vector3>& points) {
+	float m = 0.0f;
+	for (auto& p : points)
+		m = std::max({ m, std::fabs(p.x), std::fabs(p.y), std::fabs(p.z) });
+	return m;
+}
+
+inline int64_t GridCoord(float v, float cellSize) {
+	double c = std::floor(double(v) / cellSize);
+	if (!(c >= -GRID_MAX_CELL))			// Also catches NaN
+		return -int64_t(GRID_MAX_CELL);
+	return int64_t(std::min(c, GRID_MAX_CELL));
+}
+
+inline GridCell GridCellOf(const nifly::Vector3& p, float cellSize) {
+	return GridCell{ GridCoord(p.x, cellSize), GridCoord(p.y, cellSize), GridCoord(p.z, cellSize) };
+}
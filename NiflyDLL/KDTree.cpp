@@ -0,0 +1,101 @@
+/*
+	Point k-d tree.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <numeric>
+#include "KDTree.hpp"
+
+using namespace nifly;
+
+namespace {
+	bool HeapLess(const std::pair<uint32_t, float>& a, const std::pair<uint32_t, float>& b) {
+		return a.second < b.second || (a.second == b.second && a.first < b.first);
+	}
+}
+
+void KDTree::Build(const std::vector<Vector3>& inPoints)
+{
+	points = inPoints;
+	order.resize(points.size());
+	std::iota(order.begin(), order.end(), 0);
+	axes.assign(points.size(), 0);
+
+	std::vector<std::pair<size_t, size_t>> ranges;
+	if (!points.empty())
+		ranges.emplace_back(0, points.size());
+	while (!ranges.empty()) {
+		auto [begin, end] = ranges.back();
+		ranges.pop_back();
+		if (end - begin <= 1)
+			continue;
+
+		Vector3 lo = points[order[begin]];
+		Vector3 hi = lo;
+		for (size_t i = begin; i < end; i++) {
+			const Vector3& pt = points[order[i]];
+			lo = Vector3(std::min(lo.x, pt.x), std::min(lo.y, pt.y), std::min(lo.z, pt.z));
+			hi = Vector3(std::max(hi.x, pt.x), std::max(hi.y, pt.y), std::max(hi.z, pt.z));
+		}
+		Vector3 size = hi - lo;
+		uint8_t axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z ? 1 : 2);
+
+		size_t mid = begin + (end - begin) / 2;
+		std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+			[&](uint32_t a, uint32_t b) { return points[a][axis] < points[b][axis]; });
+		axes[mid] = axis;
+		ranges.emplace_back(begin, mid);
+		ranges.emplace_back(mid + 1, end);
+	}
+}
+
+void KDTree::Nearest(const Vector3& p, int k, float radius,
+	std::vector<std::pair<uint32_t, float>>& out) const
+{
+	out.clear();
+	if (order.empty() || k <= 0)
+		return;
+
+	float worst = (radius < FLT_MAX) ? radius * radius : FLT_MAX;
+	Search(0, order.size(), p, size_t(k), worst, out);
+	std::sort_heap(out.begin(), out.end(), HeapLess);
+}
+
+void KDTree::Search(size_t begin, size_t end, const Vector3& p, size_t k, float& worst,
+	std::vector<std::pair<uint32_t, float>>& heap) const
+{
+	if (begin >= end)
+		return;
+
+	size_t mid = begin + (end - begin) / 2;
+	uint32_t idx = order[mid];
+	Vector3 d = points[idx] - p;
+	float dist = d.x * d.x + d.y * d.y + d.z * d.z;
+	if (dist <= worst) {
+		heap.emplace_back(idx, dist);
+		std::push_heap(heap.begin(), heap.end(), HeapLess);
+		if (heap.size() > k) {
+			std::pop_heap(heap.begin(), heap.end(), HeapLess);
+			heap.pop_back();
+		}
+		if (heap.size() == k)
+			worst = std::min(worst, heap.front().second);
+	}
+
+	if (end - begin == 1)
+		return;
+
+	// Search the side p is on first, then the other side if it could still be close enough.
+	int axis = axes[mid];
+	float diff = p[axis] - points[idx][axis];
+	if (diff < 0.0f) {
+		Search(begin, mid, p, k, worst, heap);
+		if (diff * diff <= worst)
+			Search(mid + 1, end, p, k, worst, heap);
+	}
+	else {
+		Search(mid + 1, end, p, k, worst, heap);
+		if (diff * diff <= worst)
+			Search(begin, mid, p, k, worst, heap);
+	}
+}
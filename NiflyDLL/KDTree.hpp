@@ -0,0 +1,30 @@
+/*
+	k-d tree over a point set, for nearest-neighbour lookups against a shape's vertices.
+	*/
+#include <cfloat>
+#include <vector>
+#include "BasicTypes.hpp"
+
+#pragma once
+
+class KDTree {
+public:
+	/* Build over the given points. The points are copied. */
+	void Build(const std::vector<nifly::Vector3>& points);
+
+	bool Empty() const { return order.empty(); }
+	const std::vector<nifly::Vector3>& Points() const { return points; }
+
+	/* Find up to k points nearest to p that are within radius. out receives
+		(point index, squared distance) pairs, closest first. */
+	void Nearest(const nifly::Vector3& p, int k, float radius,
+		std::vector<std::pair<uint32_t, float>>& out) const;
+
+private:
+	std::vector<nifly::Vector3> points;
+	std::vector<uint32_t> order;		// Balanced tree: each range's median is its node.
+	std::vector<uint8_t> axes;			// Split axis of the node at each position in order.
+
+	void Search(size_t begin, size_t end, const nifly::Vector3& p, size_t k, float& worst,
+		std::vector<std::pair<uint32_t, float>>& heap) const;
+};
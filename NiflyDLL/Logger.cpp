@@ -1,70 +1,210 @@
 /*
 	Simple logger for returning messages across the DLL interface
 	*/
-#include <string>
-#include <vector>
+#include <algorithm>
+#include <atomic>
 #include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include "Logger.hpp"
 
 namespace niflydll {
-	static std::vector<std::string> messageLog;
+	namespace {
+		/* A slot's state tells readers whether its record is whole: 2*seq+1 while the
+			record with that seq is being written, 2*seq+2 once it's done. Readers check
+			it before and after copying, so a record overwritten mid-copy is dropped. */
+		struct Slot {
+			std::atomic<uint64_t> state{ 0 };
+			int32_t level = 0;
+			int32_t code = 0;
+			const void* handle = nullptr;
+			uint32_t thread = 0;
+			char message[LOG_MESSAGE_LEN] = {};
+		};
+
+		Slot ring[LOG_CAPACITY];
+		std::atomic<uint64_t> nextSeq{ 1 };
+		std::atomic<uint64_t> clearedSeq{ 1 };
+		std::atomic<int> minLevel{ LOG_INFO };
+		std::atomic<uint32_t> nextThreadId{ 1 };
+
+		const char* LevelPrefix(int level) {
+			switch (level) {
+			case LOG_WARNING: return "WARNING: ";
+			case LOG_ERROR: return "ERROR: ";
+			}
+			return "Info: ";
+		}
+
+		void Write(int level, int code, const void* handle, const char* prefix, const char* fmt, va_list args) {
+			if (level < minLevel.load(std::memory_order_relaxed))
+				return;
+
+			uint64_t seq = nextSeq.fetch_add(1, std::memory_order_relaxed);
+			Slot& slot = ring[seq % LOG_CAPACITY];
+
+			// Claim the slot. Another writer can only be in it if it's a whole lap of the
+			// ring behind, so waiting for it is rare and short.
+			uint64_t state = slot.state.load(std::memory_order_acquire);
+			for (;;) {
+				if (state >= seq * 2 + 1)
+					return;		// A newer record already has the slot; ours is overwritten anyway
+				if (state & 1) {
+					std::this_thread::yield();
+					state = slot.state.load(std::memory_order_acquire);
+				}
+				else if (slot.state.compare_exchange_weak(state, seq * 2 + 1, std::memory_order_acq_rel))
+					break;
+			}
+			std::atomic_thread_fence(std::memory_order_release);
+
+			slot.level = level;
+			slot.code = code;
+			slot.handle = handle;
+			slot.thread = LogThreadId();
+			int n = prefix ? snprintf(slot.message, LOG_MESSAGE_LEN, "%s", prefix) : 0;
+			n = std::min(std::max(n, 0), LOG_MESSAGE_LEN - 1);
+			vsnprintf(slot.message + n, size_t(LOG_MESSAGE_LEN - n), fmt, args);
+
+			slot.state.store(seq * 2 + 2, std::memory_order_release);
+		}
+
+		void WriteF(int level, int code, const void* handle, const char* prefix, const char* fmt, ...) {
+			va_list args;
+			va_start(args, fmt);
+			Write(level, code, handle, prefix, fmt, args);
+			va_end(args);
+		}
+
+		enum class SlotRead { OK, PENDING, GONE };
+
+		/* Copy the record with the given seq, if it's still there and whole. PENDING if
+			it's not written yet, GONE if it's been overwritten. */
+		SlotRead ReadSlot(uint64_t seq, LogEntry& out) {
+			const Slot& slot = ring[seq % LOG_CAPACITY];
+			uint64_t state = slot.state.load(std::memory_order_acquire);
+			if (state != seq * 2 + 2)
+				return state < seq * 2 + 2 ? SlotRead::PENDING : SlotRead::GONE;
+			out.seq = seq;
+			out.level = slot.level;
+			out.code = slot.code;
+			out.handle = slot.handle;
+			out.thread = slot.thread;
+			memcpy(out.message, slot.message, LOG_MESSAGE_LEN);
+			out.message[LOG_MESSAGE_LEN - 1] = '\0';
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return slot.state.load(std::memory_order_relaxed) == state ? SlotRead::OK : SlotRead::GONE;
+		}
+
+		/* Call fn on every whole record from seq `from` on. */
+		template <typename Fn>
+		void ForEachSince(uint64_t from, Fn fn) {
+			uint64_t end = nextSeq.load(std::memory_order_acquire);
+			if (end > LOG_CAPACITY)
+				from = std::max(from, end - LOG_CAPACITY);
+			LogEntry entry;
+			for (uint64_t seq = from; seq < end; seq++)
+				if (ReadSlot(seq, entry) == SlotRead::OK)
+					fn(entry);
+		}
+	}
 
 	void LogInit() {
-		messageLog.clear();
+		clearedSeq.store(nextSeq.load());
 	}
 
 	void LogWrite(std::string msg) {
-		messageLog.push_back(msg);
+		int level = LOG_INFO;
+		if (msg.compare(0, 5, "ERROR") == 0)
+			level = LOG_ERROR;
+		else if (msg.compare(0, 7, "WARNING") == 0)
+			level = LOG_WARNING;
+		WriteF(level, LOGCODE_NONE, nullptr, nullptr, "%s", msg.c_str());
 	}
 
 	void LogWriteMf(std::string fmt, ...)
 	{
-		char buf[500];
 		va_list args;
 		va_start(args, fmt);
-		std::string msg = "Info: " + fmt;
-		vsnprintf(buf, 500, msg.c_str(), args);
-		messageLog.push_back(buf);
+		Write(LOG_INFO, LOGCODE_NONE, nullptr, LevelPrefix(LOG_INFO), fmt.c_str(), args);
 		va_end(args);
 	}
 
 	void LogWriteWf(std::string fmt, ...)
 	{
-		char buf[500];
 		va_list args;
 		va_start(args, fmt);
-		std::string msg = "WARNING: " + fmt;
-		vsnprintf(buf, 500, msg.c_str(), args);
-		messageLog.push_back(buf);
+		Write(LOG_WARNING, LOGCODE_NONE, nullptr, LevelPrefix(LOG_WARNING), fmt.c_str(), args);
 		va_end(args);
 	}
 
 	void LogWriteEf(std::string fmt, ...)
 	{
-		char buf[500];
 		va_list args;
 		va_start(args, fmt);
-		std::string msg = "ERROR: " + fmt;
-		vsnprintf(buf, 500, msg.c_str(), args);
-		messageLog.push_back(buf);
+		Write(LOG_ERROR, LOGCODE_NONE, nullptr, LevelPrefix(LOG_ERROR), fmt.c_str(), args);
+		va_end(args);
+	}
+
+	void LogWriteCode(LogLevel level, int code, const void* handle, const char* fmt, ...)
+	{
+		va_list args;
+		va_start(args, fmt);
+		Write(level, code, handle, LevelPrefix(level), fmt, args);
 		va_end(args);
 	}
 
+	uint32_t LogThreadId() {
+		thread_local uint32_t id = nextThreadId.fetch_add(1, std::memory_order_relaxed);
+		return id;
+	}
+
+	void LogSetLevel(int level) {
+		minLevel.store(level);
+	}
+
 	int LogGetLen() {
 		int len = 0;
-		for (std::string s : messageLog) {
-			len += int(s.size() + 1);
-		}
+		ForEachSince(clearedSeq.load(), [&](const LogEntry& e) {
+			len += int(strlen(e.message) + 1);
+			});
 		return len;
 	}
 
 	int LogGet(char* buf, int len) {
-		std::string outStr;
-		for (std::string s : messageLog) {
-			outStr += s + '\n';
-		};
-		strcpy_s(buf, len - 1, outStr.c_str());
-		buf[len - 1] = '\0';
-		return outStr.size();
+		int total = 0;
+		ForEachSince(clearedSeq.load(), [&](const LogEntry& e) {
+			int n = int(strlen(e.message));
+			if (total < len - 1) {
+				int copy = std::min(n, len - 1 - total);
+				memcpy(buf + total, e.message, copy);
+				if (total + copy < len - 1)
+					buf[total + copy] = '\n';
+			}
+			total += n + 1;
+			});
+		if (len > 0)
+			buf[std::min(total, len - 1)] = '\0';
+		return total;
+	}
+
+	int LogRead(uint64_t& cursor, LogEntry* out, int count) {
+		int n = 0;
+		uint64_t end = nextSeq.load(std::memory_order_acquire);
+		uint64_t from = std::max<uint64_t>(cursor, 1);
+		if (end > LOG_CAPACITY)
+			from = std::max(from, end - LOG_CAPACITY);
+		for (uint64_t seq = from; seq < end && n < count; seq++) {
+			// Stop at a record still being written, so the next read picks it up.
+			SlotRead r = ReadSlot(seq, out[n]);
+			if (r == SlotRead::PENDING)
+				break;
+			if (r == SlotRead::OK)
+				n++;
+			cursor = seq + 1;
+		}
+		return n;
 	}
 
-}
\ No newline at end of file
+}
@@ -1,6 +1,12 @@
 /*
-	Simple logger for returning messages across the DLL interface
+	Simple logger for returning messages across the DLL interface.
+
+	Messages go in a fixed-size ring of records, so a long session can't grow the log
+	without limit; once it's full the oldest records are overwritten. Writers take a
+	ticket with an atomic increment and readers check each record's sequence number, so
+	any thread can log or read without locking.
 	*/
+#include <cstdint>
 #include <string>
 
 #pragma once
@@ -12,15 +18,63 @@
 
 namespace niflydll {
 
+	enum LogLevel {
+		LOG_INFO = 0,
+		LOG_WARNING = 1,
+		LOG_ERROR = 2
+	};
+
+	/* What went wrong, for callers that want to react to errors without parsing text */
+	enum LogCode {
+		LOGCODE_NONE = 0,
+		LOGCODE_FILE = 1,			// Couldn't read or write a file
+		LOGCODE_ARGUMENT = 2,		// Bad parameter to an API call
+		LOGCODE_GEOMETRY = 3,		// Bad or oversize mesh data
+		LOGCODE_SKIN = 4,			// Skinning, bones or weights
+		LOGCODE_SEGMENTS = 5		// Partitions or segments
+	};
+
+	const int LOG_MESSAGE_LEN = 256;
+	const int LOG_CAPACITY = 1024;
+
+	/* One log record, as returned by LogRead. seq counts up from 1 over the life of 
+		the DLL. */
+	struct LogEntry {
+		uint64_t seq;
+		int32_t level;
+		int32_t code;
+		const void* handle;			// Nif, shape or skin the message is about, if any
+		uint32_t thread;			// Thread that logged it, as numbered by LogThreadId
+		char message[LOG_MESSAGE_LEN];
+	};
+
+	/* Forget everything logged so far, as far as LogGet and LogGetLen are concerned. */
 	void LogInit();
 
+	/* Log a message. The level comes from an "ERROR"/"WARNING" prefix, if any. */
 	void LogWrite(std::string msg);
 	void LogWriteMf(std::string msg, ...);
 	void LogWriteWf(std::string msg, ...);
 	void LogWriteEf(std::string msg, ...);
 
+	/* Log a formatted message with an error code and the handle it concerns. */
+	void LogWriteCode(LogLevel level, int code, const void* handle, const char* fmt, ...);
+
+	/* Small number identifying the calling thread in log records, starting from 1. */
+	uint32_t LogThreadId();
+
+	/* Drop messages below this level. */
+	void LogSetLevel(int level);
+
+	/* Length of the text LogGet would return. */
 	int LogGetLen();
 
+	/* Every message since LogInit, one per line. Returns the full length, which may be 
+		more than fits in buf. */
 	int LogGet(char* buf, int len);
 
-}
\ No newline at end of file
+	/* Copy up to count records with seq of at least cursor into out, and move cursor past
+		them. Records already overwritten are skipped. Returns the number copied. */
+	int LogRead(uint64_t& cursor, LogEntry* out, int count);
+
+}
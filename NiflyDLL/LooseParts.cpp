@@ -0,0 +1,213 @@
+/*
+	Loose part splitting.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <numeric>
+#include "NifFile.hpp"
+#include "LooseParts.hpp"
+
+using namespace nifly;
+
+namespace {
+	/* Union-find with path halving and union by size. */
+	struct DisjointSets {
+		std::vector<uint32_t> parent;
+		std::vector<uint32_t> size;
+
+		explicit DisjointSets(size_t n) : parent(n), size(n, 1) {
+			std::iota(parent.begin(), parent.end(), 0);
+		}
+
+		uint32_t Find(uint32_t x) {
+			while (parent[x] != x) {
+				parent[x] = parent[parent[x]];
+				x = parent[x];
+			}
+			return x;
+		}
+
+		void Union(uint32_t a, uint32_t b) {
+			a = Find(a);
+			b = Find(b);
+			if (a == b)
+				return;
+			if (size[a] < size[b])
+				std::swap(a, b);
+			parent[b] = a;
+			size[a] += size[b];
+		}
+	};
+
+	/* What the split needs about the original shape, gathered once. */
+	struct SplitJob {
+		NifFile* nif = nullptr;
+		NiNode* parent = nullptr;
+		std::string name;
+		std::vector<int> vertIsland;						// -1 for verts no tri uses
+		std::vector<std::vector<Triangle>> islandTris;		// In each island's own vert numbering
+		std::vector<std::vector<int>> islandTriParts;		// Empty if the shape has no partitions or segments
+		bool hasSegments = false;
+		bool hasPartitions = false;
+		NifSegmentationInfo segInfo;
+		NiVector<BSDismemberSkinInstance::PartitionInfo> partInfos;
+		std::vector<NiShape*> shapes;						// Shape for each island
+	};
+
+	/* shape holds just island i's verts: give it the island's tris and their partitions
+		or segments. */
+	void FinishIsland(SplitJob& job, NiShape* shape, int i) {
+		job.shapes[i] = shape;
+		shape->SetTriangles(job.islandTris[i]);
+		if (!job.islandTriParts[i].empty()) {
+			if (job.hasSegments)
+				job.nif->SetShapeSegments(shape, job.segInfo, job.islandTriParts[i]);
+			else if (job.hasPartitions)
+				job.nif->SetShapePartitions(shape, job.partInfos, job.islandTriParts[i], true);
+		}
+		if (shape->IsSkinned())
+			job.nif->UpdateSkinPartitions(shape);
+		job.nif->CalcTangentsForShape(shape);
+	}
+
+	/* shape holds the verts of islands lo to hi-1, in their original order; verts gives
+		each one's original index. Copy the shape for the upper half of the islands, cut
+		each copy down to its half, and recurse. Every vert is copied and deleted once per
+		level, so the split costs O(verts * log(islands)) instead of a whole copy of the
+		shape per island. */
+	void SplitIslands(SplitJob& job, NiShape* shape, std::vector<uint32_t>& verts, int lo, int hi) {
+		if (hi - lo == 1) {
+			FinishIsland(job, shape, lo);
+			return;
+		}
+
+		int mid = lo + (hi - lo) / 2;
+		NiShape* upper = job.nif->CloneShape(shape, job.name + ":" + std::to_string(mid), job.nif);
+		if (upper && job.parent && job.nif->GetParentNode(upper) != job.parent)
+			job.nif->SetParentNode(upper, job.parent);
+
+		std::vector<uint32_t> lowerVerts, upperVerts;
+		std::vector<uint16_t> lowerDeleted, upperDeleted;
+		for (size_t v = 0; v < verts.size(); v++) {
+			if (job.vertIsland[verts[v]] < mid) {
+				lowerVerts.push_back(verts[v]);
+				upperDeleted.push_back(uint16_t(v));
+			}
+			else {
+				upperVerts.push_back(verts[v]);
+				lowerDeleted.push_back(uint16_t(v));
+			}
+		}
+		std::vector<uint32_t>().swap(verts);
+
+		job.nif->DeleteVertsForShape(shape, lowerDeleted);
+		SplitIslands(job, shape, lowerVerts, lo, mid);
+		if (upper) {
+			job.nif->DeleteVertsForShape(upper, upperDeleted);
+			SplitIslands(job, upper, upperVerts, mid, hi);
+		}
+	}
+}
+
+std::vector<int> FindMeshIslands(const std::vector<Vector3>& verts, const std::vector<Triangle>& tris,
+	uint32_t mode, int& islandCount)
+{
+	DisjointSets sets(verts.size());
+	for (auto& t : tris)
+		if (t.p1 < verts.size() && t.p2 < verts.size() && t.p3 < verts.size()) {
+			sets.Union(t.p1, t.p2);
+			sets.Union(t.p1, t.p3);
+		}
+
+	if (mode & LOOSE_WELD_POSITIONS) {
+		std::vector<uint32_t> order(verts.size());
+		std::iota(order.begin(), order.end(), 0);
+		auto less = [&](uint32_t a, uint32_t b) {
+			const Vector3& p = verts[a];
+			const Vector3& q = verts[b];
+			if (p.x != q.x) return p.x < q.x;
+			if (p.y != q.y) return p.y < q.y;
+			return p.z < q.z;
+		};
+		std::sort(order.begin(), order.end(), less);
+		for (size_t i = 1; i < order.size(); i++)
+			if (verts[order[i]] == verts[order[i - 1]])
+				sets.Union(order[i], order[i - 1]);
+	}
+
+	std::vector<int> rootIsland(verts.size(), -1);
+	std::vector<int> triIsland(tris.size(), -1);
+	islandCount = 0;
+	for (size_t i = 0; i < tris.size(); i++) {
+		if (tris[i].p1 >= verts.size() || tris[i].p2 >= verts.size() || tris[i].p3 >= verts.size())
+			continue;
+		uint32_t root = sets.Find(tris[i].p1);
+		if (rootIsland[root] < 0)
+			rootIsland[root] = islandCount++;
+		triIsland[i] = rootIsland[root];
+	}
+	return triIsland;
+}
+
+std::vector<NiShape*> SplitShapeByConnectivity(NifFile* nif, NiShape* shape, uint32_t mode)
+{
+	std::vector<Vector3> verts;
+	std::vector<Triangle> tris;
+	nif->GetVertsForShape(shape, verts);
+	shape->GetTriangles(tris);
+
+	int islandCount = 0;
+	std::vector<int> triIsland = FindMeshIslands(verts, tris, mode, islandCount);
+	if (islandCount <= 1)
+		return { shape };
+
+	SplitJob job;
+	job.nif = nif;
+	job.parent = nif->GetParentNode(shape);
+	job.name = shape->name.get();
+
+	std::vector<int> triParts;
+	job.hasSegments = nif->GetShapeSegments(shape, job.segInfo, triParts);
+	job.hasPartitions = !job.hasSegments && nif->GetShapePartitions(shape, job.partInfos, triParts);
+	if (triParts.size() != tris.size())
+		triParts.clear();
+
+	// Every vertex used by a tri belongs to exactly one island.
+	job.vertIsland.assign(verts.size(), -1);
+	for (size_t i = 0; i < tris.size(); i++)
+		if (triIsland[i] >= 0)
+			job.vertIsland[tris[i].p1] = job.vertIsland[tris[i].p2] = job.vertIsland[tris[i].p3] = triIsland[i];
+
+	// Number each island's verts in their original order, which is the order they'll
+	// have in the island's shape, and bucket the tris by island with that numbering.
+	std::vector<uint16_t> islandVertCount(islandCount, 0);
+	std::vector<uint16_t> localIndex(verts.size(), 0);
+	std::vector<uint32_t> usedVerts;
+	std::vector<uint16_t> unused;
+	for (size_t v = 0; v < verts.size(); v++) {
+		if (job.vertIsland[v] >= 0) {
+			localIndex[v] = islandVertCount[job.vertIsland[v]]++;
+			usedVerts.push_back(uint32_t(v));
+		}
+		else
+			unused.push_back(uint16_t(v));
+	}
+
+	job.islandTris.resize(islandCount);
+	job.islandTriParts.resize(islandCount);
+	for (size_t t = 0; t < tris.size(); t++) {
+		int i = triIsland[t];
+		if (i < 0)
+			continue;
+		job.islandTris[i].emplace_back(localIndex[tris[t].p1], localIndex[tris[t].p2], localIndex[tris[t].p3]);
+		if (!triParts.empty())
+			job.islandTriParts[i].push_back(triParts[t]);
+	}
+
+	if (!unused.empty())
+		nif->DeleteVertsForShape(shape, unused);
+
+	job.shapes.assign(islandCount, nullptr);
+	SplitIslands(job, shape, usedVerts, 0, islandCount);
+	return job.shapes;
+}
@@ -0,0 +1,25 @@
+/*
+	Loose part splitting: break a shape into its connected pieces, e.g. to pull apart
+	merged clutter meshes.
+	*/
+#include <vector>
+#include "BasicTypes.hpp"
+#include "NifFile.hpp"
+
+#pragma once
+
+const uint32_t LOOSE_WELD_POSITIONS = 1;		// Vertices at the same position are connected, e.g. across UV seams
+
+/* Island index of each triangle. Triangles are connected through shared vertices,
+	found with union-find so it runs in near-linear time; with LOOSE_WELD_POSITIONS
+	vertices at identical positions are joined too. Islands are numbered in order of
+	their first triangle. islandCount receives the number of islands. */
+std::vector<int> FindMeshIslands(const std::vector<nifly::Vector3>& verts,
+	const std::vector<nifly::Triangle>& tris, uint32_t mode, int& islandCount);
+
+/* Split the shape into one shape per island. The shape itself keeps the first island
+	and the rest go in copies named "<name>:1", "<name>:2"... under the same parent.
+	Vertex data--UVs, normals, colors, weights--goes with its vertices, and partitions
+	and segments with their tris. Vertices no tri uses are dropped.
+	Returns the shapes, the original first. */
+std::vector<nifly::NiShape*> SplitShapeByConnectivity(nifly::NifFile* nif, nifly::NiShape* shape, uint32_t mode);
@@ -0,0 +1,400 @@
+/*
+	Shape merging by material.
+
+	The material key is built from the same shader attributes getShaderAttrs and
+	getEffectShaderAttrs report, so shapes merge exactly when Python would see them as
+	having the same material.
+	*/
+#include "pch.h"
+#include <unordered_map>
+#include "NifFile.hpp"
+#include "Anim.h"
+#include "NiflyWrapper.hpp"
+#include "NiflyHandles.hpp"
+#include "SkinPartitions.hpp"
+#include "MergeShapes.hpp"
+
+using namespace nifly;
+
+namespace {
+	const size_t MAX_MERGED_VERTS = 0xFFFF;
+	const size_t MAX_MERGED_TRIS = 0xFFFF;
+	const size_t MAX_MERGED_BONES = 0xFF;	// Vertex bone indices are a byte
+
+	template<class T>
+	void AppendKey(std::string& key, const T& val) {
+		key.append(reinterpret_cast<const char*>(&val), sizeof(T));
+	}
+
+	void AppendKey(std::string& key, const std::string& val) {
+		AppendKey(key, uint32_t(val.size()));
+		key += val;
+	}
+
+	/* Skinned shapes can only be merged if their vertices are in the same space and
+		the bones they share bind the same way. */
+	struct ShapeGroup {
+		std::string key;
+		std::vector<NiShape*> shapes;
+		size_t vertCount = 0;
+		size_t triCount = 0;
+		bool skinned = false;
+		MatTransform xform;
+		MatTransform globalToSkin;
+		std::unordered_map<int, MatTransform> skinToBone;
+
+		bool Accepts(NifFile* nif, NiShape* shape, const std::vector<int>& boneIDs) const {
+			if (vertCount + shape->GetNumVertices() > MAX_MERGED_VERTS
+				|| triCount + shape->GetNumTriangles() > MAX_MERGED_TRIS)
+				return false;
+			if (!skinned)
+				return true;
+
+			if (!xform.IsNearlyEqualTo(shape->GetTransformToParent()))
+				return false;
+			MatTransform gts;
+			nif->GetShapeTransformGlobalToSkin(shape, gts);
+			if (!globalToSkin.IsNearlyEqualTo(gts))
+				return false;
+
+			size_t newBones = 0;
+			for (int b = 0; b < int(boneIDs.size()); b++) {
+				MatTransform stb;
+				nif->GetShapeTransformSkinToBone(shape, b, stb);
+				auto it = skinToBone.find(boneIDs[b]);
+				if (it == skinToBone.end())
+					newBones++;
+				else if (!it->second.IsNearlyEqualTo(stb))
+					return false;
+			}
+			return skinToBone.size() + newBones <= MAX_MERGED_BONES;
+		}
+
+		void Add(NifFile* nif, NiShape* shape, const std::vector<int>& boneIDs) {
+			if (shapes.empty() && skinned) {
+				xform = shape->GetTransformToParent();
+				nif->GetShapeTransformGlobalToSkin(shape, globalToSkin);
+			}
+			shapes.push_back(shape);
+			vertCount += shape->GetNumVertices();
+			triCount += shape->GetNumTriangles();
+			for (int b = 0; b < int(boneIDs.size()); b++) {
+				if (skinToBone.find(boneIDs[b]) == skinToBone.end())
+					nif->GetShapeTransformSkinToBone(shape, b, skinToBone[boneIDs[b]]);
+			}
+		}
+	};
+
+	/* Clear any of the shape's references to blocks the merged shape still uses, so
+		deleting the shape leaves them alone. */
+	void DetachSharedBlocks(NifFile* nif, NiShape* shape, NiShape* keep) {
+		NiShader* shader = nif->GetShader(shape);
+		NiShader* keepShader = nif->GetShader(keep);
+		// Shaders without texture sets, such as effect shaders, have no ref to compare.
+		NiBlockRef<BSShaderTextureSet>* texSet = shader ? shader->TextureSetRef() : nullptr;
+		NiBlockRef<BSShaderTextureSet>* keepTexSet = keepShader ? keepShader->TextureSetRef() : nullptr;
+		if (texSet && keepTexSet && shader != keepShader && texSet->index == keepTexSet->index)
+			texSet->Clear();
+		if (shape->ShaderPropertyRef()->index == keep->ShaderPropertyRef()->index)
+			shape->ShaderPropertyRef()->Clear();
+		if (shape->AlphaPropertyRef()->index == keep->AlphaPropertyRef()->index)
+			shape->AlphaPropertyRef()->Clear();
+		// Shapes with properties only merge if they share all of them.
+		shape->propertyRefs.Clear();
+	}
+}
+
+std::string ShapeMaterialKey(NifFile* nif, NiShape* shape) {
+	std::string key;
+	if (!shape || shape->HasType<BSDynamicTriShape>())
+		return key;
+	if (!shape->HasType<BSTriShape>() && !shape->HasType<NiTriShape>())
+		return key;
+	if (shape->extraDataRefs.GetSize() > 0)
+		return key;
+	NiShader* shader = nif->GetShader(shape);
+	if (!shader)
+		return key;
+
+	AppendKey(key, std::string(shape->GetBlockName()));
+	AppendKey(key, nif->GetBlockID(nif->GetParentNode(shape)));
+	AppendKey(key, shape->HasUVs());
+	AppendKey(key, shape->HasNormals());
+	AppendKey(key, shape->HasVertexColors());
+	AppendKey(key, shape->IsSkinned());
+
+	AppendKey(key, std::string(shader->GetBlockName()));
+	AppendKey(key, shader->name.get());
+	AppendKey(key, shader->GetShaderType());
+	BSShaderProperty* bssh = dynamic_cast<BSShaderProperty*>(shader);
+	if (bssh) {
+		AppendKey(key, bssh->shaderFlags1);
+		AppendKey(key, bssh->shaderFlags2);
+	}
+	BSLSPAttrs lspAttrs;
+	if (getShaderAttrs(nif, shape, &lspAttrs) == 0)
+		AppendKey(key, lspAttrs);
+	BSESPAttrs espAttrs;
+	if (getEffectShaderAttrs(nif, shape, &espAttrs) == 0)
+		AppendKey(key, espAttrs);
+
+	for (int slot = 0; slot < 10; slot++) {
+		std::string tex;
+		nif->GetTextureSlot(shape, tex, slot);
+		AppendKey(key, tex);
+	}
+
+	NiAlphaProperty* alpha = nif->GetAlphaProperty(shape);
+	AppendKey(key, alpha != nullptr);
+	if (alpha) {
+		AppendKey(key, alpha->flags);
+		AppendKey(key, alpha->threshold);
+	}
+
+	// Older games hang materials and textures off the property list.
+	for (auto& prop : shape->propertyRefs)
+		AppendKey(key, prop.index);
+
+	NifSegmentationInfo segInfo;
+	NiVector<BSDismemberSkinInstance::PartitionInfo> partInfos;
+	std::vector<int> triParts;
+	if (nif->GetShapeSegments(shape, segInfo, triParts)) {
+		AppendKey(key, 'S');
+		AppendKey(key, segInfo.ssfFile);
+		AppendKey(key, segInfo.segs.size());
+		for (auto& seg : segInfo.segs) {
+			AppendKey(key, seg.subs.size());
+			for (auto& sub : seg.subs) {
+				AppendKey(key, sub.userSlotID);
+				AppendKey(key, sub.material);
+			}
+		}
+	}
+	else if (nif->GetShapePartitions(shape, partInfos, triParts))
+		AppendKey(key, 'P');
+
+	return key;
+}
+
+std::vector<std::vector<NiShape*>> GroupShapesByMaterial(NifFile* nif, const std::vector<NiShape*>& shapes) {
+	std::vector<ShapeGroup> groups;
+	for (auto& shape : shapes) {
+		std::string key = ShapeMaterialKey(nif, shape);
+		std::vector<int> boneIDs;
+		if (shape->IsSkinned())
+			nif->GetShapeBoneIDList(shape, boneIDs);
+
+		ShapeGroup* target = nullptr;
+		if (!key.empty()) {
+			for (auto& g : groups) {
+				if (g.key == key && g.Accepts(nif, shape, boneIDs)) {
+					target = &g;
+					break;
+				}
+			}
+		}
+		if (!target) {
+			groups.emplace_back();
+			target = &groups.back();
+			target->key = key;
+			target->skinned = shape->IsSkinned();
+		}
+		target->Add(nif, shape, boneIDs);
+	}
+
+	std::vector<std::vector<NiShape*>> result;
+	for (auto& g : groups)
+		result.push_back(g.shapes);
+	return result;
+}
+
+NiShape* MergeShapes(NifFile* nif, const std::vector<NiShape*>& group) {
+	if (group.empty())
+		return nullptr;
+	NiShape* base = group[0];
+	if (group.size() == 1)
+		return base;
+
+	std::string baseName = base->name.get();
+	bool skinned = base->IsSkinned();
+	bool isBSShape = base->HasType<BSTriShape>();
+	bool isFO = nif->GetHeader().GetVersion().IsFO4() || nif->GetHeader().GetVersion().IsFO76();
+	bool hasUVs = base->HasUVs();
+	bool hasNormals = base->HasNormals();
+	bool hasColors = nif->GetColorsForShape(baseName) != nullptr;
+	MatTransform baseInverse = base->GetTransformToParent().InverseTransform();
+
+	std::vector<Vector3> verts;
+	std::vector<Vector3> normals;
+	std::vector<Vector2> uvs;
+	std::vector<Color4> colors;
+	std::vector<Triangle> tris;
+
+	std::vector<int> boneIDs;
+	std::unordered_map<int, int> boneIndex;
+	std::vector<MatTransform> skinToBone;
+	std::vector<std::unordered_map<uint16_t, float>> boneWeights;
+
+	NifSegmentationInfo segInfo;
+	NiVector<BSDismemberSkinInstance::PartitionInfo> partInfos;
+	std::vector<int> triParts;
+	bool hasSegments = false;
+	bool hasPartitions = false;
+
+	for (auto& shape : group) {
+		uint16_t offset = uint16_t(verts.size());
+
+		std::vector<Vector3> shapeVerts;
+		nif->GetVertsForShape(shape, shapeVerts);
+		size_t n = shapeVerts.size();
+
+		// Skinned shapes in a group already share their transform.
+		bool move = !skinned && shape != base;
+		MatTransform toBase = baseInverse.ComposeTransforms(shape->GetTransformToParent());
+
+		for (auto& v : shapeVerts)
+			verts.push_back(move ? toBase.ApplyTransform(v) : v);
+
+		if (hasNormals) {
+			const std::vector<Vector3>* shapeNormals = nif->GetNormalsForShape(shape);
+			for (size_t i = 0; i < n; i++) {
+				Vector3 norm = (shapeNormals && i < shapeNormals->size()) ? (*shapeNormals)[i] : Vector3(0.0f, 0.0f, 1.0f);
+				if (move) {
+					norm = toBase.ApplyTransformToDir(norm);
+					norm.Normalize();
+				}
+				normals.push_back(norm);
+			}
+		}
+		if (hasUVs) {
+			const std::vector<Vector2>* shapeUVs = nif->GetUvsForShape(shape);
+			for (size_t i = 0; i < n; i++)
+				uvs.push_back((shapeUVs && i < shapeUVs->size()) ? (*shapeUVs)[i] : Vector2());
+		}
+		if (hasColors) {
+			const std::vector<Color4>* shapeColors = nif->GetColorsForShape(shape->name.get());
+			for (size_t i = 0; i < n; i++)
+				colors.push_back((shapeColors && i < shapeColors->size()) ? (*shapeColors)[i] : Color4(1.0f, 1.0f, 1.0f, 1.0f));
+		}
+
+		std::vector<Triangle> shapeTris;
+		shape->GetTriangles(shapeTris);
+		for (auto& t : shapeTris)
+			tris.emplace_back(t.p1 + offset, t.p2 + offset, t.p3 + offset);
+
+		if (skinned) {
+			std::vector<int> shapeBoneIDs;
+			nif->GetShapeBoneIDList(shape, shapeBoneIDs);
+			for (int b = 0; b < int(shapeBoneIDs.size()); b++) {
+				auto it = boneIndex.find(shapeBoneIDs[b]);
+				int idx;
+				if (it != boneIndex.end())
+					idx = it->second;
+				else {
+					idx = int(boneIDs.size());
+					boneIndex[shapeBoneIDs[b]] = idx;
+					boneIDs.push_back(shapeBoneIDs[b]);
+					skinToBone.emplace_back();
+					nif->GetShapeTransformSkinToBone(shape, b, skinToBone.back());
+					boneWeights.emplace_back();
+				}
+				std::unordered_map<uint16_t, float> weights;
+				nif->GetShapeBoneWeights(shape, b, weights);
+				for (auto& w : weights)
+					if (w.first < n)
+						boneWeights[idx][uint16_t(w.first + offset)] = w.second;
+			}
+		}
+
+		// Segment layouts match within a group, so segment IDs carry over as they are.
+		// Partitions are matched up by body part ID.
+		NifSegmentationInfo shapeSegInfo;
+		NiVector<BSDismemberSkinInstance::PartitionInfo> shapePartInfos;
+		std::vector<int> shapeTriParts;
+		if (nif->GetShapeSegments(shape, shapeSegInfo, shapeTriParts)) {
+			if (!hasSegments)
+				segInfo = shapeSegInfo;
+			hasSegments = true;
+		}
+		else if (nif->GetShapePartitions(shape, shapePartInfos, shapeTriParts)) {
+			hasPartitions = true;
+			std::vector<int> partMap;
+			for (auto& p : shapePartInfos) {
+				int idx = 0;
+				while (idx < int(partInfos.size()) && partInfos[idx].partID != p.partID)
+					idx++;
+				if (idx == int(partInfos.size()))
+					partInfos.push_back(p);
+				partMap.push_back(idx);
+			}
+			for (auto& tp : shapeTriParts)
+				tp = (tp >= 0 && tp < int(partMap.size())) ? partMap[tp] : 0;
+		}
+		shapeTriParts.resize(shapeTris.size(), 0);
+		triParts.insert(triParts.end(), shapeTriParts.begin(), shapeTriParts.end());
+	}
+
+	NiVersion& version = nif->GetHeader().GetVersion();
+	BSTriShape* bsTriShape = dynamic_cast<BSTriShape*>(base);
+	if (bsTriShape) {
+		bsTriShape->Create(version, &verts, &tris, hasUVs ? &uvs : nullptr, hasNormals ? &normals : nullptr);
+		bsTriShape->SetSkinned(skinned);
+	}
+	else {
+		NiTriShapeData* shapeData = dynamic_cast<NiTriShapeData*>(base->GetGeomData());
+		if (!shapeData)
+			return nullptr;
+		shapeData->Create(version, &verts, &tris, hasUVs ? &uvs : nullptr, hasNormals ? &normals : nullptr);
+	}
+	if (hasColors)
+		nif->SetColorsForShape(baseName, colors);
+
+	// Bone weights, written the same way AnimInfo::WriteToNif does.
+	if (skinned) {
+		nif->SetShapeBoneIDList(base, boneIDs);
+		std::unordered_map<uint16_t, VertexBoneWeights> vertWeights;
+		for (int b = 0; b < int(boneIDs.size()); b++) {
+			nif->SetShapeTransformSkinToBone(base, b, skinToBone[b]);
+			if (!isFO)
+				nif->SetShapeBoneWeights(baseName, b, boneWeights[b]);
+			if (isBSShape)
+				for (auto& vw : boneWeights[b])
+					vertWeights[vw.first].Add(uint8_t(b), vw.second);
+
+			std::vector<Vector3> boundVerts;
+			for (auto& vw : boneWeights[b])
+				boundVerts.push_back(verts[vw.first]);
+			if (!boundVerts.empty()) {
+				BoundingSphere bounds(boundVerts);
+				bounds.center = skinToBone[b].ApplyTransform(bounds.center);
+				bounds.radius *= skinToBone[b].scale;
+				nif->SetShapeBoneBounds(baseName, b, bounds);
+			}
+		}
+		if (isBSShape) {
+			nif->ClearShapeVertWeights(baseName);
+			for (auto& vid : vertWeights)
+				nif->SetShapeVertWeights(baseName, vid.first, vid.second.boneIds, vid.second.weights);
+		}
+	}
+
+	if (hasSegments)
+		nif->SetShapeSegments(base, segInfo, triParts);
+	else if (hasPartitions) {
+		nif->SetShapePartitions(base, partInfos, triParts, true);
+		// The merged shape may need more bones than one partition can take.
+		if (skinned && DefaultBonesPerPartition(nif) > 0)
+			OptimizeSkinPartitions(nif, base, -1);
+	}
+	if (skinned)
+		nif->UpdateSkinPartitions(base);
+	nif->CalcTangentsForShape(base);
+
+	for (size_t i = 1; i < group.size(); i++) {
+		DetachSharedBlocks(nif, group[i], base);
+		niflydll::HandleRetireBlock(nif, group[i], true);
+		nif->DeleteShape(group[i]);
+	}
+
+	return base;
+}
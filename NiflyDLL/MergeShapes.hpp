@@ -0,0 +1,30 @@
+/*
+	Shape merging, to cut draw calls. Shapes that would render identically--same shader
+	block and attributes, textures, alpha property, vertex format and skinning--are
+	combined into a single shape.
+	*/
+#include <string>
+#include <vector>
+#include "BasicTypes.hpp"
+#include "NifFile.hpp"
+
+#pragma once
+
+/* Return a key that is equal for shapes that can be merged: shader block type, name and
+	attributes, texture slots, alpha property, shape block type, vertex format, parent
+	node, skinning and partition/segment layout. Returns an empty string for shapes that
+	can't be merged (head parts, strips, shapes without a shader or with extra data). */
+std::string ShapeMaterialKey(nifly::NifFile* nif, nifly::NiShape* shape);
+
+/* Group the shapes by material key. Shapes only share a group if the merged shape stays
+	within 16-bit index limits and, for skinned shapes, they share their transforms and
+	the skin-to-bone transforms of any bones they have in common. Groups keep the order
+	of the shapes list; single-shape groups are included. */
+std::vector<std::vector<nifly::NiShape*>> GroupShapesByMaterial(
+	nifly::NifFile* nif, const std::vector<nifly::NiShape*>& shapes);
+
+/* Merge the group into its first shape and delete the rest. Vertices are moved into the
+	first shape's coordinate space; triangles, UVs, colors, bone lists and weights,
+	partitions and segments are concatenated with remapped indices. Partitions with the
+	same body part ID are combined. Returns the merged shape. */
+nifly::NiShape* MergeShapes(nifly::NifFile* nif, const std::vector<nifly::NiShape*>& group);
@@ -0,0 +1,152 @@
+/*
+	Triangle adjacency.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include "MeshAdjacency.hpp"
+
+using namespace nifly;
+
+namespace {
+	struct CacheEntry {
+		NifFile* nif;
+		uint32_t vertCount;
+		uint64_t triHash;
+		std::shared_ptr<const MeshAdjacency> adjacency;
+	};
+
+	std::mutex cacheMutex;
+	std::unordered_map<NiShape*, CacheEntry> cache;
+
+	/* FNV-1a over the tri indices, to tell when a shape's tris have changed. */
+	uint64_t HashTris(const std::vector<Triangle>& tris) {
+		uint64_t h = 14695981039346656037ull;
+		for (auto& t : tris)
+			for (uint16_t i : { t.p1, t.p2, t.p3 }) {
+				h = (h ^ i) * 1099511628211ull;
+			}
+		return h ^ tris.size();
+	}
+}
+
+void MeshAdjacency::Build(uint32_t inVertCount, const std::vector<Triangle>& tris)
+{
+	vertCount = inVertCount;
+	triCount = uint32_t(tris.size());
+	auto valid = [&](const Triangle& t) {
+		return t.p1 < vertCount && t.p2 < vertCount && t.p3 < vertCount;
+	};
+
+	// Vertex -> tris
+	vertTriStart.assign(vertCount + 1, 0);
+	for (auto& t : tris)
+		if (valid(t)) {
+			vertTriStart[t.p1 + 1]++;
+			if (t.p2 != t.p1) vertTriStart[t.p2 + 1]++;
+			if (t.p3 != t.p1 && t.p3 != t.p2) vertTriStart[t.p3 + 1]++;
+		}
+	for (uint32_t v = 0; v < vertCount; v++)
+		vertTriStart[v + 1] += vertTriStart[v];
+	vertTris.resize(vertTriStart[vertCount]);
+	std::vector<uint32_t> fill(vertTriStart.begin(), vertTriStart.end() - 1);
+	for (uint32_t i = 0; i < triCount; i++) {
+		const Triangle& t = tris[i];
+		if (!valid(t)) continue;
+		vertTris[fill[t.p1]++] = i;
+		if (t.p2 != t.p1) vertTris[fill[t.p2]++] = i;
+		if (t.p3 != t.p1 && t.p3 != t.p2) vertTris[fill[t.p3]++] = i;
+	}
+
+	// Edges: sort (edge key, tri corner) pairs so each edge's tris are together.
+	std::vector<std::pair<uint64_t, uint32_t>> corners;
+	corners.reserve(size_t(triCount) * 3);
+	for (uint32_t i = 0; i < triCount; i++) {
+		const Triangle& t = tris[i];
+		if (!valid(t)) continue;
+		uint16_t p[3] = { t.p1, t.p2, t.p3 };
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t a = p[k], b = p[(k + 1) % 3];
+			if (a == b) continue;
+			if (a > b) std::swap(a, b);
+			corners.emplace_back((uint64_t(a) << 32) | b, i * 3 + k);
+		}
+	}
+	std::sort(corners.begin(), corners.end());
+
+	edges.clear();
+	edgeTriStart.clear();
+	edgeTris.resize(corners.size());
+	triEdges.assign(size_t(triCount) * 3, ADJ_NONE);
+	for (size_t c = 0; c < corners.size(); c++) {
+		if (c == 0 || corners[c].first != corners[c - 1].first) {
+			edgeTriStart.push_back(uint32_t(c));
+			edges.push_back(uint32_t(corners[c].first >> 32));
+			edges.push_back(uint32_t(corners[c].first & 0xFFFFFFFF));
+		}
+		edgeTris[c] = corners[c].second / 3;
+		triEdges[corners[c].second] = uint32_t(edgeTriStart.size() - 1);
+	}
+	edgeTriStart.push_back(uint32_t(corners.size()));
+
+	// Neighbours across manifold edges
+	triNeighbors.assign(size_t(triCount) * 3, ADJ_NONE);
+	for (uint32_t i = 0; i < triCount; i++)
+		for (uint32_t k = 0; k < 3; k++) {
+			uint32_t e = triEdges[i * 3 + k];
+			if (e == ADJ_NONE || EdgeTriCount(e) != 2)
+				continue;
+			uint32_t first = edgeTris[edgeTriStart[e]];
+			triNeighbors[i * 3 + k] = (first == i) ? edgeTris[edgeTriStart[e] + 1] : first;
+		}
+}
+
+const std::vector<uint32_t>* MeshAdjacency::Table(int table) const
+{
+	switch (table) {
+	case ADJ_VERT_TRI_START: return &vertTriStart;
+	case ADJ_VERT_TRIS: return &vertTris;
+	case ADJ_EDGES: return &edges;
+	case ADJ_EDGE_TRI_START: return &edgeTriStart;
+	case ADJ_EDGE_TRIS: return &edgeTris;
+	case ADJ_TRI_EDGES: return &triEdges;
+	case ADJ_TRI_NEIGHBORS: return &triNeighbors;
+	}
+	return nullptr;
+}
+
+std::shared_ptr<const MeshAdjacency> GetShapeAdjacency(NifFile* nif, NiShape* shape)
+{
+	std::vector<Triangle> tris;
+	shape->GetTriangles(tris);
+	uint32_t vertCount = shape->GetNumVertices();
+	uint64_t hash = HashTris(tris);
+
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		auto it = cache.find(shape);
+		if (it != cache.end() && it->second.nif == nif
+			&& it->second.vertCount == vertCount && it->second.triHash == hash)
+			return it->second.adjacency;
+	}
+
+	// Build outside the lock so shapes can be built in parallel.
+	auto adjacency = std::make_shared<MeshAdjacency>();
+	adjacency->Build(vertCount, tris);
+
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	cache[shape] = { nif, vertCount, hash, adjacency };
+	return adjacency;
+}
+
+void ForgetShapeAdjacency(NifFile* nif)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	for (auto it = cache.begin(); it != cache.end(); ) {
+		if (it->second.nif == nif)
+			it = cache.erase(it);
+		else
+			++it;
+	}
+}
@@ -0,0 +1,62 @@
+/*
+	Triangle adjacency for a shape, in compact (CSR) arrays: the tris around each vertex,
+	the unique edges with the tris on each, and each tri's edges and neighbours. Built once
+	per shape and cached until the shape's triangles change.
+	*/
+#include <memory>
+#include <vector>
+#include "BasicTypes.hpp"
+#include "NifFile.hpp"
+
+#pragma once
+
+const uint32_t ADJ_NONE = 0xFFFFFFFF;
+
+/* Tables of the adjacency, for getShapeAdjacency */
+enum AdjacencyTable {
+	ADJ_VERT_TRI_START = 0,
+	ADJ_VERT_TRIS = 1,
+	ADJ_EDGES = 2,
+	ADJ_EDGE_TRI_START = 3,
+	ADJ_EDGE_TRIS = 4,
+	ADJ_TRI_EDGES = 5,
+	ADJ_TRI_NEIGHBORS = 6
+};
+
+struct MeshAdjacency {
+	uint32_t vertCount = 0;
+	uint32_t triCount = 0;
+
+	// Tris using vertex v are vertTris[vertTriStart[v]] up to vertTris[vertTriStart[v+1]].
+	std::vector<uint32_t> vertTriStart;
+	std::vector<uint32_t> vertTris;
+
+	// Unique edges as vertex pairs, lower index first.
+	std::vector<uint32_t> edges;
+
+	// Tris on edge e are edgeTris[edgeTriStart[e]] up to edgeTris[edgeTriStart[e+1]].
+	std::vector<uint32_t> edgeTriStart;
+	std::vector<uint32_t> edgeTris;
+
+	// 3 per tri: the edges p1-p2, p2-p3, p3-p1. ADJ_NONE for degenerate edges.
+	std::vector<uint32_t> triEdges;
+
+	// 3 per tri: the tri across each of triEdges. ADJ_NONE on boundary and non-manifold edges.
+	std::vector<uint32_t> triNeighbors;
+
+	/* Build from the tris. Tris that reference verts past vertCount are left out of
+		every table except triEdges and triNeighbors, where they get ADJ_NONE. */
+	void Build(uint32_t vertCount, const std::vector<nifly::Triangle>& tris);
+
+	const std::vector<uint32_t>* Table(int table) const;
+
+	size_t EdgeCount() const { return edges.size() / 2; }
+	uint32_t EdgeTriCount(size_t e) const { return edgeTriStart[e + 1] - edgeTriStart[e]; }
+};
+
+/* Adjacency for the shape, from the cache if its tris haven't changed since it was built.
+	The result stays valid even if the cache entry is later replaced. */
+std::shared_ptr<const MeshAdjacency> GetShapeAdjacency(nifly::NifFile* nif, nifly::NiShape* shape);
+
+/* Drop the cached adjacency of every shape in the nif, e.g. when it's destroyed. */
+void ForgetShapeAdjacency(nifly::NifFile* nif);
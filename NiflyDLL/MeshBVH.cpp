@@ -0,0 +1,393 @@
+/*
+	Triangle BVH.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <cmath>
+#include "MeshBVH.hpp"
+
+using namespace nifly;
+
+namespace {
+	const uint32_t LEAF_TRIS = 4;
+	const int BIN_COUNT = 12;
+
+	struct Box {
+		Vector3 min = Vector3(FLT_MAX, FLT_MAX, FLT_MAX);
+		Vector3 max = Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+		void Add(const Vector3& p) {
+			min = Vector3(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+			max = Vector3(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+		}
+		void Add(const Box& b) {
+			Add(b.min);
+			Add(b.max);
+		}
+		bool Valid() const { return min.x <= max.x; }
+		float Area() const {
+			if (!Valid())
+				return 0.0f;
+			Vector3 d = max - min;
+			return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+		}
+	};
+
+	float BoxDistanceSquared(const MeshBVH::Node& node, const Vector3& p) {
+		float dx = std::max(std::max(node.min.x - p.x, 0.0f), p.x - node.max.x);
+		float dy = std::max(std::max(node.min.y - p.y, 0.0f), p.y - node.max.y);
+		float dz = std::max(std::max(node.min.z - p.z, 0.0f), p.z - node.max.z);
+		return dx * dx + dy * dy + dz * dz;
+	}
+
+	/* Entry distance of the ray into the node's box, or FLT_MAX if it misses within maxT. */
+	float BoxRayEntry(const MeshBVH::Node& node, const Vector3& origin, const Vector3& invDir, float maxT) {
+		float tmin = 0.0f;
+		float tmax = maxT;
+		for (int axis = 0; axis < 3; axis++) {
+			float t1 = (node.min[axis] - origin[axis]) * invDir[axis];
+			float t2 = (node.max[axis] - origin[axis]) * invDir[axis];
+			// NaN from 0 * inf (origin on the slab plane, ray parallel) leaves the range alone.
+			tmin = std::max(tmin, std::min(t1, t2));
+			tmax = std::min(tmax, std::max(t1, t2));
+		}
+		return tmin <= tmax ? tmin : FLT_MAX;
+	}
+}
+
+Vector3 ClosestPointOnTriangle(const Vector3& p, const Vector3& a, const Vector3& b, const Vector3& c, float bary[3])
+{
+	// Voronoi region tests, from Ericson, Real-Time Collision Detection 5.1.5.
+	Vector3 ab = b - a;
+	Vector3 ac = c - a;
+	Vector3 ap = p - a;
+	float d1 = ab.dot(ap);
+	float d2 = ac.dot(ap);
+	if (d1 <= 0.0f && d2 <= 0.0f) {
+		bary[0] = 1.0f; bary[1] = 0.0f; bary[2] = 0.0f;
+		return a;
+	}
+
+	Vector3 bp = p - b;
+	float d3 = ab.dot(bp);
+	float d4 = ac.dot(bp);
+	if (d3 >= 0.0f && d4 <= d3) {
+		bary[0] = 0.0f; bary[1] = 1.0f; bary[2] = 0.0f;
+		return b;
+	}
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		float v = d1 / (d1 - d3);
+		bary[0] = 1.0f - v; bary[1] = v; bary[2] = 0.0f;
+		return a + ab * v;
+	}
+
+	Vector3 cp = p - c;
+	float d5 = ab.dot(cp);
+	float d6 = ac.dot(cp);
+	if (d6 >= 0.0f && d5 <= d6) {
+		bary[0] = 0.0f; bary[1] = 0.0f; bary[2] = 1.0f;
+		return c;
+	}
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		float w = d2 / (d2 - d6);
+		bary[0] = 1.0f - w; bary[1] = 0.0f; bary[2] = w;
+		return a + ac * w;
+	}
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+		float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		bary[0] = 0.0f; bary[1] = 1.0f - w; bary[2] = w;
+		return b + (c - b) * w;
+	}
+
+	float denom = va + vb + vc;
+	if (denom == 0.0f) {
+		// Degenerate triangle; any corner will do.
+		bary[0] = 1.0f; bary[1] = 0.0f; bary[2] = 0.0f;
+		return a;
+	}
+	float v = vb / denom;
+	float w = vc / denom;
+	bary[0] = 1.0f - v - w; bary[1] = v; bary[2] = w;
+	return a + ab * v + ac * w;
+}
+
+void MeshBVH::Build(const std::vector<Vector3>& inVerts, const std::vector<Triangle>& inTris)
+{
+	verts = inVerts;
+	tris = inTris;
+	nodes.clear();
+	// Triangles are kept at their original index, so hits report it; ones with an
+	// out-of-range vertex are left out of the tree.
+	triOrder.clear();
+	for (uint32_t i = 0; i < tris.size(); i++)
+		if (ValidTri(i))
+			triOrder.push_back(i);
+	if (triOrder.empty())
+		return;
+
+	std::vector<Box> triBox(tris.size());
+	std::vector<Vector3> centers(tris.size());
+	for (uint32_t i : triOrder) {
+		triBox[i].Add(verts[tris[i].p1]);
+		triBox[i].Add(verts[tris[i].p2]);
+		triBox[i].Add(verts[tris[i].p3]);
+		centers[i] = (triBox[i].min + triBox[i].max) * 0.5f;
+	}
+
+	struct Task {
+		uint32_t begin, end;
+		int parent;
+	};
+	std::vector<Task> tasks;
+	tasks.push_back({ 0, uint32_t(triOrder.size()), -1 });
+	nodes.reserve(triOrder.size() * 2);
+
+	while (!tasks.empty()) {
+		Task task = tasks.back();
+		tasks.pop_back();
+
+		// Left children are always built right after their parent; right children
+		// are linked in when they come off the stack.
+		uint32_t nodeIndex = uint32_t(nodes.size());
+		if (task.parent >= 0 && uint32_t(task.parent) + 1 != nodeIndex)
+			nodes[task.parent].start = nodeIndex;
+		nodes.emplace_back();
+
+		Box bounds, centerBounds;
+		for (uint32_t i = task.begin; i < task.end; i++) {
+			bounds.Add(triBox[triOrder[i]]);
+			centerBounds.Add(centers[triOrder[i]]);
+		}
+		nodes[nodeIndex].min = bounds.min;
+		nodes[nodeIndex].max = bounds.max;
+
+		uint32_t count = task.end - task.begin;
+		if (count <= LEAF_TRIS) {
+			nodes[nodeIndex].start = task.begin;
+			nodes[nodeIndex].count = count;
+			continue;
+		}
+
+		// Binned SAH: try BIN_COUNT-1 planes on each axis.
+		int bestAxis = -1;
+		int bestSplit = 0;
+		float bestCost = FLT_MAX;
+		Vector3 extent = centerBounds.max - centerBounds.min;
+		for (int axis = 0; axis < 3; axis++) {
+			if (extent[axis] <= 0.0f)
+				continue;
+			Box binBox[BIN_COUNT];
+			uint32_t binCount[BIN_COUNT] = {};
+			float scale = BIN_COUNT / extent[axis];
+			for (uint32_t i = task.begin; i < task.end; i++) {
+				uint32_t t = triOrder[i];
+				int bin = std::min(BIN_COUNT - 1, int((centers[t][axis] - centerBounds.min[axis]) * scale));
+				binBox[bin].Add(triBox[t]);
+				binCount[bin]++;
+			}
+
+			float rightArea[BIN_COUNT];
+			uint32_t rightCount[BIN_COUNT];
+			Box acc;
+			uint32_t accCount = 0;
+			for (int b = BIN_COUNT - 1; b > 0; b--) {
+				acc.Add(binBox[b]);
+				accCount += binCount[b];
+				rightArea[b] = acc.Area();
+				rightCount[b] = accCount;
+			}
+			acc = Box();
+			accCount = 0;
+			for (int b = 0; b < BIN_COUNT - 1; b++) {
+				acc.Add(binBox[b]);
+				accCount += binCount[b];
+				if (accCount == 0 || rightCount[b + 1] == 0)
+					continue;
+				float cost = acc.Area() * accCount + rightArea[b + 1] * rightCount[b + 1];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+				}
+			}
+		}
+
+		uint32_t mid;
+		if (bestAxis >= 0) {
+			float scale = BIN_COUNT / extent[bestAxis];
+			float minC = centerBounds.min[bestAxis];
+			auto it = std::partition(triOrder.begin() + task.begin, triOrder.begin() + task.end,
+				[&](uint32_t t) {
+					return std::min(BIN_COUNT - 1, int((centers[t][bestAxis] - minC) * scale)) <= bestSplit;
+				});
+			mid = uint32_t(it - triOrder.begin());
+		}
+		else
+			// Every centroid in the same place; split the list in half.
+			mid = task.begin + count / 2;
+
+		nodes[nodeIndex].count = 0;
+		tasks.push_back({ mid, task.end, int(nodeIndex) });
+		tasks.push_back({ task.begin, mid, int(nodeIndex) });
+	}
+}
+
+bool MeshBVH::ClosestPoint(const Vector3& p, Hit& hit, float maxDistance) const
+{
+	if (nodes.empty())
+		return false;
+
+	float best = (maxDistance < FLT_MAX) ? maxDistance * maxDistance : FLT_MAX;
+	bool found = false;
+
+	std::vector<uint32_t> stack;
+	stack.reserve(64);
+	stack.push_back(0);
+	while (!stack.empty()) {
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+		if (BoxDistanceSquared(node, p) > best)
+			continue;
+
+		if (node.count > 0) {
+			for (uint32_t i = node.start; i < node.start + node.count; i++) {
+				const Triangle& t = tris[triOrder[i]];
+				float bary[3];
+				Vector3 q = ClosestPointOnTriangle(p, verts[t.p1], verts[t.p2], verts[t.p3], bary);
+				float d = (q - p).dot(q - p);
+				if (d <= best) {
+					best = d;
+					found = true;
+					hit.tri = triOrder[i];
+					hit.point = q;
+					std::copy(bary, bary + 3, hit.bary);
+				}
+			}
+			continue;
+		}
+
+		uint32_t left = uint32_t(&node - nodes.data()) + 1;
+		uint32_t right = node.start;
+		float dl = BoxDistanceSquared(nodes[left], p);
+		float dr = BoxDistanceSquared(nodes[right], p);
+		// Push the far child first so the near one is searched first.
+		if (dl <= dr) {
+			stack.push_back(right);
+			stack.push_back(left);
+		}
+		else {
+			stack.push_back(left);
+			stack.push_back(right);
+		}
+	}
+
+	if (found)
+		hit.distance = std::sqrt(best);
+	return found;
+}
+
+template <typename OnHit>
+void MeshBVH::Trace(const Vector3& origin, const Vector3& dir, float maxT, OnHit onHit) const
+{
+	if (nodes.empty())
+		return;
+
+	Vector3 invDir(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+	std::vector<uint32_t> stack;
+	stack.reserve(64);
+	stack.push_back(0);
+	while (!stack.empty()) {
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+		if (BoxRayEntry(node, origin, invDir, maxT) == FLT_MAX)
+			continue;
+
+		if (node.count > 0) {
+			// Moller-Trumbore over the leaf's triangles, laid out so the lane loops
+			// vectorize.
+			for (uint32_t first = node.start; first < node.start + node.count; first += LEAF_TRIS) {
+				uint32_t lanes = std::min(LEAF_TRIS, node.start + node.count - first);
+				float e1x[LEAF_TRIS], e1y[LEAF_TRIS], e1z[LEAF_TRIS];
+				float e2x[LEAF_TRIS], e2y[LEAF_TRIS], e2z[LEAF_TRIS];
+				float sx[LEAF_TRIS], sy[LEAF_TRIS], sz[LEAF_TRIS];
+				for (uint32_t l = 0; l < LEAF_TRIS; l++) {
+					const Triangle& t = tris[triOrder[first + std::min(l, lanes - 1)]];
+					const Vector3& a = verts[t.p1];
+					e1x[l] = verts[t.p2].x - a.x; e1y[l] = verts[t.p2].y - a.y; e1z[l] = verts[t.p2].z - a.z;
+					e2x[l] = verts[t.p3].x - a.x; e2y[l] = verts[t.p3].y - a.y; e2z[l] = verts[t.p3].z - a.z;
+					sx[l] = origin.x - a.x; sy[l] = origin.y - a.y; sz[l] = origin.z - a.z;
+				}
+
+				float tHit[LEAF_TRIS], uHit[LEAF_TRIS], vHit[LEAF_TRIS];
+				for (uint32_t l = 0; l < LEAF_TRIS; l++) {
+					float px = dir.y * e2z[l] - dir.z * e2y[l];
+					float py = dir.z * e2x[l] - dir.x * e2z[l];
+					float pz = dir.x * e2y[l] - dir.y * e2x[l];
+					float det = e1x[l] * px + e1y[l] * py + e1z[l] * pz;
+					float inv = det != 0.0f ? 1.0f / det : 0.0f;
+					float u = (sx[l] * px + sy[l] * py + sz[l] * pz) * inv;
+					float qx = sy[l] * e1z[l] - sz[l] * e1y[l];
+					float qy = sz[l] * e1x[l] - sx[l] * e1z[l];
+					float qz = sx[l] * e1y[l] - sy[l] * e1x[l];
+					float v = (dir.x * qx + dir.y * qy + dir.z * qz) * inv;
+					float t = (e2x[l] * qx + e2y[l] * qy + e2z[l] * qz) * inv;
+					bool hit = det != 0.0f && u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t <= maxT;
+					tHit[l] = hit ? t : -1.0f;
+					uHit[l] = u;
+					vHit[l] = v;
+				}
+
+				// Lanes were tested against maxT from before the leaf; recheck against the
+				// limit the earlier lanes' hits have set.
+				for (uint32_t l = 0; l < lanes; l++)
+					if (tHit[l] >= 0.0f && tHit[l] <= maxT)
+						maxT = onHit(triOrder[first + l], tHit[l], uHit[l], vHit[l]);
+			}
+			continue;
+		}
+
+		uint32_t left = uint32_t(&node - nodes.data()) + 1;
+		uint32_t right = node.start;
+		float tl = BoxRayEntry(nodes[left], origin, invDir, maxT);
+		float tr = BoxRayEntry(nodes[right], origin, invDir, maxT);
+		// Near child on top of the stack, so closer hits shrink maxT sooner.
+		if (tl <= tr) {
+			if (tr != FLT_MAX) stack.push_back(right);
+			if (tl != FLT_MAX) stack.push_back(left);
+		}
+		else {
+			if (tl != FLT_MAX) stack.push_back(left);
+			if (tr != FLT_MAX) stack.push_back(right);
+		}
+	}
+}
+
+bool MeshBVH::Raycast(const Vector3& origin, const Vector3& dir, Hit& hit, float maxDistance) const
+{
+	bool found = false;
+	Trace(origin, dir, maxDistance, [&](uint32_t tri, float t, float u, float v) {
+		found = true;
+		hit.tri = tri;
+		hit.distance = t;
+		hit.point = origin + dir * t;
+		hit.bary[0] = 1.0f - u - v; hit.bary[1] = u; hit.bary[2] = v;
+		return t;
+		});
+	return found;
+}
+
+uint32_t MeshBVH::CountHits(const Vector3& origin, const Vector3& dir) const
+{
+	uint32_t hits = 0;
+	Trace(origin, dir, FLT_MAX, [&](uint32_t, float, float, float) {
+		hits++;
+		return FLT_MAX;
+		});
+	return hits;
+}
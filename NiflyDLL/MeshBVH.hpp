@@ -0,0 +1,66 @@
+/*
+	Bounding volume hierarchy over a shape's triangles, for proximity queries between
+	meshes. Built top-down with the surface area heuristic over binned centroids.
+	*/
+#include <cfloat>
+#include <vector>
+#include "BasicTypes.hpp"
+
+#pragma once
+
+class MeshBVH {
+public:
+	struct Node {
+		nifly::Vector3 min;
+		nifly::Vector3 max;
+		uint32_t start = 0;		// Leaf: first entry in the triangle order. Interior: right child.
+		uint32_t count = 0;		// Leaf: number of triangles. Interior: 0; the left child follows.
+	};
+
+	struct Hit {
+		uint32_t tri = 0xFFFFFFFF;
+		nifly::Vector3 point;
+		float bary[3] = { 0.0f, 0.0f, 0.0f };	// Weights of the triangle's p1, p2, p3
+		float distance = FLT_MAX;
+	};
+
+	/* Build over the given mesh. The mesh is copied, so the BVH stands alone. */
+	void Build(const std::vector<nifly::Vector3>& verts, const std::vector<nifly::Triangle>& tris);
+
+	bool Empty() const { return nodes.empty(); }
+	const std::vector<nifly::Vector3>& Verts() const { return verts; }
+	/* The triangles as given to Build, which hits index into. Ones with a vertex out of
+		range are kept, so indices line up, but never hit; check with ValidTri. */
+	const std::vector<nifly::Triangle>& Tris() const { return tris; }
+	bool ValidTri(uint32_t i) const {
+		const nifly::Triangle& t = tris[i];
+		return t.p1 < verts.size() && t.p2 < verts.size() && t.p3 < verts.size();
+	}
+	const std::vector<Node>& Nodes() const { return nodes; }
+
+	/* Find the closest point on the mesh to p, no further than maxDistance.
+		Returns false if nothing is that close. */
+	bool ClosestPoint(const nifly::Vector3& p, Hit& hit, float maxDistance = FLT_MAX) const;
+
+	/* Find the first triangle hit by the ray from origin along dir, no further than
+		maxDistance. Triangles are hit from either side. hit.distance is measured along
+		dir, which need not be unit length. */
+	bool Raycast(const nifly::Vector3& origin, const nifly::Vector3& dir, Hit& hit,
+		float maxDistance = FLT_MAX) const;
+
+	/* Count the triangles the ray from origin along dir passes through. */
+	uint32_t CountHits(const nifly::Vector3& origin, const nifly::Vector3& dir) const;
+
+private:
+	std::vector<nifly::Vector3> verts;
+	std::vector<nifly::Triangle> tris;
+	std::vector<uint32_t> triOrder;
+	std::vector<Node> nodes;
+
+	template <typename OnHit>
+	void Trace(const nifly::Vector3& origin, const nifly::Vector3& dir, float maxT, OnHit onHit) const;
+};
+
+/* Closest point to p on the triangle a, b, c, with its barycentric coordinates. */
+nifly::Vector3 ClosestPointOnTriangle(const nifly::Vector3& p, const nifly::Vector3& a,
+	const nifly::Vector3& b, const nifly::Vector3& c, float bary[3]);
@@ -0,0 +1,110 @@
+/*
+	Morph conforming.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <atomic>
+#include "NifFile.hpp"
+#include "NiflyFunctions.hpp"
+#include "NiflyParallel.hpp"
+#include "MorphConform.hpp"
+
+using namespace nifly;
+
+namespace {
+	const size_t CONFORM_BLOCK = 256;
+}
+
+int ConformMorphDeltas(const KDTree& ref,
+	const std::vector<std::vector<Vector3>>& refDeltas,
+	const std::vector<Vector3>& targetVerts,
+	float radius, int neighbors,
+	std::vector<std::vector<Vector3>>& deltas)
+{
+	deltas.assign(refDeltas.size(), std::vector<Vector3>(targetVerts.size()));
+	if (ref.Empty())
+		return 0;
+
+	bool limited = radius > 0.0f && radius < FLT_MAX;
+	float radius2 = limited ? radius * radius : FLT_MAX;
+	// Keeps an exact match from dividing by zero while still letting it dominate.
+	float epsilon = limited ? radius2 * 1e-6f : 1e-6f;
+	std::atomic<int> found = 0;
+
+	size_t blocks = (targetVerts.size() + CONFORM_BLOCK - 1) / CONFORM_BLOCK;
+	niflydll::ParallelFor(blocks, [&](size_t b) {
+		std::vector<std::pair<uint32_t, float>> nearest;
+		std::vector<float> weights;
+		int blockFound = 0;
+		size_t end = std::min(targetVerts.size(), (b + 1) * CONFORM_BLOCK);
+		for (size_t v = b * CONFORM_BLOCK; v < end; v++) {
+			ref.Nearest(targetVerts[v], neighbors, limited ? radius : FLT_MAX, nearest);
+			if (nearest.empty())
+				continue;
+
+			weights.resize(nearest.size());
+			float total = 0.0f;
+			for (size_t i = 0; i < nearest.size(); i++) {
+				float w = 1.0f / (nearest[i].second + epsilon);
+				if (limited) {
+					float f = 1.0f - nearest[i].second / radius2;
+					w *= f * f;
+				}
+				weights[i] = w;
+				total += w;
+			}
+			if (total <= 0.0f)
+				continue;
+			blockFound++;
+
+			for (size_t m = 0; m < refDeltas.size(); m++) {
+				Vector3 d;
+				for (size_t i = 0; i < nearest.size(); i++)
+					if (nearest[i].first < refDeltas[m].size())
+						d += refDeltas[m][nearest[i].first] * (weights[i] / total);
+				deltas[m][v] = d;
+			}
+		}
+		found += blockFound;
+		});
+
+	return found;
+}
+
+int ConformShapeMorphs(NifFile* refNif, NiShape* refShape,
+	NifFile* nif, NiShape* shape,
+	const std::vector<std::vector<Vector3>>& refDeltas,
+	float radius, int neighbors,
+	std::vector<std::vector<Vector3>>& deltas)
+{
+	MatTransform refToGlobal = CalcShapeTransformToGlobal(refNif, refShape);
+	MatTransform globalToShape = CalcShapeTransformToGlobal(nif, shape).InverseTransform();
+
+	std::vector<Vector3> refVerts;
+	refNif->GetVertsForShape(refShape, refVerts);
+	for (auto& v : refVerts)
+		v = refToGlobal.ApplyTransform(v);
+	KDTree tree;
+	tree.Build(refVerts);
+
+	std::vector<std::vector<Vector3>> globalDeltas(refDeltas.size());
+	for (size_t m = 0; m < refDeltas.size(); m++) {
+		globalDeltas[m].reserve(refDeltas[m].size());
+		for (auto& d : refDeltas[m])
+			globalDeltas[m].push_back(refToGlobal.ApplyTransformToDiff(d));
+	}
+
+	std::vector<Vector3> verts;
+	nif->GetVertsForShape(shape, verts);
+	MatTransform shapeToGlobal = globalToShape.InverseTransform();
+	for (auto& v : verts)
+		v = shapeToGlobal.ApplyTransform(v);
+
+	int found = ConformMorphDeltas(tree, globalDeltas, verts, radius,
+		neighbors > 0 ? neighbors : CONFORM_DEFAULT_NEIGHBORS, deltas);
+
+	for (auto& morph : deltas)
+		for (auto& d : morph)
+			d = globalToShape.ApplyTransformToDiff(d);
+	return found;
+}
@@ -0,0 +1,33 @@
+/*
+	Morph conforming: carry a reference shape's morph deltas (e.g. body slider morphs)
+	over to a shape fitted to it, such as an outfit. Each vertex takes a distance-weighted
+	average of the deltas of its nearest reference vertices.
+	*/
+#include <vector>
+#include "BasicTypes.hpp"
+#include "NifFile.hpp"
+#include "KDTree.hpp"
+
+#pragma once
+
+const int CONFORM_DEFAULT_NEIGHBORS = 8;
+
+/* Conform each morph in refDeltas (one delta per reference vertex) to targetVerts. Every
+	target vertex blends the deltas of up to `neighbors` reference vertices within radius,
+	weighted by inverse squared distance and fading to nothing at radius. Vertices with
+	no reference vertex in range get zero deltas. The neighbour search is done once for
+	all morphs, in parallel blocks of vertices.
+	Returns the number of target vertices that found reference vertices. */
+int ConformMorphDeltas(const KDTree& ref,
+	const std::vector<std::vector<nifly::Vector3>>& refDeltas,
+	const std::vector<nifly::Vector3>& targetVerts,
+	float radius, int neighbors,
+	std::vector<std::vector<nifly::Vector3>>& deltas);
+
+/* Conform the reference shape's morphs to the shape, matching them up in global space.
+	refDeltas are in the reference shape's vertex space; deltas come back in the shape's. */
+int ConformShapeMorphs(nifly::NifFile* refNif, nifly::NiShape* refShape,
+	nifly::NifFile* nif, nifly::NiShape* shape,
+	const std::vector<std::vector<nifly::Vector3>>& refDeltas,
+	float radius, int neighbors,
+	std::vector<std::vector<nifly::Vector3>>& deltas);
@@ -7,12 +7,18 @@
 	for easier sync.
 	*/
 #include "pch.h" 
-#include "object3d.hpp"
-#include "geometry.hpp"
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+#include "Object3d.hpp"
+#include "Geometry.hpp"
 #include "NifFile.hpp"
 #include "NifUtil.hpp"
 #include "Anim.h"
 #include "NiflyFunctions.hpp"
+#include "NiflyParallel.hpp"
+#include "NiflyStats.hpp"
+#include "SkinPartitions.hpp"
 
 using namespace nifly;
 
@@ -26,11 +32,12 @@ static String curGameDataPath; // Get this from OS if it turns out we need it
 std::string curRootName;
 
 void FindProjectRoot() {
+	if (!projectRoot.empty()) return;
+
+#ifdef _WIN32
 	char path[MAX_PATH];
 	HMODULE hm = NULL;
 
-	if (!projectRoot.empty()) return;
-
 	if (GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
 			GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
 			(LPCSTR)&SkeletonFile, &hm) == 0) {
@@ -42,6 +49,15 @@ void FindProjectRoot() {
 		int ret = GetLastError();
 		niflydll::LogWrite("Failed to get the filename of the DLL");
 	}
+#else
+	// dladdr reports the shared object containing the address, like GetModuleHandleEx.
+	const char* path = "";
+	Dl_info info;
+	if (dladdr((void*)&SkeletonFile, &info) == 0 || !info.dli_fname)
+		niflydll::LogWrite("Failed to get the filename of the shared library");
+	else
+		path = info.dli_fname;
+#endif
 	
 	projectRoot = std::filesystem::path(path).parent_path();
 }
@@ -70,7 +86,7 @@ String SkeletonFile(enum TargetGame game, String& rootName) {
 	return curSkeletonPath;
 }
 
-void SetNifVersion(NifFile* nif, enum TargetGame targ) {
+NiVersion GameVersion(enum TargetGame targ) {
 	NiVersion version;
 
 	switch (targ) {
@@ -103,8 +119,11 @@ void SetNifVersion(NifFile* nif, enum TargetGame targ) {
 		version.SetStream(155);
 		break;
 	}
+	return version;
+}
 
-	nif->Create(version);
+void SetNifVersion(NifFile* nif, enum TargetGame targ) {
+	nif->Create(GameVersion(targ));
 	//NiNode* root = nif->GetRootNode();
 	//String nm = root->GetName();
 	//root->SetName("Scene Root");
@@ -122,7 +141,8 @@ void AddCustomBoneRef(
 	if (xformToParent || !skel->RefBone(boneName)) {
 		// Not in skeleton, add it
 		AnimBone& customBone = skel->AddCustomBone(boneName);
-		customBone.SetTransformBoneToParent(*xformToParent);
+		if (xformToParent)
+			customBone.SetTransformBoneToParent(*xformToParent);
 		if (parentBone)
 			customBone.SetParentBone(skel->GetBonePtr(*parentBone, true));
 	}
@@ -132,6 +152,21 @@ void GetGlobalToSkin(AnimInfo* anim, NiShape* theShape, MatTransform* outXform)
 	*outXform = anim->shapeSkinning[theShape->name.get()].xformGlobalToSkin;
 }
 
+/* Transform from a shape's vertex space to global. Skinned shapes use the inverse of 
+	their global-to-skin transform, others their node transforms. */
+MatTransform CalcShapeTransformToGlobal(NifFile* nif, NiShape* shape) {
+	MatTransform gts;
+	if (shape->IsSkinned()
+		&& (nif->CalcShapeTransformGlobalToSkin(shape, gts) || nif->GetShapeTransformGlobalToSkin(shape, gts)))
+		return gts.InverseTransform();
+
+	MatTransform parentXform;
+	NiNode* parent = nif->GetParentNode(shape);
+	if (parent)
+		nif->GetNodeTransformToGlobal(parent->name.get(), parentXform);
+	return parentXform.ComposeTransforms(shape->GetTransformToParent());
+}
+
 /* Create a skin for a nif, represented by AnimInfo */
 AnimInfo* CreateSkinForNif(NifFile* nif, enum TargetGame game) 
 /* Create an AnimInfo skin for an entire nif, based on the reference skeleton for the target game. */
@@ -140,7 +175,10 @@ AnimInfo* CreateSkinForNif(NifFile* nif, enum TargetGame game)
 	std::string rootName = "";
 	std::string fname = SkeletonFile(game, rootName);
 	AnimSkeleton* skel = AnimSkeleton::MakeInstance();
-	skel->LoadFromNif(fname, rootName); 
+	{
+		NIFLY_STAT("AnimSkeleton::LoadFromNif");
+		skel->LoadFromNif(fname, rootName);
+	}
 	anim->SetSkeleton(skel);
 	anim->SetRefNif(nif);
 	return anim;
@@ -150,6 +188,7 @@ AnimInfo* CreateSkinForNif(NifFile* nif, enum TargetGame game)
 void SetGlobalToSkinXform(AnimInfo* anim, NiShape* theShape, const MatTransform& gtsXform) {
 	String shapeName = theShape->name.get();
 	anim->shapeSkinning[shapeName].xformGlobalToSkin = gtsXform;
+	anim->MarkShapeDirty(shapeName);
 	theShape->SetTransformToParent(theShape->GetTransformToParent());
 }
 
@@ -177,13 +216,90 @@ void SetShapeWeights(AnimInfo* anim, nifly::NiShape* theShape, std::string boneN
 	anim->SetWeights(theShape->name.get(), boneName, theWeightSet.weights);
 }
 
-int SaveSkinnedNif(AnimInfo* anim, std::filesystem::path filepath)
+/* Rebuild skin partitions for the given shapes, spreading the work over threads.
+	Shapes that share a skin instance or partition block go into the same work item,
+	in their original order, so no two threads touch the same blocks. Shapes whose skin 
+	has no partition block yet are done serially first, so any blocks added to the 
+	header land in the same order as the plain serial loop would put them. */
+void UpdateShapeSkinPartitions(NifFile* nif, const std::vector<NiShape*>& shapes)
+{
+	NIFLY_STAT("UpdateSkinPartitions");
+	NiHeader& hdr = nif->GetHeader();
+	std::vector<std::vector<NiShape*>> groups;
+	std::unordered_map<uint32_t, size_t> blockGroup;
+
+	for (auto& shape : shapes) {
+		NiSkinInstance* skinInst = nullptr;
+		if (shape->HasSkinInstance() && shape->SkinInstanceRef())
+			skinInst = hdr.GetBlock<NiSkinInstance>(shape->SkinInstanceRef()->index);
+		if (!skinInst) {
+			// Nothing to partition (or FO4-style skin); cheap, do it now.
+			nif->UpdateSkinPartitions(shape);
+			continue;
+		}
+		if (!hdr.GetBlock<NiSkinPartition>(skinInst->skinPartitionRef.index)) {
+			nif->UpdateSkinPartitions(shape);
+			continue;
+		}
+
+		uint32_t instID = shape->SkinInstanceRef()->index;
+		uint32_t partID = skinInst->skinPartitionRef.index;
+		auto inst = blockGroup.find(instID);
+		auto part = blockGroup.find(partID);
+		size_t g;
+		if (inst != blockGroup.end())
+			g = inst->second;
+		else if (part != blockGroup.end())
+			g = part->second;
+		else {
+			g = groups.size();
+			groups.emplace_back();
+		}
+		blockGroup[instID] = g;
+		blockGroup[partID] = g;
+		groups[g].push_back(shape);
+	}
+
+	niflydll::ParallelFor(groups.size(), [&](size_t g) {
+		for (auto& shape : groups[g])
+			nif->UpdateSkinPartitions(shape);
+		});
+}
+
+/* Write the skin to the reference nif, touching only shapes whose skinning changed
+	since the last write. Skin partitions are rebuilt for those shapes and for any shape 
+	the skin doesn't track, since its weights may have been set on the nif directly.
+	If bonesPerPartition is non-zero, dismember partitions are first split to respect 
+	that bone limit (see OptimizeSkinPartitions).
+	Returns the number of shapes whose partitions were rebuilt. */
+int WriteSkinToNif(AnimInfo* anim, int bonesPerPartition)
 {
 	NifFile* theNif = anim->GetRefNif();
-	anim->WriteToNif(theNif, "None");
+
+	// Collect before writing; WriteToNif clears the dirty flags.
+	std::vector<NiShape*> changed;
 	for (auto& shape : theNif->GetShapes())
-		theNif->UpdateSkinPartitions(shape);
+		if (!anim->HasSkinnedShape(shape) || anim->IsShapeDirty(shape->name.get()))
+			changed.push_back(shape);
+
+	{
+		NIFLY_STAT("AnimInfo::WriteToNif");
+		anim->WriteToNif(theNif, "None", true);
+	}
+	if (bonesPerPartition)
+		for (auto& shape : changed)
+			OptimizeSkinPartitions(theNif, shape, bonesPerPartition);
+	UpdateShapeSkinPartitions(theNif, changed);
 
+	return int(changed.size());
+}
+
+int SaveSkinnedNif(AnimInfo* anim, std::filesystem::path filepath)
+{
+	NifFile* theNif = anim->GetRefNif();
+	WriteSkinToNif(anim);
+
+	NIFLY_STAT("NifFile::Save");
 	return theNif->Save(filepath);
 }
 
@@ -351,7 +467,10 @@ AnimSkeleton* MakeSkeleton(enum TargetGame theGame) {
 	AnimSkeleton* skel = AnimSkeleton::MakeInstance();
 	std::string root;
 	std::string fn = SkeletonFile(theGame, root);
-	skel->LoadFromNif(fn, root);
+	{
+		NIFLY_STAT("AnimSkeleton::LoadFromNif");
+		skel->LoadFromNif(fn, root);
+	}
 	return skel;
 };
 
@@ -7,8 +7,8 @@
 #include <map>
 //#include "object3d.hpp"
 #include "BasicTypes.hpp"
-#include "geometry.hpp"
-#include "skin.hpp"
+#include "Geometry.hpp"
+#include "Skin.hpp"
 //#include "NifFile.hpp"
 //#include "NifUtil.hpp"
 #include "Anim.h"
@@ -27,6 +27,8 @@ extern std::string curRootName;
 
 std::string SkeletonFile(enum TargetGame game, std::string& rootName);
 
+nifly::NiVersion GameVersion(enum TargetGame targ);
+
 void SetNifVersion(nifly::NifFile* nif, enum TargetGame targ);
 
 void AddCustomBoneRef(
@@ -41,6 +43,8 @@ void GetGlobalToSkin(AnimInfo* anim, nifly::NiShape* theShape, nifly::MatTransfo
 
 void SetGlobalToSkinXform(AnimInfo* anim, nifly::NiShape* theShape, const nifly::MatTransform& gtsXform);
 
+nifly::MatTransform CalcShapeTransformToGlobal(nifly::NifFile* nif, nifly::NiShape* shape);
+
 nifly::NiShape* XXXCreateShapeFromData(nifly::NifFile* nif, const char* shapeName,
 	const std::vector<nifly::Vector3>* verts, const std::vector<nifly::Triangle>* tris,
 	const std::vector<nifly::Vector2>* uv, const std::vector<nifly::Vector3>* norms);
@@ -51,6 +55,10 @@ void SetShapeGlobalToSkinXform(AnimInfo* anim, nifly::NiShape* theShape, const n
 
 void SetShapeWeights(AnimInfo* anim, nifly::NiShape* theShape, std::string boneName, AnimWeight& theWeightSet);
 
+void UpdateShapeSkinPartitions(nifly::NifFile* nif, const std::vector<nifly::NiShape*>& shapes);
+
+int WriteSkinToNif(AnimInfo* anim, int bonesPerPartition = 0);
+
 int SaveSkinnedNif(AnimInfo* anim, std::filesystem::path filepath);
 
 void GetPartitions(nifly::NifFile* workNif, nifly::NiShape* shape, 
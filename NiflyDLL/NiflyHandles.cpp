@@ -0,0 +1,202 @@
+/*
+	Handle slot tables.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "NiflyHandles.hpp"
+
+using namespace nifly;
+
+namespace niflydll {
+
+	namespace {
+		const uint32_t GENERATION_MASK = 0xFFFFFF;
+		const uint32_t NO_BLOCK = 0xFFFFFFFF;
+		const uint32_t ID_INDEX_MASK = 0xFFFFFF;		// Compact IDs: 24 bits of slot index
+		const uint32_t ID_GENERATION_MASK = 0xFF;		// and 8 of generation
+
+		struct Slot {
+			void* obj = nullptr;		// nullptr when free
+			NifFile* nif = nullptr;		// Blocks only: the nif holding the block
+			uint32_t blockId = NO_BLOCK;
+			const char* blockType = nullptr;	// Blocks only: GetBlockName when the handle was made
+			uint32_t generation = 1;
+		};
+
+		struct SlotTable {
+			std::vector<Slot> slots;
+			std::vector<uint32_t> freeSlots;
+			std::unordered_map<void*, uint32_t> slotOf;
+
+			uint32_t Add(void* obj) {
+				uint32_t index;
+				if (freeSlots.empty()) {
+					index = uint32_t(slots.size());
+					slots.emplace_back();
+				}
+				else {
+					index = freeSlots.back();
+					freeSlots.pop_back();
+				}
+				slots[index].obj = obj;
+				slotOf[obj] = index;
+				return index;
+			}
+
+			void Free(uint32_t index) {
+				Slot& s = slots[index];
+				auto it = slotOf.find(s.obj);
+				if (it != slotOf.end() && it->second == index)
+					slotOf.erase(it);
+				s = Slot{ nullptr, nullptr, NO_BLOCK, nullptr, std::max((s.generation + 1) & GENERATION_MASK, 1u) };
+				freeSlots.push_back(index);
+			}
+		};
+
+		const int TYPE_COUNT = HANDLE_SKELETON + 1;
+
+		std::mutex handleMutex;
+		SlotTable tables[TYPE_COUNT];
+		std::unordered_map<NifFile*, std::vector<uint32_t>> nifBlocks;	// Block slots per nif
+
+		uint64_t MakeHandle(HandleType type, uint32_t index, uint32_t generation) {
+			return (uint64_t(type) << 56) | (uint64_t(generation & GENERATION_MASK) << 32) | index;
+		}
+
+		/* Free a block slot and take it off its nif's list. Caller holds handleMutex. */
+		void FreeBlockSlot(uint32_t index) {
+			auto& list = nifBlocks[tables[HANDLE_BLOCK].slots[index].nif];
+			list.erase(std::remove(list.begin(), list.end(), index), list.end());
+			tables[HANDLE_BLOCK].Free(index);
+		}
+
+		/* Check the block in a block slot is still in its nif, following it if it has
+			moved; free the slot if it's gone. A block of another type at the same address
+			means the block was freed without its handle being retired, and the address
+			reused. Caller holds handleMutex. */
+		NiObject* CheckBlock(uint32_t index) {
+			Slot& s = tables[HANDLE_BLOCK].slots[index];
+			NiHeader& hdr = s.nif->GetHeader();
+			NiObject* block = static_cast<NiObject*>(s.obj);
+			if (s.blockId < hdr.GetNumBlocks() && hdr.GetBlock<NiObject>(s.blockId) == block
+				&& strcmp(block->GetBlockName(), s.blockType) == 0)
+				return block;
+
+			uint32_t id = hdr.GetBlockID(block);
+			if (id != NO_BLOCK && strcmp(block->GetBlockName(), s.blockType) == 0) {
+				s.blockId = id;
+				return block;
+			}
+
+			FreeBlockSlot(index);
+			return nullptr;
+		}
+	}
+
+	uint64_t HandleFor(HandleType type, void* obj) {
+		if (!obj || type == HANDLE_NONE || type == HANDLE_BLOCK || type >= TYPE_COUNT) return 0;
+		std::lock_guard<std::mutex> lock(handleMutex);
+		SlotTable& table = tables[type];
+		auto it = table.slotOf.find(obj);
+		uint32_t index = (it != table.slotOf.end()) ? it->second : table.Add(obj);
+		return MakeHandle(type, index, table.slots[index].generation);
+	}
+
+	uint64_t BlockHandleFor(NifFile* nif, NiObject* block) {
+		if (!nif || !block) return 0;
+		uint32_t id = nif->GetHeader().GetBlockID(block);
+		if (id == NO_BLOCK) return 0;
+
+		std::lock_guard<std::mutex> lock(handleMutex);
+		SlotTable& table = tables[HANDLE_BLOCK];
+		auto it = table.slotOf.find(block);
+		uint32_t index;
+		// A slot for the same address may be left over from a freed block, in this nif or
+		// another; checking it frees it if so.
+		if (it != table.slotOf.end() && CheckBlock(it->second) && table.slots[it->second].nif == nif)
+			index = it->second;
+		else {
+			index = table.Add(block);
+			nifBlocks[nif].push_back(index);
+		}
+		table.slots[index].nif = nif;
+		table.slots[index].blockId = id;
+		table.slots[index].blockType = block->GetBlockName();
+		return MakeHandle(HANDLE_BLOCK, index, table.slots[index].generation);
+	}
+
+	void* HandleResolve(uint64_t handle, HandleType type) {
+		if (HandleTypeOf(handle) != type || type == HANDLE_NONE || type >= TYPE_COUNT) return nullptr;
+		std::lock_guard<std::mutex> lock(handleMutex);
+		SlotTable& table = tables[type];
+		uint32_t index = HandleIndex(handle);
+		if (index >= table.slots.size()) return nullptr;
+		Slot& s = table.slots[index];
+		if (!s.obj || s.generation != uint32_t(handle >> 32 & GENERATION_MASK)) return nullptr;
+		if (type == HANDLE_BLOCK) return CheckBlock(index);
+		return s.obj;
+	}
+
+	uint32_t BlockIdOf(uint64_t blockHandle) {
+		uint32_t index = HandleIndex(blockHandle);
+		if (HandleTypeOf(blockHandle) != HANDLE_BLOCK || index > ID_INDEX_MASK) return BLOCK_ID_NONE;
+		return uint32_t(blockHandle >> 32 & ID_GENERATION_MASK) << 24 | index;
+	}
+
+	NiObject* BlockIdResolve(NifFile* nif, uint32_t id) {
+		std::lock_guard<std::mutex> lock(handleMutex);
+		SlotTable& table = tables[HANDLE_BLOCK];
+		uint32_t index = id & ID_INDEX_MASK;
+		if (id == BLOCK_ID_NONE || index >= table.slots.size()) return nullptr;
+		Slot& s = table.slots[index];
+		if (!s.obj || s.nif != nif || (s.generation & ID_GENERATION_MASK) != id >> 24) return nullptr;
+		return CheckBlock(index);
+	}
+
+	void HandleRetire(HandleType type, void* obj) {
+		if (type == HANDLE_NONE || type == HANDLE_BLOCK || type >= TYPE_COUNT) return;
+		std::lock_guard<std::mutex> lock(handleMutex);
+		SlotTable& table = tables[type];
+		auto it = table.slotOf.find(obj);
+		if (it != table.slotOf.end())
+			table.Free(it->second);
+
+		if (type == HANDLE_NIF) {
+			auto blocks = nifBlocks.find(static_cast<NifFile*>(obj));
+			if (blocks != nifBlocks.end()) {
+				for (uint32_t index : blocks->second)
+					tables[HANDLE_BLOCK].Free(index);
+				nifBlocks.erase(blocks);
+			}
+		}
+	}
+
+	void HandleRetireBlock(NifFile* nif, NiObject* block, bool withChildren) {
+		if (!nif || !block) return;
+		NiHeader& hdr = nif->GetHeader();
+		std::lock_guard<std::mutex> lock(handleMutex);
+		SlotTable& table = tables[HANDLE_BLOCK];
+		std::vector<NiObject*> pending = { block };
+		std::unordered_set<NiObject*> seen;
+		while (!pending.empty()) {
+			NiObject* b = pending.back();
+			pending.pop_back();
+			if (!seen.insert(b).second) continue;
+			auto it = table.slotOf.find(b);
+			if (it != table.slotOf.end() && table.slots[it->second].nif == nif)
+				FreeBlockSlot(it->second);
+			if (withChildren) {
+				std::vector<uint32_t> children;
+				b->GetChildIndices(children);
+				for (uint32_t id : children)
+					if (NiObject* child = hdr.GetBlock<NiObject>(id))
+						pending.push_back(child);
+			}
+		}
+	}
+}
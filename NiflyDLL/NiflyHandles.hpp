@@ -0,0 +1,64 @@
+/*
+	Generational handles for the objects the DLL hands out, checked on every lookup.
+
+	A handle is 64 bits: the slot index in the low 32, then a 24-bit generation, then
+	the type in the top byte. Each type has its own contiguous slot table. Freeing an
+	object bumps its slot's generation, so old handles to it fail to resolve instead of
+	pointing at freed memory; the slot is then reused.
+
+	Block handles (shapes, nodes, any block in a nif) also remember the block's ID and
+	type. A lookup checks the block is still at that ID in its nif, and if blocks have
+	been renumbered, finds it again. Code that deletes or replaces blocks retires their
+	handles first with HandleRetireBlock, since once a block is freed a new one can get
+	its address. As a backstop for deletions inside nifly, a block found at the address
+	with a different type is taken as stale too.
+
+	Batch calls can take compact 32-bit IDs for blocks, along with the nif they belong
+	to: the slot index in the low 24 bits and the low 8 bits of the generation above it.
+	An ID is checked to be a live block of that nif with that partial generation, so it
+	only aliases a newer block if its slot has been reused a multiple of 256 times.
+	*/
+#include <cstdint>
+#include "NifFile.hpp"
+
+#pragma once
+
+namespace niflydll {
+
+	enum HandleType : uint8_t {
+		HANDLE_NONE = 0,
+		HANDLE_NIF = 1,
+		HANDLE_BLOCK = 2,
+		HANDLE_SKIN = 3,
+		HANDLE_SKELETON = 4
+	};
+
+	inline HandleType HandleTypeOf(uint64_t handle) { return HandleType(handle >> 56); }
+	inline uint32_t HandleIndex(uint64_t handle) { return uint32_t(handle); }
+
+	/* Handle for a nif, skin or skeleton. Asking again for the same object gives the
+		same handle. */
+	uint64_t HandleFor(HandleType type, void* obj);
+
+	/* Handle for a block of a nif. 0 if the block isn't in the nif. */
+	uint64_t BlockHandleFor(nifly::NifFile* nif, nifly::NiObject* block);
+
+	/* The object, or nullptr if the handle is stale or not of that type. */
+	void* HandleResolve(uint64_t handle, HandleType type);
+
+	/* Compact ID for a block handle; BLOCK_ID_NONE if the handle's slot index doesn't
+		fit. */
+	const uint32_t BLOCK_ID_NONE = 0xFFFFFFFF;
+	uint32_t BlockIdOf(uint64_t blockHandle);
+
+	/* Block with the given compact ID, or nullptr if it isn't a live block of nif. */
+	nifly::NiObject* BlockIdResolve(nifly::NifFile* nif, uint32_t id);
+
+	/* obj is being freed: its handle, and for a nif its blocks' handles, go stale. */
+	void HandleRetire(HandleType type, void* obj);
+
+	/* block is about to be deleted from nif or replaced: its handle goes stale. With
+		children, so do the handles of the blocks it refs (a shape's data, skin and shader)
+		and theirs in turn, for deletions that take those with it. */
+	void HandleRetireBlock(nifly::NifFile* nif, nifly::NiObject* block, bool withChildren = false);
+}
@@ -0,0 +1,180 @@
+/*
+	Memory estimates.
+	*/
+#include "pch.h"
+#include <cstdio>
+#include <streambuf>
+#include <ostream>
+#include <unordered_map>
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#endif
+#include "NiflyMemory.hpp"
+
+using namespace nifly;
+
+namespace niflydll {
+
+	namespace {
+		/* Stream buffer that only counts what's written to it. */
+		class CountingBuf : public std::streambuf {
+		public:
+			uint64_t count = 0;
+		protected:
+			int_type overflow(int_type c) override {
+				if (!traits_type::eq_int_type(c, traits_type::eof())) count++;
+				return traits_type::not_eof(c);
+			}
+			std::streamsize xsputn(const char*, std::streamsize n) override {
+				count += n;
+				return n;
+			}
+		};
+
+		// Rough per-node cost of the standard containers: links plus allocator overhead.
+		const uint64_t NODE_OVERHEAD = 4 * sizeof(void*);
+
+		uint64_t StringBytes(const std::string& s) {
+			return s.capacity() >= sizeof(std::string) ? s.capacity() + 1 : 0;
+		}
+
+		template<typename K, typename V>
+		uint64_t HashMapBytes(const std::unordered_map<K, V>& m) {
+			return m.bucket_count() * sizeof(void*) + m.size() * (sizeof(std::pair<const K, V>) + NODE_OVERHEAD);
+		}
+	}
+
+	void NifUsage::Add(const NifUsage& other) {
+		header += other.header;
+		vertexData += other.vertexData;
+		skinData += other.skinData;
+		extraData += other.extraData;
+		otherBlocks += other.otherBlocks;
+		blockCount += other.blockCount;
+		for (auto& t : other.byType) {
+			byType[t.first].count += t.second.count;
+			byType[t.first].bytes += t.second.bytes;
+		}
+	}
+
+	void MeasureNif(NifFile* nif, NifUsage& usage) {
+		NiHeader& hdr = nif->GetHeader();
+		CountingBuf counter;
+		std::ostream os(&counter);
+		NiOStream stream(&os, &hdr);
+
+		hdr.Put(stream);
+		usage.header += counter.count;
+
+		for (uint32_t i = 0; i < hdr.GetNumBlocks(); i++) {
+			NiObject* block = hdr.GetBlock<NiObject>(i);
+			if (!block) continue;
+			uint64_t before = counter.count;
+			block->Put(stream);
+			uint64_t bytes = counter.count - before;
+
+			if (dynamic_cast<NiGeometryData*>(block) || dynamic_cast<BSTriShape*>(block))
+				usage.vertexData += bytes;
+			else if (dynamic_cast<NiSkinInstance*>(block) || dynamic_cast<NiSkinData*>(block)
+				|| dynamic_cast<NiSkinPartition*>(block) || dynamic_cast<BSSkin::Instance*>(block)
+				|| dynamic_cast<BSSkin::BoneData*>(block))
+				usage.skinData += bytes;
+			else if (dynamic_cast<NiExtraData*>(block))
+				usage.extraData += bytes;
+			else
+				usage.otherBlocks += bytes;
+
+			BlockTypeUsage& t = usage.byType[block->GetBlockName()];
+			t.count++;
+			t.bytes += bytes;
+			usage.blockCount++;
+		}
+	}
+
+	uint64_t MeasureSkinWeights(const AnimInfo* skin) {
+		uint64_t bytes = sizeof(AnimInfo);
+
+		for (auto& sb : skin->shapeBones) {
+			bytes += sizeof(sb) + NODE_OVERHEAD + StringBytes(sb.first);
+			bytes += sb.second.capacity() * sizeof(std::string);
+			for (auto& b : sb.second)
+				bytes += StringBytes(b);
+		}
+
+		bytes += HashMapBytes(skin->shapeSkinning);
+		for (auto& ss : skin->shapeSkinning) {
+			bytes += StringBytes(ss.first);
+			bytes += HashMapBytes(ss.second.boneWeights) + HashMapBytes(ss.second.boneNames);
+			for (auto& bw : ss.second.boneWeights)
+				bytes += HashMapBytes(bw.second.weights);
+			for (auto& bn : ss.second.boneNames)
+				bytes += StringBytes(bn.first);
+		}
+		return bytes;
+	}
+
+	uint64_t MeasureSkeleton(AnimSkeleton* skel) {
+		// Bones are map nodes with a name and a few child pointers.
+		uint64_t bytes = sizeof(AnimSkeleton);
+		bytes += skel->GetBoneCount() * (sizeof(std::string) + sizeof(AnimBone) + NODE_OVERHEAD + 4 * sizeof(void*));
+
+		NifUsage refNif;
+		MeasureNif(&skel->refSkeletonNif, refNif);
+		return bytes + refNif.Total();
+	}
+
+	ProcessUsage MeasureProcess() {
+		ProcessUsage usage;
+#ifdef _WIN32
+		// The CRT allocates from the process heap, which keeps its own totals.
+		HEAP_SUMMARY summary = {};
+		summary.cb = sizeof(summary);
+		if (HeapSummary(GetProcessHeap(), 0, &summary))
+			usage.heap = summary.cbAllocated;
+
+		PROCESS_MEMORY_COUNTERS counters = {};
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+			usage.resident = counters.WorkingSetSize;
+			usage.peakResident = counters.PeakWorkingSetSize;
+		}
+#else
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+		// malloc's own count of bytes in use, small and mmapped blocks both.
+		struct mallinfo2 mi = mallinfo2();
+		usage.heap = mi.uordblks + mi.hblkhd;
+#endif
+		long pages = 0, residentPages = 0;
+		if (FILE* f = fopen("/proc/self/statm", "r")) {
+			if (fscanf(f, "%ld %ld", &pages, &residentPages) == 2)
+				usage.resident = uint64_t(residentPages) * uint64_t(sysconf(_SC_PAGESIZE));
+			fclose(f);
+		}
+		struct rusage ru = {};
+		if (getrusage(RUSAGE_SELF, &ru) == 0)
+			usage.peakResident = uint64_t(ru.ru_maxrss) * 1024;	// Reported in KB
+#endif
+		return usage;
+	}
+
+	std::string NifUsageToJson(const NifUsage& usage) {
+		std::string out = "{";
+		bool first = true;
+		for (auto& t : usage.byType) {
+			char fields[96];
+			snprintf(fields, sizeof(fields), "\": {\"count\": %llu, \"bytes\": %llu}",
+				(unsigned long long)t.second.count, (unsigned long long)t.second.bytes);
+			if (!first)
+				out += ", ";
+			first = false;
+			out += "\"" + t.first + fields;
+		}
+		out += "}";
+		return out;
+	}
+}
@@ -0,0 +1,55 @@
+/*
+	Estimates of the memory held by nifs, skins and skeletons, and the process's totals
+	as the heap reports them.
+
+	Block sizes are what the block takes written out, measured by writing it to a
+	counting stream. In memory a block is somewhat bigger (vector slack, cached
+	decompressed vertex data) but that scales with the written size, so it's a good guide
+	to where memory is going. Skin and skeleton sizes are counted from their containers.
+	*/
+#include <cstdint>
+#include <map>
+#include <string>
+#include "Anim.h"
+
+#pragma once
+
+namespace niflydll {
+
+	struct BlockTypeUsage {
+		uint64_t count = 0;
+		uint64_t bytes = 0;
+	};
+
+	struct NifUsage {
+		uint64_t header = 0;		// Header, including the string table
+		uint64_t vertexData = 0;	// Geometry blocks
+		uint64_t skinData = 0;		// Skin instances, skin data and partitions
+		uint64_t extraData = 0;		// Extra data blocks, cloth included
+		uint64_t otherBlocks = 0;
+		uint64_t blockCount = 0;
+		std::map<std::string, BlockTypeUsage> byType;
+
+		void Add(const NifUsage& other);
+		uint64_t Total() const { return header + vertexData + skinData + extraData + otherBlocks; }
+	};
+
+	struct ProcessUsage {
+		uint64_t heap = 0;			// Bytes allocated from the heap by the whole process
+		uint64_t resident = 0;		// Working set / resident set
+		uint64_t peakResident = 0;
+	};
+
+	void MeasureNif(nifly::NifFile* nif, NifUsage& usage);
+
+	/* Bone lists, weights and transforms held by the skin. */
+	uint64_t MeasureSkinWeights(const AnimInfo* skin);
+
+	/* The skeleton's bones and the reference nif it loaded them from. */
+	uint64_t MeasureSkeleton(AnimSkeleton* skel);
+
+	/* Zero where the platform doesn't say. */
+	ProcessUsage MeasureProcess();
+
+	std::string NifUsageToJson(const NifUsage& usage);
+}
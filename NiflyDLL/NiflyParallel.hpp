@@ -0,0 +1,42 @@
+/*
+	Minimal thread fan-out for per-shape work that doesn't touch shared state.
+	*/
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#pragma once
+
+namespace niflydll {
+
+	/* Call fn(i) for every i in [0, count), spread over up to maxThreads worker
+		threads (0 = hardware concurrency). Work items are handed out in order, but
+		may finish in any order; fn must not touch state shared with other items.
+		Runs inline when there's only one item or one thread. */
+	inline void ParallelFor(size_t count, const std::function<void(size_t)>& fn, unsigned int maxThreads = 0) {
+		unsigned int threadCount = maxThreads ? maxThreads : std::thread::hardware_concurrency();
+		threadCount = unsigned(std::min<size_t>(std::max(threadCount, 1u), count));
+
+		if (threadCount <= 1) {
+			for (size_t i = 0; i < count; i++)
+				fn(i);
+			return;
+		}
+
+		std::atomic<size_t> next = 0;
+		auto worker = [&]() {
+			for (size_t i = next++; i < count; i = next++)
+				fn(i);
+		};
+
+		std::vector<std::thread> threads;
+		threads.reserve(threadCount - 1);
+		for (unsigned int t = 1; t < threadCount; t++)
+			threads.emplace_back(worker);
+		worker();
+		for (auto& t : threads)
+			t.join();
+	}
+}
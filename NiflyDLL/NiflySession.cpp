@@ -0,0 +1,205 @@
+/*
+	Object registry, sessions and the arena.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include "NiflySession.hpp"
+
+namespace niflydll {
+
+	namespace {
+		struct Entry {
+			FreeFunction freeFn;
+			Session* session;			// Only set on top-level objects
+			void* owner;
+			std::vector<void*> owned;
+		};
+
+		struct PendingFree {
+			void* obj;
+			FreeFunction freeFn;
+		};
+
+		std::mutex registryMutex;
+		std::unordered_map<void*, Entry> registry;
+		std::unordered_set<Session*> sessions;
+		thread_local Session* currentSession = nullptr;
+
+		/* Unregister obj and everything it owns, adding them to toFree owner first.
+			Caller holds registryMutex. */
+		void Collect(void* obj, std::vector<PendingFree>& toFree) {
+			auto it = registry.find(obj);
+			if (it == registry.end()) return;
+			toFree.push_back({ obj, it->second.freeFn });
+			std::vector<void*> owned = std::move(it->second.owned);
+			registry.erase(it);
+			for (void* o : owned)
+				Collect(o, toFree);
+		}
+
+		/* Free outside the lock; free functions may take other locks. */
+		void FreeAll(const std::vector<PendingFree>& toFree) {
+			for (auto& f : toFree)
+				f.freeFn(f.obj);
+		}
+
+		/* Drop freed and repeated entries from the session's object list. Caller holds
+			registryMutex. */
+		void Compact(Session* session) {
+			std::unordered_set<void*> seen;
+			std::vector<void*> kept;
+			for (auto it = session->objects.rbegin(); it != session->objects.rend(); ++it) {
+				auto e = registry.find(*it);
+				if (e != registry.end() && e->second.session == session && seen.insert(*it).second)
+					kept.push_back(*it);
+			}
+			std::reverse(kept.begin(), kept.end());
+			session->objects = std::move(kept);
+		}
+	}
+
+	void* MonotonicArena::Allocate(size_t bytes, size_t align) {
+		uintptr_t p = reinterpret_cast<uintptr_t>(next);
+		size_t pad = (align - (p & (align - 1))) & (align - 1);
+		if (!next || pad + bytes > remaining) {
+			size_t size = std::max(CHUNK_SIZE, bytes + align);
+			chunks.push_back(std::make_unique<char[]>(size));
+			next = chunks.back().get();
+			remaining = size;
+			reserved += size;
+			p = reinterpret_cast<uintptr_t>(next);
+			pad = (align - (p & (align - 1))) & (align - 1);
+		}
+		void* result = next + pad;
+		next += pad + bytes;
+		remaining -= pad + bytes;
+		return result;
+	}
+
+	void MonotonicArena::Release() {
+		chunks.clear();
+		next = nullptr;
+		remaining = 0;
+		reserved = 0;
+	}
+
+	Session* SessionCreate() {
+		Session* session = new Session();
+		std::lock_guard<std::mutex> lock(registryMutex);
+		sessions.insert(session);
+		return session;
+	}
+
+	bool SessionDestroy(Session* session) {
+		std::vector<PendingFree> toFree;
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+			if (!sessions.erase(session)) return false;
+			for (auto it = session->objects.rbegin(); it != session->objects.rend(); ++it) {
+				auto e = registry.find(*it);
+				if (e != registry.end() && e->second.session == session)
+					Collect(*it, toFree);
+			}
+		}
+		FreeAll(toFree);
+		if (currentSession == session) currentSession = nullptr;
+		delete session;
+		return true;
+	}
+
+	Session* SessionSetCurrent(Session* session) {
+		Session* prev = currentSession;
+		currentSession = session;
+		return prev;
+	}
+
+	Session* SessionCurrent() {
+		return currentSession;
+	}
+
+	void SessionAdopt(void* obj, FreeFunction freeFn, void* owner) {
+		if (!obj) return;
+		std::lock_guard<std::mutex> lock(registryMutex);
+		Entry entry{ freeFn, nullptr, nullptr, {} };
+
+		// The address was freed without going through the registry and reused.
+		auto old = registry.find(obj);
+		if (old != registry.end() && old->second.session)
+			old->second.session->liveObjects--;
+
+		auto o = owner ? registry.find(owner) : registry.end();
+		if (o != registry.end()) {
+			entry.owner = owner;
+			o->second.owned.push_back(obj);
+		}
+		else if (currentSession && sessions.count(currentSession)) {
+			Session* session = currentSession;
+			entry.session = session;
+			session->objects.push_back(obj);
+			session->liveObjects++;
+		}
+		Session* session = entry.session;
+		registry[obj] = std::move(entry);
+		if (session && session->objects.size() >= 2 * session->liveObjects + 64)
+			Compact(session);
+	}
+
+	bool SessionRelease(void* obj) {
+		std::vector<PendingFree> toFree;
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+			auto it = registry.find(obj);
+			if (it == registry.end()) return false;
+			auto o = it->second.owner ? registry.find(it->second.owner) : registry.end();
+			if (o != registry.end()) {
+				auto& siblings = o->second.owned;
+				siblings.erase(std::remove(siblings.begin(), siblings.end(), obj), siblings.end());
+			}
+			if (it->second.session)
+				it->second.session->liveObjects--;
+			Collect(obj, toFree);
+		}
+		FreeAll(toFree);
+		return true;
+	}
+
+	void* SessionAlloc(Session* session, size_t bytes) {
+		std::lock_guard<std::mutex> lock(registryMutex);
+		if (!sessions.count(session)) return nullptr;
+		return session->arena.Allocate(std::max(bytes, size_t(1)));
+	}
+
+	FreeFunction SessionFreeFunction(void* obj) {
+		std::lock_guard<std::mutex> lock(registryMutex);
+		auto it = registry.find(obj);
+		return it == registry.end() ? nullptr : it->second.freeFn;
+	}
+
+	bool SessionContents(Session* session, std::vector<std::pair<void*, FreeFunction>>& objects,
+		size_t& arenaBytes)
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+		if (!sessions.count(session)) return false;
+		std::vector<void*> pending;
+		for (void* obj : session->objects) {
+			auto e = registry.find(obj);
+			if (e != registry.end() && e->second.session == session)
+				pending.push_back(obj);
+		}
+		std::unordered_set<void*> seen;
+		while (!pending.empty()) {
+			void* obj = pending.back();
+			pending.pop_back();
+			auto e = registry.find(obj);
+			if (e == registry.end() || !seen.insert(obj).second) continue;
+			objects.push_back({ obj, e->second.freeFn });
+			pending.insert(pending.end(), e->second.owned.begin(), e->second.owned.end());
+		}
+		arenaBytes = session->arena.BytesReserved();
+		return true;
+	}
+}
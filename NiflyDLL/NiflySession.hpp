@@ -0,0 +1,83 @@
+/*
+	Ownership of the objects the DLL hands out.
+
+	Every NifFile, skin, skeleton and BVH the wrapper creates is registered here with the
+	function that frees it. An object may be owned by another, as a skin owns the skeleton
+	it loaded for itself, and is freed along with its owner.
+
+	Objects created while a session is current on the calling thread belong to that
+	session, and destroying the session frees all of them, newest first, along with the
+	scratch memory allocated from its arena. A batch job can open a session per file and
+	not have to track what it created.
+	*/
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#pragma once
+
+namespace niflydll {
+
+	/* Bump allocator for short-lived buffers. Memory comes from large chunks and is only
+		given back all at once, when the arena is released. */
+	class MonotonicArena {
+	public:
+		static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+		/* Return bytes of zeroed memory aligned to align (a power of 2). */
+		void* Allocate(size_t bytes, size_t align = alignof(std::max_align_t));
+
+		/* Free every chunk. */
+		void Release();
+
+		size_t BytesReserved() const { return reserved; }
+
+	private:
+		std::vector<std::unique_ptr<char[]>> chunks;
+		char* next = nullptr;
+		size_t remaining = 0;
+		size_t reserved = 0;
+	};
+
+	struct Session {
+		MonotonicArena arena;
+		std::vector<void*> objects;		// Top-level objects in creation order; may hold freed ones
+		size_t liveObjects = 0;
+	};
+
+	typedef void (*FreeFunction)(void* obj);
+
+	/* Start a session. */
+	Session* SessionCreate();
+
+	/* Free everything the session owns, then the session. Returns false if it isn't a
+		live session. */
+	bool SessionDestroy(Session* session);
+
+	/* Make session current on the calling thread; nullptr for none. Returns the session
+		that was current. */
+	Session* SessionSetCurrent(Session* session);
+
+	/* Session current on the calling thread, or nullptr. */
+	Session* SessionCurrent();
+
+	/* Register a new object and how to free it. With an owner, the object is freed along
+		with the owner; otherwise it belongs to the current session, if any. */
+	void SessionAdopt(void* obj, FreeFunction freeFn, void* owner = nullptr);
+
+	/* Free a registered object and everything it owns. Returns false if obj isn't
+		registered, and then does nothing. */
+	bool SessionRelease(void* obj);
+
+	/* Scratch memory from the session's arena, freed with the session. */
+	void* SessionAlloc(Session* session, size_t bytes);
+
+	/* How obj will be freed, which tells what it is. nullptr if it isn't registered. */
+	FreeFunction SessionFreeFunction(void* obj);
+
+	/* The session's live objects, including the ones they own, and the size of its 
+		arena. Returns false if it isn't a live session. */
+	bool SessionContents(Session* session, std::vector<std::pair<void*, FreeFunction>>& objects,
+		size_t& arenaBytes);
+}
@@ -0,0 +1,151 @@
+/*
+	Per-thread stat counters, merged on read.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+#include "NiflyStats.hpp"
+
+namespace niflydll {
+
+	std::atomic<bool> statsEnabled = false;
+
+	namespace {
+		struct Counter {
+			std::atomic<uint64_t> count = 0;
+			std::atomic<uint64_t> nanos = 0;
+			std::atomic<uint64_t> maxNanos = 0;
+			std::atomic<uint64_t> bytes = 0;
+		};
+
+		/* One thread's counters. A block is only written by the thread holding it; 
+			when that thread exits the block goes back in the pool, counts intact, for
+			the next new thread to pick up. */
+		struct StatBlock {
+			std::atomic<bool> inUse = false;
+			Counter counters[STATS_CAPACITY];
+		};
+
+		std::mutex statsMutex;		// Guards names and the block list, not the counters
+		std::vector<std::string> statNames;
+		// Never freed: threads may still be handing blocks back during shutdown.
+		std::vector<StatBlock*>* statBlocks = new std::vector<StatBlock*>;
+
+		StatBlock* AcquireBlock() {
+			std::lock_guard<std::mutex> lock(statsMutex);
+			for (auto& b : *statBlocks) {
+				bool free = false;
+				if (b->inUse.compare_exchange_strong(free, true, std::memory_order_acquire))
+					return b;
+			}
+			StatBlock* b = new StatBlock();
+			b->inUse = true;
+			statBlocks->push_back(b);
+			return b;
+		}
+
+		struct BlockLease {
+			StatBlock* block = nullptr;
+			~BlockLease() {
+				if (block)
+					block->inUse.store(false, std::memory_order_release);
+			}
+		};
+
+		thread_local BlockLease threadBlock;
+
+		void AppendJsonString(std::string& out, const std::string& s) {
+			out += '"';
+			for (char c : s) {
+				if (c == '"' || c == '\\')
+					out += '\\';
+				if (static_cast<unsigned char>(c) >= 0x20)
+					out += c;
+			}
+			out += '"';
+		}
+	}
+
+	int StatRegister(const char* name) {
+		std::lock_guard<std::mutex> lock(statsMutex);
+		for (size_t i = 0; i < statNames.size(); i++)
+			if (statNames[i] == name)
+				return int(i);
+		if (statNames.size() >= STATS_CAPACITY)
+			return -1;
+		statNames.push_back(name);
+		return int(statNames.size() - 1);
+	}
+
+	std::string StatName(int id) {
+		std::lock_guard<std::mutex> lock(statsMutex);
+		return id >= 0 && id < int(statNames.size()) ? statNames[id] : std::string();
+	}
+
+	void StatRecord(int id, uint64_t nanos, uint64_t bytes) {
+		if (!threadBlock.block)
+			threadBlock.block = AcquireBlock();
+
+		Counter& c = threadBlock.block->counters[id];
+		c.count.fetch_add(1, std::memory_order_relaxed);
+		c.nanos.fetch_add(nanos, std::memory_order_relaxed);
+		if (bytes)
+			c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+		// Only this thread raises the max, so no compare-exchange loop is needed.
+		if (nanos > c.maxNanos.load(std::memory_order_relaxed))
+			c.maxNanos.store(nanos, std::memory_order_relaxed);
+	}
+
+	void StatsEnable(bool on) {
+		statsEnabled.store(on, std::memory_order_relaxed);
+	}
+
+	void StatsReset() {
+		std::lock_guard<std::mutex> lock(statsMutex);
+		for (auto& b : *statBlocks)
+			for (auto& c : b->counters) {
+				c.count.store(0, std::memory_order_relaxed);
+				c.nanos.store(0, std::memory_order_relaxed);
+				c.maxNanos.store(0, std::memory_order_relaxed);
+				c.bytes.store(0, std::memory_order_relaxed);
+			}
+	}
+
+	std::string StatsToJson() {
+		std::lock_guard<std::mutex> lock(statsMutex);
+
+		std::string out = "{\"enabled\": ";
+		out += statsEnabled.load(std::memory_order_relaxed) ? "true" : "false";
+		out += ", \"stats\": {";
+
+		bool first = true;
+		for (size_t i = 0; i < statNames.size(); i++) {
+			uint64_t count = 0, nanos = 0, maxNanos = 0, bytes = 0;
+			for (auto& b : *statBlocks) {
+				const Counter& c = b->counters[i];
+				count += c.count.load(std::memory_order_relaxed);
+				nanos += c.nanos.load(std::memory_order_relaxed);
+				maxNanos = std::max(maxNanos, c.maxNanos.load(std::memory_order_relaxed));
+				bytes += c.bytes.load(std::memory_order_relaxed);
+			}
+			if (count == 0)
+				continue;
+
+			char fields[160];
+			snprintf(fields, sizeof(fields),
+				": {\"count\": %llu, \"total_ms\": %.3f, \"max_ms\": %.3f, \"bytes\": %llu}",
+				(unsigned long long)count, nanos / 1.0e6, maxNanos / 1.0e6,
+				(unsigned long long)bytes);
+
+			if (!first)
+				out += ", ";
+			first = false;
+			AppendJsonString(out, statNames[i]);
+			out += fields;
+		}
+		out += "}}";
+		return out;
+	}
+}
@@ -0,0 +1,90 @@
+/*
+	Opt-in timing and counters for the DLL's entry points and its expensive internal
+	phases.
+
+	Each instrumented scope is a NIFLY_STAT line at the top of the block. When stats and
+	tracing are off, that costs two relaxed atomic loads. When stats are on, the scope's call count, total and
+	max time and any bytes it reports are added to counters owned by the calling thread,
+	so writers never contend. GetStats sums the per-thread counters when asked.
+	*/
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include "NiflyTrace.hpp"
+
+#pragma once
+
+namespace niflydll {
+
+	const int STATS_CAPACITY = 512;		// Distinct stat names
+
+	extern std::atomic<bool> statsEnabled;
+
+	/* Return the id for a stat name, adding it if it's new. Call once per scope and
+		keep the id; NIFLY_STAT does this with a function-local static. Returns -1 if 
+		the table is full. */
+	int StatRegister(const char* name);
+
+	/* Name the stat was registered with. */
+	std::string StatName(int id);
+
+	/* Add one timed call to the stat's counters for this thread. */
+	void StatRecord(int id, uint64_t nanos, uint64_t bytes);
+
+	/* Turn stats collection on or off. Counts gathered so far are kept. */
+	void StatsEnable(bool on);
+
+	/* Zero all counters. Calls in flight on other threads may land either side of the
+		reset. */
+	void StatsReset();
+
+	/* All stats with at least one call, as JSON:
+		{"enabled": true, "stats": {"load": {"count": 2, "total_ms": 1.5, "max_ms": 1.0, 
+		"bytes": 4096}, ...}} */
+	std::string StatsToJson();
+
+	/* Times the enclosing scope, for stats and for the trace. Does nothing if both were
+		off when it was created. */
+	class StatTimer {
+	public:
+		explicit StatTimer(int statId) {
+			if (statId < 0)
+				return;
+			counted = statsEnabled.load(std::memory_order_relaxed);
+			if (counted || traceEnabled.load(std::memory_order_relaxed)) {
+				id = statId;
+				start = std::chrono::steady_clock::now();
+			}
+		}
+		~StatTimer() {
+			if (id < 0)
+				return;
+			auto end = std::chrono::steady_clock::now();
+			if (counted)
+				StatRecord(id, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+					end - start).count()), bytes);
+			if (traceEnabled.load(std::memory_order_relaxed))
+				TraceRecord(id, start, end);
+		}
+		StatTimer(const StatTimer&) = delete;
+		StatTimer& operator=(const StatTimer&) = delete;
+
+		/* Count data read, written or copied by this call. */
+		void AddBytes(uint64_t n) { bytes += n; }
+
+	private:
+		int id = -1;
+		bool counted = false;
+		uint64_t bytes = 0;
+		std::chrono::steady_clock::time_point start;
+	};
+}
+
+/* Time the rest of the enclosing block under the given name. At most one per block. */
+#define NIFLY_STAT(name) \
+	static const int niflyStatId_ = niflydll::StatRegister(name); \
+	niflydll::StatTimer niflyStatTimer_(niflyStatId_)
+
+/* Add to the bytes moved by the NIFLY_STAT scope in this block. */
+#define NIFLY_STAT_BYTES(n) niflyStatTimer_.AddBytes(uint64_t(n))
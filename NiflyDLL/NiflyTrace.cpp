@@ -0,0 +1,237 @@
+/*
+	Trace event buffering and the background writer.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "NiflyStats.hpp"
+#include "NiflyTrace.hpp"
+
+namespace niflydll {
+
+	std::atomic<bool> traceEnabled = false;
+
+	namespace {
+		struct TraceEvent {
+			int32_t id;
+			int64_t start;		// steady_clock ns
+			int64_t duration;	// ns
+		};
+
+		struct TraceChunk {
+			uint32_t tid;
+			std::vector<TraceEvent> events;
+		};
+
+		/* A thread's trace state. chunk is only touched by the owning thread while busy
+			is set and a trace is running; TraceStop waits for busy to clear before it
+			takes the chunk. Released for reuse by another thread when the owner exits. */
+		struct ThreadTrace {
+			std::atomic<bool> inUse = false;
+			std::atomic<bool> busy = false;
+			uint32_t tid = 0;
+			TraceChunk* chunk = nullptr;
+		};
+
+		std::mutex controlMutex;			// Serializes start and stop
+		std::mutex threadsMutex;
+		// Never freed: threads may still be exiting during shutdown.
+		std::vector<ThreadTrace*>* traceThreads = new std::vector<ThreadTrace*>;
+		uint32_t nextTid = 1;
+
+		// Never freed: a writer still running at shutdown is detached, and may use them
+		// after static destructors have run.
+		std::mutex& queueMutex = *new std::mutex;
+		std::condition_variable& queueReady = *new std::condition_variable;
+		std::deque<TraceChunk*>& queue = *new std::deque<TraceChunk*>;
+		std::ofstream& traceFile = *new std::ofstream;
+		bool writerStopping = false;
+		std::thread writer;
+		int64_t traceStart = 0;
+		int eventsWritten = 0;
+
+		int64_t Nanos(std::chrono::steady_clock::time_point t) {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+		}
+
+		void Submit(TraceChunk* chunk) {
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				queue.push_back(chunk);
+			}
+			queueReady.notify_one();
+		}
+
+		void WriteChunk(TraceChunk* chunk, std::vector<std::string>& names) {
+			std::string out;
+			char line[256];
+			for (auto& e : chunk->events) {
+				if (e.id >= int(names.size()))
+					for (int i = int(names.size()); i <= e.id; i++)
+						names.push_back(StatName(i));
+				// A scope already running when the trace started is cut to the part after.
+				int64_t start = std::max(e.start, traceStart);
+				int64_t duration = std::max(e.start + e.duration - start, int64_t(0));
+				snprintf(line, sizeof(line),
+					",\n{\"name\": \"%s\", \"cat\": \"nifly\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u}",
+					names[e.id].c_str(), (start - traceStart) / 1000.0, duration / 1000.0, chunk->tid);
+				out += line;
+			}
+			traceFile.write(out.data(), out.size());
+			eventsWritten += int(chunk->events.size());
+		}
+
+		void WriterLoop() {
+			std::vector<std::string> names;
+			std::unique_lock<std::mutex> lock(queueMutex);
+			while (true) {
+				queueReady.wait(lock, [] { return !queue.empty() || writerStopping; });
+				if (queue.empty())
+					break;
+				TraceChunk* chunk = queue.front();
+				queue.pop_front();
+				lock.unlock();
+				WriteChunk(chunk, names);
+				delete chunk;
+				lock.lock();
+			}
+			lock.unlock();
+			traceFile << "\n]}\n";
+			traceFile.close();
+		}
+
+		/* A trace still running when the process exits or the DLL is unloaded. The writer
+			can't be joined here: at process exit on Windows it has already been killed,
+			and on unload it can't exit while the loader lock is held. So it's told to
+			finish the file and detached. */
+		struct WriterShutdown {
+			~WriterShutdown() {
+				if (!writer.joinable())
+					return;
+				traceEnabled.store(false);
+				{
+					std::lock_guard<std::mutex> lock(queueMutex);
+					writerStopping = true;
+				}
+				queueReady.notify_one();
+				writer.detach();
+			}
+		} writerShutdown;			// After writer, so it's destroyed first
+
+		ThreadTrace* AcquireThreadTrace() {
+			std::lock_guard<std::mutex> lock(threadsMutex);
+			ThreadTrace* t = nullptr;
+			for (auto& b : *traceThreads) {
+				bool free = false;
+				if (b->inUse.compare_exchange_strong(free, true, std::memory_order_acquire)) {
+					t = b;
+					break;
+				}
+			}
+			if (!t) {
+				t = new ThreadTrace();
+				t->inUse = true;
+				traceThreads->push_back(t);
+			}
+			t->tid = nextTid++;
+			return t;
+		}
+
+		struct TraceLease {
+			ThreadTrace* trace = nullptr;
+			~TraceLease() {
+				if (!trace)
+					return;
+				// Hand off whatever this thread buffered, so it isn't mixed with the
+				// events of the next thread to get this state.
+				trace->busy.store(true);
+				if (traceEnabled.load() && trace->chunk) {
+					Submit(trace->chunk);
+					trace->chunk = nullptr;
+				}
+				trace->busy.store(false, std::memory_order_release);
+				trace->inUse.store(false, std::memory_order_release);
+			}
+		};
+
+		thread_local TraceLease threadTrace;
+	}
+
+	void TraceRecord(int id, std::chrono::steady_clock::time_point start,
+		std::chrono::steady_clock::time_point end)
+	{
+		if (!threadTrace.trace)
+			threadTrace.trace = AcquireThreadTrace();
+		ThreadTrace* t = threadTrace.trace;
+
+		// Both seq_cst: either TraceStop sees busy set and waits, or we see the trace
+		// has stopped and leave the chunk alone.
+		t->busy.store(true);
+		if (traceEnabled.load()) {
+			if (!t->chunk) {
+				t->chunk = new TraceChunk{ t->tid, {} };
+				t->chunk->events.reserve(TRACE_CHUNK_EVENTS);
+			}
+			t->chunk->events.push_back({ id, Nanos(start), Nanos(end) - Nanos(start) });
+			if (t->chunk->events.size() >= TRACE_CHUNK_EVENTS) {
+				Submit(t->chunk);
+				t->chunk = nullptr;
+			}
+		}
+		t->busy.store(false, std::memory_order_release);
+	}
+
+	int TraceStart(const std::filesystem::path& path) {
+		std::lock_guard<std::mutex> lock(controlMutex);
+		if (traceEnabled.load())
+			return 1;
+
+		traceFile.open(path, std::ios::out | std::ios::trunc | std::ios::binary);
+		if (!traceFile.is_open())
+			return 2;
+		// Opens with a metadata event, so every event after it can start with a comma.
+		traceFile << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+			<< "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"nifly\"}}";
+
+		traceStart = Nanos(std::chrono::steady_clock::now());
+		eventsWritten = 0;
+		writerStopping = false;
+		writer = std::thread(WriterLoop);
+		traceEnabled.store(true);
+		return 0;
+	}
+
+	int TraceStop() {
+		std::lock_guard<std::mutex> lock(controlMutex);
+		if (!traceEnabled.load())
+			return -1;
+		traceEnabled.store(false);
+
+		{
+			std::lock_guard<std::mutex> threadsLock(threadsMutex);
+			for (auto& t : *traceThreads) {
+				while (t->busy.load(std::memory_order_acquire))
+					std::this_thread::yield();
+				if (t->chunk) {
+					Submit(t->chunk);
+					t->chunk = nullptr;
+				}
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> queueLock(queueMutex);
+			writerStopping = true;
+		}
+		queueReady.notify_one();
+		writer.join();
+		return eventsWritten;
+	}
+}
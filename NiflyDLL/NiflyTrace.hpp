@@ -0,0 +1,37 @@
+/*
+	Chrome trace export of DLL activity, for chrome://tracing or Perfetto.
+
+	While a trace is running every NIFLY_STAT scope also becomes a trace event with 
+	its thread, start and duration. Events go into a buffer owned by the calling thread;
+	full buffers are handed to a writer thread, which formats them and appends them to
+	the file, so tracing doesn't stall the threads being traced on I/O.
+
+	Stop a trace before unloading the DLL. One left running is abandoned at unload or
+	exit, and the file is only finished if the writer gets the time.
+	*/
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+
+#pragma once
+
+namespace niflydll {
+
+	const int TRACE_CHUNK_EVENTS = 4096;	// Events a thread buffers before handing them off
+
+	extern std::atomic<bool> traceEnabled;
+
+	/* Start writing a trace to the given file. Returns 0 on success, 1 if a trace is 
+		already running, 2 if the file can't be written. */
+	int TraceStart(const std::filesystem::path& path);
+
+	/* Stop tracing, write out everything still buffered and close the file. 
+		Returns the number of events written, or -1 if no trace was running. */
+	int TraceStop();
+
+	/* Record one event for the stat with this id, on the calling thread. Dropped if no
+		trace is running. */
+	void TraceRecord(int id, std::chrono::steady_clock::time_point start, 
+		std::chrono::steady_clock::time_point end);
+}
@@ -9,19 +9,38 @@
 /*
     TODO: Refactor so this whole interface is not dependent on a single reference skeleton.
 
-    TODO: Walk through and make sure all the memory allocated here gets released
+    Everything handed out here that needs freeing is registered in NiflySession, so it
+    is released by its destroy call or with the session it was created in.
     */
 #include "pch.h" // use stdafx.h in Visual Studio 2017 and earlier
 #include <iostream>
 #include <filesystem>
 #include <string>
 #include <algorithm>
-#include "niffile.hpp"
+#include <cstring>
+#include "NifFile.hpp"
 #include "bhk.hpp"
 #include "NiflyFunctions.hpp"
+#include "NiflyHandles.hpp"
+#include "NiflyMemory.hpp"
+#include "NiflySession.hpp"
 #include "NiflyWrapper.hpp"
-
-const int NiflyDDLVersion[3] = { 5, 10, 0 };
+#include "SkinPartitions.hpp"
+#include "VertexCache.hpp"
+#include "Decimate.hpp"
+#include "MergeShapes.hpp"
+#include "SplitMesh.hpp"
+#include "WeightTransfer.hpp"
+#include "MorphConform.hpp"
+#include "Clipping.hpp"
+#include "SpatialQuery.hpp"
+#include "MeshAdjacency.hpp"
+#include "LooseParts.hpp"
+#include "VertexWeld.hpp"
+#include "SeamNormals.hpp"
+#include "NiflyStats.hpp"
+
+const int NiflyDDLVersion[3] = { 6, 0, 0 };
  
 using namespace nifly;
 
@@ -44,6 +63,39 @@ void XformToBuffer(float* xform, MatTransform& tmp) {
     xform[i++] = tmp.scale;
 }
 
+void CopyToBuffer(char* buf, int buflen, const char* str)
+/* Copy str into buf, truncated to fit and always null-terminated. */
+{
+    if (buflen <= 0) return;
+    size_t n = std::min(strlen(str), size_t(buflen - 1));
+    memcpy(buf, str, n);
+    buf[n] = '\0';
+}
+
+/* Free functions for the objects registered with NiflySession. */
+
+void FreeNif(void* f) {
+    NifFile* theNif = static_cast<NifFile*>(f);
+    niflydll::HandleRetire(niflydll::HANDLE_NIF, f);
+    ForgetShapeAdjacency(theNif);
+    theNif->Clear();
+    delete theNif;
+}
+
+void FreeSkin(void* anim) {
+    niflydll::HandleRetire(niflydll::HANDLE_SKIN, anim);
+    delete static_cast<AnimInfo*>(anim);
+}
+
+void FreeSkeleton(void* skel) {
+    niflydll::HandleRetire(niflydll::HANDLE_SKELETON, skel);
+    delete static_cast<AnimSkeleton*>(skel);
+}
+
+void FreeShapeBVH(void* bvh) {
+    delete static_cast<ShapeBVH*>(bvh);
+}
+
 
 /* ******************* NIF FILE MANAGEMENT ********************* */
 
@@ -60,23 +112,39 @@ enum TargetGame StrToTargetGame(const char* gameName) {
 }
 
 NIFLY_API void* load(const char8_t* filename) {
+    NIFLY_STAT(__func__);
     NifFile* nif = new NifFile();
-    int errval = nif->Load(std::filesystem::path(filename));
+    int errval;
+    {
+        NIFLY_STAT("NifFile::Load");
+        std::error_code ec;
+        auto size = std::filesystem::file_size(std::filesystem::path(filename), ec);
+        if (!ec) NIFLY_STAT_BYTES(size);
+        errval = nif->Load(std::filesystem::path(filename));
+    }
 
-    if (errval == 0) return nif;
+    if (errval == 0) {
+        niflydll::SessionAdopt(nif, FreeNif);
+        return nif;
+    }
+    FreeNif(nif);
 
-    if (errval == 1) niflydll::LogWrite("File does not exist or is not a nif");
-    if (errval == 2) niflydll::LogWrite("File is not a nif format we can read");
+    if (errval == 1) niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_FILE, nullptr, 
+        "File does not exist or is not a nif");
+    if (errval == 2) niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_FILE, nullptr, 
+        "File is not a nif format we can read");
 
     return nullptr;
 }
 
 NIFLY_API void* getRoot(void* f) {
+    NIFLY_STAT(__func__);
     NifFile* theNif = static_cast<NifFile*>(f);
     return theNif->GetRootNode();
 }
 
 NIFLY_API int getRootName(void* f, char* buf, int len) {
+    NIFLY_STAT(__func__);
     NifFile* theNif = static_cast<NifFile*>(f);
     nifly::NiNode* root = theNif->GetRootNode();
     std::string name = root->name.get();
@@ -87,6 +155,7 @@ NIFLY_API int getRootName(void* f, char* buf, int len) {
 }
 
 NIFLY_API int getGameName(void* f, char* buf, int len) {
+    NIFLY_STAT(__func__);
     NifFile* theNif = static_cast<NifFile*>(f);
     NiHeader hdr = theNif->GetHeader();
     NiVersion vers = hdr.GetVersion();
@@ -104,52 +173,24 @@ NIFLY_API int getGameName(void* f, char* buf, int len) {
 }
 
 NIFLY_API const int* getVersion() {
+    NIFLY_STAT(__func__);
     return NiflyDDLVersion;
 };
 
 NIFLY_API void* nifCreate() {
-    return new NifFile;
+    NIFLY_STAT(__func__);
+    NifFile* nif = new NifFile;
+    niflydll::SessionAdopt(nif, FreeNif);
+    return nif;
 }
 
 NIFLY_API void destroy(void* f) {
-    NifFile* theNif = static_cast<NifFile*>(f);
-    theNif->Clear();
-    delete theNif;
+    NIFLY_STAT(__func__);
+    if (!niflydll::SessionRelease(f)) FreeNif(f);
 }
 
 void SetNifVersionWrap(NifFile* nif, enum TargetGame targ, int rootType, std::string name) {
-    NiVersion version;
-
-    switch (targ) {
-    case FO3:
-    case FONV:
-        version.SetFile(V20_2_0_7);
-        version.SetUser(11);
-        version.SetStream(34);
-        break;
-    case SKYRIM:
-        version.SetFile(V20_2_0_7);
-        version.SetUser(12);
-        version.SetStream(83);
-        break;
-    case FO4:
-    case FO4VR:
-        version.SetFile(V20_2_0_7);
-        version.SetUser(12);
-        version.SetStream(130);
-        break;
-    case SKYRIMSE:
-    case SKYRIMVR:
-        version.SetFile(V20_2_0_7);
-        version.SetUser(12);
-        version.SetStream(100);
-        break;
-    case FO76:
-        version.SetFile(V20_2_0_7);
-        version.SetUser(12);
-        version.SetStream(155);
-        break;
-    }
+    NiVersion version = GameVersion(targ);
 
     if (rootType == RT_BSFADENODE)
         nif->CreateAsFade(version, name);
@@ -161,16 +202,60 @@ void SetNifVersionWrap(NifFile* nif, enum TargetGame targ, int rootType, std::st
 }
 
 NIFLY_API void* createNif(const char* targetGameName, int rootType, const char* rootName) {
+    NIFLY_STAT(__func__);
     TargetGame targetGame = StrToTargetGame(targetGameName);
     NifFile* workNif = new NifFile();
     std::string rootNameStr = rootName;
     SetNifVersionWrap(workNif, targetGame, rootType, rootNameStr);
+    niflydll::SessionAdopt(workNif, FreeNif);
     return workNif;
 }
 
 NIFLY_API int saveNif(void* the_nif, const char8_t* filename) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(the_nif);
-    return nif->Save(std::filesystem::path(filename));
+    int errval;
+    {
+        NIFLY_STAT("NifFile::Save");
+        errval = nif->Save(std::filesystem::path(filename));
+        std::error_code ec;
+        auto size = std::filesystem::file_size(std::filesystem::path(filename), ec);
+        if (!ec) NIFLY_STAT_BYTES(size);
+    }
+    return errval;
+}
+
+NIFLY_API int convertNifGame(void* nifref, const char* targetGame)
+/* Convert a nif between Skyrim LE and SE in place, as Outfit Studio's optimizer does.
+    Shape handles from before the call are no longer valid; get them again.
+    Returns 0 if converted, 1 if the nif is already for that game, -1 if the
+    conversion isn't supported. */
+{
+    NIFLY_STAT(__func__);
+    NifFile* nif = static_cast<NifFile*>(nifref);
+    TargetGame game = StrToTargetGame(targetGame);
+    NiVersion& current = nif->GetHeader().GetVersion();
+    if ((!current.IsSK() && !current.IsSSE()) || (game != SKYRIM && game != SKYRIMSE)) {
+        niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_ARGUMENT, nifref,
+            "Can only convert between SKYRIM and SKYRIMSE, not to %s", targetGame);
+        return -1;
+    }
+    if (current.IsSSE() == (game == SKYRIMSE))
+        return 1;
+
+    OptOptions options;
+    options.targetVersion = GameVersion(game);
+    ForgetShapeAdjacency(nif);
+    // Conversion replaces the shapes and their data and skin blocks.
+    for (NiShape* shape : nif->GetShapes())
+        niflydll::HandleRetireBlock(nif, shape, true);
+    OptResult result = nif->OptimizeFor(options);
+    if (result.versionMismatch) {
+        niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_ARGUMENT, nifref,
+            "Could not convert nif to %s", targetGame);
+        return -1;
+    }
+    return 0;
 }
 
 
@@ -178,12 +263,14 @@ NIFLY_API int saveNif(void* the_nif, const char8_t* filename) {
 
 NIFLY_API int getNodeCount(void* theNif)
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(theNif);
     return int(nif->GetNodes().size());
 }
 
 NIFLY_API void getNodes(void* theNif, void** buf)
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(theNif);
     std::vector<nifly::NiNode*> nodes = nif->GetNodes();
     for (int i = 0; i < nodes.size(); i++)
@@ -191,6 +278,7 @@ NIFLY_API void getNodes(void* theNif, void** buf)
 }
 
 NIFLY_API int getNodeBlockname(void* node, char* buf, int buflen) {
+    NIFLY_STAT(__func__);
     nifly::NiNode* theNode = static_cast<nifly::NiNode*>(node);
     std::string name = theNode->GetBlockName();
     int copylen = std::min((int)buflen - 1, (int)name.length());
@@ -200,16 +288,19 @@ NIFLY_API int getNodeBlockname(void* node, char* buf, int buflen) {
 }
 
 NIFLY_API int getNodeFlags(void* node) {
+    NIFLY_STAT(__func__);
     nifly::NiNode* theNode = static_cast<nifly::NiNode*>(node);
     return theNode->flags;
 }
 
 NIFLY_API void setNodeFlags(void* node, int theFlags) {
+    NIFLY_STAT(__func__);
     nifly::NiNode* theNode = static_cast<nifly::NiNode*>(node);
     theNode->flags = theFlags;
 }
 
 NIFLY_API int getNodeName(void* node, char* buf, int buflen) {
+    NIFLY_STAT(__func__);
     nifly::NiNode* theNode = static_cast<nifly::NiNode*>(node);
     std::string name = theNode->name.get();
     int copylen = std::min((int)buflen - 1, (int)name.length());
@@ -218,13 +309,22 @@ NIFLY_API int getNodeName(void* node, char* buf, int buflen) {
     return int(name.length());
 }
 
+NIFLY_API void setNodeName(void* node, const char* name) {
+    NIFLY_STAT(__func__);
+    /* Rename a node. Skins refer to bones by node, so this renames bones too. */
+    nifly::NiNode* theNode = static_cast<nifly::NiNode*>(node);
+    theNode->name.get() = name;
+}
+
 NIFLY_API void* getNodeParent(void* theNif, void* node) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(theNif);
     nifly::NiNode* theNode = static_cast<nifly::NiNode*>(node);
     return nif->GetParentNode(theNode);
 }
 
 NIFLY_API void* addNode(void* f, const char* name, const MatTransform* xf, void* parent) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(f);
     NiNode* parentNode = static_cast<NiNode*>(parent);
     NiNode* theNode = nif->AddNode(name, *xf, parentNode);
@@ -235,6 +335,7 @@ NIFLY_API void* addNode(void* f, const char* name, const MatTransform* xf, void*
 /* ********************* SHAPE MANAGEMENT ********************** */
 
 int NIFLY_API getAllShapeNames(void* f, char* buf, int len) {
+    NIFLY_STAT(__func__);
     NifFile* theNif = static_cast<NifFile*>(f);
     std::vector<std::string> names = theNif->GetShapeNames();
     std::string s = "";
@@ -250,6 +351,7 @@ int NIFLY_API getAllShapeNames(void* f, char* buf, int len) {
 }
 
 NIFLY_API int getShapeName(void* theShape, char* buf, int len) {
+    NIFLY_STAT(__func__);
     nifly::NiShape* shape = static_cast<nifly::NiShape*>(theShape);
     std::string name = shape->name.get();
     int copylen = std::min((int)len - 1, (int)name.length());
@@ -259,6 +361,7 @@ NIFLY_API int getShapeName(void* theShape, char* buf, int len) {
 }
 
 int NIFLY_API loadShapeNames(const char* filename, char* buf, int len) {
+    NIFLY_STAT(__func__);
     NifFile* theNif = new NifFile(std::filesystem::path(filename));
     std::vector<std::string> names = theNif->GetShapeNames();
     std::string s = "";
@@ -276,6 +379,7 @@ int NIFLY_API loadShapeNames(const char* filename, char* buf, int len) {
 }
 
 int NIFLY_API getShapes(void* f, void** buf, int len, int start) {
+    NIFLY_STAT(__func__);
     NifFile* theNif = static_cast<NifFile*>(f);
     std::vector<nifly::NiShape*> shapes = theNif->GetShapes();
     for (int i=start, j=0; (j < len) && (i < shapes.size()); i++)
@@ -284,11 +388,10 @@ int NIFLY_API getShapes(void* f, void** buf, int len, int start) {
 }
 
 NIFLY_API int getShapeBlockName(void* theShape, char* buf, int buflen) {
+    NIFLY_STAT(__func__);
     NiShape* shape = static_cast<nifly::NiShape*>(theShape);
     const char* blockname = shape->GetBlockName();
-    strncpy_s(buf, buflen, blockname, buflen);
-    //strncpy(buf, blockname, buflen);
-    buf[buflen - 1] = '\0';
+    CopyToBuffer(buf, buflen, blockname);
     return int(strlen(blockname));
 }
 
@@ -299,6 +402,7 @@ NIFLY_API int getVertsForShape(void* theNif, void* theShape, float* buf, int len
     start = vertex index to start with.
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(theNif);
     nifly::NiShape* shape = static_cast<nifly::NiShape*>(theShape);
     std::vector<nifly::Vector3> verts;
@@ -308,6 +412,7 @@ NIFLY_API int getVertsForShape(void* theNif, void* theShape, float* buf, int len
         buf[j++] = verts.at(i).y;
         buf[j++] = verts.at(i).z;
     }
+    NIFLY_STAT_BYTES(std::min<size_t>(len, 3 * (verts.size() - std::min<size_t>(start, verts.size()))) * sizeof(float));
     return int(verts.size());
 }
 
@@ -318,6 +423,7 @@ NIFLY_API int getNormalsForShape(void* theNif, void* theShape, float* buf, int l
     start = normal index to start with.
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(theNif);
     nifly::NiShape* shape = static_cast<nifly::NiShape*>(theShape);
     const std::vector<nifly::Vector3>* norms;
@@ -328,6 +434,7 @@ NIFLY_API int getNormalsForShape(void* theNif, void* theShape, float* buf, int l
             buf[j++] = norms->at(i).y;
             buf[j++] = norms->at(i).z;
         }
+        NIFLY_STAT_BYTES(std::min<size_t>(len, 3 * (norms->size() - std::min<size_t>(start, norms->size()))) * sizeof(float));
         return int(norms->size());
     }
     else
@@ -352,6 +459,7 @@ NIFLY_API int getTriangles(void* theNif, void* theShape, uint16_t* buf, int len,
     start = tri index to start with.
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(theNif);
     nifly::NiShape* shape = static_cast<nifly::NiShape*>(theShape);
     std::vector<nifly::Triangle> shapeTris;
@@ -361,18 +469,22 @@ NIFLY_API int getTriangles(void* theNif, void* theShape, uint16_t* buf, int len,
         buf[j++] = shapeTris.at(i).p2;
         buf[j++] = shapeTris.at(i).p3;
     }
+    NIFLY_STAT_BYTES(std::min<size_t>(len, 3 * (shapeTris.size() - std::min<size_t>(start, shapeTris.size()))) * sizeof(uint16_t));
     return int(shapeTris.size());
 }
 
 NIFLY_API int getUVs(void* theNif, void* theShape, float* buf, int len, int start)
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(theNif);
     nifly::NiShape* shape = static_cast<nifly::NiShape*>(theShape);
     const std::vector<nifly::Vector2>* uv = nif->GetUvsForShape(shape);
+    if (!uv) return 0;
     for (int i = start, j = 0; j < len && i < uv->size(); i++) {
         buf[j++] = uv->at(i).u;
         buf[j++] = uv->at(i).v;
     }
+    NIFLY_STAT_BYTES(std::min<size_t>(len, 2 * (uv->size() - std::min<size_t>(start, uv->size()))) * sizeof(float));
     return int(uv->size());
 }
 
@@ -399,12 +511,20 @@ NIFLY_API void* createNifShapeFromData(void* parentNif,
     * parentRef = Node to be parent of the new shape. Root if omitted.
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(parentNif);
     std::vector<Vector3> v;
     std::vector<Triangle> t;
     std::vector<Vector2> uv;
     std::vector<Vector3> n;
 
+    if (vertCount > int(MAX_SHAPE_VERTS) || triCount > int(MAX_SHAPE_TRIS)) {
+        niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_GEOMETRY, nif,
+            "Shape %s has %d verts and %d tris, more than one shape can hold. Use createNifShapesFromData.",
+            shapeName, vertCount, triCount);
+        return nullptr;
+    }
+
     for (int i = 0; i < vertCount; i++) {
         Vector3 thisv;
         thisv[0] = verts[i*3];
@@ -432,6 +552,7 @@ NIFLY_API void* createNifShapeFromData(void* parentNif,
         thist[2] = tris[i*3+2];
         t.push_back(thist);
     }
+    NIFLY_STAT_BYTES(vertCount * (norms ? 8 : 5) * sizeof(float) + triCount * 3 * sizeof(uint16_t));
 
     uint16_t opt = 0;
     if (optionsPtr) opt = *optionsPtr;
@@ -442,16 +563,433 @@ NIFLY_API void* createNifShapeFromData(void* parentNif,
             &v, &t, &uv, &n, opt, parent);
 }
 
+NIFLY_API int planShapeSplit(const float* verts, int vertCount, const uint32_t* tris, int triCount,
+    int maxVerts, int maxTris, int* triPiece)
+    /* Work out how to split a mesh into pieces small enough for a shape.
+    * verts = (float x, float y float z), ... 
+    * tris = (uint32, uint32, uint32) indices into the vertex list
+    * maxVerts, maxTris = limits for each piece, 0 for the 16-bit index limit
+    * triPiece = receives the piece index of each tri, triCount entries
+    * Returns the number of pieces, -1 if a tri references a vertex that doesn't exist
+    */
+{
+    NIFLY_STAT(__func__);
+    std::vector<Vector3> v(vertCount);
+    for (int i = 0; i < vertCount; i++)
+        v[i] = Vector3(verts[i*3], verts[i*3 + 1], verts[i*3 + 2]);
+    std::vector<uint32_t> t(tris, tris + triCount*3);
+
+    int pieceCount;
+    std::vector<int> pieces = PlanMeshSplit(v, t, 
+        maxVerts > 0 ? maxVerts : MAX_SHAPE_VERTS, maxTris > 0 ? maxTris : MAX_SHAPE_TRIS, pieceCount);
+    if (pieces.size() != size_t(triCount)) {
+        niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_GEOMETRY, nullptr,
+            "Tri list references verts that don't exist, can't split mesh");
+        return -1;
+    }
+    std::copy(pieces.begin(), pieces.end(), triPiece);
+    return pieceCount;
+}
+
+/* Set the shape's partitions from (flags, partID) pairs and the partition of each tri,
+    then rebuild its skin partitions. Shared by setPartitions and createNifShapesFromData. */
+void SetShapePartitionsFromBuf(NifFile* nif, NiShape* shape, const uint16_t* partData,
+    int partCount, std::vector<int>& triParts, int bonesPerPartition)
+{
+    NiVector<BSDismemberSkinInstance::PartitionInfo> partInfos;
+    for (int i = 0; i < partCount*2; i += 2) {
+        BSDismemberSkinInstance::PartitionInfo p;
+        p.flags = static_cast<PartitionFlags>(partData[i]);
+        p.partID = partData[i+1];
+        partInfos.push_back(p);
+    }
+
+    nif->SetShapePartitions(shape, partInfos, triParts, true);
+    if (bonesPerPartition)
+        OptimizeSkinPartitions(nif, shape, bonesPerPartition);
+    UpdateShapeSkinPartitions(nif, { shape });
+}
+
+NIFLY_API int createNifShapesFromData(void* parentNif,
+    const char* shapeName,
+    const float* verts,
+    const float* uv_points,
+    const float* norms,
+    int vertCount,
+    const uint32_t* tris, int triCount,
+    uint16_t* optionsPtr,
+    void* parentRef,
+    void** shapesOut, int shapesLen,
+    uint32_t* vertMap, int vertMapLen,
+    uint32_t* triMap,
+    const ShapeSplitExtrasBuf* extras)
+    /* Like createNifShapeFromData, but takes 32-bit tri indices and splits a mesh too big
+    * for one shape into spatially coherent pieces. The first shape is called shapeName,
+    * the rest shapeName:1, shapeName:2, ... Verts on the boundary between pieces are
+    * duplicated into each piece.
+    * shapesOut = receives the new shapes, up to shapesLen
+    * vertMap = if not null, receives the input index of each shape's verts, one shape 
+    *   after another. Boundary verts are duplicated so this can be longer than vertCount; 
+    *   3 * triCount entries is always enough. Use it to carry weights, colors and the like
+    *   over to the new shapes.
+    * triMap = if not null, receives the input index of each shape's tris, one shape after 
+    *   another (triCount entries). Use it to carry segments over.
+    * extras = if not null, vertex colors, bone weights and partitions for the input mesh,
+    *   given to each piece for its own verts and tris. Weights go in extras->skin; each
+    *   piece gets just the bones its verts use. Write them with writeSkinToNif as usual.
+    * Returns the number of shapes created, -1 if the data can't be split
+    */
+{
+    NIFLY_STAT(__func__);
+    NifFile* nif = static_cast<NifFile*>(parentNif);
+    std::vector<Vector3> v(vertCount);
+    for (int i = 0; i < vertCount; i++)
+        v[i] = Vector3(verts[i*3], verts[i*3 + 1], verts[i*3 + 2]);
+    std::vector<uint32_t> t(tris, tris + triCount*3);
+
+    int pieceCount;
+    std::vector<int> pieces = PlanMeshSplit(v, t, MAX_SHAPE_VERTS, MAX_SHAPE_TRIS, pieceCount);
+    if (pieces.size() != size_t(triCount)) {
+        niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_GEOMETRY, nullptr,
+            "Tri list references verts that don't exist, can't split mesh");
+        return -1;
+    }
+
+    uint16_t opt = 0;
+    if (optionsPtr) opt = *optionsPtr;
+    NiNode* parent = nullptr;
+    if (parentRef) parent = static_cast<NiNode*>(parentRef);
+
+    // Each input vert's weights, bucketed once so each piece can find its own.
+    AnimInfo* skin = nullptr;
+    std::vector<uint32_t> weightStart;
+    std::vector<uint32_t> weightOrder;
+    if (extras && extras->skin && extras->weights && extras->weightCount > 0) {
+        skin = static_cast<AnimInfo*>(extras->skin);
+        weightStart.assign(vertCount + 1, 0);
+        for (int w = 0; w < extras->weightCount; w++) {
+            const VertexBoneWeightBuf& vw = extras->weights[w];
+            if (vw.vertex >= uint32_t(vertCount) || vw.bone >= extras->boneCount) {
+                niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_SKIN, nif,
+                    "Weight %d is for vert %u, bone %u, which don't exist", w, vw.vertex, unsigned(vw.bone));
+                return -1;
+            }
+            weightStart[vw.vertex + 1]++;
+        }
+        for (int v = 0; v < vertCount; v++)
+            weightStart[v + 1] += weightStart[v];
+        weightOrder.resize(extras->weightCount);
+        std::vector<uint32_t> fill(weightStart.begin(), weightStart.end() - 1);
+        for (int w = 0; w < extras->weightCount; w++)
+            weightOrder[fill[extras->weights[w].vertex]++] = uint32_t(w);
+    }
+    bool hasPartitions = extras && extras->partData && extras->partCount > 0 && extras->triParts;
+
+    int vertPos = 0;
+    int triPos = 0;
+    for (int p = 0; p < pieceCount; p++) {
+        std::vector<uint32_t> pieceVerts;
+        std::vector<Triangle> pieceTris;
+        std::vector<uint32_t> pieceTriMap;
+        ExtractMeshPiece(t, pieces, p, pieceVerts, pieceTris, pieceTriMap);
+
+        std::vector<Vector3> pv;
+        std::vector<Vector2> puv;
+        std::vector<Vector3> pn;
+        for (auto i : pieceVerts) {
+            pv.push_back(v[i]);
+            puv.emplace_back(uv_points[i*2], uv_points[i*2 + 1]);
+            if (norms)
+                pn.emplace_back(norms[i*3], norms[i*3 + 1], norms[i*3 + 2]);
+        }
+
+        std::string name = shapeName;
+        if (p > 0)
+            name += ":" + std::to_string(p);
+        NiShape* shape = PyniflyCreateShapeFromData(nif, name, &pv, &pieceTris, &puv, &pn, opt, parent);
+        if (shapesOut && p < shapesLen)
+            shapesOut[p] = shape;
+
+        if (shape && extras && extras->colors) {
+            std::vector<Color4> colors;
+            for (auto i : pieceVerts)
+                colors.emplace_back(extras->colors[i*4], extras->colors[i*4 + 1], 
+                    extras->colors[i*4 + 2], extras->colors[i*4 + 3]);
+            nif->SetColorsForShape(shape->name.get(), colors);
+        }
+
+        if (shape && skin) {
+            std::vector<AnimWeight> boneWeights(extras->boneCount);
+            for (uint32_t local = 0; local < pieceVerts.size(); local++) {
+                uint32_t i = pieceVerts[local];
+                for (uint32_t w = weightStart[i]; w < weightStart[i + 1]; w++) {
+                    const VertexBoneWeightBuf& vw = extras->weights[weightOrder[w]];
+                    boneWeights[vw.bone].weights[uint16_t(local)] = vw.weight;
+                }
+            }
+            if (!shape->IsSkinned())
+                nif->CreateSkinning(shape);
+            if (extras->globalToSkin)
+                setGlobalToSkinXform(skin, shape, const_cast<MatTransform*>(extras->globalToSkin));
+            for (int b = 0; b < extras->boneCount; b++) {
+                if (boneWeights[b].weights.empty())
+                    continue;
+                MatTransform* xf = extras->boneXforms ? const_cast<MatTransform*>(&extras->boneXforms[b]) : nullptr;
+                const char* boneParent = extras->boneParents ? extras->boneParents[b] : nullptr;
+                AddBoneToShape(skin, shape, extras->boneNames[b], xf, boneParent);
+                SetShapeWeights(skin, shape, extras->boneNames[b], boneWeights[b]);
+            }
+        }
+
+        if (shape && hasPartitions) {
+            std::vector<int> triParts;
+            for (auto t : pieceTriMap)
+                triParts.push_back(extras->triParts[t]);
+            SetShapePartitionsFromBuf(nif, shape, extras->partData, extras->partCount, triParts,
+                extras->bonesPerPartition);
+        }
+
+        if (vertMap)
+            for (size_t i = 0; i < pieceVerts.size() && vertPos < vertMapLen; i++)
+                vertMap[vertPos++] = pieceVerts[i];
+        if (triMap)
+            for (size_t i = 0; i < pieceTriMap.size() && triPos < triCount; i++)
+                triMap[triPos++] = pieceTriMap[i];
+    }
+
+    return pieceCount;
+}
+
+NIFLY_API int optimizeShapeVertexCache(void* nifref, void* shaperef, void* animref, 
+    int cacheSize, uint32_t* vertOrder, int vertOrderLen, float* acmr)
+    /* Reorder the shape's triangles and vertices for the GPU's post-transform vertex 
+    * cache. Call once the shape is complete--weights, partitions/segments and colors
+    * set--since they are remapped too.
+    * animref = skin holding weights not yet written to the nif. May be null.
+    * cacheSize = simulated cache size, 0 for the default (32)
+    * vertOrder = if not null, receives the new vertex order: vertOrder[new] = old. Use
+    *   it to remap anything else indexed by vertex, such as shape keys.
+    * acmr = if not null, receives [ACMR before, ACMR after] (vertex transforms per tri)
+    * Returns 1 if the shape was reordered, 0 if it was left alone
+    */
+{
+    NIFLY_STAT(__func__);
+    NifFile* nif = static_cast<NifFile*>(nifref);
+    NiShape* shape = static_cast<NiShape*>(shaperef);
+    std::vector<uint32_t> order;
+    float acmrBefore, acmrAfter;
+
+    bool changed = OptimizeShapeVertexCache(nif, shape, static_cast<AnimInfo*>(animref),
+        cacheSize > 0 ? cacheSize : 32, order, acmrBefore, acmrAfter);
+
+    if (vertOrder)
+        for (int i = 0; i < vertOrderLen && i < int(order.size()); i++)
+            vertOrder[i] = order[i];
+    if (acmr) {
+        acmr[0] = acmrBefore;
+        acmr[1] = acmrAfter;
+    }
+    return changed ? 1 : 0;
+}
+
+NIFLY_API int decimateShapes(void* nifref, void** shapes, int shapeCount, 
+    float targetRatio, uint32_t options, void* outNifRef, void** shapesOut)
+    /* Build reduced copies of the given shapes in outNif, e.g. for LODs. Decimation uses
+    * quadric error metrics with collapses onto existing vertices, so UVs, normals, colors
+    * and weights of the remaining vertices are unchanged. Shapes are decimated in parallel.
+    * targetRatio = fraction of triangles to keep
+    * options = DECIMATE_LOCK_BORDER (1), DECIMATE_IGNORE_WEIGHTS (2), 
+    *   DECIMATE_IGNORE_NORMALS (4)
+    * outNifRef = nif to put the new shapes in, typically a new one from createNif. 
+    *   May be the source nif, in which case the new shapes are named "<name>:LOD".
+    * shapesOut = receives the new shapes, 1:1 with shapes
+    * Returns the number of shapes created
+    */
+{
+    NIFLY_STAT(__func__);
+    NifFile* nif = static_cast<NifFile*>(nifref);
+    NifFile* outNif = outNifRef ? static_cast<NifFile*>(outNifRef) : nif;
+    std::vector<NiShape*> shapeList;
+    for (int i = 0; i < shapeCount; i++)
+        shapeList.push_back(static_cast<NiShape*>(shapes[i]));
+
+    std::vector<NiShape*> newShapes = DecimateShapes(nif, shapeList, targetRatio, options, outNif);
+
+    int count = 0;
+    for (int i = 0; i < int(newShapes.size()); i++) {
+        if (shapesOut) shapesOut[i] = newShapes[i];
+        if (newShapes[i]) count++;
+    }
+    return count;
+}
+
+NIFLY_API void* decimateShape(void* nifref, void* shaperef, float targetRatio, 
+    uint32_t options, void* outNifRef)
+    /* Single-shape version of decimateShapes. Returns the new shape. */
+{
+    NIFLY_STAT(__func__);
+    void* newShape = nullptr;
+    decimateShapes(nifref, &shaperef, 1, targetRatio, options, outNifRef, &newShape);
+    return newShape;
+}
+
+NIFLY_API int mergeShapesByMaterial(void* nifref, void** shapesOut, int outLen)
+    /* Merge shapes that share shader, textures, alpha property and skinning into a
+    * single shape each, to cut draw calls. Each merged shape keeps the name and block of 
+    * the first shape in its group; the others are deleted, so any handles to them (and
+    * any skin loaded for the nif) are stale afterwards.
+    * shapesOut = if not null, receives the merged shapes, up to outLen
+    * Returns the number of shapes that absorbed other shapes
+    */
+{
+    NIFLY_STAT(__func__);
+    NifFile* nif = static_cast<NifFile*>(nifref);
+    int merged = 0;
+
+    for (auto& group : GroupShapesByMaterial(nif, nif->GetShapes())) {
+        if (group.size() < 2)
+            continue;
+        NiShape* shape = MergeShapes(nif, group);
+        if (!shape) {
+            niflydll::LogWriteWf("Could not merge shapes into %s", group[0]->name.get().c_str());
+            continue;
+        }
+        if (shapesOut && merged < outLen)
+            shapesOut[merged] = shape;
+        merged++;
+    }
+
+    return merged;
+}
+
+NIFLY_API int splitShapeByConnectivity(void* nifref, void* shaperef, uint32_t mode, void** shapesOut, int outLen)
+    /* Split the shape into one shape per connected piece. The shape keeps the first piece;
+    * the rest go in copies named "<name>:1", "<name>:2"... Weights, colors, partitions
+    * and segments go with their verts and tris.
+    * mode = 1: verts at the same position count as connected, e.g. across UV seams
+    * shapesOut = receives the shapes, the original first, up to outLen
+    * Returns the number of shapes
+    */
+{
+    NIFLY_STAT(__func__);
+    std::vector<NiShape*> shapes = SplitShapeByConnectivity(
+        static_cast<NifFile*>(nifref), static_cast<NiShape*>(shaperef), mode);
+    for (int i = 0; i < int(shapes.size()) && i < outLen; i++)
+        shapesOut[i] = shapes[i];
+    return int(shapes.size());
+}
+
+NIFLY_API int weldShapeVerts(void* nifref, void* shaperef, const float* tolerances, uint32_t* remap, int remapLen)
+    /* Merge verts that differ only by float noise. Tris that collapse are dropped, along
+    * with their partition or segment entries.
+    * tolerances = position distance, then the largest difference allowed in any UV, normal,
+    *   or color component or bone weight: 5 floats. Negative to ignore an attribute other
+    *   than position. Null for the defaults.
+    * remap = receives the new index of each old vert, up to remapLen. Use it to update
+    *   morphs and other per-vert data.
+    * Returns the new vert count
+    */
+{
+    NIFLY_STAT(__func__);
+    NifFile* nif = static_cast<NifFile*>(nifref);
+    NiShape* shape = static_cast<NiShape*>(shaperef);
+    WeldTolerances tol;
+    if (tolerances) {
+        tol.position = tolerances[0];
+        tol.uv = tolerances[1];
+        tol.normal = tolerances[2];
+        tol.color = tolerances[3];
+        tol.weight = tolerances[4];
+    }
+
+    int oldCount = shape->GetNumVertices();
+    std::vector<uint32_t> map;
+    uint32_t newCount = WeldShapeVerts(nif, shape, tol, map);
+    if (remap)
+        std::copy(map.begin(), map.begin() + std::min(size_t(std::max(remapLen, 0)), map.size()), remap);
+    if (int(newCount) < oldCount)
+        niflydll::LogWriteMf("Welded %s from %d to %d verts", shape->name.get().c_str(), oldCount, int(newCount));
+    return int(newCount);
+}
+
+NIFLY_API int unifySeamNormals(void** nifs, void** shapes, int shapeCount, int master, float tolerance)
+    /* Give boundary verts of different shapes that coincide in global space the same 
+    * normal, so seams between e.g. head, body and hands don't show.
+    * nifs, shapes = the nif of each shape and the shape, shapeCount of each. Shapes may 
+    *   come from different nifs.
+    * master = index of the shape whose normals win at its seams, or -1 to average
+    * tolerance = how close verts must be to count as coincident
+    * Returns the number of verts changed
+    */
+{
+    NIFLY_STAT(__func__);
+    std::vector<SeamShape> seamShapes;
+    for (int i = 0; i < shapeCount; i++)
+        seamShapes.push_back({ static_cast<NifFile*>(nifs[i]), static_cast<NiShape*>(shapes[i]) });
+    return UnifySeamNormals(seamShapes, master, tolerance);
+}
+
+NIFLY_API void calcShapeNormals(void* nifref, void* shaperef, int smooth, float smoothAngle)
+    /* Recompute a shape's normals and tangents from its geometry.
+    * smooth = nonzero to also average normals across split verts where the faces meet
+    *   at less than smoothAngle degrees
+    */
+{
+    NIFLY_STAT(__func__);
+    NifFile* nif = static_cast<NifFile*>(nifref);
+    NiShape* shape = static_cast<NiShape*>(shaperef);
+    nif->CalcNormalsForShape(shape, true, smooth != 0, smoothAngle);
+    nif->CalcTangentsForShape(shape);
+}
+
+NIFLY_API int getShapeAdjacency(void* nifref, void* shaperef, int table, uint32_t* buf, int bufLen)
+    /* Return one table of the shape's triangle adjacency. The adjacency is built on 
+    * first use and kept until the shape's tris change.
+    * table = 0: vert->tri offsets, vertCount+1 entries. Tris of vert v are entries
+    *           offsets[v] up to offsets[v+1] of table 1.
+    *         1: vert->tris
+    *         2: unique edges as vert pairs, lower index first
+    *         3: edge->tri offsets, edgeCount+1 entries, into table 4
+    *         4: edge->tris
+    *         5: 3 per tri, the edges p1-p2, p2-p3, p3-p1
+    *         6: 3 per tri, the tri across each of those edges
+    *     Missing entries in 5 and 6 (degenerate, boundary or non-manifold edges) are 0xFFFFFFFF.
+    * buf = receives up to bufLen entries of the table. May be null to get the length.
+    * Returns the length of the table, or -1 for an unknown table.
+    */
+{
+    NIFLY_STAT(__func__);
+    std::shared_ptr<const MeshAdjacency> adj = GetShapeAdjacency(
+        static_cast<NifFile*>(nifref), static_cast<NiShape*>(shaperef));
+    const std::vector<uint32_t>* data = adj->Table(table);
+    if (!data) {
+        niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_ARGUMENT, shaperef,
+            "Unknown adjacency table %d", table);
+        return -1;
+    }
+    if (buf)
+        std::copy(data->begin(), data->begin() + std::min(size_t(std::max(bufLen, 0)), data->size()), buf);
+    return int(data->size());
+}
+
 
 /* ********************* TRANSFORMS AND SKINNING ********************* */
 
 NIFLY_API void* makeGameSkeletonInstance(const char* gameName) {
-    return MakeSkeleton(StrToTargetGame(gameName));
+    NIFLY_STAT(__func__);
+    AnimSkeleton* skel = MakeSkeleton(StrToTargetGame(gameName));
+    niflydll::SessionAdopt(skel, FreeSkeleton);
+    return skel;
 };
 
 NIFLY_API void* makeSkeletonInstance(const char* skelPath, const char* rootName) {
+    NIFLY_STAT(__func__);
     AnimSkeleton* skel = AnimSkeleton::MakeInstance();
-    skel->LoadFromNif(skelPath, rootName);
+    {
+        NIFLY_STAT("AnimSkeleton::LoadFromNif");
+        skel->LoadFromNif(skelPath, rootName);
+    }
+    niflydll::SessionAdopt(skel, FreeSkeleton);
     return skel;
 }
 
@@ -465,14 +1003,20 @@ NIFLY_API void* loadSkinForNif(void* nifRef, const char* game)
         AnimInfo* - AnimInfo loaded with all shapes in the nif
     */
 {
+    NIFLY_STAT(__func__);
     AnimSkeleton* skel = AnimSkeleton::MakeInstance();
     std::string root;
     std::string fn = SkeletonFile(StrToTargetGame(game), root);
-    skel->LoadFromNif(fn, root);
+    {
+        NIFLY_STAT("AnimSkeleton::LoadFromNif");
+        skel->LoadFromNif(fn, root);
+    }
 
     AnimInfo* skin = new AnimInfo();
     skin->SetSkeleton(skel);
     skin->LoadFromNif(static_cast<NifFile*>(nifRef), skel);
+    niflydll::SessionAdopt(skin, FreeSkin);
+    niflydll::SessionAdopt(skel, FreeSkeleton, skin);
     return skin;
 }
 
@@ -486,15 +1030,31 @@ NIFLY_API void* loadSkinForNifSkel(void* nifRef, void* skel)
         AnimInfo* - AnimInfo loaded with all shapes in the nif
     */
 {
+    NIFLY_STAT(__func__);
 
     AnimInfo* skin = new AnimInfo();
     skin->SetSkeleton(static_cast<AnimSkeleton*>(skel));
     skin->LoadFromNif(static_cast<NifFile*>(nifRef), 
                       static_cast<AnimSkeleton*>(skel));
+    niflydll::SessionAdopt(skin, FreeSkin);
     return skin;
 }
 
+NIFLY_API void destroySkin(void* anim) {
+    /* Free a skin, and the skeleton it loaded if it made its own. */
+    NIFLY_STAT(__func__);
+    if (!niflydll::SessionRelease(anim)) FreeSkin(anim);
+}
+
+NIFLY_API void destroySkeleton(void* skel) {
+    /* Free a skeleton from makeGameSkeletonInstance or makeSkeletonInstance. Free the
+        skins using it first. */
+    NIFLY_STAT(__func__);
+    if (!niflydll::SessionRelease(skel)) FreeSkeleton(skel);
+}
+
 NIFLY_API bool getShapeGlobalToSkin(void* nifRef, void* shapeRef, float* xform) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifRef);
     MatTransform tmp;
     bool skinInstFound = nif->GetShapeTransformGlobalToSkin(static_cast<NiShape*>(shapeRef), tmp);
@@ -510,16 +1070,19 @@ NIFLY_API void getGlobalToSkin(void* nifSkinRef, void* shapeRef, void* xform)
 *   < MatTransform* xform = buffer to hold the transform
 */
 {
+    NIFLY_STAT(__func__);
     GetGlobalToSkin(static_cast<AnimInfo*>(nifSkinRef), 
                     static_cast<NiShape*>(shapeRef), 
                     static_cast<MatTransform*>(xform));
 }
 
 NIFLY_API int hasSkinInstance(void* shapeRef) {
+    NIFLY_STAT(__func__);
     return static_cast<NiShape*>(shapeRef)->HasSkinInstance()? 1: 0;
 }
 
 NIFLY_API bool getShapeSkinToBone(void* nifPtr, void* shapePtr, const  char* boneName, float* buf) {
+    NIFLY_STAT(__func__);
     MatTransform xf;
     bool hasXform = static_cast<NifFile*>(nifPtr)->GetShapeTransformSkinToBone(
         static_cast<NiShape*>(shapePtr),
@@ -530,18 +1093,21 @@ NIFLY_API bool getShapeSkinToBone(void* nifPtr, void* shapePtr, const  char* bon
 }
 
 NIFLY_API void getTransform(void* theShape, float* buf) {
+    NIFLY_STAT(__func__);
     nifly::NiShape* shape = static_cast<nifly::NiShape*>(theShape);
     nifly::MatTransform xf = shape->GetTransformToParent();
     XformToBuffer(buf, xf);
 }
 
 NIFLY_API void getNodeTransform(void* theNode, MatTransform* buf) {
+    NIFLY_STAT(__func__);
     nifly::NiNode* node = static_cast<nifly::NiNode*>(theNode);
     *buf = node->GetTransformToParent();
 }
 
 NIFLY_API void getNodeXformToGlobal(
     void* anim, const char* boneName, MatTransform* xformBuf) {
+    NIFLY_STAT(__func__);
     /* Get the transform from the nif if there, from the reference skeleton if not.
         Requires an AnimInfo because this is a skinned nif, after all. Creating the 
         AnimInfo loads the skeleton.
@@ -565,6 +1131,7 @@ NIFLY_API void getNodeXformToGlobal(
 
 NIFLY_API void getBoneSkinToBoneXform(void* nifSkinPtr, const char* shapeName,
     const char* boneName, float* xform) {
+    NIFLY_STAT(__func__);
     AnimInfo* anim = static_cast<AnimInfo*>(nifSkinPtr);
     int boneIdx = anim->GetShapeBoneIndex(shapeName, boneName);
     AnimSkin* skin = &anim->shapeSkinning[boneName];
@@ -580,26 +1147,32 @@ NIFLY_API void* createSkinForNif(void* nifPtr, const char* gameName)
 *   < returns AnimInfo* 
 */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifPtr);
-    return CreateSkinForNif(nif, StrToTargetGame(gameName));
+    AnimInfo* skin = CreateSkinForNif(nif, StrToTargetGame(gameName));
+    niflydll::SessionAdopt(skin, FreeSkin);
+    niflydll::SessionAdopt(skin->GetSkeleton(), FreeSkeleton, skin);
+    return skin;
 }
 
 NIFLY_API void skinShape(void* nif, void* shapeRef)
 {
+    NIFLY_STAT(__func__);
     static_cast<NifFile*>(nif)->CreateSkinning(static_cast<nifly::NiShape*>(shapeRef));
 }
 
-NIFLY_API void writeSkinToNif(void* animref) {
-    /* Write skin info to nif, creating bone nodes as needed
+NIFLY_API void writeSkinToNif(void* animref, int bonesPerPartition) {
+    NIFLY_STAT(__func__);
+    /* Write skin info to nif, creating bone nodes as needed. Only shapes whose 
+    *  skinning changed since the last write are rewritten and re-partitioned.
+    *  bonesPerPartition = 0 to leave skin partitions as nifly builds them, 
+    *       -1 to split them to the game's bone limit, or an explicit bone limit
     */
-    AnimInfo* anim = static_cast<AnimInfo*>(animref);
-    NifFile* theNif = anim->GetRefNif();
-    anim->WriteToNif(theNif, "None");
-    for (auto& shape : theNif->GetShapes())
-        theNif->UpdateSkinPartitions(shape);
+    WriteSkinToNif(static_cast<AnimInfo*>(animref), bonesPerPartition);
 }
 
 NIFLY_API int saveSkinnedNif(void* animref, const char8_t* filepath) {
+    NIFLY_STAT(__func__);
     /* Save skinned nif
     *   Parameters
     *   > AnimInfo* anim = Nif skin for the nif to save
@@ -612,6 +1185,7 @@ NIFLY_API int saveSkinnedNif(void* animref, const char8_t* filepath) {
 }
 
 NIFLY_API void setGlobalToSkinXform(void* animPtr, void* shapePtr, void* gtsXformPtr) {
+    NIFLY_STAT(__func__);
     if (static_cast<NiShape*>(shapePtr)->HasSkinInstance()) {
         SetShapeGlobalToSkinXform(static_cast<AnimInfo*>(animPtr),
             static_cast<NiShape*>(shapePtr),
@@ -626,12 +1200,14 @@ NIFLY_API void setGlobalToSkinXform(void* animPtr, void* shapePtr, void* gtsXfor
 }
 
 NIFLY_API void setShapeGlobalToSkinXform(void* animPtr, void* shapePtr, void* gtsXformPtr) {
+    NIFLY_STAT(__func__);
     SetShapeGlobalToSkinXform(static_cast<AnimInfo*>(animPtr),
         static_cast<NiShape*>(shapePtr),
         *static_cast<MatTransform*>(gtsXformPtr));
 }
 
 NIFLY_API void setTransform(void* theShape, void* buf) {
+    NIFLY_STAT(__func__);
     NiShape* shape = static_cast<nifly::NiShape*>(theShape);
     MatTransform* xf = static_cast<MatTransform*>(buf);
     shape->SetTransformToParent(*xf);
@@ -642,6 +1218,7 @@ NIFLY_API void setTransform(void* theShape, void* buf) {
 /* ************************* BONES AND WEIGHTS ************************* */
 
 NIFLY_API int getShapeBoneCount(void* theNif, void* theShape) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(theNif);
     nifly::NiShape* shape = static_cast<nifly::NiShape*>(theShape);
     std::vector<int> bonelist;
@@ -649,6 +1226,7 @@ NIFLY_API int getShapeBoneCount(void* theNif, void* theShape) {
 }
 
 NIFLY_API int getShapeBoneIDs(void* theNif, void* theShape, int* buf, int bufsize) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(theNif);
     nifly::NiShape* shape = static_cast<nifly::NiShape*>(theShape);
     std::vector<int> bonelist;
@@ -661,6 +1239,7 @@ NIFLY_API int getShapeBoneIDs(void* theNif, void* theShape, int* buf, int bufsiz
 NIFLY_API int getShapeBoneNames(void* theNif, void* theShape, char* buf, int buflen) 
 // Returns a list of bone names the shape uses. List is separated by \n characters.
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(theNif);
     nifly::NiShape* shape = static_cast<nifly::NiShape*>(theShape);
     std::vector<std::string> names;
@@ -681,6 +1260,7 @@ NIFLY_API int getShapeBoneNames(void* theNif, void* theShape, char* buf, int buf
 }
 
 NIFLY_API int getShapeBoneWeightsCount(void* theNif, void* theShape, int boneIndex) {
+    NIFLY_STAT(__func__);
     /* Get the count of bone weights associated with the given bone. */
     NifFile* nif = static_cast<NifFile*>(theNif);
     nifly::NiShape* shape = static_cast<nifly::NiShape*>(theShape);
@@ -691,6 +1271,7 @@ NIFLY_API int getShapeBoneWeightsCount(void* theNif, void* theShape, int boneInd
 
 NIFLY_API int getShapeBoneWeights(void* theNif, void* theShape, int boneIndex,
                                   struct VertexWeightPair* buf, int buflen) {
+    NIFLY_STAT(__func__);
     /* Get the bone weights associated with the given bone for the given shape.
         boneIndex = index of bone in the list of bones associated with this shape 
         buf = Buffer to hold <vertex index, weight> for every vertex weighted to this bone.
@@ -726,11 +1307,13 @@ NIFLY_API void addBoneToSkin(void* anim, const char* boneName,
     *  parentName may be omitted if the bone has no parent.
     */
 {
-    std::string parent = std::string(parentName);
+    NIFLY_STAT(__func__);
+    std::string parent;
+    if (parentName) parent = parentName;
     AddCustomBoneRef(
         static_cast<AnimInfo*>(anim), 
         std::string(boneName), 
-        &parent, 
+        parentName ? &parent : nullptr, 
         static_cast<MatTransform*>(xformPtr));
 }
 
@@ -745,12 +1328,14 @@ NIFLY_API void addBoneToShape(void* anim, void* theShape, const char* boneName,
 *  parentName may be omitted if the bone has no parent.
 */
 {
+    NIFLY_STAT(__func__);
     AddBoneToShape(static_cast<AnimInfo*>(anim), static_cast<NiShape*>(theShape),
         boneName, static_cast<MatTransform*>(xformPtr), parentName);
 }
 
 NIFLY_API void setShapeWeights(void* anim, void* theShape, const char* boneName,
     VertexWeightPair* vertWeights, int vertWeightLen, MatTransform* skinToBoneXform) {
+    NIFLY_STAT(__func__);
     AnimWeight aw;
     for (int i = 0; i < vertWeightLen; i++) {
         aw.weights[vertWeights[i].vertex] = vertWeights[i].weight;
@@ -758,8 +1343,173 @@ NIFLY_API void setShapeWeights(void* anim, void* theShape, const char* boneName,
     SetShapeWeights(static_cast<AnimInfo*>(anim), static_cast<NiShape*>(theShape), boneName, aw);
 }
 
+NIFLY_API int transferWeights(void* srcNifRef, void* srcShapeRef, void* destAnim, void* destShapeRef,
+    uint32_t options, float maxDistance)
+    /* Copy bone weights from the source shape onto the destination shape by proximity:
+    * each destination vert takes the weights at the closest point on the source mesh,
+    * interpolated across the source tri. Shapes are matched up in global space, so set
+    * the destination's global-to-skin transform first. Bones are added to the 
+    * destination as needed; use writeSkinToNif or saveSkinnedNif to write them out.
+    * destAnim = skin (AnimInfo) for the destination shape's nif
+    * options = 1: copy the nearest source vert's weights instead of interpolating
+    *           2: keep all influences, not just the strongest 4
+    * maxDistance = verts farther than this from the source are left alone. 0 for no limit.
+    * Returns the number of destination verts weighted
+    */
+{
+    NIFLY_STAT(__func__);
+    return TransferShapeWeights(static_cast<NifFile*>(srcNifRef), static_cast<NiShape*>(srcShapeRef),
+        static_cast<AnimInfo*>(destAnim), static_cast<NiShape*>(destShapeRef), options, maxDistance);
+}
+
+NIFLY_API int conformMorphs(void* refNifRef, void* refShapeRef, void* nifRef, void* shapeRef,
+    const float* refDeltas, int morphCount, float radius, int neighbors, float* deltasOut)
+    /* Conform morphs from a reference shape (e.g. a body) to a shape fitted to it (e.g. an 
+    * outfit). Each vert takes a distance-weighted average of the deltas of its nearest
+    * reference verts. Shapes are matched up in global space.
+    * refDeltas = morphCount blocks of (dx, dy, dz) for every reference vert
+    * radius = reference verts farther than this have no effect. 0 for no limit.
+    * neighbors = number of reference verts to blend, 0 for the default (8)
+    * deltasOut = receives morphCount blocks of (dx, dy, dz) for every vert of the shape
+    * Returns the number of verts that found reference verts in range
+    */
+{
+    NIFLY_STAT(__func__);
+    NifFile* refNif = static_cast<NifFile*>(refNifRef);
+    NiShape* refShape = static_cast<NiShape*>(refShapeRef);
+    NifFile* nif = static_cast<NifFile*>(nifRef);
+    NiShape* shape = static_cast<NiShape*>(shapeRef);
+    if (morphCount <= 0) return 0;
+
+    size_t refCount = refShape->GetNumVertices();
+    std::vector<std::vector<Vector3>> refMorphs(morphCount, std::vector<Vector3>(refCount));
+    for (int m = 0; m < morphCount; m++)
+        for (size_t i = 0; i < refCount; i++) {
+            const float* d = refDeltas + (m * refCount + i) * 3;
+            refMorphs[m][i] = Vector3(d[0], d[1], d[2]);
+        }
+
+    std::vector<std::vector<Vector3>> morphs;
+    int found = ConformShapeMorphs(refNif, refShape, nif, shape, refMorphs, radius, neighbors, morphs);
+
+    size_t count = shape->GetNumVertices();
+    for (int m = 0; m < morphCount; m++)
+        for (size_t i = 0; i < count; i++) {
+            float* d = deltasOut + (m * count + i) * 3;
+            Vector3 v = i < morphs[m].size() ? morphs[m][i] : Vector3();
+            d[0] = v.x; d[1] = v.y; d[2] = v.z;
+        }
+    return found;
+}
+
+NIFLY_API int findClipping(void* bodyNifRef, void* bodyShapeRef, void* nifRef, void* shapeRef,
+    float maxDepth, uint32_t options, int* vertsOut, float* depthOut, int outLen)
+    /* Find the shape's verts that clip into the body shape, comparing the two in the pose 
+    * given by their skin transforms.
+    * maxDepth = verts deeper than this are taken to be on the far side of the body. 0 for
+    *   no limit.
+    * options = 1: decide inside by counting ray crossings; needs a closed body mesh
+    * vertsOut, depthOut = receive the clipping verts and how deep each one is, up to outLen
+    * Returns the number of clipping verts
+    */
+{
+    NIFLY_STAT(__func__);
+    std::vector<float> depth;
+    int count = FindShapeClipping(static_cast<NifFile*>(bodyNifRef), static_cast<NiShape*>(bodyShapeRef),
+        static_cast<NifFile*>(nifRef), static_cast<NiShape*>(shapeRef), maxDepth, options, depth);
+
+    int n = 0;
+    for (size_t i = 0; i < depth.size() && n < outLen; i++)
+        if (depth[i] > 0.0f) {
+            if (vertsOut) vertsOut[n] = int(i);
+            if (depthOut) depthOut[n] = depth[i];
+            n++;
+        }
+    return count;
+}
+
+NIFLY_API void* buildShapeBVH(void* nifRef, void** shapes, int shapeCount)
+    /* Build a BVH over the shapes in global space, for raycast and closestPoint. 
+    * Returns a handle to free with destroyShapeBVH. The BVH holds its own copy of the 
+    * geometry, so later changes to the shapes aren't seen.
+    */
+{
+    NIFLY_STAT(__func__);
+    NifFile* nif = static_cast<NifFile*>(nifRef);
+    std::vector<NiShape*> shapeList;
+    for (int i = 0; i < shapeCount; i++)
+        shapeList.push_back(static_cast<NiShape*>(shapes[i]));
+
+    ShapeBVH* bvh = new ShapeBVH();
+    bvh->Build(nif, shapeList);
+    niflydll::SessionAdopt(bvh, FreeShapeBVH);
+    return bvh;
+}
+
+NIFLY_API void destroyShapeBVH(void* bvhRef) {
+    NIFLY_STAT(__func__);
+    if (!niflydll::SessionRelease(bvhRef)) FreeShapeBVH(bvhRef);
+}
+
+void CopySpatialHits(const std::vector<ShapeBVH::Hit>& hits, SpatialHitBuf* out) {
+    for (size_t i = 0; i < hits.size(); i++) {
+        out[i].shape = hits[i].shape;
+        out[i].tri = hits[i].tri;
+        for (int j = 0; j < 3; j++) {
+            out[i].point[j] = hits[i].point[j];
+            out[i].bary[j] = hits[i].bary[j];
+        }
+        out[i].distance = hits[i].distance;
+    }
+}
+
+NIFLY_API int raycast(void* bvhRef, const float* origins, const float* dirs, int count,
+    float maxDistance, SpatialHitBuf* hits)
+    /* Cast a batch of rays against the BVH's shapes. 
+    * origins, dirs = count (x, y, z) triples. Directions needn't be unit length.
+    * maxDistance = ignore hits further than this. 0 for no limit.
+    * hits = receives the first hit of each ray, count entries. Misses have shape -1.
+    * Returns the number of rays that hit
+    */
+{
+    NIFLY_STAT(__func__);
+    ShapeBVH* bvh = static_cast<ShapeBVH*>(bvhRef);
+    std::vector<Vector3> o(count), d(count);
+    for (int i = 0; i < count; i++) {
+        o[i] = Vector3(origins[i * 3], origins[i * 3 + 1], origins[i * 3 + 2]);
+        d[i] = Vector3(dirs[i * 3], dirs[i * 3 + 1], dirs[i * 3 + 2]);
+    }
+    std::vector<ShapeBVH::Hit> result(count);
+    int found = bvh->RaycastBatch(o.data(), d.data(), count,
+        maxDistance > 0.0f ? maxDistance : FLT_MAX, result.data());
+    CopySpatialHits(result, hits);
+    return found;
+}
+
+NIFLY_API int closestPoint(void* bvhRef, const float* points, int count, float maxDistance,
+    SpatialHitBuf* hits)
+    /* Find the closest point on the BVH's shapes to each of a batch of points.
+    * points = count (x, y, z) triples
+    * maxDistance = ignore anything further than this. 0 for no limit.
+    * hits = receives the closest point for each, count entries. Misses have shape -1.
+    * Returns the number of points that found something
+    */
+{
+    NIFLY_STAT(__func__);
+    ShapeBVH* bvh = static_cast<ShapeBVH*>(bvhRef);
+    std::vector<Vector3> p(count);
+    for (int i = 0; i < count; i++)
+        p[i] = Vector3(points[i * 3], points[i * 3 + 1], points[i * 3 + 2]);
+    std::vector<ShapeBVH::Hit> result(count);
+    int found = bvh->ClosestPointBatch(p.data(), count,
+        maxDistance > 0.0f ? maxDistance : FLT_MAX, result.data());
+    CopySpatialHits(result, hits);
+    return found;
+}
+
 NIFLY_API void setShapeVertWeights(void* theFile, void* theShape,
     int vertIdx, const uint8_t* vertex_bones, const float* vertex_weights) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(theFile);
     NiShape* shape = static_cast<nifly::NiShape*>(theShape);
 
@@ -777,6 +1527,7 @@ NIFLY_API void setShapeVertWeights(void* theFile, void* theShape,
 NIFLY_API void setShapeBoneWeights(void* theFile, void* theShape,
     int boneIdx, VertexWeightPair* weights, int weightsLen)
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(theFile);
     NiShape* shape = static_cast<nifly::NiShape*>(theShape);
     std::unordered_map<uint16_t, float> weight_map;
@@ -788,6 +1539,7 @@ NIFLY_API void setShapeBoneWeights(void* theFile, void* theShape,
 
 NIFLY_API void setShapeBoneIDList(void* theFile, void* shapeRef, int* boneIDList, int listLen)
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(theFile);
     NiShape* shape = static_cast<nifly::NiShape*>(shapeRef);
     std::vector<int> bids;
@@ -801,6 +1553,7 @@ NIFLY_API void setShapeBoneIDList(void* theFile, void* shapeRef, int* boneIDList
 /* ************************** SHADERS ************************** */
 
 NIFLY_API int getShaderName(void* nifref, void* shaperef, char* buf, int buflen) {
+    NIFLY_STAT(__func__);
 /*
     Returns length of name string, -1 if there is no shader
 */
@@ -812,14 +1565,14 @@ NIFLY_API int getShaderName(void* nifref, void* shaperef, char* buf, int buflen)
     if (!shader)
         return -1;
     else {
-        strncpy_s(buf, buflen, shader->name.get().c_str(), buflen);
-        buf[buflen - 1] = '\0';
+        CopyToBuffer(buf, buflen, shader->name.get().c_str());
     };
 
     return int(shader->name.get().length());
 };
 
 NIFLY_API uint32_t getShaderFlags1(void* nifref, void* shaperef) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
 
@@ -836,6 +1589,7 @@ NIFLY_API uint32_t getShaderFlags1(void* nifref, void* shaperef) {
 }
 
 NIFLY_API uint32_t getShaderFlags2(void* nifref, void* shaperef) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
 
@@ -861,6 +1615,7 @@ NIFLY_API int getShaderTextureSlot(void* nifref, void* shaperef, int slotIndex,
 *   5 = environment mask
 */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
     NiShader* shader = nif->GetShader(shape);
@@ -908,6 +1663,7 @@ NIFLY_API int getShaderTextureSlot(void* nifref, void* shaperef, int slotIndex,
 };
 
 NIFLY_API const char* getShaderBlockName(void* nifref, void* shaperef) {
+    NIFLY_STAT(__func__);
     /* Returns name of the shader block property, e.g. "BSLightingShaderProperty"
     * Return value is null if shader is not BSLightingShader or BSEffectShader.
     */
@@ -932,6 +1688,7 @@ NIFLY_API const char* getShaderBlockName(void* nifref, void* shaperef) {
 };
 
 NIFLY_API uint32_t getShaderType(void* nifref, void* shaperef) {
+    NIFLY_STAT(__func__);
 /*
     Return value: 0 = no shader or not a LSLightingShader; anything else is the shader type
 */
@@ -952,6 +1709,7 @@ NIFLY_API int getShaderAttrs(void* nifref, void* shaperef, struct BSLSPAttrs* bu
     Return value: 0 = success, 1 = no shader, or not a BSLightingShaderProperty
 */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
 
@@ -966,7 +1724,7 @@ NIFLY_API int getShaderAttrs(void* nifref, void* shaperef, struct BSLSPAttrs* bu
 
     NiTexturingProperty* txtProp = nif->GetTexturingProperty(shape);
 
-    FillMemory(buf, sizeof(BSLSPAttrs), 0);
+    memset(buf, 0, sizeof(BSLSPAttrs));
 
     buf->Shader_Type = shader->GetShaderType();
     if (bssh) buf->Shader_Flags_1 = bssh->shaderFlags1;
@@ -1010,6 +1768,7 @@ NIFLY_API int getEffectShaderAttrs(void* nifref, void* shaperef, struct BSESPAtt
     Return value: 0 = success, 1 = no shader, or not a BSEffectShaderProperty
 */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
 
@@ -1022,7 +1781,7 @@ NIFLY_API int getEffectShaderAttrs(void* nifref, void* shaperef, struct BSESPAtt
 
     if (!bsesp) return 1;
 
-    FillMemory(buf, sizeof(BSESPAttrs), 0);
+    memset(buf, 0, sizeof(BSESPAttrs));
 
     if (bssh) buf->Shader_Flags_1 = bssh->shaderFlags1;
     if (bssh) buf->Shader_Flags_2 = bssh->shaderFlags2;
@@ -1049,6 +1808,7 @@ NIFLY_API int getEffectShaderAttrs(void* nifref, void* shaperef, struct BSESPAtt
 };
 
 NIFLY_API int getAlphaProperty(void* nifref, void* shaperef, AlphaPropertyBuf* bufptr) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
     if (shape->HasAlphaProperty()) {
@@ -1062,6 +1822,7 @@ NIFLY_API int getAlphaProperty(void* nifref, void* shaperef, AlphaPropertyBuf* b
 }
 
 NIFLY_API void setAlphaProperty(void* nifref, void* shaperef, AlphaPropertyBuf* bufptr) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
 
@@ -1072,6 +1833,7 @@ NIFLY_API void setAlphaProperty(void* nifref, void* shaperef, AlphaPropertyBuf*
 }
 
 NIFLY_API void setShaderName(void* nifref, void* shaperef, char* name) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
 
@@ -1080,6 +1842,7 @@ NIFLY_API void setShaderName(void* nifref, void* shaperef, char* name) {
 };
 
 NIFLY_API void setShaderType(void* nifref, void* shaperef, uint32_t shaderType) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
 
@@ -1088,6 +1851,7 @@ NIFLY_API void setShaderType(void* nifref, void* shaperef, uint32_t shaderType)
 };
 
 NIFLY_API void setShaderFlags1(void* nifref, void* shaperef, uint32_t flags) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
 
@@ -1098,6 +1862,7 @@ NIFLY_API void setShaderFlags1(void* nifref, void* shaperef, uint32_t flags) {
 }
 
 NIFLY_API void setShaderFlags2(void* nifref, void* shaperef, uint32_t flags) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
 
@@ -1108,6 +1873,7 @@ NIFLY_API void setShaderFlags2(void* nifref, void* shaperef, uint32_t flags) {
 }
 
 NIFLY_API void setShaderTextureSlot(void* nifref, void* shaperef, int slotIndex, const char* buf) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
 
@@ -1140,6 +1906,7 @@ void NifFile::SetTextureSlot(NiShader* shader, std::string& inTexFile, int texIn
 }
 
 NIFLY_API void setShaderAttrs(void* nifref, void* shaperef, struct BSLSPAttrs* buf) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
 
@@ -1184,6 +1951,7 @@ NIFLY_API void setShaderAttrs(void* nifref, void* shaperef, struct BSLSPAttrs* b
 };
 
 NIFLY_API void setEffectShaderAttrs(void* nifref, void* shaperef, struct BSESPAttrs* buf) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
 
@@ -1222,6 +1990,7 @@ NIFLY_API void setEffectShaderAttrs(void* nifref, void* shaperef, struct BSESPAt
 /* ******************** SEGMENTS AND PARTITIONS ****************************** */
 
 NIFLY_API int segmentCount(void* nifref, void* shaperef) {
+    NIFLY_STAT(__func__);
     /*
         Return count of segments associated with the shape.
         If not FO4 nif or no segments returns 0
@@ -1237,6 +2006,7 @@ NIFLY_API int segmentCount(void* nifref, void* shaperef) {
 }
 
 NIFLY_API int getSegmentFile(void* nifref, void* shaperef, char* buf, int buflen) {
+    NIFLY_STAT(__func__);
     /*
         Return segment file associated with the shape
         If not FO4 nif or no segments returns ''
@@ -1260,6 +2030,7 @@ NIFLY_API int getSegmentFile(void* nifref, void* shaperef, char* buf, int buflen
 }
 
 NIFLY_API int getSegments(void* nifref, void* shaperef, int* segments, int segLen) {
+    NIFLY_STAT(__func__);
     /*
         Return segments associated with a shape. Only for FO4-style nifs.
         segments -> (int ID, int count_of_subsegments)...
@@ -1280,6 +2051,7 @@ NIFLY_API int getSegments(void* nifref, void* shaperef, int* segments, int segLe
 }
 
 NIFLY_API int getSubsegments(void* nifref, void* shaperef, int segID, uint32_t* segments, int segLen) {
+    NIFLY_STAT(__func__);
     /*
         Return subsegments associated with a shape. Only for FO4-style nifs.
         segments -> (int ID, userSlotID, material)...
@@ -1306,6 +2078,7 @@ return 0;
 }
 
 NIFLY_API int getPartitions(void* nifref, void* shaperef, uint16_t* partitions, int partLen) {
+    NIFLY_STAT(__func__);
     /*
         Return a list of partitions associated with the shape. Only for skyrim-style nifs.
         partitions = (uint16 flags, uint16 partID)... where partID is the body part ID
@@ -1326,6 +2099,7 @@ NIFLY_API int getPartitions(void* nifref, void* shaperef, uint16_t* partitions,
 }
 
 NIFLY_API int getPartitionTris(void* nifref, void* shaperef, uint16_t* tris, int triLen) {
+    NIFLY_STAT(__func__);
     /*
         Return a list of segment indices matching 1-1 with the shape's triangles.
         Used for both skyrim and fo4-style nifs
@@ -1345,32 +2119,20 @@ NIFLY_API int getPartitionTris(void* nifref, void* shaperef, uint16_t* tris, int
 
 NIFLY_API void setPartitions(void* nifref, void* shaperef,
     uint16_t* partData, int partDataLen,
-    uint16_t* tris, int triLen)
+    uint16_t* tris, int triLen, int bonesPerPartition)
     /* partData = (uint16 flags, uint16 partID)... where partID is the body part ID
     * partDataLen = length of the buffer in uint16s
     * tris = list of segment indices matching 1-1 with shape triangles
+    * bonesPerPartition = 0 to let nifly split partitions, -1 to group triangles by bone 
+    *   set within the game's bone limit, or an explicit bone limit
     * 
         >>Needs to be called AFTER bone weights are set
     */
 {
-    NifFile* nif = static_cast<NifFile*>(nifref);
-    NiShape* shape = static_cast<NiShape*>(shaperef);
-    NiVector<BSDismemberSkinInstance::PartitionInfo> partInfos;
-    std::vector<int> triParts;
-
-    for (int i = 0; i < partDataLen*2; i += 2) {
-        BSDismemberSkinInstance::PartitionInfo p;
-        p.flags = static_cast<PartitionFlags>(partData[i]);
-        p.partID = partData[i+1];
-        partInfos.push_back(p);
-    }
-
-    for (int i = 0; i < triLen; i++) {
-        triParts.push_back(tris[i]);
-    }
-
-    nif->SetShapePartitions(shape, partInfos, triParts, true);
-    nif->UpdateSkinPartitions(shape);
+    NIFLY_STAT(__func__);
+    std::vector<int> triParts(tris, tris + triLen);
+    SetShapePartitionsFromBuf(static_cast<NifFile*>(nifref), static_cast<NiShape*>(shaperef),
+        partData, partDataLen, triParts, bonesPerPartition);
 }
 
 NIFLY_API void setSegments(void* nifref, void* shaperef,
@@ -1387,6 +2149,7 @@ NIFLY_API void setSegments(void* nifref, void* shaperef,
     * filename = null-terminated filename
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiShape* shape = static_cast<NiShape*>(shaperef);
 
@@ -1396,10 +2159,10 @@ NIFLY_API void setSegments(void* nifref, void* shaperef,
         std::unordered_set<uint32_t> allParts;
 
         for (int i = 0; i < segDataLen; i++) {
-            NifSegmentInfo* seg = new NifSegmentInfo();
-            seg->partID = segData[i];
-            inf.segs.push_back(*seg);
-            allParts.insert(seg->partID);
+            NifSegmentInfo seg;
+            seg.partID = segData[i];
+            inf.segs.push_back(seg);
+            allParts.insert(seg.partID);
         }
 
         for (int i = 0, j = 0; i < subsegDataLen; i++) {
@@ -1422,23 +2185,26 @@ NIFLY_API void setSegments(void* nifref, void* shaperef,
         for (int i = 0; i < triLen; i++) {
             // Checking for invalid segment references explicitly because the try/catch isn't working
             if (allParts.find(tris[i]) == allParts.end()) {
-                niflydll::LogWrite("ERROR: Tri list references invalid segment, segments are not correct");
+                niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_SEGMENTS, shaperef,
+                    "Tri list references invalid segment, segments are not correct");
                 return;
             }
             else
                 triParts.push_back(tris[i]);
         }
         nif->SetShapeSegments(shape, inf, triParts);
-        nif->UpdateSkinPartitions(shape);
+        UpdateShapeSkinPartitions(nif, { shape });
     }
     catch (std::exception e) {
-        niflydll::LogWrite("Error in setSegments, segments may not be correct");
+        niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_SEGMENTS, shaperef,
+            "Error in setSegments, segments may not be correct");
     }
 }
 
 /* ************************ VERTEX COLORS AND ALPHA ********************* */
 
 NIFLY_API int getColorsForShape(void* nifref, void* shaperef, float* colors, int colorLen) {
+    NIFLY_STAT(__func__);
     /*
         Return vertex colors.
         colorLen = # of floats buffer can hold, has to be 4x number of colors
@@ -1457,6 +2223,7 @@ NIFLY_API int getColorsForShape(void* nifref, void* shaperef, float* colors, int
 }
 
 NIFLY_API void setColorsForShape(void* nifref, void* shaperef, float* colors, int colorLen) {
+    NIFLY_STAT(__func__);
     /*
         Set vertex colors.
         colorLen = # of color values in the buf, must be same as # of vertices
@@ -1486,6 +2253,7 @@ int getClothExtraDataLen(void* nifref, void* shaperef, int idx, int* namelen, in
     (Probably there can be only one per file but code allows for more)
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
 
@@ -1519,6 +2287,7 @@ int getClothExtraData(void* nifref, void* shaperef, int idx, char* name, int nam
     Returns 1 if the extra data was found at requested index
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
 
@@ -1537,7 +2306,7 @@ int getClothExtraData(void* nifref, void* shaperef, int idx, char* name, int nam
                 for (int j = 0; j < buflen && j < clothData->data.size(); j++) {
                     buf[j] = clothData->data[j];
                 }
-                strncpy_s(name, namelen, ClothExtraDataName, ClothExtraDataNameLen);
+                CopyToBuffer(name, namelen, ClothExtraDataName);
                 return 1;
             }
             else
@@ -1548,6 +2317,7 @@ int getClothExtraData(void* nifref, void* shaperef, int idx, char* name, int nam
 };
 
 void setClothExtraData(void* nifref, void* shaperef, char* name, char* buf, int buflen) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiAVObject* target = nullptr;
     target = nif->GetRootNode();
@@ -1569,6 +2339,7 @@ int getStringExtraDataLen(void* nifref, void* shaperef, int idx, int* namelen, i
     which to return (0-based).
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
 
@@ -1600,6 +2371,7 @@ int getStringExtraData(void* nifref, void* shaperef, int idx, char* name, int na
     which to return (0-based).
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
 
@@ -1615,8 +2387,8 @@ int getStringExtraData(void* nifref, void* shaperef, int idx, char* name, int na
         NiStringExtraData* strData = hdr.GetBlock<NiStringExtraData>(extraData);
         if (strData) {
             if (i == 0) {
-                strncpy_s(name, namelen, strData->name.get().c_str(), namelen - 1);
-                strncpy_s(buf, buflen, strData->stringData.get().c_str(), buflen - 1);
+                CopyToBuffer(name, namelen, strData->name.get().c_str());
+                CopyToBuffer(buf, buflen, strData->stringData.get().c_str());
                 return 1;
             }
             else
@@ -1627,6 +2399,7 @@ int getStringExtraData(void* nifref, void* shaperef, int idx, char* name, int na
 };
 
 void setStringExtraData(void* nifref, void* shaperef, char* name, char* buf) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiAVObject* target = nullptr;
     if (shaperef)
@@ -1648,6 +2421,7 @@ int getBGExtraDataLen(void* nifref, void* shaperef, int idx, int* namelen, int*
     Returns T/F depending on whether extra data exists
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
 
@@ -1679,6 +2453,7 @@ int getBGExtraData(void* nifref, void* shaperef, int idx, char* name, int namele
     which to return (0-based).
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
 
@@ -1694,8 +2469,8 @@ int getBGExtraData(void* nifref, void* shaperef, int idx, char* name, int namele
         BSBehaviorGraphExtraData* bgData = hdr.GetBlock<BSBehaviorGraphExtraData>(extraData);
         if (bgData) {
             if (i == 0) {
-                strncpy_s(name, namelen, bgData->name.get().c_str(), namelen - 1);
-                strncpy_s(buf, buflen, bgData->behaviorGraphFile.get().c_str(), buflen - 1);
+                CopyToBuffer(name, namelen, bgData->name.get().c_str());
+                CopyToBuffer(buf, buflen, bgData->behaviorGraphFile.get().c_str());
                 *ctrlBaseSkelP = bgData->controlsBaseSkel;
                 return 1;
             }
@@ -1716,6 +2491,7 @@ int getInvMarker(void* nifref, char* name, int namelen, int* rot, float* zoom)
 * Return value = true/false whether a BSInvMarker exists
 */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     NiAVObject* source = nif->GetRootNode();
@@ -1723,7 +2499,7 @@ int getInvMarker(void* nifref, char* name, int namelen, int* rot, float* zoom)
     for (auto& extraData : source->extraDataRefs) {
         BSInvMarker* invm = hdr.GetBlock<BSInvMarker>(extraData);
         if (invm) {
-            strncpy_s(name, namelen, invm->name.get().c_str(), namelen - 1);
+            CopyToBuffer(name, namelen, invm->name.get().c_str());
             rot[0] = invm->rotationX;
             rot[1] = invm->rotationY;
             rot[2] = invm->rotationZ;
@@ -1735,6 +2511,7 @@ int getInvMarker(void* nifref, char* name, int namelen, int* rot, float* zoom)
 };
 
 int getFurnMarker(void* nifref, int index, FurnitureMarkerBuf* buf) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     NiAVObject* source = nif->GetRootNode();
@@ -1761,6 +2538,7 @@ int getFurnMarker(void* nifref, int index, FurnitureMarkerBuf* buf) {
 }
 
 void setFurnMarkers(void* nifref, int buflen, FurnitureMarkerBuf* buf) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
 
     auto fm = std::make_unique<BSFurnitureMarkerNode>();
@@ -1778,6 +2556,7 @@ void setFurnMarkers(void* nifref, int buflen, FurnitureMarkerBuf* buf) {
 
 void setInvMarker(void* nifref, const char* name, int* rot, float* zoom)
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     auto inv = std::make_unique<BSInvMarker>();
     inv->name.get() = name;
@@ -1790,6 +2569,7 @@ void setInvMarker(void* nifref, const char* name, int* rot, float* zoom)
 
 int getBSXFlags(void* nifref, int* buf)
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     NiAVObject* source = nif->GetRootNode();
@@ -1806,6 +2586,7 @@ int getBSXFlags(void* nifref, int* buf)
 
 void setBSXFlags(void* nifref, const char* name, uint32_t flags)
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     auto bsx = std::make_unique<BSXFlags>();
     bsx->name.get() = name;
@@ -1814,6 +2595,7 @@ void setBSXFlags(void* nifref, const char* name, uint32_t flags)
 }
 
 void setBGExtraData(void* nifref, void* shaperef, char* name, char* buf, int controlsBaseSkel) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiAVObject* target = nullptr;
     if (shaperef)
@@ -1830,13 +2612,53 @@ void setBGExtraData(void* nifref, void* shaperef, char* name, char* buf, int con
     }
 };
 
+int removeExtraData(void* nifref, void* shaperef, const char* name)
+/* Remove extra data from a shape, or from the root node if shaperef is null.
+    name = only remove extra data with this name; null or "" removes all of it.
+    Returns the number of blocks removed. */
+{
+    NIFLY_STAT(__func__);
+    NifFile* nif = static_cast<NifFile*>(nifref);
+    NiHeader& hdr = nif->GetHeader();
+    NiAVObject* target = nullptr;
+    if (shaperef)
+        target = static_cast<NiAVObject*>(shaperef);
+    else
+        target = nif->GetRootNode();
+    if (!target) return 0;
+
+    std::vector<int> positions;
+    std::vector<uint32_t> ids;
+    int i = 0;
+    for (auto& extraData : target->extraDataRefs) {
+        NiExtraData* ed = hdr.GetBlock<NiExtraData>(extraData);
+        if (ed && (!name || !*name || ed->name.get() == name)) {
+            positions.push_back(i);
+            ids.push_back(extraData.index);
+        }
+        i++;
+    }
+
+    // Back to front, so earlier positions and block IDs stay put.
+    for (auto p = positions.rbegin(); p != positions.rend(); p++)
+        target->extraDataRefs.RemoveBlockRef(*p);
+    std::sort(ids.rbegin(), ids.rend());
+    for (uint32_t id : ids) {
+        niflydll::HandleRetireBlock(nif, hdr.GetBlock<NiObject>(id));
+        hdr.DeleteBlock(id);
+    }
+    return int(ids.size());
+}
+
 /* ********************* ERROR REPORTING ********************* */
 
 void clearMessageLog() {
+    NIFLY_STAT(__func__);
     niflydll::LogInit();
 };
 
 int getMessageLog(char* buf, int buflen) {
+    NIFLY_STAT(__func__);
     if (buf)
         return niflydll::LogGet(buf, buflen);
     else
@@ -1844,9 +2666,313 @@ int getMessageLog(char* buf, int buflen) {
     //return niflydll::LogGetLen();
 }
 
+int getLogRecords(uint64_t* cursor, niflydll::LogEntry* buf, int buflen)
+/* Read log records incrementally. 
+    cursor = seq to read from; 0 for the oldest record still held. Moved past the 
+        records returned, so pass it back in to get only newer ones.
+    buf = receives up to buflen records
+    Returns the number of records read. The log holds the last 1024 records; compare
+    seq with the cursor to see if any were lost. */
+{
+    NIFLY_STAT(__func__);
+    return niflydll::LogRead(*cursor, buf, buflen);
+}
+
+uint32_t getLogThreadId()
+/* Number the log gives the calling thread in the thread field of its records. A batch
+    job can pick out what it logged itself while other threads are logging too. */
+{
+    NIFLY_STAT(__func__);
+    return niflydll::LogThreadId();
+}
+
+void setLogLevel(int level) {
+    NIFLY_STAT(__func__);
+    /* Drop messages below this level: 0 info, 1 warnings, 2 errors only */
+    niflydll::LogSetLevel(level);
+}
+
+/* ***************************** SESSIONS ***************************** */
+
+void* createSession()
+/* Start a session. Nifs, skins, skeletons and BVHs created on a thread while the session
+    is current there belong to it, and are freed when it's destroyed. They can still be 
+    freed individually before then. */
+{
+    NIFLY_STAT(__func__);
+    return niflydll::SessionCreate();
+}
+
+void* setSession(void* session) {
+    /* Make the session current on the calling thread; null for none. Returns the 
+        session that was current. */
+    NIFLY_STAT(__func__);
+    return niflydll::SessionSetCurrent(static_cast<niflydll::Session*>(session));
+}
+
+void destroySession(void* session)
+/* Free everything the session owns and the session itself. Handles to its objects are
+    invalid afterwards. Don't destroy a session that's still current on another thread. */
+{
+    NIFLY_STAT(__func__);
+    if (!niflydll::SessionDestroy(static_cast<niflydll::Session*>(session)))
+        niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_ARGUMENT, nullptr,
+            "Not a live session");
+}
+
+void* sessionAlloc(void* session, int bytes)
+/* Return zeroed scratch memory that lives until the session is destroyed. 
+    session = session to allocate from; null for the current one */
+{
+    NIFLY_STAT(__func__);
+    niflydll::Session* s = session ? static_cast<niflydll::Session*>(session) : niflydll::SessionCurrent();
+    void* p = (s && bytes >= 0) ? niflydll::SessionAlloc(s, size_t(bytes)) : nullptr;
+    if (!p) niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_ARGUMENT, nullptr,
+        "No live session to allocate from");
+    return p;
+}
+
+/* ***************************** HANDLES ***************************** */
+
+uint64_t getHandle(void* obj)
+/* Return a checked handle for a nif, skin or skeleton. Once the object is freed the 
+    handle no longer resolves, even if the memory is reused. Returns 0 if obj isn't one
+    of those. */
+{
+    NIFLY_STAT(__func__);
+    niflydll::FreeFunction f = niflydll::SessionFreeFunction(obj);
+    niflydll::HandleType type = niflydll::HANDLE_NONE;
+    if (f == FreeNif) type = niflydll::HANDLE_NIF;
+    else if (f == FreeSkin) type = niflydll::HANDLE_SKIN;
+    else if (f == FreeSkeleton) type = niflydll::HANDLE_SKELETON;
+    else {
+        niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_ARGUMENT, obj,
+            "Not a nif, skin or skeleton");
+        return 0;
+    }
+    return niflydll::HandleFor(type, obj);
+}
+
+uint64_t getBlockHandle(void* nifref, void* block)
+/* Return a checked handle for a shape, node or other block of the nif. It stops 
+    resolving once the block is deleted or replaced, or the nif is freed. 
+    Returns 0 if the block isn't in the nif. */
+{
+    NIFLY_STAT(__func__);
+    uint64_t h = niflydll::BlockHandleFor(static_cast<NifFile*>(nifref), static_cast<NiObject*>(block));
+    if (!h) niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_ARGUMENT, nifref,
+        "Block is not in the nif");
+    return h;
+}
+
+void* ResolveAnyHandle(uint64_t handle) {
+    return niflydll::HandleResolve(handle, niflydll::HandleTypeOf(handle));
+}
+
+void* resolveHandle(uint64_t handle) {
+    /* Return the object for a handle, or null if the handle is stale. */
+    NIFLY_STAT(__func__);
+    void* obj = ResolveAnyHandle(handle);
+    if (!obj) niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_ARGUMENT, nullptr,
+        "Stale or invalid handle %llx", (unsigned long long)handle);
+    return obj;
+}
+
+int resolveHandles(const uint64_t* handles, int count, void** out)
+/* Resolve count handles into out, null for stale ones. Returns the number resolved. */
+{
+    NIFLY_STAT(__func__);
+    int resolved = 0;
+    for (int i = 0; i < count; i++) {
+        out[i] = ResolveAnyHandle(handles[i]);
+        if (out[i]) resolved++;
+    }
+    return resolved;
+}
+
+int getShapeIds(uint64_t nifHandle, uint32_t* ids, int len)
+/* Return compact IDs for the nif's shapes, for the calls that take ID arrays. An ID is
+    only good with this nif. Like handles, IDs of shapes that have since been deleted or
+    replaced are rejected, though with only 8 bits of generation to go on.
+    Returns the number of shapes, which may be more than len; -1 if the handle is stale. */
+{
+    NIFLY_STAT(__func__);
+    NifFile* nif = static_cast<NifFile*>(niflydll::HandleResolve(nifHandle, niflydll::HANDLE_NIF));
+    if (!nif) {
+        niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_ARGUMENT, nullptr,
+            "Stale or invalid nif handle");
+        return -1;
+    }
+    std::vector<NiShape*> shapes = nif->GetShapes();
+    for (int i = 0; i < int(shapes.size()) && i < len; i++)
+        ids[i] = niflydll::BlockIdOf(niflydll::BlockHandleFor(nif, shapes[i]));
+    return int(shapes.size());
+}
+
+void* buildShapeBVHFromIds(uint64_t nifHandle, const uint32_t* shapeIds, int count)
+/* As buildShapeBVH, with the shapes given by ID from getShapeIds. Returns null if the
+    nif handle is stale or any ID isn't a live shape of the nif. */
+{
+    NIFLY_STAT(__func__);
+    NifFile* nif = static_cast<NifFile*>(niflydll::HandleResolve(nifHandle, niflydll::HANDLE_NIF));
+    std::vector<NiShape*> shapeList;
+    for (int i = 0; nif && i < count; i++) {
+        NiShape* shape = dynamic_cast<NiShape*>(niflydll::BlockIdResolve(nif, shapeIds[i]));
+        if (!shape) {
+            niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_ARGUMENT, nif,
+                "Shape ID %u is stale", shapeIds[i]);
+            return nullptr;
+        }
+        shapeList.push_back(shape);
+    }
+    if (!nif) {
+        niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_ARGUMENT, nullptr,
+            "Stale or invalid nif handle");
+        return nullptr;
+    }
+
+    ShapeBVH* bvh = new ShapeBVH();
+    bvh->Build(nif, shapeList);
+    niflydll::SessionAdopt(bvh, FreeShapeBVH);
+    return bvh;
+}
+
+/* ***************************** STATISTICS ***************************** */
+
+void enableStats(int on) {
+    /* Start or stop timing calls. Off by default. Counts so far are kept. */
+    niflydll::StatsEnable(on != 0);
+}
+
+int getStats(char* buf, int buflen)
+/* Return call counts, total and max time in ms and bytes moved for every API call and 
+    internal phase timed since the last reset, as JSON. 
+    Returns the full length of the JSON, which may be more than fits in buf. */
+{
+    std::string stats = niflydll::StatsToJson();
+    if (buf && buflen > 0) {
+        int copylen = std::min(buflen - 1, int(stats.length()));
+        stats.copy(buf, copylen, 0);
+        buf[copylen] = '\0';
+    }
+    return int(stats.length());
+}
+
+void resetStats() {
+    niflydll::StatsReset();
+}
+
+int startTrace(const char8_t* filename)
+/* Record every timed call and internal phase, on every thread, to a Chrome trace 
+    event file that chrome://tracing or Perfetto can load. Events are written in the 
+    background until stopTrace is called.
+    Returns 0 on success, 1 if a trace is already running, 2 if the file can't be
+    written. */
+{
+    int rval = niflydll::TraceStart(std::filesystem::path(filename));
+    if (rval == 1) niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_ARGUMENT, nullptr,
+        "A trace is already running");
+    if (rval == 2) niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_FILE, nullptr,
+        "Could not open trace file %s", reinterpret_cast<const char*>(filename));
+    return rval;
+}
+
+int stopTrace() {
+    /* Finish the trace file. Returns the number of events written, -1 if no trace was 
+        running. */
+    return niflydll::TraceStop();
+}
+
+bool MeasureHandle(void* handle, niflydll::NifUsage& nifUsage, uint64_t& weights, 
+    uint64_t& skeletons, uint64_t& scratch)
+/* Add up what handle holds. A session counts everything it owns, each skeleton once.
+    Returns false if handle isn't a nif, skin, skeleton or session. */
+{
+    std::vector<std::pair<void*, niflydll::FreeFunction>> objects;
+    size_t arenaBytes = 0;
+    if (niflydll::SessionContents(static_cast<niflydll::Session*>(handle), objects, arenaBytes))
+        scratch += arenaBytes;
+    else if (niflydll::FreeFunction f = niflydll::SessionFreeFunction(handle))
+        objects.push_back({ handle, f });
+    else
+        return false;
+
+    std::unordered_set<AnimSkeleton*> seen;
+    auto addSkeleton = [&](AnimSkeleton* skel) {
+        if (skel && seen.insert(skel).second)
+            skeletons += niflydll::MeasureSkeleton(skel);
+    };
+    for (auto& o : objects) {
+        if (o.second == FreeNif)
+            niflydll::MeasureNif(static_cast<NifFile*>(o.first), nifUsage);
+        else if (o.second == FreeSkin) {
+            AnimInfo* skin = static_cast<AnimInfo*>(o.first);
+            weights += niflydll::MeasureSkinWeights(skin);
+            addSkeleton(skin->GetSkeleton());
+        }
+        else if (o.second == FreeSkeleton)
+            addSkeleton(static_cast<AnimSkeleton*>(o.first));
+    }
+    return true;
+}
+
+int getMemoryUsage(void* handle, MemoryReport* report)
+/* Estimate the memory held through a handle, by category, plus the process totals.
+    handle = nif, skin, skeleton or session; null for the process totals only. A skin
+        includes its skeleton.
+    Block sizes are as written to a file; in memory they run somewhat larger.
+    Returns 0, or -1 if handle isn't one of those, when only the process totals are
+    filled in. */
+{
+    NIFLY_STAT(__func__);
+    *report = {};
+    int rval = 0;
+    if (handle) {
+        niflydll::NifUsage nifUsage;
+        if (MeasureHandle(handle, nifUsage, report->weightMaps, report->skeletons, report->scratch)) {
+            report->header = nifUsage.header;
+            report->vertexData = nifUsage.vertexData;
+            report->skinData = nifUsage.skinData;
+            report->extraData = nifUsage.extraData;
+            report->otherBlocks = nifUsage.otherBlocks;
+            report->blockCount = nifUsage.blockCount;
+        }
+        else {
+            niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_ARGUMENT, nullptr,
+                "Not a nif, skin, skeleton or session handle");
+            rval = -1;
+        }
+    }
+    niflydll::ProcessUsage proc = niflydll::MeasureProcess();
+    report->processHeap = proc.heap;
+    report->processResident = proc.resident;
+    report->processPeakResident = proc.peakResident;
+    return rval;
+}
+
+int getBlockMemoryUsage(void* handle, char* buf, int buflen)
+/* Block count and bytes per block type held through a nif or session handle, as JSON:
+    {"BSTriShape": {"count": 2, "bytes": 51234}, ...}
+    Returns the full length of the JSON, which may be more than fits in buf, or -1 if
+    handle isn't a nif, skin, skeleton or session. */
+{
+    NIFLY_STAT(__func__);
+    niflydll::NifUsage nifUsage;
+    uint64_t weights = 0, skeletons = 0, scratch = 0;
+    if (!MeasureHandle(handle, nifUsage, weights, skeletons, scratch)) {
+        niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_ARGUMENT, nullptr,
+            "Not a nif, skin, skeleton or session handle");
+        return -1;
+    }
+    std::string json = niflydll::NifUsageToJson(nifUsage);
+    if (buf) CopyToBuffer(buf, buflen, json.c_str());
+    return int(json.length());
+}
+
 /* ***************************** COLLISION OBJECTS ***************************** */
 
 void* getCollision(void* nifref, void* noderef) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     nifly::NiNode* node = static_cast<nifly::NiNode*>(noderef);
@@ -1855,6 +2981,7 @@ void* getCollision(void* nifref, void* noderef) {
 };
 
 NIFLY_API void* addCollision(void* nifref, void* targetref, int body_index, int flags) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     nifly::bhkRigidBody* theBody = nif->GetHeader().GetBlock<bhkRigidBody>(body_index);
@@ -1875,6 +3002,7 @@ NIFLY_API void* addCollision(void* nifref, void* targetref, int body_index, int
 };
 
 NIFLY_API int getCollBlockname(void* node, char* buf, int buflen) {
+    NIFLY_STAT(__func__);
     nifly::bhkCollisionObject* theNode = static_cast<nifly::bhkCollisionObject*>(node);
     if (theNode) {
         std::string name = theNode->GetBlockName();
@@ -1888,6 +3016,7 @@ NIFLY_API int getCollBlockname(void* node, char* buf, int buflen) {
 }
 
 NIFLY_API int getCollBodyID(void* nifref, void* node) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     nifly::bhkCollisionObject* theNode = static_cast<nifly::bhkCollisionObject*>(node);
@@ -1898,6 +3027,7 @@ NIFLY_API int getCollBodyID(void* nifref, void* node) {
 }
 
 NIFLY_API int addRigidBody(void* nifref, const char* type, uint32_t collShapeIndex, BHKRigidBodyBuf* buf) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
 
@@ -1968,6 +3098,7 @@ NIFLY_API int addRigidBody(void* nifref, const char* type, uint32_t collShapeInd
 };
 
 NIFLY_API void* getCollTarget(void* nifref, void* node) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     nifly::bhkCollisionObject* theNode = static_cast<nifly::bhkCollisionObject*>(node);
@@ -1978,6 +3109,7 @@ NIFLY_API void* getCollTarget(void* nifref, void* node) {
 }
 
 NIFLY_API int getCollFlags(void* node) {
+    NIFLY_STAT(__func__);
     nifly::bhkCollisionObject* theNode = static_cast<nifly::bhkCollisionObject*>(node);
     if (theNode) {
         return theNode->flags;
@@ -1987,6 +3119,7 @@ NIFLY_API int getCollFlags(void* node) {
 }
 
 NIFLY_API int getCollBodyBlockname(void* nifref, int nodeIndex, char* buf, int buflen) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     nifly::bhkRigidBody* theBody = hdr.GetBlock<bhkRigidBody>(nodeIndex);
@@ -2007,6 +3140,7 @@ NIFLY_API int getRigidBodyProps(void* nifref, int nodeIndex, BHKRigidBodyBuf* bu
     Return the rigid body details. Return value = 1 if the node is a rigid body, 0 if not 
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     nifly::bhkWorldObject* theWO = hdr.GetBlock<bhkWorldObject>(nodeIndex);
@@ -2076,6 +3210,7 @@ NIFLY_API int getRigidBodyProps(void* nifref, int nodeIndex, BHKRigidBodyBuf* bu
 }
 
 NIFLY_API int getRigidBodyShapeID(void* nifref, int nodeIndex) {
+    NIFLY_STAT(__func__);
     /* Returns the block index of the collision shape */
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
@@ -2087,6 +3222,7 @@ NIFLY_API int getRigidBodyShapeID(void* nifref, int nodeIndex) {
 }
 
 NIFLY_API int getCollShapeBlockname(void* nifref, int nodeIndex, char* buf, int buflen) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     nifly::bhkShape* theBody = hdr.GetBlock<bhkShape>(nodeIndex);
@@ -2108,6 +3244,7 @@ NIFLY_API int getCollConvexVertsShapeProps(void* nifref, int nodeIndex, BHKConve
     0 if not
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     nifly::bhkConvexVerticesShape* sh = hdr.GetBlock<bhkConvexVerticesShape>(nodeIndex);
@@ -2129,6 +3266,7 @@ NIFLY_API int getCollConvexVertsShapeProps(void* nifref, int nodeIndex, BHKConve
 
 NIFLY_API int addCollConvexVertsShape(void* nifref, const BHKConvexVertsShapeBuf* buf, 
         float* verts, int vertcount, float* normals, int normcount) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
 
@@ -2153,6 +3291,7 @@ NIFLY_API int getCollShapeVerts(void* nifref, int nodeIndex, float* buf, int buf
     buflen = number of verts the buffer can receive, so buf must be 4x this size.
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     int vertCount = 0;
@@ -2179,6 +3318,7 @@ NIFLY_API int getCollShapeNormals(void* nifref, int nodeIndex, float* buf, int b
     buflen = number of verts the buffer can receive, so buf must be 4x this size.
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     int vertCount = 0;
@@ -2205,6 +3345,7 @@ NIFLY_API int getCollBoxShapeProps(void* nifref, int nodeIndex, BHKBoxShapeBuf*
     0 if not
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     nifly::bhkBoxShape* sh = hdr.GetBlock<bhkBoxShape>(nodeIndex);
@@ -2222,6 +3363,7 @@ NIFLY_API int getCollBoxShapeProps(void* nifref, int nodeIndex, BHKBoxShapeBuf*
 }
 
 NIFLY_API int addCollBoxShape(void* nifref, const BHKBoxShapeBuf* buf) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
 
@@ -2241,6 +3383,7 @@ NIFLY_API int getCollListShapeProps(void* nifref, int nodeIndex, BHKListShapeBuf
     0 if not
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     nifly::bhkListShape* sh = hdr.GetBlock<bhkListShape>(nodeIndex);
@@ -2264,6 +3407,7 @@ NIFLY_API int getCollListShapeChildren(void* nifref, int nodeIndex, uint32_t* bu
     Return the collision shape children.
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     int childCount = 0;
@@ -2284,6 +3428,7 @@ NIFLY_API int getCollListShapeChildren(void* nifref, int nodeIndex, uint32_t* bu
 }
 
 NIFLY_API int addCollListShape(void* nifref, const BHKListShapeBuf* buf) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
 
@@ -2300,6 +3445,7 @@ NIFLY_API int addCollListShape(void* nifref, const BHKListShapeBuf* buf) {
 };
 
 NIFLY_API void addCollListChild(void* nifref, const uint32_t id, uint32_t child_id) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     bhkListShape* collList = hdr.GetBlock<bhkListShape>(id);
@@ -2314,6 +3460,7 @@ NIFLY_API int getCollConvexTransformShapeProps(
     0 if not
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     nifly::bhkConvexTransformShape* sh = hdr.GetBlock<bhkConvexTransformShape>(nodeIndex);
@@ -2331,6 +3478,7 @@ NIFLY_API int getCollConvexTransformShapeProps(
 }
 
 NIFLY_API int getCollConvexTransformShapeChildID(void* nifref, int nodeIndex) {
+    NIFLY_STAT(__func__);
     /* Returns the block index of the collision shape */
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
@@ -2342,6 +3490,7 @@ NIFLY_API int getCollConvexTransformShapeChildID(void* nifref, int nodeIndex) {
 }
 
 NIFLY_API int addCollConvexTransformShape(void* nifref, const BHKConvexTransformShapeBuf* buf) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
 
@@ -2358,6 +3507,7 @@ NIFLY_API int addCollConvexTransformShape(void* nifref, const BHKConvexTransform
 
 NIFLY_API void setCollConvexTransformShapeChild(
         void* nifref, const uint32_t id, uint32_t child_id) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     bhkConvexTransformShape* cts = hdr.GetBlock<bhkConvexTransformShape>(id);
@@ -2371,6 +3521,7 @@ NIFLY_API int getCollCapsuleShapeProps(void* nifref, int nodeIndex, BHKCapsuleSh
     0 if not
     */
 {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
     nifly::bhkCapsuleShape* sh = hdr.GetBlock<bhkCapsuleShape>(nodeIndex);
@@ -2389,6 +3540,7 @@ NIFLY_API int getCollCapsuleShapeProps(void* nifref, int nodeIndex, BHKCapsuleSh
 }
 
 NIFLY_API int addCollCapsuleShape(void* nifref, const BHKCapsuleShapeBuf* buf) {
+    NIFLY_STAT(__func__);
     NifFile* nif = static_cast<NifFile*>(nifref);
     NiHeader hdr = nif->GetHeader();
 
@@ -2,9 +2,12 @@
 #pragma once
 #include <string>
 #include "Object3d.hpp"
+#include "Logger.hpp"
 
 
-#ifdef NIFLYDLL_EXPORTS
+#if !defined(_WIN32)
+	#define NIFLY_API __attribute__((visibility("default")))
+#elif defined(NIFLYDLL_EXPORTS)
 	#define NIFLY_API __declspec(dllexport)
 #else
 	#define NIFLY_API __declspec(dllimport)
@@ -26,6 +29,53 @@ struct BoneWeight {
 	float weight;
 };
 
+struct SpatialHitBuf {
+	int shape;			// Index into the shapes the BVH was built from; -1 for no hit
+	uint32_t tri;
+	float point[3];
+	float bary[3];
+	float distance;
+};
+
+struct MemoryReport {
+	uint64_t header;			// Nif header and string table
+	uint64_t vertexData;		// Geometry blocks
+	uint64_t skinData;			// Skin instances, skin data and partitions
+	uint64_t extraData;			// Extra data blocks, cloth included
+	uint64_t otherBlocks;
+	uint64_t blockCount;
+	uint64_t weightMaps;		// Skin bone lists and weights
+	uint64_t skeletons;			// Skeletons, with the reference nif each one loads
+	uint64_t scratch;			// Session arena
+	uint64_t processHeap;		// The rest are for the whole process
+	uint64_t processResident;
+	uint64_t processPeakResident;
+};
+
+struct VertexBoneWeightBuf {
+	uint32_t vertex;
+	uint16_t bone;				// Index into ShapeSplitExtrasBuf::boneNames
+	float weight;
+};
+
+/* What createNifShapesFromData carries into each piece besides positions, UVs and
+	normals. Leave any of it null or 0. */
+struct ShapeSplitExtrasBuf {
+	const float* colors;					// (r, g, b, a) for each input vert
+	void* skin;								// Skin to weight the pieces in, from createSkinForNif
+	const nifly::MatTransform* globalToSkin;	// For each weighted piece; null to leave nifly's
+	int boneCount;
+	const char* const* boneNames;
+	const nifly::MatTransform* boneXforms;	// Transform to parent of each bone; null to take them from the skeleton
+	const char* const* boneParents;			// Parent name of each bone; null, or null entries, for none
+	const VertexBoneWeightBuf* weights;
+	int weightCount;
+	const uint16_t* partData;				// (flags, partID) pairs, as for setPartitions
+	int partCount;
+	const uint16_t* triParts;				// Index into partData for each input tri
+	int bonesPerPartition;					// As for setPartitions
+};
+
 extern "C" NIFLY_API const int* getVersion();
 extern "C" NIFLY_API void* load(const char8_t* filename);
 extern "C" NIFLY_API void* getRoot(void* f);
@@ -50,6 +100,8 @@ extern "C" NIFLY_API void* makeGameSkeletonInstance(const char* gameName);
 extern "C" NIFLY_API void* makeSkeletonInstance(const char* skelPath, const char* rootName);
 extern "C" NIFLY_API void* loadSkinForNif(void* nifRef, const char* game);
 extern "C" NIFLY_API void* loadSkinForNifSkel(void* nifRef, void* skel);
+extern "C" NIFLY_API void destroySkin(void* anim);
+extern "C" NIFLY_API void destroySkeleton(void* skel);
 extern "C" NIFLY_API bool getShapeGlobalToSkin(void* nifRef, void* shapeRef, float* xform);
 extern "C" NIFLY_API void getGlobalToSkin(void* nifSkinRef, void* shapeRef, void* xform);
 extern "C" NIFLY_API int hasSkinInstance(void* shapeRef);
@@ -63,6 +115,7 @@ extern "C" NIFLY_API int getNodeBlockname(void* node, char* buf, int buflen);
 extern "C" NIFLY_API int getNodeFlags(void* node);
 extern "C" NIFLY_API void setNodeFlags(void* node, int theFlags);
 extern "C" NIFLY_API int getNodeName(void* theNode, char* buf, int buflen);
+extern "C" NIFLY_API void setNodeName(void* node, const char* name);
 extern "C" NIFLY_API void* getNodeParent(void* theNif, void* node);
 extern "C" NIFLY_API void getNodeXformToGlobal(void* anim, const char* boneName, nifly::MatTransform* xformBuf);
 extern "C" NIFLY_API void* createNif(const char* targetGame, int rootType, const char* rootName);
@@ -75,6 +128,17 @@ extern "C" NIFLY_API void* createNifShapeFromData(void* parentNif,
 	const uint16_t * tris, int triCount,
 	uint16_t * optionsPtr = nullptr,
 	void* parentRef = nullptr);
+extern "C" NIFLY_API int planShapeSplit(const float* verts, int vertCount, const uint32_t* tris, int triCount, int maxVerts, int maxTris, int* triPiece);
+extern "C" NIFLY_API int createNifShapesFromData(void* parentNif, const char* shapeName, const float* verts, const float* uv_points, const float* norms, int vertCount, const uint32_t* tris, int triCount, uint16_t* optionsPtr, void* parentRef, void** shapesOut, int shapesLen, uint32_t* vertMap, int vertMapLen, uint32_t* triMap, const ShapeSplitExtrasBuf* extras);
+extern "C" NIFLY_API int optimizeShapeVertexCache(void* nifref, void* shaperef, void* animref, int cacheSize, uint32_t* vertOrder, int vertOrderLen, float* acmr);
+extern "C" NIFLY_API int decimateShapes(void* nifref, void** shapes, int shapeCount, float targetRatio, uint32_t options, void* outNifRef, void** shapesOut);
+extern "C" NIFLY_API void* decimateShape(void* nifref, void* shaperef, float targetRatio, uint32_t options, void* outNifRef);
+extern "C" NIFLY_API int mergeShapesByMaterial(void* nifref, void** shapesOut, int outLen);
+extern "C" NIFLY_API int splitShapeByConnectivity(void* nifref, void* shaperef, uint32_t mode, void** shapesOut, int outLen);
+extern "C" NIFLY_API int weldShapeVerts(void* nifref, void* shaperef, const float* tolerances, uint32_t* remap, int remapLen);
+extern "C" NIFLY_API int unifySeamNormals(void** nifs, void** shapes, int shapeCount, int master, float tolerance);
+extern "C" NIFLY_API void calcShapeNormals(void* nifref, void* shaperef, int smooth, float smoothAngle);
+extern "C" NIFLY_API int getShapeAdjacency(void* nifref, void* shaperef, int table, uint32_t* buf, int bufLen);
 extern "C" NIFLY_API void setTransform(void* theShape, void* buf);
 extern "C" NIFLY_API void* addNode(void* f, const char* name, const nifly::MatTransform* xf, void* parent);
 extern "C" NIFLY_API void skinShape(void* f, void* shapeRef);
@@ -83,13 +147,14 @@ extern "C" NIFLY_API void setShapeVertWeights(void* theFile, void* theShape, int
 extern "C" NIFLY_API void setShapeBoneWeights(void* theFile, void* theShape, int boneIdx, VertexWeightPair * weights, int weightsLen);
 extern "C" NIFLY_API void setShapeBoneIDList(void* f, void* shapeRef, int* boneIDList, int listLen);
 extern "C" NIFLY_API int saveNif(void* the_nif, const char8_t* filename);
+extern "C" NIFLY_API int convertNifGame(void* nifref, const char* targetGame);
 extern "C" NIFLY_API int segmentCount(void* nifref, void* shaperef);
 extern "C" NIFLY_API int getSegmentFile(void* nifref, void* shaperef, char* buf, int buflen);
 extern "C" NIFLY_API int getSegments(void* nifref, void* shaperef, int* segments, int segLen);
 extern "C" NIFLY_API int getSubsegments(void* nifref, void* shaperef, int segID, uint32_t* segments, int segLen);
 extern "C" NIFLY_API int getPartitions(void* nifref, void* shaperef, uint16_t* partitions, int partLen);
 extern "C" NIFLY_API int getPartitionTris(void* nifref, void* shaperef, uint16_t* tris, int triLen);
-extern "C" NIFLY_API void setPartitions(void* nifref, void* shaperef, uint16_t * partData, int partDataLen, uint16_t * tris, int triLen);
+extern "C" NIFLY_API void setPartitions(void* nifref, void* shaperef, uint16_t * partData, int partDataLen, uint16_t * tris, int triLen, int bonesPerPartition = 0);
 extern "C" NIFLY_API void setSegments(void* nifref, void* shaperef, uint16_t * segData, int segDataLen, uint32_t * subsegData, int subsegDataLen, uint16_t * tris, int triLen, const char* filename);
 extern "C" NIFLY_API int getColorsForShape(void* nifref, void* shaperef, float* colors, int colorLen);
 extern "C" NIFLY_API void setColorsForShape(void* nifref, void* shaperef, float* colors, int colorLen);
@@ -103,7 +168,14 @@ extern "C" NIFLY_API void addBoneToShape(void * anim, void * theShape, const cha
 extern "C" NIFLY_API void setShapeGlobalToSkinXform(void* animPtr, void* shapePtr, void* gtsXformPtr);
 extern "C" NIFLY_API void setShapeWeights(void * anim, void * theShape, const char* boneName,
 	VertexWeightPair * vertWeights, int vertWeightLen, nifly::MatTransform * skinToBoneXform);
-extern "C" NIFLY_API void writeSkinToNif(void* animref);
+extern "C" NIFLY_API int transferWeights(void* srcNifRef, void* srcShapeRef, void* destAnim, void* destShapeRef, uint32_t options, float maxDistance);
+extern "C" NIFLY_API int conformMorphs(void* refNifRef, void* refShapeRef, void* nifRef, void* shapeRef, const float* refDeltas, int morphCount, float radius, int neighbors, float* deltasOut);
+extern "C" NIFLY_API int findClipping(void* bodyNifRef, void* bodyShapeRef, void* nifRef, void* shapeRef, float maxDepth, uint32_t options, int* vertsOut, float* depthOut, int outLen);
+extern "C" NIFLY_API void* buildShapeBVH(void* nifRef, void** shapes, int shapeCount);
+extern "C" NIFLY_API void destroyShapeBVH(void* bvhRef);
+extern "C" NIFLY_API int raycast(void* bvhRef, const float* origins, const float* dirs, int count, float maxDistance, SpatialHitBuf* hits);
+extern "C" NIFLY_API int closestPoint(void* bvhRef, const float* points, int count, float maxDistance, SpatialHitBuf* hits);
+extern "C" NIFLY_API void writeSkinToNif(void* animref, int bonesPerPartition = 0);
 extern "C" NIFLY_API int saveSkinnedNif(void* animref, const char8_t* filepath);
 
 /* ********************* SHADERS ***************** */
@@ -430,10 +502,37 @@ extern "C" NIFLY_API void setFurnMarkers(void* nifref, int buflen, FurnitureMark
 extern "C" NIFLY_API int getBSXFlags(void* nifref, int* buf);
 extern "C" NIFLY_API void setBSXFlags(void* nifref, const char* name, uint32_t flags);
 extern "C" NIFLY_API void setBGExtraData(void* nifref, void* shaperef, char* name, char* buf, int controlsBaseSkel);
+extern "C" NIFLY_API int removeExtraData(void* nifref, void* shaperef, const char* name);
+
+/* ********************* SESSIONS ********************* */
+extern "C" NIFLY_API void* createSession();
+extern "C" NIFLY_API void* setSession(void* session);
+extern "C" NIFLY_API void destroySession(void* session);
+extern "C" NIFLY_API void* sessionAlloc(void* session, int bytes);
+
+/* ********************* HANDLES ********************* */
+extern "C" NIFLY_API uint64_t getHandle(void* obj);
+extern "C" NIFLY_API uint64_t getBlockHandle(void* nifref, void* block);
+extern "C" NIFLY_API void* resolveHandle(uint64_t handle);
+extern "C" NIFLY_API int resolveHandles(const uint64_t* handles, int count, void** out);
+extern "C" NIFLY_API int getShapeIds(uint64_t nifHandle, uint32_t* ids, int len);
+extern "C" NIFLY_API void* buildShapeBVHFromIds(uint64_t nifHandle, const uint32_t* shapeIds, int count);
 
 /* ********************* ERROR REPORTING ********************* */
 extern "C" NIFLY_API void clearMessageLog();
 extern "C" NIFLY_API int getMessageLog(char* buf, int buflen);
+extern "C" NIFLY_API int getLogRecords(uint64_t* cursor, niflydll::LogEntry* buf, int buflen);
+extern "C" NIFLY_API uint32_t getLogThreadId();
+extern "C" NIFLY_API void setLogLevel(int level);
+
+/* ********************* STATISTICS ********************* */
+extern "C" NIFLY_API void enableStats(int on);
+extern "C" NIFLY_API int getStats(char* buf, int buflen);
+extern "C" NIFLY_API void resetStats();
+extern "C" NIFLY_API int startTrace(const char8_t* filename);
+extern "C" NIFLY_API int stopTrace();
+extern "C" NIFLY_API int getMemoryUsage(void* handle, MemoryReport* report);
+extern "C" NIFLY_API int getBlockMemoryUsage(void* handle, char* buf, int buflen);
 
 /* ********************* COLLISIONS ********************* */
 extern "C" NIFLY_API void* getCollision(void* nifref, void* noderef);
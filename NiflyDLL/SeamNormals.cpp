@@ -0,0 +1,145 @@
+/*
+	Seam normal unification.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include "NifFile.hpp"
+#include "GridHash.hpp"
+#include "NiflyFunctions.hpp"
+#include "NiflyParallel.hpp"
+#include "MeshAdjacency.hpp"
+#include "SeamNormals.hpp"
+
+using namespace nifly;
+
+namespace {
+	struct ShapeSeamData {
+		MatTransform toGlobal;
+		std::vector<Vector3> verts;			// Global space
+		std::vector<Vector3> normals;		// Global space
+		std::vector<Vector3> localNormals;	// As they are in the shape
+		std::vector<uint32_t> boundary;		// Verts on an edge with only one tri
+		std::vector<uint32_t> changed;
+	};
+}
+
+int UnifySeamNormals(const std::vector<SeamShape>& shapes, int master, float tolerance)
+{
+	std::vector<ShapeSeamData> data(shapes.size());
+	niflydll::ParallelFor(shapes.size(), [&](size_t s) {
+		NifFile* nif = shapes[s].nif;
+		NiShape* shape = shapes[s].shape;
+		const std::vector<Vector3>* normals = nif->GetNormalsForShape(shape);
+		if (!normals)
+			return;
+		ShapeSeamData& d = data[s];
+		d.toGlobal = CalcShapeTransformToGlobal(nif, shape);
+		nif->GetVertsForShape(shape, d.verts);
+		if (normals->size() != d.verts.size()) {
+			d.verts.clear();
+			return;
+		}
+		for (auto& v : d.verts)
+			v = d.toGlobal.ApplyTransform(v);
+		d.localNormals = *normals;
+		for (auto& n : *normals) {
+			Vector3 g = d.toGlobal.ApplyTransformToDir(n);
+			g.Normalize();
+			d.normals.push_back(g);
+		}
+
+		std::shared_ptr<const MeshAdjacency> adj = GetShapeAdjacency(nif, shape);
+		std::vector<char> onBoundary(d.verts.size(), 0);
+		for (size_t e = 0; e < adj->EdgeCount(); e++)
+			if (adj->EdgeTriCount(e) == 1)
+				onBoundary[adj->edges[e * 2]] = onBoundary[adj->edges[e * 2 + 1]] = 1;
+		for (uint32_t v = 0; v < onBoundary.size(); v++)
+			if (onBoundary[v])
+				d.boundary.push_back(v);
+		});
+
+	// Group coincident boundary verts. Each vert joins the first group whose first vert
+	// is within tolerance; cells are at least tolerance-sized so that's in a neighbouring
+	// cell.
+	struct Member { uint32_t shape, vert; };
+	std::vector<std::vector<Member>> groups;
+	std::unordered_map<GridCell, std::vector<uint32_t>, GridCellHash> grid;
+	float maxCoord = 0.0f;
+	for (auto& d : data)
+		maxCoord = std::max(maxCoord, GridMaxCoord(d.verts));
+	float cellSize = GridCellSize(tolerance, maxCoord);
+	float tol2 = tolerance * tolerance;
+	for (uint32_t s = 0; s < data.size(); s++)
+		for (uint32_t v : data[s].boundary) {
+			const Vector3& p = data[s].verts[v];
+			GridCell c = GridCellOf(p, cellSize);
+			int found = -1;
+			for (int dx = -1; dx <= 1 && found < 0; dx++)
+				for (int dy = -1; dy <= 1 && found < 0; dy++)
+					for (int dz = -1; dz <= 1 && found < 0; dz++) {
+						auto it = grid.find(c.Offset(dx, dy, dz));
+						if (it == grid.end())
+							continue;
+						for (uint32_t g : it->second) {
+							const Member& first = groups[g][0];
+							if (data[first.shape].verts[first.vert].DistanceSquaredTo(p) <= tol2) {
+								found = int(g);
+								break;
+							}
+						}
+					}
+			if (found < 0) {
+				found = int(groups.size());
+				groups.emplace_back();
+				grid[c].push_back(uint32_t(found));
+			}
+			groups[found].push_back({ s, v });
+		}
+
+	int changedVerts = 0;
+	for (auto& group : groups) {
+		bool crossShape = false;
+		bool hasMaster = false;
+		for (auto& m : group) {
+			crossShape |= m.shape != group[0].shape;
+			hasMaster |= int(m.shape) == master;
+		}
+		if (!crossShape)
+			continue;
+
+		Vector3 normal;
+		for (auto& m : group)
+			if (!hasMaster || int(m.shape) == master)
+				normal += data[m.shape].normals[m.vert];
+		if (normal.IsZero())
+			continue;
+		normal.Normalize();
+
+		for (auto& m : group) {
+			Vector3& n = data[m.shape].normals[m.vert];
+			if (n.IsNearlyEqualTo(normal))
+				continue;
+			n = normal;
+			data[m.shape].changed.push_back(m.vert);
+			changedVerts++;
+		}
+	}
+
+	// Writing back changes the nifs, so that's done one shape at a time.
+	for (size_t s = 0; s < shapes.size(); s++) {
+		ShapeSeamData& d = data[s];
+		if (d.changed.empty())
+			continue;
+		MatTransform toShape = d.toGlobal.InverseTransform();
+		for (uint32_t v : d.changed) {
+			d.localNormals[v] = toShape.ApplyTransformToDir(d.normals[v]);
+			d.localNormals[v].Normalize();
+		}
+		shapes[s].nif->SetNormalsForShape(shapes[s].shape, d.localNormals);
+		shapes[s].nif->CalcTangentsForShape(shapes[s].shape);
+	}
+
+	return changedVerts;
+}
@@ -0,0 +1,22 @@
+/*
+	Seam normal unification: make the normals match where shapes meet, such as at the
+	neck and wrist seams between head, body and hands, so the seams don't show in game.
+	*/
+#include <vector>
+#include "BasicTypes.hpp"
+#include "NifFile.hpp"
+
+#pragma once
+
+struct SeamShape {
+	nifly::NifFile* nif;
+	nifly::NiShape* shape;
+};
+
+/* Find boundary vertices of different shapes that coincide, within tolerance, in global
+	space and give them all the same normal. If master is the index of one of the
+	shapes, seams it's part of take its normal; other seams, or all of them if master
+	is -1, get the average. Shapes are read and the seams worked out in parallel over
+	the shapes; tangents are recalculated for shapes that change.
+	Returns the number of vertices changed. */
+int UnifySeamNormals(const std::vector<SeamShape>& shapes, int master, float tolerance);
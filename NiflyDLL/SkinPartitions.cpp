@@ -0,0 +1,254 @@
+/*
+	Bone-limited skin partitioning.
+
+	Triangles are clustered greedily: a cluster starts from the first unassigned
+	triangle and grows across shared vertices as long as no new bones are needed.
+	Once it can't grow for free it picks up any other triangle whose bones it already
+	has, then adds the triangle needing the fewest new bones (preferring ones touching
+	the cluster) as long as it stays under the limit.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <bitset>
+#include <climits>
+#include "NifFile.hpp"
+#include "SkinPartitions.hpp"
+
+using namespace nifly;
+
+int DefaultBonesPerPartition(NifFile* nif) {
+	NiVersion& version = nif->GetHeader().GetVersion();
+	if (version.IsSK() || version.IsSSE())
+		return 80;
+	if (version.IsFO3())
+		return 18;
+	return 0;
+}
+
+namespace {
+	int CountNewBones(const uint64_t* triMask, const std::vector<uint64_t>& clusterMask) {
+		int n = 0;
+		for (size_t w = 0; w < clusterMask.size(); w++)
+			n += int(std::bitset<64>(triMask[w] & ~clusterMask[w]).count());
+		return n;
+	}
+}
+
+std::vector<int> ClusterTrisByBones(
+	const std::vector<Triangle>& tris,
+	const std::vector<std::vector<uint16_t>>& triBones,
+	int maxBones)
+{
+	size_t triCount = tris.size();
+	std::vector<int> triCluster(triCount, -1);
+	if (triCount == 0)
+		return triCluster;
+
+	// Bone sets as bitmasks, one row of words per triangle.
+	int boneCount = 1;
+	for (auto& tb : triBones)
+		for (auto b : tb)
+			boneCount = std::max(boneCount, b + 1);
+	size_t words = (boneCount + 63) / 64;
+	std::vector<uint64_t> masks(triCount * words, 0);
+	for (size_t t = 0; t < triCount; t++)
+		for (auto b : triBones[t])
+			masks[t * words + b / 64] |= uint64_t(1) << (b % 64);
+
+	// Vertex -> triangle adjacency.
+	uint32_t vertCount = 0;
+	for (auto& t : tris)
+		vertCount = std::max<uint32_t>(vertCount, std::max({ t.p1, t.p2, t.p3 }) + 1u);
+	std::vector<uint32_t> vertStart(vertCount + 1, 0);
+	for (auto& t : tris) {
+		vertStart[t.p1 + 1]++;
+		vertStart[t.p2 + 1]++;
+		vertStart[t.p3 + 1]++;
+	}
+	for (uint32_t v = 0; v < vertCount; v++)
+		vertStart[v + 1] += vertStart[v];
+	std::vector<uint32_t> vertTris(triCount * 3);
+	std::vector<uint32_t> fill(vertStart.begin(), vertStart.end() - 1);
+	for (uint32_t t = 0; t < triCount; t++) {
+		vertTris[fill[tris[t].p1]++] = t;
+		vertTris[fill[tris[t].p2]++] = t;
+		vertTris[fill[tris[t].p3]++] = t;
+	}
+
+	std::vector<uint64_t> clusterMask(words);
+	std::vector<char> vertInCluster(vertCount, 0);
+	std::vector<uint32_t> clusterVerts;
+	std::vector<uint32_t> queue;
+	int clusterBones = 0;
+	int cluster = -1;
+	size_t firstFree = 0;
+
+	auto addTri = [&](uint32_t t) {
+		triCluster[t] = cluster;
+		for (size_t w = 0; w < words; w++)
+			clusterMask[w] |= masks[t * words + w];
+		for (uint16_t v : { tris[t].p1, tris[t].p2, tris[t].p3 }) {
+			if (!vertInCluster[v]) {
+				vertInCluster[v] = 1;
+				clusterVerts.push_back(v);
+			}
+		}
+		queue.push_back(t);
+	};
+
+	while (true) {
+		while (firstFree < triCount && triCluster[firstFree] >= 0)
+			firstFree++;
+		if (firstFree == triCount)
+			break;
+
+		cluster++;
+		std::fill(clusterMask.begin(), clusterMask.end(), 0);
+		for (auto v : clusterVerts)
+			vertInCluster[v] = 0;
+		clusterVerts.clear();
+		addTri(uint32_t(firstFree));
+		clusterBones = int(triBones[firstFree].size());
+
+		while (true) {
+			// Grow across shared vertices while no new bones are needed.
+			while (!queue.empty()) {
+				uint32_t t = queue.back();
+				queue.pop_back();
+				for (uint16_t v : { tris[t].p1, tris[t].p2, tris[t].p3 })
+					for (uint32_t i = vertStart[v]; i < vertStart[v + 1]; i++) {
+						uint32_t n = vertTris[i];
+						if (triCluster[n] < 0 && CountNewBones(&masks[n * words], clusterMask) == 0)
+							addTri(n);
+					}
+			}
+
+			// Take anything else that fits for free; otherwise find the cheapest
+			// triangle to add.
+			int best = -1;
+			int bestNew = INT_MAX;
+			bool bestTouches = false;
+			for (size_t t = firstFree; t < triCount; t++) {
+				if (triCluster[t] >= 0)
+					continue;
+				int newBones = CountNewBones(&masks[t * words], clusterMask);
+				if (newBones == 0) {
+					addTri(uint32_t(t));
+					continue;
+				}
+				if (clusterBones + newBones > maxBones)
+					continue;
+				bool touches = vertInCluster[tris[t].p1] || vertInCluster[tris[t].p2] || vertInCluster[tris[t].p3];
+				if (newBones < bestNew || (newBones == bestNew && touches && !bestTouches)) {
+					best = int(t);
+					bestNew = newBones;
+					bestTouches = touches;
+				}
+			}
+
+			if (!queue.empty())
+				continue;
+			if (best < 0)
+				break;
+			addTri(uint32_t(best));
+			clusterBones += bestNew;
+		}
+	}
+
+	return triCluster;
+}
+
+int OptimizeSkinPartitions(NifFile* nif, NiShape* shape, int maxBones) {
+	if (maxBones < 0)
+		maxBones = DefaultBonesPerPartition(nif);
+	if (maxBones <= 0)
+		return 0;
+
+	NiVector<BSDismemberSkinInstance::PartitionInfo> partInfos;
+	std::vector<int> triParts;
+	if (!nif->GetShapePartitions(shape, partInfos, triParts) || partInfos.empty())
+		return 0;
+
+	std::vector<Triangle> tris;
+	shape->GetTriangles(tris);
+	if (triParts.size() != tris.size())
+		return 0;
+
+	// Merge partitions split by an earlier pass: a continuation has the same
+	// partition ID as the one before it and doesn't start a new bone set.
+	NiVector<BSDismemberSkinInstance::PartitionInfo> merged;
+	std::vector<int> mergedIndex(partInfos.size());
+	for (size_t i = 0; i < partInfos.size(); i++) {
+		if (i > 0 && partInfos[i].partID == partInfos[i - 1].partID
+			&& !(partInfos[i].flags & PF_START_NET_BONESET)) {
+			mergedIndex[i] = int(merged.size()) - 1;
+			continue;
+		}
+		merged.push_back(partInfos[i]);
+		mergedIndex[i] = int(merged.size()) - 1;
+	}
+
+	// Bones used by each vertex: the skin partition keeps at most 4 per vertex.
+	std::vector<int> boneIDs;
+	nif->GetShapeBoneIDList(shape, boneIDs);
+	std::vector<std::vector<std::pair<float, uint16_t>>> vertWeights(shape->GetNumVertices());
+	for (int b = 0; b < int(boneIDs.size()); b++) {
+		std::unordered_map<uint16_t, float> weights;
+		nif->GetShapeBoneWeights(shape, b, weights);
+		for (auto& w : weights)
+			if (w.first < vertWeights.size() && w.second > 0.0f)
+				vertWeights[w.first].emplace_back(w.second, uint16_t(b));
+	}
+	std::vector<std::vector<uint16_t>> vertBones(vertWeights.size());
+	for (size_t v = 0; v < vertWeights.size(); v++) {
+		auto& vw = vertWeights[v];
+		std::stable_sort(vw.begin(), vw.end(), [](auto& a, auto& b) { return a.first > b.first; });
+		for (size_t i = 0; i < vw.size() && i < 4; i++)
+			vertBones[v].push_back(vw[i].second);
+	}
+
+	// Cluster each partition's triangles separately.
+	std::vector<std::vector<uint32_t>> partTris(merged.size());
+	for (uint32_t t = 0; t < tris.size(); t++) {
+		int p = triParts[t];
+		if (p < 0 || p >= int(mergedIndex.size()))
+			return 0;
+		partTris[mergedIndex[p]].push_back(t);
+	}
+
+	NiVector<BSDismemberSkinInstance::PartitionInfo> newInfos;
+	std::vector<int> newTriParts(tris.size());
+	for (size_t p = 0; p < merged.size(); p++) {
+		std::vector<Triangle> ptris;
+		std::vector<std::vector<uint16_t>> pbones;
+		for (auto t : partTris[p]) {
+			const Triangle& tri = tris[t];
+			std::vector<uint16_t> bones;
+			for (uint16_t v : { tri.p1, tri.p2, tri.p3 })
+				if (v < vertBones.size())
+					bones.insert(bones.end(), vertBones[v].begin(), vertBones[v].end());
+			std::sort(bones.begin(), bones.end());
+			bones.erase(std::unique(bones.begin(), bones.end()), bones.end());
+			ptris.push_back(tri);
+			pbones.push_back(std::move(bones));
+		}
+
+		std::vector<int> clusters = ClusterTrisByBones(ptris, pbones, maxBones);
+		int clusterCount = 1;
+		for (int c : clusters)
+			clusterCount = std::max(clusterCount, c + 1);
+
+		int base = int(newInfos.size());
+		for (int c = 0; c < clusterCount; c++) {
+			BSDismemberSkinInstance::PartitionInfo info = merged[p];
+			if (c > 0)
+				info.flags = PartitionFlags(info.flags & ~PF_START_NET_BONESET);
+			newInfos.push_back(info);
+		}
+		for (size_t i = 0; i < partTris[p].size(); i++)
+			newTriParts[partTris[p][i]] = base + clusters[i];
+	}
+
+	nif->SetShapePartitions(shape, newInfos, newTriParts, true);
+	return int(newInfos.size());
+}
@@ -0,0 +1,31 @@
+/*
+	Bone-limited skin partitioning. Splits each dismember partition into as few
+	bone sets as possible so the NiSkinPartition nifly builds from them stays under
+	the game's per-partition bone limit.
+	*/
+#include <vector>
+#include "BasicTypes.hpp"
+#include "NifFile.hpp"
+
+#pragma once
+
+/* Bone limit per skin partition for the nif's game: 80 for Skyrim, 18 for FO3/FNV.
+	Returns 0 for games whose skinning doesn't use bone-limited partitions. */
+int DefaultBonesPerPartition(nifly::NifFile* nif);
+
+/* Group the triangles of one dismember partition into clusters of at most maxBones
+	bones. triBones[i] is the sorted list of bones used by triangle i, tris are the
+	triangles themselves, used for adjacency. Returns the cluster index for each triangle.
+	Clusters are numbered in the order they are created, deterministically. */
+std::vector<int> ClusterTrisByBones(
+	const std::vector<nifly::Triangle>& tris,
+	const std::vector<std::vector<uint16_t>>& triBones,
+	int maxBones);
+
+/* Replace the shape's dismember partitions with bone-limited ones. Each partition is
+	split into clusters of at most maxBones bones (maxBones < 0 = game default); the pieces
+	keep the partition ID, and only the first keeps PF_START_NET_BONESET. Partitions
+	that were already split this way are merged back first, so the pass can be rerun.
+	Bone weights must already be on the nif. Call UpdateSkinPartitions afterwards.
+	Returns the new partition count, or 0 if the shape has no dismember partitions. */
+int OptimizeSkinPartitions(nifly::NifFile* nif, nifly::NiShape* shape, int maxBones);
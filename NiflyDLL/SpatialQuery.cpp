@@ -0,0 +1,107 @@
+/*
+	Spatial queries over nif geometry.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <atomic>
+#include "NifFile.hpp"
+#include "NiflyFunctions.hpp"
+#include "NiflyParallel.hpp"
+#include "SpatialQuery.hpp"
+
+using namespace nifly;
+
+namespace {
+	const size_t QUERY_BLOCK = 64;
+
+	void CopyHit(const MeshBVH::Hit& from, int shape, ShapeBVH::Hit& to) {
+		to.shape = shape;
+		to.tri = from.tri;
+		to.point = from.point;
+		std::copy(from.bary, from.bary + 3, to.bary);
+		to.distance = from.distance;
+	}
+
+	template <typename Query>
+	int RunBatch(size_t count, ShapeBVH::Hit* hits, Query query) {
+		std::atomic<int> found = 0;
+		size_t blocks = (count + QUERY_BLOCK - 1) / QUERY_BLOCK;
+		niflydll::ParallelFor(blocks, [&](size_t b) {
+			int blockFound = 0;
+			size_t end = std::min(count, (b + 1) * QUERY_BLOCK);
+			for (size_t i = b * QUERY_BLOCK; i < end; i++) {
+				hits[i] = ShapeBVH::Hit();
+				if (query(i, hits[i]))
+					blockFound++;
+			}
+			found += blockFound;
+			});
+		return found;
+	}
+}
+
+void ShapeBVH::Build(NifFile* nif, const std::vector<NiShape*>& shapes)
+{
+	meshes.clear();
+	meshes.resize(shapes.size());
+	niflydll::ParallelFor(shapes.size(), [&](size_t s) {
+		MatTransform toGlobal = CalcShapeTransformToGlobal(nif, shapes[s]);
+		std::vector<Vector3> verts;
+		nif->GetVertsForShape(shapes[s], verts);
+		for (auto& v : verts)
+			v = toGlobal.ApplyTransform(v);
+		std::vector<Triangle> tris;
+		shapes[s]->GetTriangles(tris);
+		meshes[s].Build(verts, tris);
+		});
+}
+
+bool ShapeBVH::Raycast(const Vector3& origin, const Vector3& dir, Hit& hit, float maxDistance) const
+{
+	float len = dir.length();
+	if (len == 0.0f)
+		return false;
+	Vector3 unit = dir / len;
+
+	bool found = false;
+	float best = maxDistance;
+	for (size_t s = 0; s < meshes.size(); s++) {
+		MeshBVH::Hit h;
+		if (meshes[s].Raycast(origin, unit, h, best)) {
+			best = h.distance;
+			CopyHit(h, int(s), hit);
+			found = true;
+		}
+	}
+	return found;
+}
+
+bool ShapeBVH::ClosestPoint(const Vector3& p, Hit& hit, float maxDistance) const
+{
+	bool found = false;
+	float best = maxDistance;
+	for (size_t s = 0; s < meshes.size(); s++) {
+		MeshBVH::Hit h;
+		if (meshes[s].ClosestPoint(p, h, best)) {
+			best = h.distance;
+			CopyHit(h, int(s), hit);
+			found = true;
+		}
+	}
+	return found;
+}
+
+int ShapeBVH::RaycastBatch(const Vector3* origins, const Vector3* dirs, size_t count,
+	float maxDistance, Hit* hits) const
+{
+	return RunBatch(count, hits, [&](size_t i, Hit& hit) {
+		return Raycast(origins[i], dirs[i], hit, maxDistance);
+		});
+}
+
+int ShapeBVH::ClosestPointBatch(const Vector3* points, size_t count, float maxDistance, Hit* hits) const
+{
+	return RunBatch(count, hits, [&](size_t i, Hit& hit) {
+		return ClosestPoint(points[i], hit, maxDistance);
+		});
+}
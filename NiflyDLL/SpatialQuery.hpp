@@ -0,0 +1,46 @@
+/*
+	Spatial queries over a nif's geometry: ray casts and closest points against a set of
+	shapes in global space, for marker placement, furniture marker checks and the like.
+	*/
+#include <cfloat>
+#include <vector>
+#include "BasicTypes.hpp"
+#include "NifFile.hpp"
+#include "MeshBVH.hpp"
+
+#pragma once
+
+class ShapeBVH {
+public:
+	struct Hit {
+		int shape = -1;			// Index into the shapes the BVH was built from; -1 for no hit
+		uint32_t tri = 0xFFFFFFFF;
+		nifly::Vector3 point;
+		float bary[3] = { 0.0f, 0.0f, 0.0f };
+		float distance = FLT_MAX;
+	};
+
+	/* Build over the shapes, in global space. Each shape gets its own MeshBVH, since
+		the shapes together can be past 16-bit vertex indices. */
+	void Build(nifly::NifFile* nif, const std::vector<nifly::NiShape*>& shapes);
+
+	size_t ShapeCount() const { return meshes.size(); }
+
+	/* First hit along the ray, no further than maxDistance. dir is normalized, so
+		hit.distance is in nif units. */
+	bool Raycast(const nifly::Vector3& origin, const nifly::Vector3& dir, Hit& hit,
+		float maxDistance = FLT_MAX) const;
+
+	/* Closest point on any of the shapes, no further than maxDistance. */
+	bool ClosestPoint(const nifly::Vector3& p, Hit& hit, float maxDistance = FLT_MAX) const;
+
+	/* Batched versions, run in parallel. hits receives one entry per query; misses have
+		shape -1. Return the number of hits. */
+	int RaycastBatch(const nifly::Vector3* origins, const nifly::Vector3* dirs, size_t count,
+		float maxDistance, Hit* hits) const;
+	int ClosestPointBatch(const nifly::Vector3* points, size_t count,
+		float maxDistance, Hit* hits) const;
+
+private:
+	std::vector<MeshBVH> meshes;
+};
@@ -0,0 +1,116 @@
+/*
+	Mesh splitting for the 16-bit index limit.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include "SplitMesh.hpp"
+
+using namespace nifly;
+
+std::vector<int> PlanMeshSplit(const std::vector<Vector3>& verts,
+	const std::vector<uint32_t>& tris, uint32_t maxVerts, uint32_t maxTris, int& pieceCount)
+{
+	pieceCount = 0;
+	size_t triCount = tris.size() / 3;
+	for (auto& v : tris)
+		if (v >= verts.size())
+			return {};
+
+	maxVerts = std::max(maxVerts, 3u);
+	maxTris = std::max(maxTris, 1u);
+
+	std::vector<Vector3> centers(triCount);
+	for (size_t t = 0; t < triCount; t++)
+		centers[t] = (verts[tris[t * 3]] + verts[tris[t * 3 + 1]] + verts[tris[t * 3 + 2]]) / 3.0f;
+
+	std::vector<uint32_t> order(triCount);
+	std::iota(order.begin(), order.end(), 0);
+	std::vector<int> triPiece(triCount, 0);
+
+	// Marks vertices already counted for the range being checked.
+	std::vector<uint32_t> seen(verts.size(), 0);
+	uint32_t stamp = 0;
+
+	// Depth first, lower half first, so pieces are numbered in a stable order.
+	std::vector<std::pair<size_t, size_t>> ranges;
+	if (triCount > 0)
+		ranges.emplace_back(0, triCount);
+	while (!ranges.empty()) {
+		auto [begin, end] = ranges.back();
+		ranges.pop_back();
+
+		size_t count = end - begin;
+		stamp++;
+		size_t used = 0;
+		for (size_t i = begin; i < end; i++) {
+			for (int c = 0; c < 3; c++) {
+				uint32_t v = tris[order[i] * 3 + c];
+				if (seen[v] != stamp) {
+					seen[v] = stamp;
+					used++;
+				}
+			}
+		}
+		if ((count <= maxTris && used <= maxVerts) || count == 1) {
+			for (size_t i = begin; i < end; i++)
+				triPiece[order[i]] = pieceCount;
+			pieceCount++;
+			continue;
+		}
+
+		Vector3 lo = centers[order[begin]];
+		Vector3 hi = lo;
+		for (size_t i = begin; i < end; i++) {
+			const Vector3& c = centers[order[i]];
+			lo = Vector3(std::min(lo.x, c.x), std::min(lo.y, c.y), std::min(lo.z, c.z));
+			hi = Vector3(std::max(hi.x, c.x), std::max(hi.y, c.y), std::max(hi.z, c.z));
+		}
+		Vector3 size = hi - lo;
+		int axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z ? 1 : 2);
+
+		// Split in proportion to the number of pieces this range needs, so a mesh a
+		// little over the limit makes two pieces rather than four.
+		size_t needed = std::max((count + maxTris - 1) / maxTris, (used + maxVerts - 1) / maxVerts);
+		needed = std::max(needed, size_t(2));
+		size_t mid = begin + count * (needed / 2) / needed;
+		std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+			[&](uint32_t a, uint32_t b) {
+				return centers[a][axis] < centers[b][axis] || (centers[a][axis] == centers[b][axis] && a < b);
+			});
+		ranges.emplace_back(mid, end);
+		ranges.emplace_back(begin, mid);
+	}
+
+	return triPiece;
+}
+
+void ExtractMeshPiece(const std::vector<uint32_t>& tris, const std::vector<int>& triPiece, int piece,
+	std::vector<uint32_t>& vertMap, std::vector<Triangle>& pieceTris, std::vector<uint32_t>& triMap)
+{
+	vertMap.clear();
+	pieceTris.clear();
+	triMap.clear();
+
+	std::unordered_map<uint32_t, uint16_t> pieceIndex;
+	auto local = [&](uint32_t v) {
+		auto it = pieceIndex.find(v);
+		if (it != pieceIndex.end())
+			return it->second;
+		uint16_t idx = uint16_t(vertMap.size());
+		pieceIndex[v] = idx;
+		vertMap.push_back(v);
+		return idx;
+	};
+
+	for (size_t t = 0; t < triPiece.size(); t++) {
+		if (triPiece[t] != piece)
+			continue;
+		uint16_t p1 = local(tris[t * 3]);
+		uint16_t p2 = local(tris[t * 3 + 1]);
+		uint16_t p3 = local(tris[t * 3 + 2]);
+		pieceTris.emplace_back(p1, p2, p3);
+		triMap.push_back(uint32_t(t));
+	}
+}
@@ -0,0 +1,26 @@
+/*
+	Splitting of meshes too big for 16-bit vertex and triangle indices. Triangles are
+	divided into spatially coherent pieces that each fit; vertices on the boundary
+	between pieces are duplicated into each piece that uses them.
+	*/
+#include <vector>
+#include "BasicTypes.hpp"
+
+#pragma once
+
+const uint32_t MAX_SHAPE_VERTS = 0xFFFF;
+const uint32_t MAX_SHAPE_TRIS = 0xFFFF;
+
+/* Split the triangles (3 32-bit vertex indices each) into pieces of at most maxVerts
+	distinct vertices and maxTris triangles, by recursively cutting the triangle set
+	along its longest axis. Returns the piece index of each triangle, or an empty list if
+	a triangle references a vertex that doesn't exist. pieceCount receives the number of
+	pieces; a mesh that already fits is one piece. */
+std::vector<int> PlanMeshSplit(const std::vector<nifly::Vector3>& verts,
+	const std::vector<uint32_t>& tris, uint32_t maxVerts, uint32_t maxTris, int& pieceCount);
+
+/* Extract one piece of a split. vertMap receives the input index of each of the piece's
+	vertices, in order of first use; pieceTris receives the piece's triangles in piece
+	vertex indices, and triMap the input index of each of them. */
+void ExtractMeshPiece(const std::vector<uint32_t>& tris, const std::vector<int>& triPiece, int piece,
+	std::vector<uint32_t>& vertMap, std::vector<nifly::Triangle>& pieceTris, std::vector<uint32_t>& triMap);
@@ -11,13 +11,24 @@
 #include <vector>
 #include <unordered_map>
 #include <filesystem>
+#include <fstream>
+#include <thread>
+#ifdef _WIN32
 #include <libloaderapi.h>
+#endif
 #include <bitset>
 #include "CppUnitTest.h"
 #include "Object3d.hpp"
 #include "Anim.h"
 #include "NiflyFunctions.hpp"
 #include "NiflyWrapper.hpp"
+#include "SkinPartitions.hpp"
+#include "MeshAdjacency.hpp"
+#include "LooseParts.hpp"
+#include "MeshBVH.hpp"
+#include "NiflyStats.hpp"
+#include "NiflyTrace.hpp"
+#include "VertexWeld.hpp"
 #include "TestDLL.h"
 
 using namespace nifly;
@@ -35,11 +46,15 @@ DEFINE_ENUM_FLAG_OPERATORS(NifOptions)
 //static std::string curRootName;
 
 //std::filesystem::path testRoot(TEST_ROOT);
+#ifdef NIFLY_TEST_ROOT
+std::filesystem::path testRoot(NIFLY_TEST_ROOT);
+#else
 std::filesystem::path testRoot = std::filesystem::current_path()
 	.parent_path().parent_path().parent_path().parent_path() / "PyNifly/Pynifly/tests/";
+#endif
 
 bool TApproxEqual(float first, float second) {
-	return abs(first - second) < .001;
+	return std::abs(first - second) < .001;
 }
 bool TApproxEqual(Vector3 first, Vector3 second) {
 	return TApproxEqual(first.x, second.x)
@@ -3273,5 +3288,1123 @@ namespace NiflyDLLTests
 			int shapeCount = getShapes(nif, shapes, 100, 0);
 			Assert::IsTrue(shapeCount == 87, L"Found enough shapes");
 		};
+		TEST_METHOD(writeSkinDirtyOnly) {
+			/* Writing the skin only rewrites and re-partitions shapes that changed */
+			void* nif = load((testRoot / "Skyrim/test.nif").u8string().c_str());
+			AnimInfo* anim = static_cast<AnimInfo*>(loadSkinForNif(nif, "SKYRIM"));
+
+			Assert::IsTrue(anim->GetDirtyShapes().empty(), L"Freshly loaded skin is clean");
+
+			std::string bone = "NPC R Calf [RClf]";
+			std::unordered_map<uint16_t, float> weights;
+			anim->GetWeights("Armor", bone, weights);
+			Assert::IsFalse(weights.empty(), L"Armor has calf weights");
+			for (auto& w : weights) w.second = 0.5f;
+			anim->SetWeights("Armor", bone, weights);
+
+			Assert::IsTrue(anim->IsShapeDirty("Armor"), L"Changed shape is dirty");
+			Assert::IsFalse(anim->IsShapeDirty("MaleBody"), L"Unchanged shape is clean");
+
+			int rebuilt = WriteSkinToNif(anim);
+			Assert::AreEqual(1, rebuilt, L"Only the changed shape was re-partitioned");
+			Assert::IsTrue(anim->GetDirtyShapes().empty(), L"Writing clears dirty flags");
+			Assert::AreEqual(0, WriteSkinToNif(anim), L"Nothing to rewrite the second time");
+
+			saveNif(nif, (testRoot / "Out/writeSkinDirtyOnly.nif").u8string().c_str());
+
+			NifFile nifCheck(testRoot / "Out/writeSkinDirtyOnly.nif");
+			NiShape* armor = nifCheck.FindBlockByName<NiShape>("Armor");
+			std::vector<std::string> boneNames;
+			nifCheck.GetShapeBoneList(armor, boneNames);
+			int boneIdx = int(std::find(boneNames.begin(), boneNames.end(), bone) - boneNames.begin());
+			std::unordered_map<uint16_t, float> checkWeights;
+			nifCheck.GetShapeBoneWeights(armor, boneIdx, checkWeights);
+			Assert::AreEqual(weights.size(), checkWeights.size(), L"Weights written for every vertex");
+			for (auto& w : checkWeights)
+				Assert::IsTrue(TApproxEqual(w.second, 0.5), L"Changed weights were written");
+		};
+		TEST_METHOD(updatePartitionsParallel) {
+			/* Rebuilding skin partitions across threads gives the same result as one at a time */
+			NifFile nifSerial(testRoot / "Skyrim/test.nif");
+			NifFile nifParallel(testRoot / "Skyrim/test.nif");
+
+			for (auto& shape : nifSerial.GetShapes())
+				nifSerial.UpdateSkinPartitions(shape);
+			UpdateShapeSkinPartitions(&nifParallel, nifParallel.GetShapes());
+
+			Assert::AreEqual(nifSerial.GetHeader().GetNumBlocks(), nifParallel.GetHeader().GetNumBlocks(),
+				L"Same number of blocks");
+
+			for (auto& shape : nifSerial.GetShapes()) {
+				NiShape* other = nifParallel.FindBlockByName<NiShape>(shape->name.get());
+				auto skinA = nifSerial.GetHeader().GetBlock<NiSkinInstance>(shape->SkinInstanceRef()->index);
+				auto skinB = nifParallel.GetHeader().GetBlock<NiSkinInstance>(other->SkinInstanceRef()->index);
+				auto partA = nifSerial.GetHeader().GetBlock<NiSkinPartition>(skinA->skinPartitionRef.index);
+				auto partB = nifParallel.GetHeader().GetBlock<NiSkinPartition>(skinB->skinPartitionRef.index);
+				Assert::AreEqual(partA->partitions.size(), partB->partitions.size(), L"Same partition count");
+				for (size_t i = 0; i < partA->partitions.size(); i++) {
+					Assert::IsTrue(partA->partitions[i].bones == partB->partitions[i].bones, L"Same partition bones");
+					Assert::AreEqual(partA->partitions[i].numTriangles, partB->partitions[i].numTriangles, 
+						L"Same partition tris");
+				}
+			}
+		};
+		TEST_METHOD(optimizePartitionsBoneLimit) {
+			/* Partitions can be split by bone set to respect a bone limit */
+			NifFile nif(testRoot / "Skyrim/test.nif");
+			NiShape* body = nif.FindBlockByName<NiShape>("MaleBody");
+
+			NiVector<BSDismemberSkinInstance::PartitionInfo> oldParts;
+			std::vector<int> oldTriParts;
+			nif.GetShapePartitions(body, oldParts, oldTriParts);
+
+			const int limit = 12;
+			int partCount = OptimizeSkinPartitions(&nif, body, limit);
+			Assert::IsTrue(partCount >= int(oldParts.size()), L"Have at least the original partitions");
+			nif.UpdateSkinPartitions(body);
+
+			NiVector<BSDismemberSkinInstance::PartitionInfo> newParts;
+			std::vector<int> newTriParts;
+			nif.GetShapePartitions(body, newParts, newTriParts);
+			Assert::AreEqual(partCount, int(newParts.size()), L"Partitions were written");
+			for (size_t t = 0; t < oldTriParts.size(); t++)
+				Assert::AreEqual(oldParts[oldTriParts[t]].partID, newParts[newTriParts[t]].partID, 
+					L"Tris keep their body part");
+
+			auto skin = nif.GetHeader().GetBlock<NiSkinInstance>(body->SkinInstanceRef()->index);
+			auto skinPart = nif.GetHeader().GetBlock<NiSkinPartition>(skin->skinPartitionRef.index);
+			for (auto& p : skinPart->partitions)
+				Assert::IsTrue(int(p.bones.size()) <= limit, L"Partition within bone limit");
+
+			Assert::AreEqual(partCount, OptimizeSkinPartitions(&nif, body, limit), 
+				L"Rerunning gives the same partitions");
+		};
+		TEST_METHOD(optimizeVertexCache) {
+			/* Reordering for the vertex cache improves ACMR and keeps geometry and weights */
+			void* nif = load((testRoot / "Skyrim/test.nif").u8string().c_str());
+			NifFile* theNif = static_cast<NifFile*>(nif);
+			AnimInfo* anim = static_cast<AnimInfo*>(loadSkinForNif(nif, "SKYRIM"));
+			NiShape* armor = theNif->FindBlockByName<NiShape>("Armor");
+			std::string bone = "NPC R Calf [RClf]";
+
+			std::vector<Vector3> oldVerts;
+			theNif->GetVertsForShape(armor, oldVerts);
+			std::vector<Triangle> oldTris;
+			armor->GetTriangles(oldTris);
+			std::unordered_map<uint16_t, float> oldWeights;
+			anim->GetWeights("Armor", bone, oldWeights);
+
+			std::vector<uint32_t> order(oldVerts.size());
+			float acmr[2];
+			int changed = optimizeShapeVertexCache(nif, armor, anim, 0, order.data(), int(order.size()), acmr);
+			Assert::AreEqual(1, changed, L"Shape was reordered");
+			Assert::IsTrue(acmr[1] < acmr[0], L"ACMR improved");
+
+			std::vector<Vector3> newVerts;
+			theNif->GetVertsForShape(armor, newVerts);
+			Assert::AreEqual(oldVerts.size(), newVerts.size(), L"Same vertex count");
+			for (size_t i = 0; i < newVerts.size(); i++)
+				Assert::IsTrue(newVerts[i] == oldVerts[order[i]], L"Verts remapped");
+
+			std::vector<Triangle> newTris;
+			armor->GetTriangles(newTris);
+			Assert::AreEqual(oldTris.size(), newTris.size(), L"Same tri count");
+
+			std::unordered_map<uint16_t, float> newWeights;
+			anim->GetWeights("Armor", bone, newWeights);
+			Assert::AreEqual(oldWeights.size(), newWeights.size(), L"Same weight count");
+			for (auto& w : newWeights)
+				Assert::IsTrue(TApproxEqual(w.second, oldWeights[order[w.first]]), L"Weights remapped");
+
+			saveSkinnedNif(anim, (testRoot / "Out/optimizeVertexCache.nif").u8string().c_str());
+			NifFile nifCheck(testRoot / "Out/optimizeVertexCache.nif");
+			NiShape* armorCheck = nifCheck.FindBlockByName<NiShape>("Armor");
+			std::vector<Triangle> checkTris;
+			armorCheck->GetTriangles(checkTris);
+			Assert::AreEqual(int(oldTris.size()), int(checkTris.size()), L"Saved all tris");
+		};
+		TEST_METHOD(decimateLOD) {
+			/* Can build a reduced copy of a nif's shapes in a new nif */
+			void* nif = load((testRoot / "SkyrimSE/farmbench01.nif").u8string().c_str());
+			void* shapes[10];
+			int shapeCount = getShapes(nif, shapes, 10, 0);
+			Assert::IsTrue(shapeCount > 0, L"Have shapes");
+
+			void* lodNif = createNif("SKYRIMSE", RT_NINODE, "Scene Root");
+			void* lodShapes[10];
+			int lodCount = decimateShapes(nif, shapes, shapeCount, 0.5f, 0, lodNif, lodShapes);
+			Assert::AreEqual(shapeCount, lodCount, L"Decimated every shape");
+
+			for (int i = 0; i < shapeCount; i++) {
+				NiShape* src = static_cast<NiShape*>(shapes[i]);
+				NiShape* lod = static_cast<NiShape*>(lodShapes[i]);
+				Assert::IsTrue(lod->GetNumTriangles() > 0, L"LOD has tris");
+				Assert::IsTrue(lod->GetNumTriangles() < src->GetNumTriangles(), L"LOD has fewer tris");
+				Assert::IsTrue(lod->GetNumVertices() <= src->GetNumVertices(), L"No verts added");
+				std::vector<Triangle> tris;
+				lod->GetTriangles(tris);
+				for (auto& t : tris)
+					Assert::IsTrue(t.p1 < lod->GetNumVertices() && t.p2 < lod->GetNumVertices() 
+						&& t.p3 < lod->GetNumVertices(), L"Tris reference valid verts");
+			}
+
+			saveNif(lodNif, (testRoot / "Out/decimateLOD.nif").u8string().c_str());
+			void* nifCheck = load((testRoot / "Out/decimateLOD.nif").u8string().c_str());
+			void* checkShapes[10];
+			Assert::AreEqual(shapeCount, getShapes(nifCheck, checkShapes, 10, 0), L"LOD nif has all shapes");
+		};
+		TEST_METHOD(mergeShapes) {
+			/* Shapes with the same material are merged into one */
+			void* nifref = load((testRoot / "SkyrimSE/farmbench01.nif").u8string().c_str());
+			NifFile* nif = static_cast<NifFile*>(nifref);
+			NiShape* src = nif->GetShapes()[0];
+
+			// Kit-bash a couple of copies of the first shape, one of them moved.
+			nif->CloneShape(src, "BenchCopy1");
+			NiShape* copy2 = nif->CloneShape(src, "BenchCopy2");
+			MatTransform xf = copy2->GetTransformToParent();
+			xf.translation.x += 100.0f;
+			copy2->SetTransformToParent(xf);
+
+			uint32_t triCount = 0;
+			uint32_t vertCount = 0;
+			for (auto& s : nif->GetShapes()) {
+				triCount += s->GetNumTriangles();
+				vertCount += s->GetNumVertices();
+			}
+			size_t shapeCount = nif->GetShapes().size();
+
+			void* merged[10];
+			int mergedCount = mergeShapesByMaterial(nifref, merged, 10);
+			Assert::IsTrue(mergedCount >= 1, L"Merged the copies");
+			Assert::IsTrue(nif->GetShapes().size() <= shapeCount - 2, L"Copies are gone");
+
+			uint32_t newTriCount = 0;
+			uint32_t newVertCount = 0;
+			for (auto& s : nif->GetShapes()) {
+				newTriCount += s->GetNumTriangles();
+				newVertCount += s->GetNumVertices();
+			}
+			Assert::AreEqual(triCount, newTriCount, L"No tris lost");
+			Assert::AreEqual(vertCount, newVertCount, L"No verts lost");
+
+			Assert::IsTrue(merged[0] == src, L"Copies merged into the source shape");
+			Assert::IsTrue(nif->FindBlockByName<NiShape>("BenchCopy2") == nullptr, L"Copy deleted");
+
+			saveNif(nifref, (testRoot / "Out/mergeShapes.nif").u8string().c_str());
+			void* nifCheck = load((testRoot / "Out/mergeShapes.nif").u8string().c_str());
+			void* checkShapes[10];
+			Assert::AreEqual(int(nif->GetShapes().size()), getShapes(nifCheck, checkShapes, 10, 0), L"Merged nif reads back");
+
+			// Effect shaders have no texture set. Shapes with separate but equal ones merge.
+			void* fo4Ref = createNif("FO4", RT_NINODE, "Scene Root");
+			NifFile* fo4 = static_cast<NifFile*>(fo4Ref);
+			float verts[9] = { 0.0f, 0.0f, 0.0f,  1.0f, 0.0f, 0.0f,  0.0f, 1.0f, 0.0f };
+			float uvs[6] = { 0.0f, 0.0f,  1.0f, 0.0f,  0.0f, 1.0f };
+			uint16_t tris[3] = { 0, 1, 2 };
+			uint16_t options = 2 | 4;
+			void* glow1 = createNifShapeFromData(fo4Ref, "Glow1", verts, uvs, nullptr, 3, tris, 1, &options);
+			createNifShapeFromData(fo4Ref, "Glow2", verts, uvs, nullptr, 3, tris, 1, &options);
+			Assert::IsTrue(fo4->GetShader(static_cast<NiShape*>(glow1))->TextureSetRef() == nullptr,
+				L"Effect shader has no texture set");
+			Assert::AreEqual(1, mergeShapesByMaterial(fo4Ref, merged, 10), L"Effect shaded shapes merged");
+			Assert::AreEqual(size_t(1), fo4->GetShapes().size(), L"Second shape is gone");
+			Assert::AreEqual(2u, fo4->GetShapes()[0]->GetNumTriangles(), L"Merged shape has both tris");
+		};
+		TEST_METHOD(splitOversizeShape) {
+			/* A mesh too big for 16-bit indices is split into several shapes */
+			const int gridSize = 300;
+			std::vector<float> verts;
+			std::vector<float> uvs;
+			std::vector<uint32_t> tris;
+			for (int y = 0; y <= gridSize; y++)
+				for (int x = 0; x <= gridSize; x++) {
+					verts.insert(verts.end(), { float(x), float(y), 0.0f });
+					uvs.insert(uvs.end(), { float(x) / gridSize, float(y) / gridSize });
+				}
+			for (int y = 0; y < gridSize; y++)
+				for (int x = 0; x < gridSize; x++) {
+					uint32_t a = y * (gridSize + 1) + x;
+					uint32_t c = a + gridSize + 1;
+					tris.insert(tris.end(), { a, a + 1, c + 1, a, c + 1, c });
+				}
+			int vertCount = int(verts.size() / 3);
+			int triCount = int(tris.size() / 3);
+
+			void* nif = createNif("SKYRIMSE", RT_NINODE, "Scene Root");
+			std::vector<uint16_t> tris16(tris.begin(), tris.end());
+			Assert::IsNull(createNifShapeFromData(nif, "Grid", verts.data(), uvs.data(), nullptr, 
+				vertCount, tris16.data(), triCount), L"One shape can't hold the grid");
+
+			void* shapes[10];
+			std::vector<uint32_t> vertMap(tris.size());
+			std::vector<uint32_t> triMap(triCount);
+			int shapeCount = createNifShapesFromData(nif, "Grid", verts.data(), uvs.data(), nullptr,
+				vertCount, tris.data(), triCount, nullptr, nullptr, shapes, 10, 
+				vertMap.data(), int(vertMap.size()), triMap.data(), nullptr);
+			Assert::AreEqual(3, shapeCount, L"Grid split into as few pieces as fit");
+
+			int mapPos = 0;
+			int totalTris = 0;
+			for (int i = 0; i < shapeCount; i++) {
+				NiShape* shape = static_cast<NiShape*>(shapes[i]);
+				Assert::IsTrue(shape->GetNumVertices() <= 0xFFFF, L"Piece fits in 16 bits");
+				std::vector<Vector3> shapeVerts;
+				static_cast<NifFile*>(nif)->GetVertsForShape(shape, shapeVerts);
+				for (auto& v : shapeVerts) {
+					uint32_t src = vertMap[mapPos++];
+					Assert::IsTrue(v.IsNearlyEqualTo(Vector3(verts[src*3], verts[src*3+1], verts[src*3+2])), 
+						L"Vert map points to the source vert");
+				}
+				totalTris += shape->GetNumTriangles();
+			}
+			Assert::AreEqual(triCount, totalTris, L"All tris are in some shape");
+
+			saveNif(nif, (testRoot / "Out/splitOversizeShape.nif").u8string().c_str());
+			void* nifCheck = load((testRoot / "Out/splitOversizeShape.nif").u8string().c_str());
+			void* checkShapes[10];
+			Assert::AreEqual(shapeCount, getShapes(nifCheck, checkShapes, 10, 0), L"Split shapes read back");
+		};
+		TEST_METHOD(splitOversizeShapeExtras) {
+			/* Colors, weights and partitions go into each piece of a split mesh with their
+				verts and tris */
+			const int gridSize = 300;
+			std::vector<float> verts, uvs, colors;
+			std::vector<uint32_t> tris;
+			std::vector<VertexBoneWeightBuf> weights;
+			for (int y = 0; y <= gridSize; y++)
+				for (int x = 0; x <= gridSize; x++) {
+					uint32_t v = uint32_t(verts.size() / 3);
+					verts.insert(verts.end(), { float(x), float(y), 0.0f });
+					uvs.insert(uvs.end(), { float(x) / gridSize, float(y) / gridSize });
+					colors.insert(colors.end(), { float(x) / gridSize, 0.0f, 0.0f, 1.0f });
+					// Left half on the spine, right half on the head.
+					weights.push_back({ v, uint16_t(x < gridSize / 2 ? 0 : 1), 1.0f });
+				}
+			std::vector<uint16_t> triParts;
+			for (int y = 0; y < gridSize; y++)
+				for (int x = 0; x < gridSize; x++) {
+					uint32_t a = y * (gridSize + 1) + x;
+					uint32_t c = a + gridSize + 1;
+					tris.insert(tris.end(), { a, a + 1, c + 1, a, c + 1, c });
+					uint16_t part = y < gridSize / 2 ? 0 : 1;
+					triParts.insert(triParts.end(), { part, part });
+				}
+			int vertCount = int(verts.size() / 3);
+			int triCount = int(tris.size() / 3);
+
+			void* nifRef = createNif("SKYRIM", RT_NINODE, "Scene Root");
+			NifFile* nif = static_cast<NifFile*>(nifRef);
+			void* skin = createSkinForNif(nifRef, "SKYRIM");
+			const char* boneNames[] = { "NPC Spine [Spn0]", "NPC Head [Head]" };
+			uint16_t partData[] = { 0, 32,  0, 30 };
+			ShapeSplitExtrasBuf extras = {};
+			extras.colors = colors.data();
+			extras.skin = skin;
+			extras.boneCount = 2;
+			extras.boneNames = boneNames;
+			extras.weights = weights.data();
+			extras.weightCount = int(weights.size());
+			extras.partData = partData;
+			extras.partCount = 2;
+			extras.triParts = triParts.data();
+
+			void* shapes[10];
+			std::vector<uint32_t> vertMap(tris.size());
+			std::vector<uint32_t> triMap(triCount);
+			int shapeCount = createNifShapesFromData(nifRef, "Grid", verts.data(), uvs.data(), nullptr,
+				vertCount, tris.data(), triCount, nullptr, nullptr, shapes, 10,
+				vertMap.data(), int(vertMap.size()), triMap.data(), &extras);
+			Assert::IsTrue(shapeCount > 1, L"Grid split");
+
+			int vertPos = 0;
+			int triPos = 0;
+			for (int i = 0; i < shapeCount; i++) {
+				NiShape* shape = static_cast<NiShape*>(shapes[i]);
+				int shapeVerts = int(shape->GetNumVertices());
+
+				const std::vector<Color4>* shapeColors = nif->GetColorsForShape(shape->name.get());
+				Assert::IsNotNull(shapeColors, L"Piece has colors");
+				for (int v = 0; v < shapeVerts; v++)
+					Assert::IsTrue(TApproxEqual(colors[vertMap[vertPos + v] * 4], (*shapeColors)[v].r),
+						L"Colors go with their verts");
+
+				std::vector<std::string> bones;
+				nif->GetShapeBoneList(shape, bones);
+				for (int b = 0; b < int(bones.size()); b++) {
+					std::unordered_map<uint16_t, float> boneWeights;
+					nif->GetShapeBoneWeights(shape, b, boneWeights);
+					uint16_t srcBone = bones[b] == boneNames[0] ? 0 : 1;
+					for (auto& w : boneWeights)
+						Assert::AreEqual(int(srcBone), int(weights[vertMap[vertPos + w.first]].bone),
+							L"Weights go with their verts");
+				}
+				vertPos += shapeVerts;
+
+				NiVector<BSDismemberSkinInstance::PartitionInfo> partInfos;
+				std::vector<int> shapeTriParts;
+				Assert::IsTrue(nif->GetShapePartitions(shape, partInfos, shapeTriParts), L"Piece has partitions");
+				for (size_t t = 0; t < shapeTriParts.size(); t++)
+					Assert::AreEqual(int(partData[triParts[triMap[triPos + t]] * 2 + 1]),
+						int(partInfos[shapeTriParts[t]].partID), L"Partitions go with their tris");
+				triPos += int(shapeTriParts.size());
+			}
+			Assert::AreEqual(triCount, triPos, L"Every tri has its partition");
+			destroySkin(skin);
+			destroy(nifRef);
+		};
+		TEST_METHOD(transferWeightsByProximity) {
+			/* Bone weights can be copied onto a new shape by proximity */
+			void* srcNifRef = load((testRoot / "Skyrim/test.nif").u8string().c_str());
+			NifFile* srcNif = static_cast<NifFile*>(srcNifRef);
+			NiShape* body = srcNif->FindBlockByName<NiShape>("MaleBody");
+
+			std::vector<Vector3> verts;
+			std::vector<Triangle> tris;
+			srcNif->GetVertsForShape(body, verts);
+			body->GetTriangles(tris);
+			std::vector<Vector2> uvs = *srcNif->GetUvsForShape(body);
+
+			void* destNifRef = createNif("SKYRIM", RT_NINODE, "Scene Root");
+			NifFile* destNif = static_cast<NifFile*>(destNifRef);
+			void* skin = createSkinForNif(destNifRef, "SKYRIM");
+			NiShape* dest = PyniflyCreateShapeFromData(destNif, "Body", &verts, &tris, &uvs, nullptr, 0, nullptr);
+			skinShape(destNifRef, dest);
+			MatTransform gts;
+			srcNif->GetShapeTransformGlobalToSkin(body, gts);
+			setGlobalToSkinXform(skin, dest, &gts);
+
+			int weighted = transferWeights(srcNifRef, body, skin, dest, 0, 0.0f);
+			Assert::AreEqual(int(verts.size()), weighted, L"Every vert got weights");
+
+			// Same verts, so each one gets the weights it had.
+			AnimInfo* anim = static_cast<AnimInfo*>(skin);
+			std::unordered_map<uint16_t, float> calf;
+			anim->GetWeights("Body", "NPC R Calf [RClf]", calf);
+			Assert::IsTrue(calf.find(358) != calf.end(), L"Calf vert weighted to the calf");
+			Assert::IsTrue(TApproxEqual(1.0f, calf[358]), L"Calf vert fully weighted to the calf");
+
+			saveSkinnedNif(skin, (testRoot / "Out/transferWeights.nif").u8string().c_str());
+			void* nifCheck = load((testRoot / "Out/transferWeights.nif").u8string().c_str());
+			void* checkShapes[10];
+			getShapes(nifCheck, checkShapes, 10, 0);
+			Assert::IsTrue(getShapeBoneCount(nifCheck, checkShapes[0]) > 0, L"Bones written to the nif");
+		};
+		TEST_METHOD(conformMorphsToOutfit) {
+			/* Body morphs can be conformed to an outfit */
+			void* nifRef = load((testRoot / "Skyrim/test.nif").u8string().c_str());
+			NifFile* nif = static_cast<NifFile*>(nifRef);
+			NiShape* body = nif->FindBlockByName<NiShape>("MaleBody");
+			NiShape* armor = nif->FindBlockByName<NiShape>("Armor");
+
+			// Two morphs: lift everything 1 unit, and do nothing.
+			int bodyCount = body->GetNumVertices();
+			int armorCount = armor->GetNumVertices();
+			std::vector<float> bodyDeltas(2 * bodyCount * 3, 0.0f);
+			for (int i = 0; i < bodyCount; i++)
+				bodyDeltas[i * 3 + 2] = 1.0f;
+			std::vector<float> armorDeltas(2 * armorCount * 3, -1.0f);
+
+			int found = conformMorphs(nifRef, body, nifRef, armor, bodyDeltas.data(), 2, 10.0f, 0, armorDeltas.data());
+			Assert::IsTrue(found > 0, L"Armor verts found body verts nearby");
+			Assert::IsTrue(found <= armorCount, L"Can't find more verts than the armor has");
+
+			int moved = 0;
+			for (int i = 0; i < armorCount; i++) {
+				Vector3 d(armorDeltas[i * 3], armorDeltas[i * 3 + 1], armorDeltas[i * 3 + 2]);
+				if (d.IsZero()) continue;
+				moved++;
+				Assert::IsTrue(TApproxEqual(1.0f, d.length()), L"Uniform lift carried over whole");
+			}
+			Assert::AreEqual(found, moved, L"Verts in range got the lift");
+
+			for (int i = armorCount * 3; i < armorCount * 6; i++)
+				Assert::IsTrue(armorDeltas[i] == 0.0f, L"Empty morph stays empty");
+		};
+		TEST_METHOD(findClippingVerts) {
+			/* Verts pushed inside the body are found, with how deep they are */
+			void* nifRef = load((testRoot / "Skyrim/test.nif").u8string().c_str());
+			NifFile* nif = static_cast<NifFile*>(nifRef);
+			NiShape* body = nif->FindBlockByName<NiShape>("MaleBody");
+
+			// A shell around the body, with a few verts pushed half a unit in.
+			std::vector<Vector3> verts;
+			std::vector<Triangle> tris;
+			nif->GetVertsForShape(body, verts);
+			body->GetTriangles(tris);
+			const std::vector<Vector3>* norms = nif->GetNormalsForShape(body);
+			std::vector<int> pushed = { 10, 358, 1000 };
+			for (size_t i = 0; i < verts.size(); i++) {
+				bool in = std::find(pushed.begin(), pushed.end(), int(i)) != pushed.end();
+				verts[i] += (*norms)[i] * (in ? -0.5f : 0.5f);
+			}
+			NiShape* shell = PyniflyCreateShapeFromData(nif, "Shell", &verts, &tris, nullptr, nullptr, 0, nullptr);
+			shell->SetTransformToParent(CalcShapeTransformToGlobal(nif, body));
+
+			std::vector<int> clipVerts(verts.size());
+			std::vector<float> depth(verts.size());
+			int count = findClipping(nifRef, body, nifRef, shell, 2.0f, 0, clipVerts.data(), depth.data(), int(verts.size()));
+			Assert::IsTrue(count >= int(pushed.size()) && count < 20, L"Found the pushed verts and not the shell");
+			for (int p : pushed) {
+				auto it = std::find(clipVerts.begin(), clipVerts.begin() + count, p);
+				Assert::IsTrue(it != clipVerts.begin() + count, L"Pushed vert clips");
+				float d = depth[it - clipVerts.begin()];
+				Assert::IsTrue(d > 0.0f && d <= 0.5f + 0.01f, L"Depth is no more than the push");
+			}
+		};
+		TEST_METHOD(spatialQueries) {
+			/* A BVH over nif shapes answers ray casts and closest points in global space */
+			void* nifRef = createNif("SKYRIM", RT_NINODE, "Scene Root");
+			NifFile* nif = static_cast<NifFile*>(nifRef);
+
+			// A 2x2 square, lifted 5 units.
+			std::vector<Vector3> verts = { Vector3(-1, -1, 0), Vector3(1, -1, 0), Vector3(1, 1, 0), Vector3(-1, 1, 0) };
+			std::vector<Triangle> tris = { Triangle(0, 1, 2), Triangle(0, 2, 3) };
+			NiShape* square = PyniflyCreateShapeFromData(nif, "Square", &verts, &tris, nullptr, nullptr, 0, nullptr);
+			MatTransform xf;
+			xf.translation = Vector3(0, 0, 5);
+			square->SetTransformToParent(xf);
+
+			void* shapes[1] = { square };
+			void* bvh = buildShapeBVH(nifRef, shapes, 1);
+
+			float origins[6] = { 0.2f, 0.3f, 10.0f,  5.0f, 5.0f, 10.0f };
+			float dirs[6] = { 0.0f, 0.0f, -2.0f,  0.0f, 0.0f, -1.0f };
+			SpatialHitBuf hits[2];
+			Assert::AreEqual(1, raycast(bvh, origins, dirs, 2, 0.0f, hits), L"One ray hits");
+			Assert::AreEqual(0, hits[0].shape, L"Ray hits the square");
+			Assert::IsTrue(TApproxEqual(5.0f, hits[0].point[2]), L"Hit is in global space");
+			Assert::IsTrue(TApproxEqual(5.0f, hits[0].distance), L"Distance is in nif units");
+			Assert::AreEqual(-1, hits[1].shape, L"Other ray misses");
+			Assert::AreEqual(0, raycast(bvh, origins, dirs, 1, 4.0f, hits), L"Hit is past the limit");
+
+			float points[3] = { 0.5f, 0.5f, 8.0f };
+			Assert::AreEqual(1, closestPoint(bvh, points, 1, 0.0f, hits), L"Found closest point");
+			Assert::IsTrue(TApproxEqual(0.5f, hits[0].point[0]) && TApproxEqual(5.0f, hits[0].point[2]), 
+				L"Closest point is straight below");
+			Assert::IsTrue(TApproxEqual(3.0f, hits[0].distance), L"Closest point is 3 units away");
+
+			destroyShapeBVH(bvh);
+		};
+		TEST_METHOD(spatialQueriesStacked) {
+			/* Batched rays through stacked surfaces of one shape report the nearest */
+			void* nifRef = createNif("SKYRIM", RT_NINODE, "Scene Root");
+			NifFile* nif = static_cast<NifFile*>(nifRef);
+
+			// Two 2x2 squares, 2 units apart, few enough tris to share a leaf.
+			std::vector<Vector3> verts = { 
+				Vector3(-1, -1, 2), Vector3(1, -1, 2), Vector3(1, 1, 2), Vector3(-1, 1, 2),
+				Vector3(-1, -1, 0), Vector3(1, -1, 0), Vector3(1, 1, 0), Vector3(-1, 1, 0) };
+			std::vector<Triangle> tris = { Triangle(0, 1, 2), Triangle(0, 2, 3), 
+				Triangle(4, 5, 6), Triangle(4, 6, 7) };
+			NiShape* stack = PyniflyCreateShapeFromData(nif, "Stack", &verts, &tris, nullptr, nullptr, 0, nullptr);
+			MatTransform xf;
+			xf.translation = Vector3(0, 0, 5);
+			stack->SetTransformToParent(xf);
+
+			void* shapes[1] = { stack };
+			void* bvh = buildShapeBVH(nifRef, shapes, 1);
+
+			// Down onto the top square, up onto the bottom one.
+			float origins[6] = { 0.5f, -0.5f, 10.0f,  0.5f, -0.5f, 0.0f };
+			float dirs[6] = { 0.0f, 0.0f, -1.0f,  0.0f, 0.0f, 1.0f };
+			SpatialHitBuf hits[2];
+			Assert::AreEqual(2, raycast(bvh, origins, dirs, 2, 0.0f, hits), L"Both rays hit");
+			Assert::IsTrue(hits[0].tri < 2, L"Ray from above hits the top square");
+			Assert::IsTrue(TApproxEqual(3.0f, hits[0].distance), L"Distance is to the top square");
+			Assert::IsTrue(hits[1].tri >= 2, L"Ray from below hits the bottom square");
+			Assert::IsTrue(TApproxEqual(5.0f, hits[1].distance), L"Distance is to the bottom square");
+
+			destroyShapeBVH(bvh);
+		};
+		TEST_METHOD(bvhInvalidTris) {
+			/* Hits give the triangle's index in the mesh, even after a triangle the BVH
+				had to skip */
+			std::vector<Vector3> verts = { Vector3(-1, -1, 0), Vector3(1, -1, 0), Vector3(1, 1, 0), Vector3(-1, 1, 0) };
+			std::vector<Triangle> tris = { Triangle(0, 1, 99), Triangle(0, 1, 2), Triangle(0, 2, 3) };
+			MeshBVH bvh;
+			bvh.Build(verts, tris);
+			Assert::IsFalse(bvh.ValidTri(0), L"Out of range tri is invalid");
+
+			MeshBVH::Hit hit;
+			Assert::IsTrue(bvh.Raycast(Vector3(-0.5f, 0.5f, 1.0f), Vector3(0, 0, -1), hit), L"Ray hits");
+			Assert::AreEqual(2u, hit.tri, L"Ray hit names the mesh's tri");
+			MeshBVH::Hit closest;
+			Assert::IsTrue(bvh.ClosestPoint(Vector3(0.5f, -0.5f, 1.0f), closest), L"Found closest point");
+			Assert::AreEqual(1u, closest.tri, L"Closest point names the mesh's tri");
+		};
+		TEST_METHOD(bvhNearestInLeaf) {
+			/* A ray through stacked triangles in the same leaf reports the nearest, whichever
+				order they're in */
+			std::vector<Vector3> verts = { 
+				Vector3(-1, -1, 2), Vector3(1, -1, 2), Vector3(0, 1, 2),
+				Vector3(-1, -1, 0), Vector3(1, -1, 0), Vector3(0, 1, 0) };
+			std::vector<Triangle> nearFirst = { Triangle(0, 1, 2), Triangle(3, 4, 5) };
+			std::vector<Triangle> nearLast = { Triangle(3, 4, 5), Triangle(0, 1, 2) };
+
+			MeshBVH bvh;
+			MeshBVH::Hit hit;
+			bvh.Build(verts, nearFirst);
+			Assert::IsTrue(bvh.Raycast(Vector3(0, 0, 5), Vector3(0, 0, -1), hit), L"Ray hits");
+			Assert::AreEqual(0u, hit.tri, L"Nearer tri is hit");
+			Assert::IsTrue(TApproxEqual(3.0f, hit.distance), L"Distance is to the nearer tri");
+
+			bvh.Build(verts, nearLast);
+			Assert::IsTrue(bvh.Raycast(Vector3(0, 0, 5), Vector3(0, 0, -1), hit), L"Ray hits");
+			Assert::AreEqual(1u, hit.tri, L"Nearer tri is hit");
+			Assert::IsTrue(TApproxEqual(3.0f, hit.distance), L"Distance is to the nearer tri");
+			Assert::AreEqual(2u, bvh.CountHits(Vector3(0, 0, 5), Vector3(0, 0, -1)), L"Ray passes through both");
+		};
+		TEST_METHOD(shapeAdjacency) {
+			/* Adjacency tables are consistent with the shape's tris */
+			void* nifRef = load((testRoot / "Skyrim/test.nif").u8string().c_str());
+			NifFile* nif = static_cast<NifFile*>(nifRef);
+			NiShape* body = nif->FindBlockByName<NiShape>("MaleBody");
+			std::vector<Triangle> tris;
+			body->GetTriangles(tris);
+			int vertCount = body->GetNumVertices();
+
+			int startLen = getShapeAdjacency(nifRef, body, ADJ_VERT_TRI_START, nullptr, 0);
+			Assert::AreEqual(vertCount + 1, startLen, L"One offset per vert, plus the end");
+			std::vector<uint32_t> vertTriStart(startLen);
+			getShapeAdjacency(nifRef, body, ADJ_VERT_TRI_START, vertTriStart.data(), startLen);
+			std::vector<uint32_t> vertTris(getShapeAdjacency(nifRef, body, ADJ_VERT_TRIS, nullptr, 0));
+			getShapeAdjacency(nifRef, body, ADJ_VERT_TRIS, vertTris.data(), int(vertTris.size()));
+			Assert::AreEqual(size_t(vertTriStart[vertCount]), vertTris.size(), L"Offsets cover the tri list");
+
+			// Every tri listed for vert 358 uses it.
+			for (uint32_t i = vertTriStart[358]; i < vertTriStart[359]; i++) {
+				const Triangle& t = tris[vertTris[i]];
+				Assert::IsTrue(t.p1 == 358 || t.p2 == 358 || t.p3 == 358, L"Vert's tris use the vert");
+			}
+
+			// Neighbours are mutual.
+			std::vector<uint32_t> neighbors(tris.size() * 3);
+			Assert::AreEqual(int(tris.size() * 3), 
+				getShapeAdjacency(nifRef, body, ADJ_TRI_NEIGHBORS, neighbors.data(), int(neighbors.size())),
+				L"3 neighbours per tri");
+			int shared = 0;
+			for (size_t t = 0; t < tris.size(); t++)
+				for (int k = 0; k < 3; k++) {
+					uint32_t n = neighbors[t * 3 + k];
+					if (n == ADJ_NONE) continue;
+					shared++;
+					Assert::IsTrue(neighbors[n * 3] == t || neighbors[n * 3 + 1] == t || neighbors[n * 3 + 2] == t,
+						L"Neighbour points back");
+				}
+			Assert::IsTrue(shared > 0, L"Body tris have neighbours");
+
+			Assert::AreEqual(-1, getShapeAdjacency(nifRef, body, 99, nullptr, 0), L"Unknown table");
+		};
+		TEST_METHOD(splitLooseParts) {
+			/* Shapes can be split into their connected pieces */
+			void* nifRef = createNif("SKYRIM", RT_NINODE, "Scene Root");
+			NifFile* nif = static_cast<NifFile*>(nifRef);
+
+			// A lone tri, and a quad whose two tris only share positions, as at a UV seam.
+			std::vector<Vector3> verts = {
+				Vector3(0, 0, 0), Vector3(1, 0, 0), Vector3(0, 1, 0),
+				Vector3(5, 0, 0), Vector3(6, 0, 0), Vector3(6, 1, 0),
+				Vector3(5, 0, 0), Vector3(6, 1, 0), Vector3(5, 1, 0) };
+			std::vector<Triangle> tris = { Triangle(0, 1, 2), Triangle(3, 4, 5), Triangle(6, 7, 8) };
+			std::vector<Vector2> uvs(verts.size());
+			NiShape* shape = PyniflyCreateShapeFromData(nif, "Clutter", &verts, &tris, &uvs, nullptr, 0, nullptr);
+
+			int count = 0;
+			FindMeshIslands(verts, tris, 0, count);
+			Assert::AreEqual(3, count, L"Seam splits the quad without welding");
+			std::vector<int> islands = FindMeshIslands(verts, tris, LOOSE_WELD_POSITIONS, count);
+			Assert::AreEqual(2, count, L"Welding joins the quad");
+			Assert::AreEqual(islands[1], islands[2], L"Quad tris are one island");
+
+			void* shapes[4];
+			Assert::AreEqual(2, splitShapeByConnectivity(nifRef, shape, LOOSE_WELD_POSITIONS, shapes, 4), 
+				L"Two loose parts");
+			Assert::IsTrue(shapes[0] == shape, L"Original shape comes first");
+			Assert::AreEqual(3, int(shape->GetNumVertices()), L"Original keeps the lone tri");
+			NiShape* quad = static_cast<NiShape*>(shapes[1]);
+			Assert::AreEqual(std::string("Clutter:1"), quad->name.get(), L"Copy is named after the original");
+			Assert::AreEqual(6, int(quad->GetNumVertices()), L"Copy has the quad's verts");
+			Assert::AreEqual(2, int(quad->GetNumTriangles()), L"Copy has the quad's tris");
+
+			std::vector<Vector3> quadVerts;
+			nif->GetVertsForShape(quad, quadVerts);
+			Assert::IsTrue(quadVerts[0] == Vector3(5, 0, 0), L"Copy's verts are the quad's");
+		};
+		TEST_METHOD(splitLoosePartsSkinned) {
+			/* Weights go with their verts and partitions with their tris when a skinned
+				shape is split */
+			void* nifRef = createNif("SKYRIM", RT_NINODE, "Scene Root");
+			NifFile* nif = static_cast<NifFile*>(nifRef);
+			void* skin = createSkinForNif(nifRef, "SKYRIM");
+
+			// Three separate tris; the middle one is weighted to its own bone and body part.
+			float verts[] = { 0, 0, 0,  1, 0, 0,  0, 1, 0,
+				5, 0, 0,  6, 0, 0,  5, 1, 0,
+				10, 0, 0,  11, 0, 0,  10, 1, 0 };
+			float uvs[18] = {};
+			float norms[27];
+			for (int i = 0; i < 27; i++)
+				norms[i] = (i % 3 == 2) ? 1.0f : 0.0f;
+			uint16_t tris[] = { 0, 1, 2,  3, 4, 5,  6, 7, 8 };
+			void* shape = createNifShapeFromData(nifRef, "Pieces", verts, uvs, norms, 9, tris, 3);
+			skinShape(nifRef, shape);
+
+			MatTransform xf;
+			addBoneToShape(skin, shape, "NPC Spine [Spn0]", &xf, nullptr);
+			addBoneToShape(skin, shape, "NPC Head [Head]", &xf, nullptr);
+			VertexWeightPair spine[] = { {0, 1.0f}, {1, 1.0f}, {2, 1.0f}, {6, 1.0f}, {7, 1.0f}, {8, 1.0f} };
+			VertexWeightPair head[] = { {3, 1.0f}, {4, 1.0f}, {5, 1.0f} };
+			setShapeWeights(skin, shape, "NPC Spine [Spn0]", spine, 6, &xf);
+			setShapeWeights(skin, shape, "NPC Head [Head]", head, 3, &xf);
+			writeSkinToNif(skin);
+			uint16_t partData[] = { 0, 32,  0, 30 };
+			uint16_t triParts[] = { 0, 1, 0 };
+			setPartitions(nifRef, shape, partData, 2, triParts, 3);
+
+			void* shapes[4];
+			Assert::AreEqual(3, splitShapeByConnectivity(nifRef, shape, 0, shapes, 4), L"Three loose parts");
+			for (int i = 0; i < 3; i++) {
+				NiShape* part = static_cast<NiShape*>(shapes[i]);
+				Assert::AreEqual(3, int(part->GetNumVertices()), L"Each part has its tri's verts");
+
+				std::vector<std::string> bones;
+				nif->GetShapeBoneList(part, bones);
+				for (int b = 0; b < int(bones.size()); b++) {
+					std::unordered_map<uint16_t, float> weights;
+					nif->GetShapeBoneWeights(part, b, weights);
+					bool ownBone = (bones[b] == "NPC Head [Head]") == (i == 1);
+					Assert::AreEqual(ownBone ? 3 : 0, int(weights.size()), L"Weights go with their verts");
+				}
+
+				NiVector<BSDismemberSkinInstance::PartitionInfo> partInfos;
+				std::vector<int> partTris;
+				Assert::IsTrue(nif->GetShapePartitions(part, partInfos, partTris), L"Part keeps its partitions");
+				Assert::AreEqual(1, int(partTris.size()), L"One tri's partition");
+				Assert::AreEqual(i == 1 ? 30 : 32, int(partInfos[partTris[0]].partID), L"Tri keeps its body part");
+			}
+			destroySkin(skin);
+			destroy(nifRef);
+		};
+		TEST_METHOD(weldVerts) {
+			/* Verts that differ by float noise are welded, and tris remapped */
+			void* nifRef = createNif("SKYRIM", RT_NINODE, "Scene Root");
+			NifFile* nif = static_cast<NifFile*>(nifRef);
+
+			// A quad whose second tri has its own, slightly off, copies of the shared corners;
+			// vert 5 matches vert 0's position but not its UV.
+			std::vector<Vector3> verts = {
+				Vector3(0, 0, 0), Vector3(1, 0, 0), Vector3(1, 1, 0),
+				Vector3(0.00001f, 0, 0), Vector3(1, 1.00001f, 0), Vector3(0, 0, 0), Vector3(0, 1, 0) };
+			std::vector<Vector2> uvs = {
+				Vector2(0, 0), Vector2(1, 0), Vector2(1, 1),
+				Vector2(0, 0), Vector2(1, 1), Vector2(0.5f, 0.5f), Vector2(0, 1) };
+			std::vector<Triangle> tris = { Triangle(0, 1, 2), Triangle(3, 4, 6), Triangle(5, 1, 2) };
+			NiShape* shape = PyniflyCreateShapeFromData(nif, "Quad", &verts, &tris, &uvs, nullptr, 0, nullptr);
+
+			std::vector<uint32_t> remap(verts.size());
+			int count = weldShapeVerts(nifRef, shape, nullptr, remap.data(), int(remap.size()));
+			Assert::AreEqual(5, count, L"Two verts welded");
+			Assert::AreEqual(5, int(shape->GetNumVertices()), L"Shape has the welded verts");
+			Assert::AreEqual(remap[0], remap[3], L"Noisy corner welded");
+			Assert::AreEqual(remap[2], remap[4], L"Other noisy corner welded");
+			Assert::AreNotEqual(remap[0], remap[5], L"Different UV keeps its own vert");
+
+			std::vector<Triangle> newTris;
+			shape->GetTriangles(newTris);
+			Assert::AreEqual(3, int(newTris.size()), L"No tris collapsed");
+			Assert::AreEqual(int(remap[3]), int(newTris[1].p1), L"Tris use the welded verts");
+
+			// Ignoring UVs, vert 5 welds too.
+			float tolerances[5] = { 0.0001f, -1.0f, -1.0f, -1.0f, -1.0f };
+			Assert::AreEqual(4, weldShapeVerts(nifRef, shape, tolerances, remap.data(), int(remap.size())),
+				L"UV seam welded when UVs are ignored");
+
+			// Far from the origin with no tolerance, cells stay in range and exact
+			// duplicates still weld.
+			std::vector<Vector3> farVerts = {
+				Vector3(3.0e9f, -3.0e9f, 1.0f), Vector3(3.0e9f, -3.0e9f, 1.0f), Vector3(-3.0e9f, 0, 0) };
+			WeldInput farInput;
+			farInput.verts = &farVerts;
+			WeldTolerances exact;
+			exact.position = 0.0f;
+			uint32_t kept = 0;
+			std::vector<uint32_t> farRemap = FindWeldMap(farInput, exact, kept);
+			Assert::AreEqual(2u, kept, L"Far duplicates welded");
+			Assert::AreEqual(farRemap[0], farRemap[1], L"Duplicates share a vert");
+		};
+		TEST_METHOD(seamNormals) {
+			/* Normals match across a seam between shapes */
+			void* nifRef = createNif("SKYRIM", RT_NINODE, "Scene Root");
+			NifFile* nif = static_cast<NifFile*>(nifRef);
+
+			// Two quads meeting along x = 1, facing different ways.
+			std::vector<Triangle> tris = { Triangle(0, 1, 2), Triangle(0, 2, 3) };
+			std::vector<Vector3> vertsA = { Vector3(0, 0, 0), Vector3(1, 0, 0), Vector3(1, 1, 0), Vector3(0, 1, 0) };
+			std::vector<Vector3> vertsB = { Vector3(1, 0, 0), Vector3(2, 0, 0), Vector3(2, 1, 0), Vector3(1, 1, 0) };
+			std::vector<Vector3> normsA(4, Vector3(0, 0, 1));
+			std::vector<Vector3> normsB(4, Vector3(0.7071f, 0, 0.7071f));
+			NiShape* a = PyniflyCreateShapeFromData(nif, "Body", &vertsA, &tris, nullptr, &normsA, 0, nullptr);
+			NiShape* b = PyniflyCreateShapeFromData(nif, "Hands", &vertsB, &tris, nullptr, &normsB, 0, nullptr);
+
+			void* nifs[2] = { nifRef, nifRef };
+			void* shapes[2] = { a, b };
+			Assert::AreEqual(2, unifySeamNormals(nifs, shapes, 2, 0, 0.001f), L"Hands' seam verts changed");
+
+			const std::vector<Vector3>* newNorms = nif->GetNormalsForShape(b);
+			Assert::IsTrue(TApproxEqual(1.0f, (*newNorms)[0].z) && TApproxEqual(1.0f, (*newNorms)[3].z),
+				L"Seam verts take the body's normal");
+			Assert::IsTrue(TApproxEqual(0.7071f, (*newNorms)[1].x), L"Other verts left alone");
+
+			Assert::AreEqual(0, unifySeamNormals(nifs, shapes, 2, -1, 0.001f), L"Seam already matches");
+		};
+		TEST_METHOD(logRecords) {
+			/* The log can be read incrementally, filtered by level, and stays bounded */
+			uint64_t cursor = 0;
+			niflydll::LogEntry entries[16];
+			while (getLogRecords(&cursor, entries, 16) > 0);
+
+			niflydll::LogWriteCode(niflydll::LOG_ERROR, niflydll::LOGCODE_GEOMETRY, &cursor, "Bad tris in %s", "Body");
+			niflydll::LogWriteWf("Just a warning");
+			Assert::AreEqual(2, getLogRecords(&cursor, entries, 16), L"Only the new records");
+			Assert::AreEqual(int(niflydll::LOGCODE_GEOMETRY), int(entries[0].code), L"Code comes through");
+			Assert::IsTrue(entries[0].handle == &cursor, L"Handle comes through");
+			Assert::AreEqual(std::string("ERROR: Bad tris in Body"), std::string(entries[0].message), L"Message formatted");
+			Assert::AreEqual(int(niflydll::LOG_WARNING), int(entries[1].level), L"Level comes through");
+			Assert::AreEqual(getLogThreadId(), entries[1].thread, L"Records name the thread that logged them");
+			Assert::AreEqual(0, getLogRecords(&cursor, entries, 16), L"Nothing more to read");
+
+			// A worker can pick out its own records from another thread's.
+			uint32_t otherThread = 0;
+			std::thread([&]() {
+				niflydll::LogWriteWf("From another thread");
+				otherThread = getLogThreadId();
+				}).join();
+			Assert::AreEqual(1, getLogRecords(&cursor, entries, 16), L"Other thread's record read");
+			Assert::AreEqual(otherThread, entries[0].thread, L"Other thread's record is tagged with its id");
+			Assert::AreNotEqual(getLogThreadId(), otherThread, L"Threads get different ids");
+
+			setLogLevel(niflydll::LOG_ERROR);
+			niflydll::LogWriteWf("Filtered out");
+			niflydll::LogWriteEf("Kept");
+			setLogLevel(niflydll::LOG_INFO);
+			Assert::AreEqual(1, getLogRecords(&cursor, entries, 16), L"Warning filtered out");
+
+			// Writing past the end of the ring drops the oldest records, not memory.
+			clearMessageLog();
+			for (int i = 0; i < niflydll::LOG_CAPACITY * 2; i++)
+				niflydll::LogWriteMf("Message %d", i);
+			int len = getMessageLog(nullptr, 0);
+			Assert::IsTrue(len > 0 && len < niflydll::LOG_CAPACITY * niflydll::LOG_MESSAGE_LEN, L"Log is bounded");
+			std::vector<char> buf(len + 1);
+			getMessageLog(buf.data(), len + 1);
+			Assert::IsTrue(strstr(buf.data(), "Message 2047\n") != nullptr, L"Newest message kept");
+			Assert::IsTrue(strstr(buf.data(), "Message 0\n") == nullptr, L"Oldest message dropped");
+			clearMessageLog();
+		};
+		TEST_METHOD(callStats) {
+			/* Calls are only counted while stats are on; loads report the file size */
+			resetStats();
+			void* nif = load((testRoot / "Skyrim/test.nif").u8string().c_str());
+			int len = getStats(nullptr, 0);
+			std::vector<char> buf(len + 1);
+			getStats(buf.data(), len + 1);
+			Assert::IsTrue(strstr(buf.data(), "\"load\"") == nullptr, L"Nothing counted while off");
+
+			enableStats(1);
+			void* shapes[10];
+			getShapes(nif, shapes, 10, 0);
+			getShapes(nif, shapes, 10, 0);
+			void* nif2 = load((testRoot / "Skyrim/test.nif").u8string().c_str());
+			enableStats(0);
+
+			len = getStats(nullptr, 0);
+			buf.resize(len + 1);
+			Assert::AreEqual(len, getStats(buf.data(), len + 1), L"Returns full length");
+			std::string stats(buf.data());
+			Assert::IsTrue(stats.find("\"getShapes\": {\"count\": 2,") != std::string::npos, L"Counted both calls");
+			Assert::IsTrue(stats.find("\"load\": {\"count\": 1,") != std::string::npos, L"Counted the load");
+			size_t phase = stats.find("\"NifFile::Load\"");
+			Assert::IsTrue(phase != std::string::npos, L"Internal phase timed");
+			size_t bytes = stats.find("\"bytes\": ", phase);
+			Assert::IsTrue(atoll(stats.c_str() + bytes + 9) > 0, L"Load reports bytes read");
+
+			resetStats();
+			len = getStats(buf.data(), int(buf.size()));
+			Assert::AreEqual(std::string("{\"enabled\": false, \"stats\": {}}"), std::string(buf.data()), L"Reset clears counts");
+			destroy(nif);
+			destroy(nif2);
+		};
+		TEST_METHOD(traceEvents) {
+			/* A trace records each timed call as an event in a Chrome trace file */
+			std::filesystem::path fileOut = testRoot / "Out/traceEvents.json";
+			Assert::AreEqual(0, startTrace(fileOut.u8string().c_str()), L"Trace started");
+			Assert::AreEqual(1, startTrace(fileOut.u8string().c_str()), L"Only one trace at a time");
+			void* nif = load((testRoot / "Skyrim/test.nif").u8string().c_str());
+			void* shapes[10];
+			getShapes(nif, shapes, 10, 0);
+			destroy(nif);
+			// A scope that began before the trace did.
+			auto now = std::chrono::steady_clock::now();
+			niflydll::TraceRecord(niflydll::StatRegister("earlyScope"), now - std::chrono::seconds(1), now);
+			int count = stopTrace();
+			Assert::IsTrue(count >= 4, L"Load, its file read, getShapes and destroy recorded");
+			Assert::AreEqual(-1, stopTrace(), L"Already stopped");
+
+			std::ifstream in(fileOut);
+			std::string trace((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			Assert::IsTrue(trace.find("\"traceEvents\"") != std::string::npos, L"Trace event format");
+			Assert::IsTrue(trace.find("\"name\": \"getShapes\"") != std::string::npos, L"Call recorded");
+			Assert::IsTrue(trace.find("\"name\": \"NifFile::Load\"") != std::string::npos, L"Phase recorded");
+			Assert::IsTrue(trace.find("\"name\": \"earlyScope\"") != std::string::npos, L"Early scope recorded");
+			Assert::IsTrue(trace.find("\"ts\": -") == std::string::npos, L"No event starts before the trace");
+			Assert::IsTrue(trace.rfind("]}") != std::string::npos, L"File closed off");
+		};
+		TEST_METHOD(batchEdits) {
+			/* The edits niflycli makes: strip extra data, rename nodes, recompute normals
+				and convert Skyrim LE to SE */
+			void* nif = load((testRoot / "Skyrim/sheath_p1_1.nif").u8string().c_str());
+			int namelen, vallen;
+			Assert::AreEqual(1, removeExtraData(nif, nullptr, "HDT Havok Path"), L"Removed by name");
+			getStringExtraDataLen(nif, nullptr, 0, &namelen, &vallen);
+			std::vector<char> edname(namelen + 1), edval(vallen + 1);
+			getStringExtraData(nif, nullptr, 0, edname.data(), namelen + 1, edval.data(), vallen + 1);
+			Assert::AreEqual("HDT Skinned Mesh Physics Object", edname.data(), L"Other extra data kept");
+
+			std::vector<void*> nodes(getNodeCount(nif));
+			getNodes(nif, nodes.data());
+			char buf[64];
+			setNodeName(nodes.back(), "RenamedNode");
+			getNodeName(nodes.back(), buf, 64);
+			Assert::AreEqual("RenamedNode", buf, L"Node renamed");
+
+			void* shapes[10];
+			getShapes(nif, shapes, 10, 0);
+			int vertCount = getNormalsForShape(nif, shapes[0], nullptr, 0, 0);
+			std::vector<float> before(vertCount * 3), after(vertCount * 3);
+			getNormalsForShape(nif, shapes[0], before.data(), vertCount * 3, 0);
+			calcShapeNormals(nif, shapes[0], 1, 60.0f);
+			getNormalsForShape(nif, shapes[0], after.data(), vertCount * 3, 0);
+			int sameWay = 0;
+			for (int i = 0; i < vertCount; i++) {
+				Vector3 a(after[3 * i], after[3 * i + 1], after[3 * i + 2]);
+				Vector3 b(before[3 * i], before[3 * i + 1], before[3 * i + 2]);
+				Assert::IsTrue(TApproxEqual(a.length(), 1.0f), L"Normals are unit length");
+				if (a.dot(b) > 0) sameWay++;
+			}
+			Assert::IsTrue(sameWay > vertCount * 9 / 10, L"Recomputed normals face the same way");
+
+			Assert::AreEqual(0, convertNifGame(nif, "SKYRIMSE"), L"Converted");
+			Assert::AreEqual(1, convertNifGame(nif, "SKYRIMSE"), L"Already converted");
+			Assert::AreEqual(-1, convertNifGame(nif, "FO4"), L"Only LE and SE convert");
+			getGameName(nif, buf, 64);
+			Assert::AreEqual("SKYRIMSE", buf, L"Now an SE nif");
+
+			std::filesystem::path fileOut = testRoot / "Out/batchEdits.nif";
+			saveNif(nif, fileOut.u8string().c_str());
+			destroy(nif);
+
+			void* nif2 = load(fileOut.u8string().c_str());
+			getGameName(nif2, buf, 64);
+			Assert::AreEqual("SKYRIMSE", buf, L"Saved as SE");
+			Assert::IsTrue(removeExtraData(nif2, nullptr, nullptr) >= 2, L"Removed everything else");
+			Assert::AreEqual(0, getStringExtraDataLen(nif2, nullptr, 0, &namelen, &vallen), L"No extra data left");
+			destroy(nif2);
+		};
+		TEST_METHOD(sessions) {
+			/* Objects created under a session are freed with it; ones freed early or
+				created outside it are left alone. */
+			std::filesystem::path testfile = testRoot / "Skyrim/sheath_p1_1.nif";
+			void* outside = load(testfile.u8string().c_str());
+
+			void* session = createSession();
+			Assert::IsNull(setSession(session), L"No session was current");
+			void* nif = load(testfile.u8string().c_str());
+			void* early = load(testfile.u8string().c_str());
+			void* skin = loadSkinForNif(nif, "SKYRIM");
+			void* skel = makeGameSkeletonInstance("SKYRIM");
+			void* skin2 = loadSkinForNifSkel(nif, skel);
+			destroy(early);
+			destroySkin(skin2);
+
+			char* scratch = static_cast<char*>(sessionAlloc(nullptr, 100));
+			Assert::IsNotNull(scratch, L"Allocated from the current session");
+			for (int i = 0; i < 100; i++) Assert::AreEqual(char(0), scratch[i], L"Scratch is zeroed");
+			void* big = sessionAlloc(session, 1 << 20);
+			Assert::IsNotNull(big, L"Allocations bigger than a chunk work");
+			Assert::IsTrue(big != scratch, L"Separate allocations");
+
+			Assert::IsTrue(setSession(nullptr) == session, L"Got the session back");
+			void* afterSession = createNif("SKYRIM", 0, "Scene Root");
+
+			// The session holds the nif, the skin and its skeleton, and the shared skeleton.
+			MemoryReport before;
+			Assert::AreEqual(0, getMemoryUsage(session, &before), L"Session measured");
+			Assert::IsTrue(before.blockCount > 0 && before.weightMaps > 0 && before.skeletons > 0,
+				L"Session holds a nif, a skin and skeletons");
+			uint64_t nifHandle = getHandle(nif);
+			uint64_t skinHandle = getHandle(skin);
+			uint64_t skelHandle = getHandle(skel);
+			uint64_t afterHandle = getHandle(afterSession);
+
+			destroySession(session);
+			Assert::IsNull(resolveHandle(nifHandle), L"Session freed its nif");
+			Assert::IsNull(resolveHandle(skinHandle), L"Session freed its skin");
+			Assert::IsNull(resolveHandle(skelHandle), L"Session freed its skeleton");
+			Assert::IsTrue(resolveHandle(afterHandle) == afterSession, L"Nif made after the session is left alone");
+			Assert::IsTrue(getHandle(outside) != 0, L"Nif made before the session is left alone");
+			clearMessageLog();
+			Assert::IsNull(sessionAlloc(session, 10), L"Session is gone");
+			Assert::IsTrue(getMessageLog(nullptr, 0) > 0, L"Error logged");
+			MemoryReport after;
+			Assert::AreEqual(-1, getMemoryUsage(session, &after), L"Session can't be measured once destroyed");
+
+			char buf[64];
+			Assert::IsTrue(getRootName(outside, buf, 64) > 0, L"Nif from outside the session still valid");
+			destroy(outside);
+			destroy(afterSession);
+		};
+		TEST_METHOD(memoryUsage) {
+			/* Memory is reported by category for nifs, skins and sessions. */
+			std::filesystem::path testfile = testRoot / "Skyrim/sheath_p1_1.nif";
+			void* session = createSession();
+			setSession(session);
+			void* nif = load(testfile.u8string().c_str());
+			void* skin = loadSkinForNif(nif, "SKYRIM");
+			setSession(nullptr);
+
+			MemoryReport nifReport;
+			Assert::AreEqual(0, getMemoryUsage(nif, &nifReport), L"Nif measured");
+			Assert::IsTrue(nifReport.header > 0 && nifReport.vertexData > 0 && nifReport.skinData > 0, 
+				L"Header, geometry and skin blocks counted");
+			Assert::IsTrue(nifReport.blockCount > 0, L"Blocks counted");
+			Assert::IsTrue(nifReport.weightMaps == 0 && nifReport.skeletons == 0, L"No skin in a nif");
+			Assert::IsTrue(nifReport.processResident > 0, L"Process totals filled in");
+
+			MemoryReport skinReport;
+			getMemoryUsage(skin, &skinReport);
+			Assert::IsTrue(skinReport.weightMaps > 0 && skinReport.skeletons > 0, L"Skin weights and skeleton counted");
+			Assert::IsTrue(skinReport.blockCount == 0, L"Skin doesn't count the nif");
+
+			sessionAlloc(session, 1000);
+			MemoryReport sessionReport;
+			getMemoryUsage(session, &sessionReport);
+			Assert::AreEqual(nifReport.vertexData, sessionReport.vertexData, L"Session includes the nif");
+			Assert::AreEqual(skinReport.skeletons, sessionReport.skeletons, L"Session includes the skeleton once");
+			Assert::IsTrue(sessionReport.scratch >= 1000, L"Session includes its arena");
+
+			char json[2000];
+			int len = getBlockMemoryUsage(nif, json, 2000);
+			Assert::IsTrue(len > 0 && std::string(json).find("\"NiTriShapeData\"") != std::string::npos,
+				L"Block types reported");
+
+			int notAHandle = 0;
+			Assert::AreEqual(-1, getMemoryUsage(&notAHandle, &nifReport), L"Unknown handle rejected");
+			Assert::IsTrue(nifReport.processResident > 0, L"Process totals still filled in");
+
+			destroySession(session);
+		};
+		TEST_METHOD(handles) {
+			/* Handles resolve while their object lives and stop once it's freed or
+				replaced. */
+			std::filesystem::path testfile = testRoot / "Skyrim/sheath_p1_1.nif";
+			void* nif = load(testfile.u8string().c_str());
+			uint64_t nifHandle = getHandle(nif);
+			Assert::IsTrue(nifHandle != 0, L"Got a nif handle");
+			Assert::AreEqual(nifHandle, getHandle(nif), L"Same handle each time");
+			Assert::IsTrue(resolveHandle(nifHandle) == nif, L"Nif handle resolves");
+
+			void* shapes[10];
+			int shapeCount = getShapes(nif, shapes, 10, 0);
+			uint64_t shapeHandle = getBlockHandle(nif, shapes[0]);
+			Assert::IsTrue(resolveHandle(shapeHandle) == shapes[0], L"Shape handle resolves");
+			uint64_t rootHandle = getBlockHandle(nif, getRoot(nif));
+
+			uint32_t ids[10];
+			Assert::AreEqual(shapeCount, getShapeIds(nifHandle, ids, 10), L"Got shape IDs");
+			void* bvh = buildShapeBVHFromIds(nifHandle, ids, shapeCount);
+			Assert::IsNotNull(bvh, L"Built BVH from IDs");
+			destroyShapeBVH(bvh);
+			uint32_t wrongGeneration = ids[0] ^ (1u << 24);
+			Assert::IsNull(buildShapeBVHFromIds(nifHandle, &wrongGeneration, 1), L"ID from another generation rejected");
+
+			uint64_t both[2] = { nifHandle, shapeHandle };
+			void* resolved[2];
+			Assert::AreEqual(2, resolveHandles(both, 2, resolved), L"Both resolve");
+
+			// Converting replaces the shapes but keeps the root.
+			Assert::AreEqual(0, convertNifGame(nif, "SKYRIMSE"), L"Converted");
+			Assert::IsNull(resolveHandle(shapeHandle), L"Replaced shape's handle is stale");
+			Assert::IsNull(buildShapeBVHFromIds(nifHandle, ids, shapeCount), L"Old shape IDs are stale");
+			Assert::IsTrue(resolveHandle(rootHandle) == getRoot(nif), L"Root handle still good");
+
+			// Deleting a block retires its handle, whatever then reuses its memory.
+			char edName[] = "HandleTest";
+			char edValue[] = "x";
+			setStringExtraData(nif, nullptr, edName, edValue);
+			NiObject* ed = static_cast<NifFile*>(nif)->FindBlockByName<NiStringExtraData>("HandleTest");
+			uint64_t edHandle = getBlockHandle(nif, ed);
+			Assert::IsTrue(resolveHandle(edHandle) == ed, L"Extra data handle resolves");
+			Assert::AreEqual(1, removeExtraData(nif, nullptr, "HandleTest"), L"Extra data removed");
+			Assert::IsNull(resolveHandle(edHandle), L"Deleted block's handle is stale");
+			setStringExtraData(nif, nullptr, edName, edValue);
+			Assert::IsNull(resolveHandle(edHandle), L"Still stale once a new block is added");
+
+			void* skin = loadSkinForNif(nif, "SKYRIMSE");
+			uint64_t skinHandle = getHandle(skin);
+			Assert::IsTrue(resolveHandle(skinHandle) == skin, L"Skin handle resolves");
+			destroySkin(skin);
+			Assert::IsNull(resolveHandle(skinHandle), L"Freed skin's handle is stale");
+
+			destroy(nif);
+			Assert::IsNull(resolveHandle(nifHandle), L"Freed nif's handle is stale");
+			Assert::IsNull(resolveHandle(rootHandle), L"Freed nif's blocks are stale");
+			Assert::AreEqual(-1, getShapeIds(nifHandle, ids, 10), L"No IDs from a stale nif");
+
+			void* nif2 = load(testfile.u8string().c_str());
+			Assert::IsTrue(getHandle(nif2) != nifHandle, L"New nif gets a new handle");
+			destroy(nif2);
+		};
+		TEST_METHOD(rootBoneWithoutParent) {
+			/* A custom root bone can be added to a skin with no parent name. */
+			void* nif = createNif("FO4", 0, "Scene Root");
+			void* skin = createSkinForNif(nif, "FO4");
+			float verts[] = { 0, 0, 0,  1, 0, 0,  0, 1, 0 };
+			float uvs[] = { 0, 0,  1, 0,  0, 1 };
+			float norms[] = { 0, 0, 1,  0, 0, 1,  0, 0, 1 };
+			uint16_t tris[] = { 0, 1, 2 };
+			void* shape = createNifShapeFromData(nif, "Tri", verts, uvs, norms, 3, tris, 1);
+			skinShape(nif, shape);
+
+			MatTransform rootXf, childXf;
+			rootXf.translation = Vector3(0, 0, 10);
+			childXf.translation = Vector3(0, 0, 5);
+			addBoneToSkin(skin, "CustomRoot", &rootXf, nullptr);
+			addBoneToShape(skin, shape, "CustomChild", &childXf, "CustomRoot");
+			VertexWeightPair vw[] = { {0, 1.0f}, {1, 1.0f}, {2, 1.0f} };
+			setShapeWeights(skin, shape, "CustomChild", vw, 3, &childXf);
+
+			std::filesystem::path fileOut = testRoot / "Out/rootBoneWithoutParent.nif";
+			Assert::AreEqual(0, saveSkinnedNif(skin, fileOut.u8string().c_str()), L"Saved");
+			destroySkin(skin);
+			destroy(nif);
+
+			void* nif2 = load(fileOut.u8string().c_str());
+			int nodeCount = getNodeCount(nif2);
+			std::vector<void*> nodes(nodeCount);
+			getNodes(nif2, nodes.data());
+			char name[64];
+			void* child = nullptr;
+			for (void* n : nodes) {
+				getNodeName(n, name, 64);
+				if (strcmp(name, "CustomChild") == 0) child = n;
+			}
+			Assert::IsNotNull(child, L"Child bone written");
+			void* parent = getNodeParent(nif2, child);
+			Assert::IsNotNull(parent, L"Child bone has a parent");
+			getNodeName(parent, name, 64);
+			Assert::AreEqual("CustomRoot", name, L"Parented to the custom root");
+			destroy(nif2);
+		};
 	};
 }
@@ -0,0 +1,330 @@
+/*
+	Post-transform vertex cache optimization.
+
+	Triangle ordering follows Tom Forsyth's "Linear-Speed Vertex Cache Optimisation":
+	vertices are scored by their position in a simulated LRU cache and by how many
+	unemitted triangles still use them; each step emits the best-scoring triangle
+	touching the cache.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include "NifFile.hpp"
+#include "VertexCache.hpp"
+
+using namespace nifly;
+
+namespace {
+	const float CacheDecayPower = 1.5f;
+	const float LastTriScore = 0.75f;
+	const float ValenceBoostScale = 2.0f;
+	const float ValenceBoostPower = 0.5f;
+
+	float VertexScore(int cachePos, uint32_t activeTris, int cacheSize) {
+		if (activeTris == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if (cachePos >= 0) {
+			if (cachePos < 3)
+				// Vertices of the last triangle: fixed score so the next triangle
+				// doesn't just flip-flop around them.
+				score = LastTriScore;
+			else {
+				float scaler = 1.0f / float(cacheSize - 3);
+				score = std::pow(1.0f - float(cachePos - 3) * scaler, CacheDecayPower);
+			}
+		}
+
+		// Bonus for vertices with few triangles left, to finish them off.
+		score += ValenceBoostScale * std::pow(float(activeTris), -ValenceBoostPower);
+		return score;
+	}
+}
+
+float CalcACMR(const std::vector<Triangle>& tris, int cacheSize) {
+	if (tris.empty() || cacheSize <= 0)
+		return 0.0f;
+
+	uint32_t vertCount = 0;
+	for (auto& t : tris)
+		vertCount = std::max<uint32_t>(vertCount, std::max({ t.p1, t.p2, t.p3 }) + 1u);
+
+	// FIFO cache: a vertex is a hit if it was loaded within the last cacheSize misses.
+	std::vector<int64_t> loadedAt(vertCount, -1);
+	int64_t misses = 0;
+	for (auto& t : tris) {
+		for (uint16_t v : { t.p1, t.p2, t.p3 }) {
+			if (loadedAt[v] < 0 || misses - loadedAt[v] >= cacheSize) {
+				loadedAt[v] = misses;
+				misses++;
+			}
+		}
+	}
+	return float(misses) / float(tris.size());
+}
+
+std::vector<uint32_t> OptimizeTriangleOrder(
+	const std::vector<Triangle>& tris, uint32_t vertCount, int cacheSize)
+{
+	size_t triCount = tris.size();
+	std::vector<uint32_t> order;
+	order.reserve(triCount);
+	cacheSize = std::max(cacheSize, 4);
+
+	// Triangles using each vertex. The first activeTris[v] entries are the ones
+	// not emitted yet.
+	std::vector<uint32_t> activeTris(vertCount, 0);
+	for (auto& t : tris) {
+		activeTris[t.p1]++;
+		activeTris[t.p2]++;
+		activeTris[t.p3]++;
+	}
+	std::vector<uint32_t> vertStart(vertCount + 1, 0);
+	for (uint32_t v = 0; v < vertCount; v++)
+		vertStart[v + 1] = vertStart[v] + activeTris[v];
+	std::vector<uint32_t> vertTris(vertStart[vertCount]);
+	std::vector<uint32_t> fill(vertStart.begin(), vertStart.end() - 1);
+	for (uint32_t t = 0; t < triCount; t++) {
+		vertTris[fill[tris[t].p1]++] = t;
+		vertTris[fill[tris[t].p2]++] = t;
+		vertTris[fill[tris[t].p3]++] = t;
+	}
+
+	std::vector<int> cachePos(vertCount, -1);
+	std::vector<float> vertScore(vertCount);
+	for (uint32_t v = 0; v < vertCount; v++)
+		vertScore[v] = VertexScore(-1, activeTris[v], cacheSize);
+
+	std::vector<char> emitted(triCount, 0);
+	std::vector<uint32_t> cache;
+	std::vector<uint32_t> newCache;
+	cache.reserve(cacheSize + 3);
+	newCache.reserve(cacheSize + 3);
+	size_t nextUnemitted = 0;
+	int64_t bestTri = -1;
+
+	while (order.size() < triCount) {
+		if (bestTri < 0) {
+			// Nothing useful in the cache: start on the next unused triangle.
+			while (emitted[nextUnemitted])
+				nextUnemitted++;
+			bestTri = int64_t(nextUnemitted);
+		}
+
+		uint32_t t = uint32_t(bestTri);
+		emitted[t] = 1;
+		order.push_back(t);
+
+		// Drop the triangle from its vertices' active lists.
+		for (uint16_t v : { tris[t].p1, tris[t].p2, tris[t].p3 }) {
+			uint32_t* first = &vertTris[vertStart[v]];
+			uint32_t* last = first + activeTris[v];
+			uint32_t* it = std::find(first, last, t);
+			if (it != last) {
+				std::swap(*it, *(last - 1));
+				activeTris[v]--;
+			}
+		}
+
+		// Triangle's vertices move to the front of the cache.
+		newCache.clear();
+		for (uint16_t v : { tris[t].p1, tris[t].p2, tris[t].p3 })
+			if (std::find(newCache.begin(), newCache.end(), v) == newCache.end())
+				newCache.push_back(v);
+		for (auto v : cache)
+			if (std::find(newCache.begin(), newCache.end(), v) == newCache.end())
+				newCache.push_back(v);
+
+		for (size_t i = 0; i < newCache.size(); i++) {
+			uint32_t v = newCache[i];
+			cachePos[v] = i < size_t(cacheSize) ? int(i) : -1;
+			vertScore[v] = VertexScore(cachePos[v], activeTris[v], cacheSize);
+		}
+
+		// Rescore the triangles touching the cache and pick the best.
+		bestTri = -1;
+		float bestScore = -1.0f;
+		for (auto v : newCache) {
+			for (uint32_t i = vertStart[v]; i < vertStart[v] + activeTris[v]; i++) {
+				uint32_t nt = vertTris[i];
+				float s = vertScore[tris[nt].p1] + vertScore[tris[nt].p2] + vertScore[tris[nt].p3];
+				if (s > bestScore) {
+					bestScore = s;
+					bestTri = nt;
+				}
+			}
+		}
+
+		if (newCache.size() > size_t(cacheSize))
+			newCache.resize(cacheSize);
+		std::swap(cache, newCache);
+	}
+
+	return order;
+}
+
+std::vector<uint32_t> OptimizeVertexFetch(const std::vector<Triangle>& tris, uint32_t vertCount) {
+	std::vector<uint32_t> vertOrder;
+	vertOrder.reserve(vertCount);
+	std::vector<char> used(vertCount, 0);
+
+	for (auto& t : tris)
+		for (uint16_t v : { t.p1, t.p2, t.p3 })
+			if (v < vertCount && !used[v]) {
+				used[v] = 1;
+				vertOrder.push_back(v);
+			}
+
+	for (uint32_t v = 0; v < vertCount; v++)
+		if (!used[v])
+			vertOrder.push_back(v);
+
+	return vertOrder;
+}
+
+bool OptimizeShapeVertexCache(NifFile* nif, NiShape* shape, AnimInfo* anim,
+	int cacheSize, std::vector<uint32_t>& vertOrder, float& acmrBefore, float& acmrAfter)
+{
+	vertOrder.clear();
+	acmrBefore = acmrAfter = 0.0f;
+	if (!shape)
+		return false;
+
+	uint32_t vertCount = shape->GetNumVertices();
+	vertOrder.resize(vertCount);
+	std::iota(vertOrder.begin(), vertOrder.end(), 0);
+
+	std::vector<Triangle> tris;
+	if (shape->HasType<BSDynamicTriShape>() || !shape->GetTriangles(tris) || tris.empty())
+		return false;
+	for (auto& t : tris)
+		if (t.p1 >= vertCount || t.p2 >= vertCount || t.p3 >= vertCount)
+			return false;
+	acmrBefore = acmrAfter = CalcACMR(tris, cacheSize);
+
+	std::vector<uint32_t> triOrder = OptimizeTriangleOrder(tris, vertCount, cacheSize);
+	std::vector<Triangle> newTris;
+	newTris.reserve(tris.size());
+	for (auto t : triOrder)
+		newTris.push_back(tris[t]);
+
+	std::vector<uint32_t> newOrder = OptimizeVertexFetch(newTris, vertCount);
+	std::vector<uint16_t> newIndex(vertCount);
+	for (uint32_t i = 0; i < vertCount; i++)
+		newIndex[newOrder[i]] = uint16_t(i);
+	for (auto& t : newTris) {
+		t.p1 = newIndex[t.p1];
+		t.p2 = newIndex[t.p2];
+		t.p3 = newIndex[t.p3];
+	}
+
+	float acmr = CalcACMR(newTris, cacheSize);
+	if (acmr >= acmrBefore)
+		return false;
+	acmrAfter = acmr;
+	vertOrder = newOrder;
+
+	// Read everything indexed by triangle or vertex before changing the shape.
+	std::string shapeName = shape->name.get();
+	NiVector<BSDismemberSkinInstance::PartitionInfo> partInfos;
+	NifSegmentationInfo segInfo;
+	std::vector<int> triParts;
+	bool hasSegments = nif->GetShapeSegments(shape, segInfo, triParts);
+	bool hasPartitions = !hasSegments && nif->GetShapePartitions(shape, partInfos, triParts);
+
+	bool isBSShape = shape->HasType<BSTriShape>();
+	bool isFO = nif->GetHeader().GetVersion().IsFO4() || nif->GetHeader().GetVersion().IsFO76();
+	std::vector<std::unordered_map<uint16_t, float>> boneWeights;
+	if (shape->IsSkinned()) {
+		std::vector<int> boneIDs;
+		nif->GetShapeBoneIDList(shape, boneIDs);
+		boneWeights.resize(boneIDs.size());
+		for (int b = 0; b < int(boneIDs.size()); b++)
+			nif->GetShapeBoneWeights(shape, b, boneWeights[b]);
+	}
+
+	auto reorder = [&](auto& values) {
+		if (values.size() != vertCount)
+			return false;
+		auto old = values;
+		for (uint32_t i = 0; i < vertCount; i++)
+			values[i] = old[vertOrder[i]];
+		return true;
+	};
+	auto remapWeights = [&](std::unordered_map<uint16_t, float>& weights) {
+		std::unordered_map<uint16_t, float> remapped;
+		for (auto& w : weights)
+			if (w.first < vertCount)
+				remapped[newIndex[w.first]] = w.second;
+		weights = std::move(remapped);
+	};
+
+	shape->SetTriangles(newTris);
+
+	std::vector<Vector3> verts;
+	if (nif->GetVertsForShape(shape, verts) && reorder(verts))
+		nif->SetVertsForShape(shape, verts);
+
+	const std::vector<Vector3>* normsPtr = nif->GetNormalsForShape(shape);
+	if (normsPtr) {
+		std::vector<Vector3> norms = *normsPtr;
+		if (reorder(norms))
+			nif->SetNormalsForShape(shape, norms);
+	}
+
+	const std::vector<Vector2>* uvsPtr = nif->GetUvsForShape(shape);
+	if (uvsPtr) {
+		std::vector<Vector2> uvs = *uvsPtr;
+		if (reorder(uvs))
+			nif->SetUvsForShape(shape, uvs);
+	}
+
+	const std::vector<Color4>* colorsPtr = nif->GetColorsForShape(shapeName);
+	if (colorsPtr) {
+		std::vector<Color4> colors = *colorsPtr;
+		if (reorder(colors))
+			nif->SetColorsForShape(shapeName, colors);
+	}
+
+	// Bone weights in the nif, written the same way AnimInfo::WriteToNif does.
+	if (!boneWeights.empty()) {
+		std::unordered_map<uint16_t, VertexBoneWeights> vertWeights;
+		for (int b = 0; b < int(boneWeights.size()); b++) {
+			remapWeights(boneWeights[b]);
+			if (isBSShape)
+				for (auto& vw : boneWeights[b])
+					vertWeights[vw.first].Add(b, vw.second);
+			if (!isFO)
+				nif->SetShapeBoneWeights(shapeName, b, boneWeights[b]);
+		}
+		if (isBSShape) {
+			nif->ClearShapeVertWeights(shapeName);
+			for (auto& vid : vertWeights)
+				nif->SetShapeVertWeights(shapeName, vid.first, vid.second.boneIds, vid.second.weights);
+		}
+	}
+
+	// Bone weights waiting in the skin to be written.
+	if (anim && anim->HasSkinnedShape(shape)) {
+		for (auto& bw : anim->shapeSkinning[shapeName].boneWeights)
+			remapWeights(bw.second.weights);
+		anim->MarkShapeDirty(shapeName);
+	}
+
+	if (triParts.size() == triOrder.size()) {
+		std::vector<int> newTriParts(triParts.size());
+		for (size_t i = 0; i < triOrder.size(); i++)
+			newTriParts[i] = triParts[triOrder[i]];
+		if (hasSegments)
+			nif->SetShapeSegments(shape, segInfo, newTriParts);
+		else if (hasPartitions)
+			nif->SetShapePartitions(shape, partInfos, newTriParts, true);
+	}
+	if (shape->IsSkinned())
+		nif->UpdateSkinPartitions(shape);
+
+	nif->CalcTangentsForShape(shape);
+	return true;
+}
@@ -0,0 +1,35 @@
+/*
+	Post-transform vertex cache optimization. Reorders triangles so vertices are
+	reused while still in the GPU's cache (Tom Forsyth's linear-speed algorithm), then
+	reorders vertices into first-use order for fetch locality.
+	*/
+#include <vector>
+#include "BasicTypes.hpp"
+#include "NifFile.hpp"
+#include "Anim.h"
+
+#pragma once
+
+/* Average cache miss ratio: vertex transforms per triangle with a FIFO cache of the
+	given size. 3.0 is worst; around 0.6-0.7 is good for a typical mesh. */
+float CalcACMR(const std::vector<nifly::Triangle>& tris, int cacheSize);
+
+/* Return the triangle indices in cache-friendly order. */
+std::vector<uint32_t> OptimizeTriangleOrder(
+	const std::vector<nifly::Triangle>& tris, uint32_t vertCount, int cacheSize);
+
+/* Return the vertex order (new index -> old index) that has vertices in the order the
+	triangles first use them. Unused vertices go last, in their original order. */
+std::vector<uint32_t> OptimizeVertexFetch(
+	const std::vector<nifly::Triangle>& tris, uint32_t vertCount);
+
+/* Reorder a shape's triangles and vertices for the vertex cache. Vertex positions,
+	normals, UVs, colors, bone weights (in the nif and in the skin, if it tracks the shape),
+	partition and segment triangle lists are all remapped, and tangents recalculated.
+	Anything else indexed by vertex, such as morphs, has to be remapped by the caller
+	using vertOrder (new index -> old index).
+	Head parts (BSDynamicTriShape) are left alone: their vertex order has to match
+	their tri files and facegen data.
+	Returns true if the shape was changed. */
+bool OptimizeShapeVertexCache(nifly::NifFile* nif, nifly::NiShape* shape, AnimInfo* anim,
+	int cacheSize, std::vector<uint32_t>& vertOrder, float& acmrBefore, float& acmrAfter);
@@ -0,0 +1,181 @@
+/*
+	Vertex welding.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include "NifFile.hpp"
+#include "GridHash.hpp"
+#include "VertexWeld.hpp"
+
+using namespace nifly;
+
+namespace {
+	bool Within(float a, float b, float tol) {
+		return tol < 0.0f || std::fabs(a - b) <= tol;
+	}
+
+	bool WeightsMatch(const std::vector<std::pair<uint16_t, float>>& a,
+		const std::vector<std::pair<uint16_t, float>>& b, float tol)
+	{
+		// A bone missing from one side counts as weight 0.
+		auto weightOf = [](const std::vector<std::pair<uint16_t, float>>& w, uint16_t bone) {
+			for (auto& bw : w)
+				if (bw.first == bone)
+					return bw.second;
+			return 0.0f;
+		};
+		for (auto& bw : a)
+			if (!Within(bw.second, weightOf(b, bw.first), tol))
+				return false;
+		for (auto& bw : b)
+			if (!Within(bw.second, weightOf(a, bw.first), tol))
+				return false;
+		return true;
+	}
+}
+
+std::vector<uint32_t> FindWeldMap(const WeldInput& in, const WeldTolerances& tol, uint32_t& keptCount)
+{
+	const std::vector<Vector3>& verts = *in.verts;
+	size_t n = verts.size();
+	auto has = [n](const auto* list) { return list && list->size() == n; };
+	bool useUVs = tol.uv >= 0.0f && has(in.uvs);
+	bool useNormals = tol.normal >= 0.0f && has(in.normals);
+	bool useColors = tol.color >= 0.0f && has(in.colors);
+	bool useWeights = tol.weight >= 0.0f && has(in.weights);
+
+	float posTol = std::max(tol.position, 0.0f);
+	auto matches = [&](uint32_t a, uint32_t b) {
+		if (verts[a].DistanceSquaredTo(verts[b]) > posTol * posTol)
+			return false;
+		if (useUVs) {
+			const Vector2& p = (*in.uvs)[a];
+			const Vector2& q = (*in.uvs)[b];
+			if (!Within(p.u, q.u, tol.uv) || !Within(p.v, q.v, tol.uv))
+				return false;
+		}
+		if (useNormals) {
+			const Vector3& p = (*in.normals)[a];
+			const Vector3& q = (*in.normals)[b];
+			if (!Within(p.x, q.x, tol.normal) || !Within(p.y, q.y, tol.normal) || !Within(p.z, q.z, tol.normal))
+				return false;
+		}
+		if (useColors) {
+			const Color4& p = (*in.colors)[a];
+			const Color4& q = (*in.colors)[b];
+			if (!Within(p.r, q.r, tol.color) || !Within(p.g, q.g, tol.color)
+				|| !Within(p.b, q.b, tol.color) || !Within(p.a, q.a, tol.color))
+				return false;
+		}
+		if (useWeights && !WeightsMatch((*in.weights)[a], (*in.weights)[b], tol.weight))
+			return false;
+		return true;
+	};
+
+	float cellSize = GridCellSize(posTol, GridMaxCoord(verts));
+	std::unordered_map<GridCell, std::vector<uint32_t>, GridCellHash> grid;
+	grid.reserve(n);
+	std::vector<uint32_t> remap(n);
+	keptCount = 0;
+	for (uint32_t v = 0; v < n; v++) {
+		GridCell c = GridCellOf(verts[v], cellSize);
+		uint32_t target = NIF_NPOS;
+		for (int dx = -1; dx <= 1 && target == NIF_NPOS; dx++)
+			for (int dy = -1; dy <= 1 && target == NIF_NPOS; dy++)
+				for (int dz = -1; dz <= 1 && target == NIF_NPOS; dz++) {
+					auto it = grid.find(c.Offset(dx, dy, dz));
+					if (it == grid.end())
+						continue;
+					for (uint32_t kept : it->second)
+						if (matches(kept, v)) {
+							target = kept;
+							break;
+						}
+				}
+
+		if (target != NIF_NPOS)
+			remap[v] = remap[target];
+		else {
+			remap[v] = keptCount++;
+			grid[c].push_back(v);
+		}
+	}
+	return remap;
+}
+
+uint32_t WeldShapeVerts(NifFile* nif, NiShape* shape, const WeldTolerances& tol, std::vector<uint32_t>& remap)
+{
+	std::vector<Vector3> verts;
+	nif->GetVertsForShape(shape, verts);
+	std::vector<Triangle> tris;
+	shape->GetTriangles(tris);
+
+	WeldInput input;
+	input.verts = &verts;
+	input.uvs = nif->GetUvsForShape(shape);
+	input.normals = nif->GetNormalsForShape(shape);
+	input.colors = nif->GetColorsForShape(shape->name.get());
+
+	std::vector<std::vector<std::pair<uint16_t, float>>> weights;
+	if (shape->IsSkinned()) {
+		std::vector<int> boneIDs;
+		nif->GetShapeBoneIDList(shape, boneIDs);
+		weights.resize(verts.size());
+		for (int b = 0; b < int(boneIDs.size()); b++) {
+			std::unordered_map<uint16_t, float> bw;
+			nif->GetShapeBoneWeights(shape, b, bw);
+			for (auto& w : bw)
+				if (w.first < weights.size() && w.second > 0.0f)
+					weights[w.first].emplace_back(uint16_t(b), w.second);
+		}
+		input.weights = &weights;
+	}
+
+	uint32_t keptCount = 0;
+	remap = FindWeldMap(input, tol, keptCount);
+	if (keptCount == verts.size())
+		return keptCount;
+
+	NiVector<BSDismemberSkinInstance::PartitionInfo> partInfos;
+	NifSegmentationInfo segInfo;
+	std::vector<int> triParts;
+	bool hasSegments = nif->GetShapeSegments(shape, segInfo, triParts);
+	bool hasPartitions = !hasSegments && nif->GetShapePartitions(shape, partInfos, triParts);
+
+	// Each kept vertex is the first of its group, so the others are the ones to delete.
+	std::vector<uint16_t> deleted;
+	uint32_t next = 0;
+	for (size_t v = 0; v < verts.size(); v++) {
+		if (remap[v] == next)
+			next++;
+		else
+			deleted.push_back(uint16_t(v));
+	}
+	nif->DeleteVertsForShape(shape, deleted);
+
+	std::vector<Triangle> newTris;
+	std::vector<int> newTriParts;
+	for (size_t t = 0; t < tris.size(); t++) {
+		Triangle nt(uint16_t(remap[tris[t].p1]), uint16_t(remap[tris[t].p2]), uint16_t(remap[tris[t].p3]));
+		if (nt.p1 == nt.p2 || nt.p2 == nt.p3 || nt.p3 == nt.p1)
+			continue;
+		newTris.push_back(nt);
+		if (triParts.size() == tris.size())
+			newTriParts.push_back(triParts[t]);
+	}
+	shape->SetTriangles(newTris);
+
+	if (newTriParts.size() == newTris.size()) {
+		if (hasSegments)
+			nif->SetShapeSegments(shape, segInfo, newTriParts);
+		else if (hasPartitions)
+			nif->SetShapePartitions(shape, partInfos, newTriParts, true);
+	}
+	if (shape->IsSkinned())
+		nif->UpdateSkinPartitions(shape);
+	nif->CalcTangentsForShape(shape);
+
+	return keptCount;
+}
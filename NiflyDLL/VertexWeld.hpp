@@ -0,0 +1,44 @@
+/*
+	Vertex welding: merge vertices that differ only by float noise, as often comes in
+	with meshes from other tools.
+	*/
+#include <vector>
+#include "BasicTypes.hpp"
+#include "NifFile.hpp"
+
+#pragma once
+
+/* How far apart vertices can be and still weld. Position is distance; the rest are the
+	largest difference allowed in any one component or bone weight. A negative tolerance
+	ignores that attribute; positions always count. */
+struct WeldTolerances {
+	float position = 0.0001f;
+	float uv = 0.0001f;
+	float normal = 0.001f;
+	float color = 0.002f;
+	float weight = 0.001f;
+};
+
+/* Vertex data to compare. Any of the attribute lists may be null. weights holds the
+	(bone index, weight) pairs of each vertex. */
+struct WeldInput {
+	const std::vector<nifly::Vector3>* verts = nullptr;
+	const std::vector<nifly::Vector2>* uvs = nullptr;
+	const std::vector<nifly::Vector3>* normals = nullptr;
+	const std::vector<nifly::Color4>* colors = nullptr;
+	const std::vector<std::vector<std::pair<uint16_t, float>>>* weights = nullptr;
+};
+
+/* Find the vertices that weld. Vertices are bucketed in a grid of position-tolerance
+	cells, so each is only compared with those in neighbouring cells. A vertex welds to
+	the first earlier vertex that matches it on every attribute.
+	Returns the new index of each vertex; the kept vertices stay in order. keptCount
+	receives the number of vertices left. */
+std::vector<uint32_t> FindWeldMap(const WeldInput& input, const WeldTolerances& tol, uint32_t& keptCount);
+
+/* Weld the shape's vertices. Triangles are remapped and any that collapse are dropped,
+	along with their partition or segment entries. remap receives the new index of each
+	old vertex, for updating morphs and other per-vertex data.
+	Returns the new vertex count. */
+uint32_t WeldShapeVerts(nifly::NifFile* nif, nifly::NiShape* shape, const WeldTolerances& tol,
+	std::vector<uint32_t>& remap);
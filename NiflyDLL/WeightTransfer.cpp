@@ -0,0 +1,179 @@
+/*
+	Bone weight transfer.
+	*/
+#include "pch.h"
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "NifFile.hpp"
+#include "NiflyFunctions.hpp"
+#include "NiflyParallel.hpp"
+#include "WeightTransfer.hpp"
+
+using namespace nifly;
+
+namespace {
+	const size_t TRANSFER_CHUNK = 256;
+	const size_t MAX_VERTEX_BONES = 4;
+}
+
+std::vector<std::vector<std::pair<uint16_t, float>>> TransferVertexWeights(
+	const MeshBVH& src,
+	const std::vector<std::vector<std::pair<uint16_t, float>>>& srcWeights,
+	const std::vector<Vector3>& destVerts,
+	uint32_t options,
+	float maxDistance)
+{
+	std::vector<std::vector<std::pair<uint16_t, float>>> result(destVerts.size());
+	if (src.Empty())
+		return result;
+
+	size_t chunks = (destVerts.size() + TRANSFER_CHUNK - 1) / TRANSFER_CHUNK;
+	niflydll::ParallelFor(chunks, [&](size_t c) {
+		size_t end = std::min(destVerts.size(), (c + 1) * TRANSFER_CHUNK);
+		for (size_t v = c * TRANSFER_CHUNK; v < end; v++) {
+			MeshBVH::Hit hit;
+			if (!src.ClosestPoint(destVerts[v], hit, maxDistance))
+				continue;
+
+			const Triangle& t = src.Tris()[hit.tri];
+			uint16_t corners[3] = { t.p1, t.p2, t.p3 };
+			std::vector<std::pair<uint16_t, float>>& out = result[v];
+
+			if (options & TRANSFER_NEAREST_VERTEX) {
+				int nearest = int(std::max_element(hit.bary, hit.bary + 3) - hit.bary);
+				if (corners[nearest] < srcWeights.size())
+					out = srcWeights[corners[nearest]];
+			}
+			else {
+				for (int i = 0; i < 3; i++) {
+					if (corners[i] >= srcWeights.size() || hit.bary[i] <= 0.0f)
+						continue;
+					for (auto& bw : srcWeights[corners[i]]) {
+						auto it = std::find_if(out.begin(), out.end(),
+							[&](const std::pair<uint16_t, float>& o) { return o.first == bw.first; });
+						if (it == out.end())
+							out.emplace_back(bw.first, bw.second * hit.bary[i]);
+						else
+							it->second += bw.second * hit.bary[i];
+					}
+				}
+			}
+
+			std::sort(out.begin(), out.end(),
+				[](const std::pair<uint16_t, float>& a, const std::pair<uint16_t, float>& b) {
+					return a.second > b.second || (a.second == b.second && a.first < b.first);
+				});
+			if (!(options & TRANSFER_ALL_BONES) && out.size() > MAX_VERTEX_BONES)
+				out.resize(MAX_VERTEX_BONES);
+			while (!out.empty() && out.back().second <= 0.0f)
+				out.pop_back();
+
+			float total = 0.0f;
+			for (auto& bw : out)
+				total += bw.second;
+			if (total > 0.0f)
+				for (auto& bw : out)
+					bw.second /= total;
+		}
+		});
+
+	return result;
+}
+
+int TransferShapeWeights(NifFile* srcNif, NiShape* srcShape,
+	AnimInfo* anim, NiShape* destShape, uint32_t options, float maxDistance)
+{
+	NifFile* destNif = anim->GetRefNif();
+	std::string destName = destShape->name.get();
+
+	// Source mesh and weights, in global space.
+	std::vector<Vector3> srcVerts;
+	srcNif->GetVertsForShape(srcShape, srcVerts);
+	MatTransform srcToGlobal = CalcShapeTransformToGlobal(srcNif, srcShape);
+	for (auto& v : srcVerts)
+		v = srcToGlobal.ApplyTransform(v);
+	std::vector<Triangle> srcTris;
+	srcShape->GetTriangles(srcTris);
+
+	std::vector<std::string> boneNames;
+	srcNif->GetShapeBoneList(srcShape, boneNames);
+	std::vector<std::vector<std::pair<uint16_t, float>>> srcWeights(srcVerts.size());
+	for (int b = 0; b < int(boneNames.size()); b++) {
+		std::unordered_map<uint16_t, float> weights;
+		srcNif->GetShapeBoneWeights(srcShape, b, weights);
+		for (auto& w : weights)
+			if (w.first < srcVerts.size() && w.second > 0.0f)
+				srcWeights[w.first].emplace_back(uint16_t(b), w.second);
+	}
+
+	MeshBVH bvh;
+	bvh.Build(srcVerts, srcTris);
+
+	// Destination verts, in global space.
+	std::vector<Vector3> destVerts;
+	destNif->GetVertsForShape(destShape, destVerts);
+	MatTransform destToGlobal;
+	auto skin = anim->shapeSkinning.find(destName);
+	if (skin != anim->shapeSkinning.end())
+		destToGlobal = skin->second.xformGlobalToSkin.InverseTransform();
+	else
+		destToGlobal = CalcShapeTransformToGlobal(destNif, destShape);
+	for (auto& v : destVerts)
+		v = destToGlobal.ApplyTransform(v);
+
+	auto result = TransferVertexWeights(bvh, srcWeights, destVerts, options, 
+		maxDistance > 0.0f ? maxDistance : FLT_MAX);
+
+	std::unordered_set<uint16_t> weighted;
+	std::vector<std::unordered_map<uint16_t, float>> boneWeights(boneNames.size());
+	for (size_t v = 0; v < result.size(); v++) {
+		if (result[v].empty())
+			continue;
+		weighted.insert(uint16_t(v));
+		for (auto& bw : result[v])
+			boneWeights[bw.first][uint16_t(v)] = bw.second;
+	}
+	if (weighted.empty())
+		return 0;
+
+	// Transferred weights replace whatever the vertices had before.
+	auto existing = anim->shapeBones.find(destName);
+	if (existing != anim->shapeBones.end()) {
+		for (auto& boneName : existing->second) {
+			std::unordered_map<uint16_t, float> weights;
+			anim->GetWeights(destName, boneName, weights);
+			size_t before = weights.size();
+			for (auto v : weighted)
+				weights.erase(v);
+			if (weights.size() != before)
+				anim->SetWeights(destName, boneName, weights);
+		}
+	}
+
+	for (int b = 0; b < int(boneNames.size()); b++) {
+		if (boneWeights[b].empty())
+			continue;
+		const std::string& boneName = boneNames[b];
+
+		if (anim->GetSkeleton()->GetBonePtr(boneName)) 
+			AddBoneToShape(anim, destShape, boneName);
+		else {
+			// Not in the skeleton; bring the bone over from the source nif.
+			MatTransform xform;
+			srcNif->GetNodeTransform(boneName, xform);
+			NiNode* bone = srcNif->FindBlockByName<NiNode>(boneName);
+			NiNode* parent = bone ? srcNif->GetParentNode(bone) : nullptr;
+			std::string parentName = parent ? parent->name.get() : "";
+			AddBoneToShape(anim, destShape, boneName, &xform, parent ? parentName.c_str() : nullptr);
+		}
+
+		std::unordered_map<uint16_t, float> weights;
+		anim->GetWeights(destName, boneName, weights);
+		for (auto& w : boneWeights[b])
+			weights[w.first] = w.second;
+		anim->SetWeights(destName, boneName, weights);
+	}
+
+	return int(weighted.size());
+}
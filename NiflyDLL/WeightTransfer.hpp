@@ -0,0 +1,32 @@
+/*
+	Bone weight transfer between shapes, e.g. from a reference body onto an outfit. Each
+	target vertex takes its weights from the closest point on the source mesh.
+	*/
+#include <vector>
+#include "BasicTypes.hpp"
+#include "NifFile.hpp"
+#include "Anim.h"
+#include "MeshBVH.hpp"
+
+#pragma once
+
+const uint32_t TRANSFER_NEAREST_VERTEX = 1;		// Copy the closest source vertex's weights instead of interpolating
+const uint32_t TRANSFER_ALL_BONES = 2;			// Keep every influence instead of the strongest 4
+
+/* Weights for each of destVerts, taken from the closest point on the source mesh and
+	interpolated across the source triangle. srcWeights has the (bone, weight) pairs for
+	each source vertex. Vertices farther than maxDistance from the source get no weights.
+	Runs in parallel over the destination vertices. */
+std::vector<std::vector<std::pair<uint16_t, float>>> TransferVertexWeights(
+	const MeshBVH& src,
+	const std::vector<std::vector<std::pair<uint16_t, float>>>& srcWeights,
+	const std::vector<nifly::Vector3>& destVerts,
+	uint32_t options,
+	float maxDistance);
+
+/* Copy weights from srcShape onto destShape, which must be in anim. Shapes are matched
+	up in global space. Source bones are added to destShape as needed, and the weights of
+	every destination vertex that found a source replace whatever it had before.
+	Returns the number of destination vertices weighted. */
+int TransferShapeWeights(nifly::NifFile* srcNif, nifly::NiShape* srcShape,
+	AnimInfo* anim, nifly::NiShape* destShape, uint32_t options, float maxDistance);
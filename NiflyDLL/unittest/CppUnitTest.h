@@ -0,0 +1,102 @@
+/*
+	Stand-in for the Visual Studio CppUnitTest framework, so TestDLL.cpp builds and runs
+	where that isn't available. Covers only what TestDLL uses. Tests register themselves
+	and TestRunner.cpp runs them.
+	*/
+#pragma once
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace Microsoft { namespace VisualStudio { namespace CppUnitTestFramework {
+
+	struct AssertFailure {
+		std::string message;
+	};
+
+	class Assert {
+	public:
+		static void Fail(const wchar_t* message = nullptr) {
+			std::string msg;
+			for (const wchar_t* p = message; p && *p; p++)
+				msg += (*p < 128) ? char(*p) : '?';
+			throw AssertFailure{ msg.empty() ? "Assert failed" : msg };
+		}
+		static void IsTrue(bool condition, const wchar_t* message = nullptr) {
+			if (!condition) Fail(message);
+		}
+		static void IsFalse(bool condition, const wchar_t* message = nullptr) {
+			if (condition) Fail(message);
+		}
+		template<typename T>
+		static void AreEqual(const T& expected, const T& actual, const wchar_t* message = nullptr) {
+			if (!(expected == actual)) Fail(message);
+		}
+		static void AreEqual(const char* expected, const char* actual, const wchar_t* message = nullptr) {
+			if (strcmp(expected, actual) != 0) Fail(message);
+		}
+		static void AreEqual(float expected, float actual, float tolerance, const wchar_t* message = nullptr) {
+			if (std::abs(expected - actual) > tolerance) Fail(message);
+		}
+		static void AreEqual(double expected, double actual, double tolerance, const wchar_t* message = nullptr) {
+			if (std::abs(expected - actual) > tolerance) Fail(message);
+		}
+		template<typename T>
+		static void AreNotEqual(const T& notExpected, const T& actual, const wchar_t* message = nullptr) {
+			if (notExpected == actual) Fail(message);
+		}
+		template<typename T>
+		static void IsNull(const T* ptr, const wchar_t* message = nullptr) {
+			if (ptr) Fail(message);
+		}
+		template<typename T>
+		static void IsNotNull(const T* ptr, const wchar_t* message = nullptr) {
+			if (!ptr) Fail(message);
+		}
+	};
+
+	struct TestEntry {
+		const char* name;
+		void (*run)();
+	};
+
+	inline std::vector<TestEntry>& RegisteredTests() {
+		static std::vector<TestEntry> tests;
+		return tests;
+	}
+
+	struct TestRegistrar {
+		TestRegistrar(const char* name, void (*run)()) {
+			RegisteredTests().push_back({ name, run });
+		}
+	};
+
+	template<typename T>
+	struct TestClass {
+		using ThisTestClass = T;
+	};
+} } }
+
+#define TEST_CLASS(className) \
+	class className : public ::Microsoft::VisualStudio::CppUnitTestFramework::TestClass<className>
+
+/* Each method registers a runner that calls it on a fresh instance, as VS does. */
+#define TEST_METHOD(methodName) \
+	static void methodName##_Run() { ThisTestClass instance; instance.methodName(); } \
+	inline static const ::Microsoft::VisualStudio::CppUnitTestFramework::TestRegistrar \
+		methodName##_Registrar{ #methodName, &methodName##_Run }; \
+	public: void methodName()
+
+// Normally from winnt.h.
+#ifndef DEFINE_ENUM_FLAG_OPERATORS
+#define DEFINE_ENUM_FLAG_OPERATORS(T) \
+	inline constexpr T operator|(T a, T b) { return T(std::underlying_type_t<T>(a) | std::underlying_type_t<T>(b)); } \
+	inline constexpr T operator&(T a, T b) { return T(std::underlying_type_t<T>(a) & std::underlying_type_t<T>(b)); } \
+	inline constexpr T operator^(T a, T b) { return T(std::underlying_type_t<T>(a) ^ std::underlying_type_t<T>(b)); } \
+	inline constexpr T operator~(T a) { return T(~std::underlying_type_t<T>(a)); } \
+	inline T& operator|=(T& a, T b) { return a = a | b; } \
+	inline T& operator&=(T& a, T b) { return a = a & b; } \
+	inline T& operator^=(T& a, T b) { return a = a ^ b; }
+#endif
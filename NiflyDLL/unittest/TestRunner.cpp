@@ -0,0 +1,54 @@
+/*
+	Runs the tests registered through CppUnitTest.h.
+
+	Usage: NiflyTest [name ...]
+	With names, runs only the tests whose name contains one of them.
+	*/
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <string>
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+int main(int argc, char* argv[]) {
+	int run = 0;
+	int failed = 0;
+	for (auto& test : RegisteredTests()) {
+		bool selected = argc < 2;
+		for (int i = 1; i < argc && !selected; i++)
+			selected = std::string(test.name).find(argv[i]) != std::string::npos;
+		if (!selected)
+			continue;
+
+		run++;
+		std::string error;
+		auto start = std::chrono::steady_clock::now();
+		try {
+			test.run();
+		}
+		catch (const AssertFailure& f) {
+			error = f.message;
+		}
+		catch (const std::exception& e) {
+			error = std::string("Exception: ") + e.what();
+		}
+		catch (...) {
+			error = "Unknown exception";
+		}
+		double ms = std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count();
+
+		if (error.empty())
+			printf("PASS %s (%.0f ms)\n", test.name, ms);
+		else {
+			failed++;
+			printf("FAIL %s: %s\n", test.name, error.c_str());
+		}
+		fflush(stdout);
+	}
+
+	printf("%d tests, %d failed\n", run, failed);
+	return (failed || !run) ? 1 : 0;
+}
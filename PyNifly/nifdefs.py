@@ -233,6 +233,16 @@ class TransformBuf(pynStructure):
 RT_NINODE = 0
 RT_BSFADENODE = 1
 
+# Adjacency tables, for NiShape.adjacency
+ADJ_VERT_TRI_START = 0
+ADJ_VERT_TRIS = 1
+ADJ_EDGES = 2
+ADJ_EDGE_TRI_START = 3
+ADJ_EDGE_TRIS = 4
+ADJ_TRI_EDGES = 5
+ADJ_TRI_NEIGHBORS = 6
+ADJ_NONE = 0xFFFFFFFF
+
 class RootFlags(PynIntFlag):
     HIDDEN = 1
     SELECTIVE_UPDATE = 1 << 1
@@ -529,6 +539,57 @@ class AlphaPropertyBuf(Structure):
 
 AlphaPropertyBuf_p = POINTER(AlphaPropertyBuf)
 
+LOG_MESSAGE_LEN = 256
+
+class LogRecordBuf(Structure):
+    _fields_ = [('seq', c_uint64),
+                ('level', c_int32),
+                ('code', c_int32),
+                ('handle', c_void_p),
+                ('thread', c_uint32),
+                ('message', c_char * LOG_MESSAGE_LEN)]
+
+class VertexBoneWeightBuf(Structure):
+    _fields_ = [('vertex', c_uint32),
+                ('bone', c_uint16),
+                ('weight', c_float)]
+
+class ShapeSplitExtrasBuf(Structure):
+    _fields_ = [('colors', c_void_p),
+                ('skin', c_void_p),
+                ('globalToSkin', POINTER(TransformBuf)),
+                ('boneCount', c_int),
+                ('boneNames', POINTER(c_char_p)),
+                ('boneXforms', POINTER(TransformBuf)),
+                ('boneParents', POINTER(c_char_p)),
+                ('weights', POINTER(VertexBoneWeightBuf)),
+                ('weightCount', c_int),
+                ('partData', c_void_p),
+                ('partCount', c_int),
+                ('triParts', c_void_p),
+                ('bonesPerPartition', c_int)]
+
+class SpatialHitBuf(Structure):
+    _fields_ = [('shape', c_int),
+                ('tri', c_uint32),
+                ('point', VECTOR3),
+                ('bary', VECTOR3),
+                ('distance', c_float)]
+
+class MemoryReport(Structure):
+    _fields_ = [('header', c_uint64),
+                ('vertexData', c_uint64),
+                ('skinData', c_uint64),
+                ('extraData', c_uint64),
+                ('otherBlocks', c_uint64),
+                ('blockCount', c_uint64),
+                ('weightMaps', c_uint64),
+                ('skeletons', c_uint64),
+                ('scratch', c_uint64),
+                ('processHeap', c_uint64),
+                ('processResident', c_uint64),
+                ('processPeakResident', c_uint64)]
+
     
 class bhkCOFlags(PynIntFlag):
     ACTIVE = 1
@@ -7,6 +7,7 @@ import struct
 from enum import Enum, IntFlag, IntEnum
 from math import asin, atan2, pi, sin, cos
 import re
+import json
 import logging
 from ctypes import *
 from typing import ValuesView # c_void_p, c_int, c_bool, c_char_p, c_wchar_p, c_float, c_uint8, c_uint16, c_uint32, create_string_buffer, Structure, cdll, pointer, addressof
@@ -38,20 +39,56 @@ def load_nifly(nifly_path):
     nifly.addRigidBody.restype = c_int
     nifly.addNode.argtypes = [c_void_p, c_char_p, POINTER(TransformBuf), c_void_p]
     nifly.addNode.restype = c_void_p
+    nifly.buildShapeBVH.argtypes = [c_void_p, POINTER(c_void_p), c_int]
+    nifly.buildShapeBVH.restype = c_void_p
+    nifly.buildShapeBVHFromIds.argtypes = [c_uint64, POINTER(c_uint32), c_int]
+    nifly.buildShapeBVHFromIds.restype = c_void_p
+    nifly.calcShapeNormals.argtypes = [c_void_p, c_void_p, c_int, c_float]
+    nifly.calcShapeNormals.restype = None
     nifly.clearMessageLog.argtypes = []
     nifly.clearMessageLog.restype = None
+    nifly.closestPoint.argtypes = [c_void_p, c_void_p, c_int, c_float, POINTER(SpatialHitBuf)]
+    nifly.closestPoint.restype = c_int
+    nifly.conformMorphs.argtypes = [c_void_p, c_void_p, c_void_p, c_void_p, c_void_p, c_int, c_float, c_int, c_void_p]
+    nifly.conformMorphs.restype = c_int
+    nifly.convertNifGame.argtypes = [c_void_p, c_char_p]
+    nifly.convertNifGame.restype = c_int
     nifly.createNif.argtypes = [c_char_p, c_int, c_char_p]
     nifly.createNif.restype = c_void_p
     nifly.createNifShapeFromData.argtypes = [c_void_p, c_char_p, c_void_p, c_void_p, c_void_p, c_int, c_void_p, c_int, c_void_p, c_void_p]
     nifly.createNifShapeFromData.restype = c_void_p
+    nifly.createNifShapesFromData.argtypes = [c_void_p, c_char_p, c_void_p, c_void_p, c_void_p, c_int, c_void_p, c_int, c_void_p, c_void_p, POINTER(c_void_p), c_int, c_void_p, c_int, c_void_p, POINTER(ShapeSplitExtrasBuf)]
+    nifly.createNifShapesFromData.restype = c_int
+    nifly.createSession.argtypes = []
+    nifly.createSession.restype = c_void_p
     nifly.createSkinForNif.argtypes = [c_void_p, c_char_p]
     nifly.createSkinForNif.restype = c_void_p
+    nifly.decimateShape.argtypes = [c_void_p, c_void_p, c_float, c_uint32, c_void_p]
+    nifly.decimateShape.restype = c_void_p
+    nifly.decimateShapes.argtypes = [c_void_p, POINTER(c_void_p), c_int, c_float, c_uint32, c_void_p, POINTER(c_void_p)]
+    nifly.decimateShapes.restype = c_int
     nifly.destroy.argtypes = [c_void_p]
     nifly.destroy.restype = None
+    nifly.destroySession.argtypes = [c_void_p]
+    nifly.destroySession.restype = None
+    nifly.destroyShapeBVH.argtypes = [c_void_p]
+    nifly.destroyShapeBVH.restype = None
+    nifly.destroySkeleton.argtypes = [c_void_p]
+    nifly.destroySkeleton.restype = None
+    nifly.destroySkin.argtypes = [c_void_p]
+    nifly.destroySkin.restype = None
+    nifly.enableStats.argtypes = [c_int]
+    nifly.enableStats.restype = None
+    nifly.findClipping.argtypes = [c_void_p, c_void_p, c_void_p, c_void_p, c_float, c_uint32, c_void_p, c_void_p, c_int]
+    nifly.findClipping.restype = c_int
     nifly.getAllShapeNames.argtypes = [c_void_p, c_char_p, c_int]
     nifly.getAllShapeNames.restype = c_int
     nifly.getAlphaProperty.argtypes = [c_void_p, c_void_p, AlphaPropertyBuf_p]
     nifly.getAlphaProperty.restype = c_int
+    nifly.getBlockMemoryUsage.argtypes = [c_void_p, c_char_p, c_int]
+    nifly.getBlockMemoryUsage.restype = c_int
+    nifly.getBlockHandle.argtypes = [c_void_p, c_void_p]
+    nifly.getBlockHandle.restype = c_uint64
     nifly.getBoneSkinToBoneXform.argtypes = [c_void_p, c_char_p, c_char_p, POINTER(TransformBuf)]
     nifly.getBoneSkinToBoneXform.restype = None 
     nifly.getBSXFlags.argtypes = [c_void_p, c_void_p]
@@ -98,8 +135,16 @@ def load_nifly(nifly_path):
     nifly.getGameName.restype = c_int
     nifly.getGlobalToSkin.argtypes = [c_void_p, c_void_p, POINTER(TransformBuf)]
     nifly.getGlobalToSkin.restype = None
+    nifly.getHandle.argtypes = [c_void_p]
+    nifly.getHandle.restype = c_uint64
     nifly.getInvMarker.argtypes = [c_void_p, c_char_p, c_int, c_void_p, c_void_p]
     nifly.getInvMarker.restype = c_int
+    nifly.getLogRecords.argtypes = [POINTER(c_uint64), POINTER(LogRecordBuf), c_int]
+    nifly.getLogRecords.restype = c_int
+    nifly.getLogThreadId.argtypes = []
+    nifly.getLogThreadId.restype = c_uint32
+    nifly.getMemoryUsage.argtypes = [c_void_p, POINTER(MemoryReport)]
+    nifly.getMemoryUsage.restype = c_int
     nifly.getMessageLog.argtypes = [c_char_p, c_int]
     nifly.getMessageLog.restype = c_int
     nifly.getNodeBlockname.argtypes = [c_void_p, c_char_p, c_int]
@@ -128,6 +173,8 @@ def load_nifly(nifly_path):
     nifly.getRoot.restype = c_void_p
     nifly.getRootName.argtypes = [c_void_p, c_char_p, c_int]
     nifly.getRootName.restype = c_int
+    nifly.getStats.argtypes = [c_char_p, c_int]
+    nifly.getStats.restype = c_int
     nifly.getSegmentFile.argtypes = [c_void_p, c_void_p, c_void_p, c_int]
     nifly.getSegmentFile.restype = c_int
     nifly.getSegments.argtypes = [c_void_p, c_void_p, c_void_p, c_int]
@@ -142,6 +189,8 @@ def load_nifly(nifly_path):
     nifly.getShaderName.restype = c_int
     nifly.getShaderTextureSlot.argtypes = [c_void_p, c_void_p, c_int, c_char_p, c_int]
     nifly.getShaderTextureSlot.restype = c_int
+    nifly.getShapeAdjacency.argtypes = [c_void_p, c_void_p, c_int, c_void_p, c_int]
+    nifly.getShapeAdjacency.restype = c_int
     nifly.getShapeBlockName.argtypes = [c_void_p, c_void_p, c_int]
     nifly.getShapeBlockName.restypes = c_int
     nifly.getShapeBoneCount.argtypes = [c_void_p, c_void_p]
@@ -170,6 +219,8 @@ def load_nifly(nifly_path):
     nifly.getRigidBodyProps.restype= c_int
     nifly.getRigidBodyShapeID.argtypes = [c_void_p, c_int]
     nifly.getRigidBodyShapeID.restype = c_int
+    nifly.getShapeIds.argtypes = [c_uint64, POINTER(c_uint32), c_int]
+    nifly.getShapeIds.restype = c_int
     nifly.getStringExtraData.argtypes = [c_void_p, c_void_p, c_int, c_char_p, c_int, c_char_p, c_int]
     nifly.getStringExtraData.restype = c_int
     nifly.getStringExtraDataLen.argtypes = [c_void_p, c_void_p, c_int, c_void_p, c_void_p]
@@ -200,12 +251,30 @@ def load_nifly(nifly_path):
     nifly.makeGameSkeletonInstance.restype = c_void_p
     nifly.makeSkeletonInstance.argtypes = [c_char_p, c_char_p]
     nifly.makeSkeletonInstance.restype = c_void_p
+    nifly.mergeShapesByMaterial.argtypes = [c_void_p, POINTER(c_void_p), c_int]
+    nifly.mergeShapesByMaterial.restype = c_int
+    nifly.optimizeShapeVertexCache.argtypes = [c_void_p, c_void_p, c_void_p, c_int, c_void_p, c_int, c_void_p]
+    nifly.optimizeShapeVertexCache.restype = c_int
+    nifly.planShapeSplit.argtypes = [c_void_p, c_int, c_void_p, c_int, c_int, c_int, c_void_p]
+    nifly.planShapeSplit.restype = c_int
+    nifly.raycast.argtypes = [c_void_p, c_void_p, c_void_p, c_int, c_float, POINTER(SpatialHitBuf)]
+    nifly.raycast.restype = c_int
+    nifly.removeExtraData.argtypes = [c_void_p, c_void_p, c_char_p]
+    nifly.removeExtraData.restype = c_int
+    nifly.resetStats.argtypes = []
+    nifly.resetStats.restype = None
+    nifly.resolveHandle.argtypes = [c_uint64]
+    nifly.resolveHandle.restype = c_void_p
+    nifly.resolveHandles.argtypes = [POINTER(c_uint64), c_int, POINTER(c_void_p)]
+    nifly.resolveHandles.restype = c_int
     nifly.saveNif.argtypes = [c_void_p, c_char_p]
     nifly.saveNif.restype = c_int
     nifly.saveSkinnedNif.argtypes = [c_void_p, c_char_p]
     nifly.saveSkinnedNif.restype = None
     nifly.segmentCount.argtypes = [c_void_p, c_void_p]
     nifly.segmentCount.restype = c_int
+    nifly.sessionAlloc.argtypes = [c_void_p, c_int]
+    nifly.sessionAlloc.restype = c_void_p
     nifly.setAlphaProperty.argtypes = [c_void_p, c_void_p, AlphaPropertyBuf_p]
     nifly.setAlphaProperty.restype = None
     nifly.setBSXFlags.argtypes = [c_void_p, c_char_p, c_uint32]
@@ -214,6 +283,8 @@ def load_nifly(nifly_path):
     nifly.setCollConvexTransformShapeChild.restype = None
     nifly.setEffectShaderAttrs.argtypes = [c_void_p, c_void_p, POINTER(BSESPAttrs)]
     nifly.setEffectShaderAttrs.restype = None
+    nifly.setLogLevel.argtypes = [c_int]
+    nifly.setLogLevel.restype = None
     nifly.setInvMarker.argtypes = [c_void_p, c_char_p, c_void_p, c_void_p]
     nifly.setInvMarker.restype = None
     nifly.setColorsForShape.argtypes = [c_void_p, c_void_p, c_void_p, c_int]
@@ -224,7 +295,11 @@ def load_nifly(nifly_path):
     nifly.setGlobalToSkinXform.restype = None
     nifly.setNodeFlags.argtypes = [c_void_p, c_int]
     nifly.setNodeFlags.restype = None
-    nifly.setPartitions.argtypes = [c_void_p, c_void_p, c_void_p, c_int, c_void_p, c_int]
+    nifly.setNodeName.argtypes = [c_void_p, c_char_p]
+    nifly.setNodeName.restype = None
+    nifly.setSession.argtypes = [c_void_p]
+    nifly.setSession.restype = c_void_p
+    nifly.setPartitions.argtypes = [c_void_p, c_void_p, c_void_p, c_int, c_void_p, c_int, c_int]
     nifly.setPartitions.restype = None
     nifly.setShaderAttrs.argtypes = [c_void_p, c_void_p, POINTER(BSLSPAttrs)]
     nifly.setShaderAttrs.restype = None
@@ -248,9 +323,21 @@ def load_nifly(nifly_path):
     nifly.setTransform.restype = None
     nifly.skinShape.argtypes = [c_void_p, c_void_p]
     nifly.skinShape.restype = None
+    nifly.splitShapeByConnectivity.argtypes = [c_void_p, c_void_p, c_uint32, POINTER(c_void_p), c_int]
+    nifly.splitShapeByConnectivity.restype = c_int
+    nifly.startTrace.argtypes = [c_char_p]
+    nifly.startTrace.restype = c_int
+    nifly.stopTrace.argtypes = []
+    nifly.stopTrace.restype = c_int
     nifly.setSegments.argtypes = [c_void_p, c_void_p, c_void_p, c_int, c_void_p, c_int, c_void_p, c_int, c_char_p]
     nifly.setSegments.restype = None
-    nifly.writeSkinToNif.argtypes = [c_void_p]
+    nifly.transferWeights.argtypes = [c_void_p, c_void_p, c_void_p, c_void_p, c_uint32, c_float]
+    nifly.transferWeights.restype = c_int
+    nifly.unifySeamNormals.argtypes = [POINTER(c_void_p), POINTER(c_void_p), c_int, c_int, c_float]
+    nifly.unifySeamNormals.restype = c_int
+    nifly.weldShapeVerts.argtypes = [c_void_p, c_void_p, c_void_p, c_void_p, c_int]
+    nifly.weldShapeVerts.restype = c_int
+    nifly.writeSkinToNif.argtypes = [c_void_p, c_int]
     nifly.writeSkinToNif.restype = None
     return nifly
 
@@ -1284,11 +1371,152 @@ class NiShape(NiNode):
                                       bone_name.encode('utf-8'),
                                       vert_buf, len(vert_weights), xfbuf)
        
-    def set_partitions(self, partitionlist, trilist):
+    def transfer_weights(self, source, options=0, max_distance=0):
+        """ Copy bone weights onto this shape from the source shape by proximity. Each vert 
+            takes the weights at the closest point on the source, interpolated across the 
+            source tri. Set the global-to-skin transform first; bones are added as needed.
+            source = NiShape to copy from, may be in another nif
+            options = 1 to copy the nearest source vert's weights instead of interpolating,
+                2 to keep all influences rather than the strongest 4
+            max_distance = verts farther than this from the source are left alone, 0 = no limit
+            Returns the number of verts weighted.
+            """
+        if self.file._skin_handle is None:
+            self.file.createSkin()
+        self._bone_ids = None
+        self._bone_names = None
+        self._weights = None
+        return NifFile.nifly.transferWeights(source.file._handle, source._handle,
+                                             self.file._skin_handle, self._handle,
+                                             options, max_distance)
+
+    def conform_morphs(self, reference, morphs, radius=0, neighbors=0):
+        """ Conform morphs from a reference shape (e.g. a body) to this shape (e.g. an outfit
+            fitted to it). Each vert takes a distance-weighted average of the deltas of its
+            nearest reference verts, matched up in global space.
+            reference = NiShape the morphs belong to, may be in another nif
+            morphs = {name: deltas} where deltas is either a list of (x, y, z) for every
+                reference vert or a dict {vert index: (x, y, z)}
+            radius = reference verts farther than this have no effect, 0 = no limit
+            neighbors = number of reference verts to blend, 0 = default
+            Returns {name: {vert index: (x, y, z)}} holding the nonzero deltas.
+            """
+        names = list(morphs.keys())
+        if not names:
+            return {}
+        refcount = len(reference.verts)
+        count = len(self.verts)
+        refbuf = (c_float * 3 * (refcount * len(names)))()
+        for m, name in enumerate(names):
+            deltas = morphs[name]
+            items = deltas.items() if isinstance(deltas, dict) else enumerate(deltas)
+            for i, d in items:
+                if i < refcount:
+                    refbuf[m * refcount + i][0] = d[0]
+                    refbuf[m * refcount + i][1] = d[1]
+                    refbuf[m * refcount + i][2] = d[2]
+        outbuf = (c_float * 3 * (count * len(names)))()
+        NifFile.nifly.conformMorphs(reference.file._handle, reference._handle,
+                                    self.file._handle, self._handle,
+                                    refbuf, len(names), radius, neighbors, outbuf)
+        result = {}
+        for m, name in enumerate(names):
+            result[name] = {}
+            for i in range(count):
+                d = outbuf[m * count + i]
+                if d[0] != 0 or d[1] != 0 or d[2] != 0:
+                    result[name][i] = (d[0], d[1], d[2])
+        return result
+
+    def split_loose_parts(self, weld=False):
+        """ Split this shape into one shape per connected piece. This shape keeps the first 
+            piece; the rest go in copies named "<name>:1", "<name>:2"... Weights, colors, 
+            partitions and segments go with their verts and tris.
+            weld = treat verts at the same position as connected, e.g. across UV seams
+            Returns the shapes, this one first.
+            """
+        maxcount = len(self.tris)
+        buf = (c_void_p * max(maxcount, 1))()
+        count = NifFile.nifly.splitShapeByConnectivity(self.file._handle, self._handle, 
+                                                       1 if weld else 0, buf, maxcount)
+        self._verts = None
+        self._tris = None
+        self._normals = None
+        self._uvs = None
+        self._colors = None
+        self._weights = None
+        self._partitions = None
+        self._partition_tris = None
+        self.file._shapes = None
+        handles = {sh._handle: sh for sh in self.file.shapes}
+        handles[self._handle] = self
+        return [handles[buf[i]] for i in range(min(count, maxcount)) if buf[i] in handles]
+
+    def weld_verts(self, position=0.0001, uv=0.0001, normal=0.001, color=0.002, weight=0.001):
+        """ Merge verts that differ only by float noise. Tris that collapse are dropped, 
+            along with their partitions or segments.
+            position = how far apart verts can be and still weld
+            uv, normal, color, weight = largest difference allowed in any component or 
+                bone weight. None to ignore that attribute.
+            Returns the new index of each old vert, for updating morphs and other 
+            per-vert data.
+            """
+        tol = (c_float * 5)(*[-1 if x is None else x for x in (position, uv, normal, color, weight)])
+        count = len(self.verts)
+        remap = (c_uint32 * max(count, 1))()
+        NifFile.nifly.weldShapeVerts(self.file._handle, self._handle, tol, remap, count)
+        self._verts = None
+        self._tris = None
+        self._normals = None
+        self._uvs = None
+        self._colors = None
+        self._weights = None
+        self._partitions = None
+        self._partition_tris = None
+        return remap[0:count]
+
+    def adjacency(self, table):
+        """ Return one table of the shape's triangle adjacency as a list, in compact 
+            offset/value form. The DLL builds it once and keeps it until the tris change.
+            table = one of the ADJ_ constants:
+                ADJ_VERT_TRI_START, ADJ_VERT_TRIS: tris of vert v are 
+                    vert_tris[vert_tri_start[v]:vert_tri_start[v+1]]
+                ADJ_EDGES: unique edges as flattened vert pairs, lower index first
+                ADJ_EDGE_TRI_START, ADJ_EDGE_TRIS: tris of each edge, as above
+                ADJ_TRI_EDGES: 3 per tri, the edges p1-p2, p2-p3, p3-p1
+                ADJ_TRI_NEIGHBORS: 3 per tri, the tri across each of those edges
+            Missing edges and neighbors are ADJ_NONE.
+            """
+        n = NifFile.nifly.getShapeAdjacency(self.file._handle, self._handle, table, None, 0)
+        if n <= 0:
+            return []
+        buf = (c_uint32 * n)()
+        NifFile.nifly.getShapeAdjacency(self.file._handle, self._handle, table, buf, n)
+        return buf[:]
+
+    def find_clipping(self, body, max_depth=0, options=0):
+        """ Find the verts of this shape that clip into the body shape, comparing the two 
+            in the pose given by their skin transforms.
+            body = NiShape to check against, may be in another nif
+            max_depth = verts deeper than this are on the far side of the body, 0 = no limit
+            options = 1 to decide inside by counting ray crossings; needs a closed body
+            Returns {vert index: penetration depth}.
+            """
+        count = len(self.verts)
+        vertbuf = (c_int * count)()
+        depthbuf = (c_float * count)()
+        n = NifFile.nifly.findClipping(body.file._handle, body._handle,
+                                       self.file._handle, self._handle,
+                                       max_depth, options, vertbuf, depthbuf, count)
+        return {vertbuf[i]: depthbuf[i] for i in range(min(n, count))}
+
+    def set_partitions(self, partitionlist, trilist, bones_per_partition=0):
         """ Set the partitions for a shape
             partitionlist = list of Partition objects, either Skyrim or FO. Any Subsegments in the
                 list are ignored. Subsegments are found separately under Partitions.
             trilist = 1:1 with shape tris, gives the ID of the tri's partition
+            bones_per_partition = Skyrim partitions only: 0 to let nifly split partitions, 
+                -1 to group tris by bone set within the game's bone limit, or a bone limit
             """
         if len(partitionlist) == 0:
             return
@@ -1328,7 +1556,8 @@ class NiShape(NiNode):
 
             NifFile.nifly.setPartitions(self.file._handle, self._handle,
                                         pbuf, len(parts),
-                                        tbuf, len(trilist))
+                                        tbuf, len(trilist),
+                                        bones_per_partition)
         else:
             # For segments, the trilist has to refer to IDs becuase of referring to subsegments.
             pbuf = (c_uint16 * len(parts))()
@@ -1368,6 +1597,27 @@ class NiShape(NiNode):
         NifFile.nifly.setColorsForShape(self.file._handle, self._handle, 
                                         buf, len(colors))
 
+    def optimize_vertex_cache(self, cache_size=0):
+        """ Reorder tris and verts for the GPU vertex cache. Call after the shape is 
+            complete: weights, partitions and colors are remapped too.
+            Returns (vert_order, acmr_before, acmr_after) where vert_order[new] = old
+            index, for remapping anything else indexed by vertex, such as shape keys. 
+            """
+        vertcount = len(self.verts)
+        obuf = (c_uint32 * vertcount)()
+        abuf = (c_float * 2)()
+        NifFile.nifly.optimizeShapeVertexCache(self.file._handle, self._handle, 
+                                               self.file._skin_handle, cache_size,
+                                               obuf, vertcount, abuf)
+        self._verts = None
+        self._normals = None
+        self._uvs = None
+        self._colors = None
+        self._tris = None
+        self._weights = None
+        self._partition_tris = None
+        return list(obuf), abuf[0], abuf[1]
+
 
 # --- NifFile --- #
 class NifFile:
@@ -1385,6 +1635,7 @@ class NifFile:
         self._handle = None
         self._game = None
         self._root = None
+        self._skin_handle = None
         if not filepath is None:
             self._handle = NifFile.nifly.load(filepath.encode('utf-8'))
             if not self._handle:
@@ -1392,7 +1643,6 @@ class NifFile:
         self._shapes = None
         self._shape_dict = {}
         self._nodes = None
-        self._skin_handle = None
         if self.game is not None:
             self.dict = gameSkeletons[self.game]
         self._bgdata = None
@@ -1401,6 +1651,10 @@ class NifFile:
         self._furniture_markers = None
 
     def __del__(self):
+        # The skin refers to the nif, so it goes first. It takes its skeleton with it.
+        if self._skin_handle:
+            NifFile.nifly.destroySkin(self._skin_handle)
+            self._skin_handle = None
         if self._handle:
             NifFile.nifly.destroy(self._handle)
 
@@ -1481,6 +1735,162 @@ class NifFile:
         sh._handle = shape_handle
         return sh
 
+    def createShapesFromData(self, shape_name, verts, tris, uvs, normals, 
+                             is_headpart=False, is_skinned=False, is_effectsshader=False,
+                             parent=None, colors=None, weights=None, global_to_skin=None,
+                             partitions=None, partition_tris=None, bones_per_partition=0):
+        """ Like createShapeFromData, but for meshes that may be too big for one shape. 
+            Tris may use any vertex index; a mesh over the 16-bit limit is split into 
+            pieces named shape_name, shape_name:1, ... with boundary verts duplicated. 
+            colors = (r, g, b, a) for each vert
+            weights = {bone name: [(vert index, weight)...]}; each shape gets the bones its 
+                verts use, with transforms from the skeleton
+            global_to_skin = TransformBuf for each weighted shape
+            partitions, partition_tris = Skyrim partitions and the partition ID of each tri,
+                as for set_partitions
+            Returns [(shape, vert_map, tri_map)...], where vert_map[i] is the input index of 
+            the shape's vert i and tri_map[j] the input index of its tri j. Use them to carry
+            anything else, such as FO4 segments, over to each shape.
+            """
+        parenthandle = None
+        if parent:
+            parenthandle = parent._handle
+        vertbuf = (c_float * 3 * len(verts))()
+        for i, v in enumerate(verts): vertbuf[i] = v
+        normbuf = None
+        if normals:
+            normbuf = (c_float * 3 * len(normals))()
+            for i, n in enumerate(normals): normbuf[i] = n
+        tribuf = (c_uint32 * 3 * len(tris))()
+        for i, t in enumerate(tris): tribuf[i] = t
+        uvbuf = (c_float * 2 * len(uvs))()
+        for i, u in enumerate(uvs): uvbuf[i] = (u[0], 1-u[1])
+        optbuf = (c_uint16 * 1)()
+        optbuf[0] = (1 if is_headpart else 0) \
+            + (2 if not is_skinned else 0) \
+            + (4 if is_effectsshader else 0)
+
+        maxshapes = len(tris) // 0xFFFF + 8
+        shapebuf = (c_void_p * maxshapes)()
+        vertmapbuf = (c_uint32 * (len(tris) * 3))()
+        trimapbuf = (c_uint32 * len(tris))()
+
+        extras = ShapeSplitExtrasBuf()
+        if colors:
+            colorbuf = (c_float * 4 * len(colors))()
+            for i, c in enumerate(colors): colorbuf[i] = c[0:4]
+            extras.colors = cast(colorbuf, c_void_p)
+        if weights:
+            self.createSkin()
+            extras.skin = self._skin_handle
+            if global_to_skin:
+                extras.globalToSkin = pointer(global_to_skin)
+            bonenames = list(weights.keys())
+            namebuf = (c_char_p * len(bonenames))(*[b.encode('utf-8') for b in bonenames])
+            extras.boneCount = len(bonenames)
+            extras.boneNames = namebuf
+            weightlist = [(v, b, w) for b, name in enumerate(bonenames) for v, w in weights[name]]
+            weightbuf = (VertexBoneWeightBuf * len(weightlist))(*weightlist)
+            extras.weights = weightbuf
+            extras.weightCount = len(weightlist)
+        if partitions and partition_tris:
+            parts = [p for p in partitions if type(p) == SkyPartition]
+            parts_lookup = {p.id: i for i, p in enumerate(parts)}
+            partbuf = (c_uint16 * 2 * len(parts))()
+            for i, p in enumerate(parts): partbuf[i] = (0, p.id)
+            tripartbuf = (c_uint16 * len(tris))()
+            for i, pid in enumerate(partition_tris[0:len(tris)]):
+                tripartbuf[i] = parts_lookup.get(pid, 0)
+            extras.partData = cast(partbuf, c_void_p)
+            extras.partCount = len(parts)
+            extras.triParts = cast(tripartbuf, c_void_p)
+            extras.bonesPerPartition = bones_per_partition
+
+        count = NifFile.nifly.createNifShapesFromData(
+            self._handle, 
+            shape_name.encode('utf-8'), 
+            vertbuf, uvbuf, normbuf, len(verts),
+            tribuf, len(tris), 
+            optbuf,
+            parenthandle,
+            shapebuf, maxshapes, 
+            vertmapbuf, len(tris) * 3,
+            trimapbuf,
+            byref(extras))
+        if count < 0:
+            raise Exception(f"Could not create shape {shape_name} from the data given")
+
+        if self._shapes is None:
+            self._shapes = []
+        result = []
+        vertpos = 0
+        tripos = 0
+        for i in range(min(count, maxshapes)):
+            sh = NiShape(self, shapebuf[i])
+            sh._is_skinned = sh._is_skinned or bool(weights)
+            self._shapes.append(sh)
+            vcount = NifFile.nifly.getVertsForShape(self._handle, sh._handle, None, 0, 0)
+            tcount = NifFile.nifly.getTriangles(self._handle, sh._handle, None, 0, 0)
+            result.append((sh, 
+                           vertmapbuf[vertpos:vertpos+vcount], 
+                           trimapbuf[tripos:tripos+tcount]))
+            vertpos += vcount
+            tripos += tcount
+        return result
+
+    def decimate_shapes(self, shapes, ratio, target=None, options=0):
+        """ Create reduced copies of the given shapes, e.g. for LODs.
+            ratio = fraction of tris to keep
+            target = NifFile to put the new shapes in, usually a new one. Defaults to this 
+                nif, in which case the copies are named "<name>:LOD".
+            options = 1 to lock open edges, 2 to ignore bone weights, 4 to allow faces to 
+                turn more than 60 degrees
+            Returns the new shapes, 1:1 with the given shapes (None if one failed).
+            """
+        if target is None:
+            target = self
+        inbuf = (c_void_p * len(shapes))(*[sh._handle for sh in shapes])
+        outbuf = (c_void_p * len(shapes))()
+        NifFile.nifly.decimateShapes(self._handle, inbuf, len(shapes), ratio, options,
+                                     target._handle, outbuf)
+        target._shapes = None
+        handles = {sh._handle: sh for sh in target.shapes}
+        return [handles.get(h) for h in outbuf]
+
+    def merge_shapes(self):
+        """ Merge shapes that share shader, textures, alpha property and skinning, to cut
+            draw calls. Each group is merged into its first shape and the rest are deleted, 
+            so do this before creating a skin for the nif. 
+            Returns the merged shapes.
+            """
+        maxcount = len(self.shapes)
+        buf = (c_void_p * max(maxcount, 1))()
+        count = NifFile.nifly.mergeShapesByMaterial(self._handle, buf, maxcount)
+        self._shapes = None
+        handles = {sh._handle: sh for sh in self.shapes}
+        return [handles[buf[i]] for i in range(min(count, maxcount)) if buf[i] in handles]
+
+    @staticmethod
+    def unify_seam_normals(shapes, master=None, tolerance=0.001):
+        """ Give boundary verts of different shapes that coincide in global space the same
+            normal, so seams between e.g. head, body and hands don't show.
+            shapes = NiShapes, which may come from different nifs
+            master = the shape whose normals win at its seams; None to average
+            tolerance = how close verts must be to count as coincident
+            Returns the number of verts changed.
+            """
+        count = len(shapes)
+        nifbuf = (c_void_p * max(count, 1))(*[s.file._handle for s in shapes])
+        shapebuf = (c_void_p * max(count, 1))(*[s._handle for s in shapes])
+        master_index = -1
+        for i, s in enumerate(shapes):
+            if s is master:
+                master_index = i
+        changed = NifFile.nifly.unifySeamNormals(nifbuf, shapebuf, count, master_index, tolerance)
+        for s in shapes:
+            s._normals = None
+        return changed
+
     def add_coll_shape(self, blocktype, properties, vertices=None, normals=None, transform=None):
         """ Create collision shape 
             bhkBoxShape - All data passed in through the properties
@@ -1644,12 +2054,14 @@ class NifFile:
         NifFile.nifly.getNodeXformToGlobal(self.skin, name.encode('utf-8'), buf)
         return buf
 
-    def apply_skin(self):
+    def apply_skin(self, bones_per_partition=0):
         """ Adding bones to the nif only adds them to the "skin" not to the nif itself.
         "apply_skin" adds them to the nif so they can be found later. 
+        bones_per_partition = 0 to leave skin partitions as nifly builds them, -1 to split 
+            them by bone set to the game's bone limit, or an explicit bone limit
         Note this zaps the nodelist. """
         if self._skin_handle:
-            NifFile.nifly.writeSkinToNif(self._skin_handle)
+            NifFile.nifly.writeSkinToNif(self._skin_handle, bones_per_partition)
             self._nodes = None
 
     @property
@@ -1767,6 +2179,104 @@ class NifFile:
         NifFile.nifly.getMessageLog(buf, msgsize)
         return buf.value.decode('utf-8')
 
+    @staticmethod
+    def log_records(cursor=0):
+        """ Read the log incrementally. Returns (records, cursor), where records is a list
+            of (seq, level, code, message) and cursor is to be passed back in to get only
+            newer records. Levels are 0 info, 1 warning, 2 error.
+            """
+        cur = c_uint64(cursor)
+        buf = (LogRecordBuf * 64)()
+        records = []
+        while True:
+            n = NifFile.nifly.getLogRecords(byref(cur), buf, 64)
+            for r in buf[0:n]:
+                records.append((r.seq, r.level, r.code, r.message.decode('utf-8', errors='replace')))
+            if n < 64:
+                break
+        return records, cur.value
+
+    @staticmethod
+    def set_log_level(level):
+        """ Drop log messages below this level: 0 info, 1 warnings, 2 errors only """
+        NifFile.nifly.setLogLevel(level)
+
+    @staticmethod
+    def enable_stats(on=True):
+        """ Start or stop timing DLL calls. Off by default; counts so far are kept. """
+        NifFile.nifly.enableStats(1 if on else 0)
+
+    @staticmethod
+    def stats():
+        """ Per-call stats since the last reset, as a dict of name -> {'count', 'total_ms',
+            'max_ms', 'bytes'}. Names are DLL entry points and internal phases such as
+            'NifFile::Load'.
+            """
+        n = NifFile.nifly.getStats(None, 0)
+        buf = create_string_buffer(n+1)
+        NifFile.nifly.getStats(buf, n+1)
+        return json.loads(buf.value.decode('utf-8'))['stats']
+
+    @staticmethod
+    def reset_stats():
+        NifFile.nifly.resetStats()
+
+    @staticmethod
+    def start_trace(filepath):
+        """ Write a Chrome trace of DLL calls on all threads to filepath, for viewing in
+            chrome://tracing or Perfetto. Returns 0 on success. """
+        return NifFile.nifly.startTrace(str(filepath).encode('utf-8'))
+
+    @staticmethod
+    def stop_trace():
+        """ Finish the trace file. Returns the number of events written. """
+        return NifFile.nifly.stopTrace()
+
+class ShapeBVH:
+    """ Acceleration structure over a set of shapes in global space, for batched ray 
+        casts and closest-point lookups. Holds its own copy of the geometry, so later 
+        changes to the shapes aren't seen.
+        """
+    def __init__(self, nif, shapes=None):
+        self.nif = nif
+        self.shapes = list(shapes) if shapes is not None else nif.shapes
+        buf = (c_void_p * max(len(self.shapes), 1))()
+        for i, s in enumerate(self.shapes):
+            buf[i] = s._handle
+        self._handle = NifFile.nifly.buildShapeBVH(nif._handle, buf, len(self.shapes))
+
+    def __del__(self):
+        if self._handle:
+            NifFile.nifly.destroyShapeBVH(self._handle)
+
+    def _hits(self, buf, count):
+        """ Return (shape, tri index, point, distance) for each hit, None for misses """
+        return [(self.shapes[h.shape], h.tri, tuple(h.point), h.distance) if h.shape >= 0 else None
+                for h in buf[0:count]]
+
+    def raycast(self, origins, dirs, max_distance=0):
+        """ Cast rays from each origin along the matching direction. Returns the first hit
+            of each ray as (shape, tri index, point, distance), or None for misses. 
+            max_distance = ignore hits further than this, 0 = no limit
+            """
+        count = len(origins)
+        obuf = (c_float * 3 * count)(*[tuple(o) for o in origins])
+        dbuf = (c_float * 3 * count)(*[tuple(d) for d in dirs])
+        hits = (SpatialHitBuf * count)()
+        NifFile.nifly.raycast(self._handle, obuf, dbuf, count, max_distance, hits)
+        return self._hits(hits, count)
+
+    def closest_point(self, points, max_distance=0):
+        """ Find the closest point on the shapes to each of the points. Returns 
+            (shape, tri index, point, distance) for each, or None if nothing is in range.
+            max_distance = ignore anything further than this, 0 = no limit
+            """
+        count = len(points)
+        pbuf = (c_float * 3 * count)(*[tuple(p) for p in points])
+        hits = (SpatialHitBuf * count)()
+        NifFile.nifly.closestPoint(self._handle, pbuf, count, max_distance, hits)
+        return self._hits(hits, count)
+
 #
 # ######################################## TESTS ########################################
 #